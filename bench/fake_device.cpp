@@ -0,0 +1,362 @@
+#include "fake_device.h"
+
+#include "common/clock.h"
+#include "common/unique_fd.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <mtd/mtd-user.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+namespace recovery {
+
+namespace {
+
+// A write that returns this late is not charged to the next one.
+const uint64_t kSlackUs = 2000;
+
+void sleep_until_us(uint64_t when)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t)(when / 1000000);
+	ts.tv_nsec = (long)(when % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+		;
+}
+
+char *trim(char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	char *end = s + strlen(s);
+	while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+		*--end = '\0';
+	return s;
+}
+
+// Sizes of the writes record_profile() times.
+const uint32_t kLargeWrite = 512 * 1024;
+const unsigned kLargeWrites = 64;
+const uint32_t kSmallWrite = 4096;
+const unsigned kSmallWrites = 256;
+// Erase blocks timed on MTD.
+const unsigned kMtdBlocks = 8;
+
+struct AlignedBuffer {
+	explicit AlignedBuffer(size_t size)
+	{
+		if (posix_memalign(&data, 4096, size))
+			data = nullptr;
+		else
+			for (size_t i = 0; i < size; i++)
+				((uint8_t *)data)[i] = (uint8_t)(i * 2654435761u >> 24);
+	}
+	~AlignedBuffer() { free(data); }
+	void *data = nullptr;
+};
+
+// Times |count| writes of |size| bytes from |offset| on; returns the
+// microseconds taken or -errno.
+int64_t time_writes(int fd, const void *buf, uint32_t size, unsigned count, uint64_t offset)
+{
+	uint64_t start = monotonic_us();
+	for (unsigned i = 0; i < count; i++)
+		if (pwrite(fd, buf, size, (off_t)(offset + (uint64_t)i * size)) != (ssize_t)size)
+			return errno ? -errno : -EIO;
+	if (fdatasync(fd) < 0 && errno != EINVAL)
+		return -errno;
+	return (int64_t)(monotonic_us() - start);
+}
+
+int64_t time_reads(int fd, void *buf, uint32_t size, unsigned count, uint64_t offset)
+{
+	uint64_t start = monotonic_us();
+	for (unsigned i = 0; i < count; i++)
+		if (pread(fd, buf, size, (off_t)(offset + (uint64_t)i * size)) != (ssize_t)size)
+			return errno ? -errno : -EIO;
+	return (int64_t)(monotonic_us() - start);
+}
+
+int record_mtd(int fd, const mtd_info_user &info, DeviceProfile *p)
+{
+	p->mtd = true;
+	p->erase_block = info.erasesize;
+	p->max_io = info.writesize ? info.writesize : 1;
+	p->capacity = info.size;
+	AlignedBuffer buf(info.erasesize);
+	if (!buf.data)
+		return -ENOMEM;
+	bool nand = info.type == MTD_NANDFLASH || info.type == MTD_MLCNANDFLASH;
+	unsigned blocks = 0;
+	uint64_t erase_us = 0, write_us = 0, read_us = 0;
+	for (uint64_t block = 0; blocks < kMtdBlocks && block + info.erasesize <= info.size; block += info.erasesize) {
+		__kernel_loff_t pos = (__kernel_loff_t)block;
+		if (nand && ioctl(fd, MEMGETBADBLOCK, &pos) != 0)
+			continue;
+		struct erase_info_user64 erase = { block, info.erasesize };
+		uint64_t start = monotonic_us();
+		if (ioctl(fd, MEMERASE64, &erase) < 0)
+			return -errno;
+		erase_us += monotonic_us() - start;
+		// One page at a time, as MtdSink programs them.
+		int64_t us = time_writes(fd, buf.data, p->max_io, info.erasesize / p->max_io, block);
+		if (us < 0)
+			return (int)us;
+		write_us += (uint64_t)us;
+		us = time_reads(fd, buf.data, info.erasesize, 1, block);
+		if (us < 0)
+			return (int)us;
+		read_us += (uint64_t)us;
+		blocks++;
+	}
+	if (!blocks)
+		return -ENOSPC;
+	double bytes = (double)blocks * info.erasesize;
+	// Page programs are all the same size, so their latency cannot be told
+	// apart from their throughput; it is all counted as throughput.
+	p->op_latency_us = 0;
+	p->erase_ms = erase_us / 1000.0 / blocks;
+	p->write_mib_s = bytes / 1048576 / (std::max<uint64_t>(write_us, 1) / 1e6);
+	p->read_mib_s = bytes / 1048576 / (std::max<uint64_t>(read_us, 1) / 1e6);
+	return 0;
+}
+
+int record_block(const char *path, uint64_t capacity, DeviceProfile *p)
+{
+	uint64_t large = (uint64_t)kLargeWrite * kLargeWrites;
+	uint64_t small = (uint64_t)kSmallWrite * kSmallWrites;
+	if (capacity < large)
+		return -ENOSPC;
+	p->capacity = capacity;
+	p->max_io = kLargeWrite;
+	AlignedBuffer buf(kLargeWrite);
+	if (!buf.data)
+		return -ENOMEM;
+
+	// Each write must reach the device before the next; files on a
+	// filesystem without O_DIRECT fall back to O_DSYNC alone.
+	UniqueFd fd(open(path, O_WRONLY | O_DIRECT | O_DSYNC | O_CLOEXEC));
+	if (!fd && errno == EINVAL)
+		fd.reset(open(path, O_WRONLY | O_DSYNC | O_CLOEXEC));
+	if (!fd)
+		return -errno;
+	int64_t t_large = time_writes(fd.get(), buf.data, kLargeWrite, kLargeWrites, 0);
+	if (t_large < 0)
+		return (int)t_large;
+	int64_t t_small = time_writes(fd.get(), buf.data, kSmallWrite, kSmallWrites, 0);
+	if (t_small < 0)
+		return (int)t_small;
+
+	// t = commands * latency + bytes * per_byte, for both runs.
+	double det = (double)kLargeWrites * small - (double)kSmallWrites * large;
+	double latency = ((double)t_large * small - (double)t_small * large) / det;
+	double per_byte = ((double)kLargeWrites * t_small - (double)kSmallWrites * t_large) / det;
+	if (per_byte <= 0 || latency < 0) {
+		latency = std::max(latency, 0.0);
+		per_byte = std::max(((double)t_large - kLargeWrites * latency) / large, 1e-6);
+	}
+	p->op_latency_us = latency;
+	p->write_mib_s = 1e6 / per_byte / 1048576;
+
+	UniqueFd rfd(open(path, O_RDONLY | O_DIRECT | O_CLOEXEC));
+	if (!rfd && errno == EINVAL) {
+		rfd.reset(open(path, O_RDONLY | O_CLOEXEC));
+		if (rfd)
+			posix_fadvise(rfd.get(), 0, (off_t)large, POSIX_FADV_DONTNEED);
+	}
+	if (!rfd)
+		return -errno;
+	int64_t t_read = time_reads(rfd.get(), buf.data, kLargeWrite, kLargeWrites, 0);
+	if (t_read < 0)
+		return (int)t_read;
+	p->read_mib_s = large / 1048576.0 / (std::max<int64_t>(t_read, 1) / 1e6);
+	return 0;
+}
+
+} // namespace
+
+int load_profile(const char *path, DeviceProfile *profile)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	DeviceProfile p;
+	char line[256];
+	unsigned number = 0;
+	int ret = 0;
+	while (ret == 0 && fgets(line, sizeof(line), f)) {
+		number++;
+		if (char *hash = strchr(line, '#'))
+			*hash = '\0';
+		char *key = trim(line);
+		if (!*key)
+			continue;
+		char *eq = strchr(key, '=');
+		if (!eq) {
+			ret = -EINVAL;
+			break;
+		}
+		*eq = '\0';
+		char *value = trim(eq + 1);
+		key = trim(key);
+		double v = strtod(value, nullptr);
+		if (!strcmp(key, "name"))
+			p.name = value;
+		else if (!strcmp(key, "type") && (!strcmp(value, "emmc") || !strcmp(value, "mtd")))
+			p.mtd = !strcmp(value, "mtd");
+		else if (!strcmp(key, "write_mib_s") && v > 0)
+			p.write_mib_s = v;
+		else if (!strcmp(key, "read_mib_s") && v > 0)
+			p.read_mib_s = v;
+		else if (!strcmp(key, "op_latency_us") && v >= 0)
+			p.op_latency_us = v;
+		else if (!strcmp(key, "max_io_kb") && v >= 0.5)
+			p.max_io = (uint32_t)(v * 1024);
+		else if (!strcmp(key, "erase_block_kb") && v >= 1)
+			p.erase_block = (uint32_t)(v * 1024);
+		else if (!strcmp(key, "erase_ms") && v >= 0)
+			p.erase_ms = v;
+		else if (!strcmp(key, "capacity_mib") && v >= 1)
+			p.capacity = (uint64_t)v << 20;
+		else
+			ret = -EINVAL;
+	}
+	fclose(f);
+	if (ret == 0 && p.mtd && !p.erase_block)
+		ret = -EINVAL;
+	if (ret < 0) {
+		fprintf(stderr, "%s:%u: bad profile line\n", path, number);
+		return ret;
+	}
+	if (p.name.empty())
+		p.name = path;
+	*profile = p;
+	return 0;
+}
+
+void print_profile(FILE *out, const DeviceProfile &p)
+{
+	fprintf(out, "name = %s\n", p.name.c_str());
+	fprintf(out, "type = %s\n", p.mtd ? "mtd" : "emmc");
+	fprintf(out, "write_mib_s = %.1f\n", p.write_mib_s);
+	fprintf(out, "read_mib_s = %.1f\n", p.read_mib_s);
+	fprintf(out, "op_latency_us = %.0f\n", p.op_latency_us);
+	fprintf(out, "max_io_kb = %g\n", p.max_io / 1024.0);
+	if (p.mtd) {
+		fprintf(out, "erase_block_kb = %u\n", p.erase_block / 1024);
+		fprintf(out, "erase_ms = %.2f\n", p.erase_ms);
+	}
+	fprintf(out, "capacity_mib = %llu\n", (unsigned long long)(p.capacity >> 20));
+}
+
+int record_profile(const char *path, DeviceProfile *profile)
+{
+	UniqueFd fd(open(path, O_RDWR | O_CLOEXEC));
+	if (!fd)
+		return -errno;
+	DeviceProfile p;
+	p.name = path;
+	int ret;
+	struct mtd_info_user info;
+	struct stat st;
+	if (ioctl(fd.get(), MEMGETINFO, &info) == 0) {
+		ret = record_mtd(fd.get(), info, &p);
+	} else if (fstat(fd.get(), &st) < 0) {
+		ret = -errno;
+	} else {
+		uint64_t capacity = (uint64_t)st.st_size;
+		if (S_ISBLK(st.st_mode) && ioctl(fd.get(), BLKGETSIZE64, &capacity) < 0)
+			return -errno;
+		fd.reset();
+		ret = record_block(path, capacity, &p);
+	}
+	if (ret == 0)
+		*profile = p;
+	return ret;
+}
+
+FakeDevice::~FakeDevice()
+{
+	if (m_data)
+		munmap(m_data, (size_t)m_profile.capacity);
+}
+
+int FakeDevice::open()
+{
+	void *p = mmap(nullptr, (size_t)m_profile.capacity, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	m_data = (uint8_t *)p;
+	if (m_profile.mtd)
+		m_erased.assign((size_t)(m_profile.capacity / m_profile.erase_block), false);
+	return 0;
+}
+
+void FakeDevice::charge(double us)
+{
+	uint64_t now = monotonic_us();
+	if (now > m_idle_at_us + kSlackUs)
+		m_idle_at_us = now;
+	m_idle_at_us += (uint64_t)us;
+	m_busy_us += (uint64_t)us;
+	if (m_idle_at_us > now)
+		sleep_until_us(m_idle_at_us);
+}
+
+int FakeDevice::write(const uint8_t *data, size_t len, uint64_t offset)
+{
+	if (offset + len > m_profile.capacity)
+		return -ENOSPC;
+	memcpy(m_data + offset, data, len);
+
+	double us = 0;
+	if (m_profile.mtd && len) {
+		for (uint64_t b = offset / m_profile.erase_block; b <= (offset + len - 1) / m_profile.erase_block; b++) {
+			if (m_erased[b])
+				continue;
+			m_erased[b] = true;
+			m_erases++;
+			us += m_profile.erase_ms * 1000;
+		}
+	}
+	uint64_t commands = (len + m_profile.max_io - 1) / m_profile.max_io;
+	m_commands += commands;
+	us += commands * m_profile.op_latency_us + len / (m_profile.write_mib_s * 1048576) * 1e6;
+	charge(us);
+	return 0;
+}
+
+uint32_t FakeDevice::block_size() const
+{
+	return m_profile.mtd ? m_profile.erase_block : FileSink::kDeltaBlockSize;
+}
+
+ssize_t FakeDevice::read_back(uint8_t *buf, size_t len, uint64_t offset)
+{
+	if (offset >= m_profile.capacity)
+		return 0;
+	len = (size_t)std::min<uint64_t>(len, m_profile.capacity - offset);
+	uint64_t start = monotonic_us();
+	memcpy(buf, m_data + offset, len);
+	sleep_until_us(start + (uint64_t)(len / (m_profile.read_mib_s * 1048576) * 1e6));
+	return (ssize_t)len;
+}
+
+int FakeDevice::skip(uint64_t offset, uint64_t len)
+{
+	// What is skipped stays as it was, erased or not.
+	if (m_profile.mtd && len)
+		for (uint64_t b = offset / m_profile.erase_block; b <= (offset + len - 1) / m_profile.erase_block; b++)
+			m_erased[b] = true;
+	return 0;
+}
+
+} // namespace recovery
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "flash/sink.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace recovery {
+
+// Timing of a flash device, as a profile file of "key = value" lines:
+//
+//   name = emmc-class10
+//   type = emmc              # or mtd
+//   write_mib_s = 18         # sustained write throughput
+//   read_mib_s = 45          # for delta flashing's read-back
+//   op_latency_us = 350      # per write command
+//   max_io_kb = 512          # largest command (emmc); a page (mtd)
+//   erase_block_kb = 128     # mtd only
+//   erase_ms = 2.0           # per erase block (mtd only)
+//   capacity_mib = 1024      # size of the partition
+//
+// '#' starts a comment. Synthetic profiles are written by hand from data
+// sheets; recorded ones come from flash-bench --record-profile on a box.
+struct DeviceProfile {
+	std::string name;
+	bool mtd = false;
+	double write_mib_s = 20;
+	double read_mib_s = 40;
+	double op_latency_us = 0;
+	uint32_t max_io = 512 * 1024;
+	uint32_t erase_block = 0;
+	double erase_ms = 0;
+	uint64_t capacity = 1024ull << 20;
+};
+
+// Parses a profile file. Returns 0, -errno, or -EINVAL on a bad line
+// (reported on stderr).
+int load_profile(const char *path, DeviceProfile *profile);
+// Writes |profile| in the format load_profile() reads.
+void print_profile(FILE *out, const DeviceProfile &profile);
+// Measures the device or file at |path| by writing over its first 32 MiB
+// (a few erase blocks on MTD), destroying what was there. Latency and
+// throughput come from timing large and small synchronous writes.
+// Returns 0 or -errno.
+int record_profile(const char *path, DeviceProfile *profile);
+
+// RAM-backed stand-in for an eMMC partition or raw NAND, for measuring the
+// flash pipeline without a box. Writes are copied into memory and then
+// take as long as the profile says the device would: each command costs
+// its latency plus its bytes at the write throughput, and on MTD every
+// erase block is erased before its first write, like MtdSink does.
+//
+// Time is kept as the moment the device will be idle again; a write sleeps
+// until then, as a synchronous write to the device would, so costs far
+// below a timer tick still add up exactly.
+class FakeDevice : public Sink {
+public:
+	explicit FakeDevice(const DeviceProfile &profile) : m_profile(profile) {}
+	~FakeDevice() override;
+
+	FakeDevice(const FakeDevice &) = delete;
+	FakeDevice &operator=(const FakeDevice &) = delete;
+
+	// Maps the device's memory; pages are only backed once written.
+	// Returns 0 or -errno.
+	int open();
+
+	const char *name() const override { return m_profile.mtd ? "fake-mtd" : "fake-emmc"; }
+	int write(const uint8_t *data, size_t len, uint64_t offset) override;
+
+	// Delta flashing against what was written before. Reads take their
+	// time on the calling thread, without holding up writes.
+	uint32_t block_size() const override;
+	uint64_t capacity() const override { return m_profile.capacity; }
+	ssize_t read_back(uint8_t *buf, size_t len, uint64_t offset) override;
+	int skip(uint64_t offset, uint64_t len) override;
+
+	const DeviceProfile &profile() const { return m_profile; }
+	uint64_t commands() const { return m_commands; }
+	uint64_t erases() const { return m_erases; }
+	// Time the device spent writing and erasing.
+	uint64_t busy_us() const { return m_busy_us; }
+
+private:
+	// Charges |us| of device time and waits for the device.
+	void charge(double us);
+
+	DeviceProfile m_profile;
+	uint8_t *m_data = nullptr;
+	// Erase blocks erased so far (mtd).
+	std::vector<bool> m_erased;
+	uint64_t m_idle_at_us = 0;
+	uint64_t m_commands = 0;
+	uint64_t m_erases = 0;
+	uint64_t m_busy_us = 0;
+};
+
+} // namespace recovery
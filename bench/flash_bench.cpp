@@ -0,0 +1,465 @@
+// Measures per-stage throughput of the flash pipeline.
+//
+// By default a synthetic image is streamed from memory into a sink that
+// discards it, which isolates pipeline overhead and SHA-256 cost. Point
+// --source at a real image (a file or an http(s) URL) and --sink at a file
+// or device to measure the whole path, or --fake at a device profile to
+// have the image written to a RAM-backed device that takes as long as the
+// profiled one. Results are printed as one JSON object.
+
+#include "fake_device.h"
+#include "common/trace.h"
+#include "crypto/hasher.h"
+#include "flash/backup_index.h"
+#include "flash/container.h"
+#include "flash/delta_sink.h"
+#include "flash/flash_journal.h"
+#include "flash/http_source.h"
+#include "flash/pipeline.h"
+#include "flash/tar_extract.h"
+#include "platform/platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+// Repeats one pseudo-random megabyte; generation cost stays out of the numbers.
+// A mixed pattern zeroes the second half of every 4 KiB, which compresses
+// about as well as a filesystem image does.
+class PatternSource : public Source {
+public:
+	PatternSource(uint64_t size, bool mixed) : m_size(size), m_pattern(1 << 20)
+	{
+		uint32_t x = 0x12345678;
+		for (size_t i = 0; i < m_pattern.size(); i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			m_pattern[i] = mixed && (i & 2048) ? 0 : (uint8_t)x;
+		}
+	}
+
+	ssize_t read(uint8_t *buf, size_t len) override
+	{
+		size_t n = (size_t)std::min<uint64_t>(len, m_size - m_pos);
+		for (size_t done = 0; done < n;) {
+			size_t at = (size_t)((m_pos + done) % m_pattern.size());
+			size_t step = std::min(n - done, m_pattern.size() - at);
+			memcpy(buf + done, &m_pattern[at], step);
+			done += step;
+		}
+		m_pos += n;
+		return (ssize_t)n;
+	}
+
+	int64_t size() const override { return (int64_t)m_size; }
+
+private:
+	uint64_t m_size;
+	uint64_t m_pos = 0;
+	std::vector<uint8_t> m_pattern;
+};
+
+class NullSink : public Sink {
+public:
+	const char *name() const override { return "null"; }
+	int write(const uint8_t *, size_t, uint64_t) override { return 0; }
+};
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [--size MB] [--chunk KB] [--depth N] [--source PATH] [--sink PATH] [--sha256 HEX]\n"
+		"          [--decoder raw|gz|xz|zst|bz2|ruic|tar|zip] [--threads N] [--delta]\n"
+		"          [--connections N] [--tree-sha256 HEX] [--leaf KB] [--hash-threads N]\n"
+		"          [--hash-engine auto|cpu|af_alg] [--trace FILE] [--progress] [--direct]\n"
+		"          [--extract DIR] [--fake PROFILE] [--fill random|mixed] [--write-image PATH]\n"
+		"          [--record-profile] [--journal PATH]\n"
+		"Without --source a synthetic image of --size MiB is used (default 256).\n"
+		"--source may be an http:// or https:// URL, fetched over --connections N.\n"
+		"The decoder is detected from a file source unless given; URLs default to raw.\n"
+		"Without --sink the output is discarded. --sink may name a partition of the\n"
+		"MACHINE built for; MTD ones are written as raw flash, others with O_DIRECT\n"
+		"if --direct. --delta only rewrites blocks of --sink that differ from the\n"
+		"image. --extract unpacks a tarball --source into DIR instead of a sink.\n"
+		"--fake writes to a RAM-backed device timed like the one PROFILE describes.\n"
+		"--write-image saves the synthetic image (--size, --fill) to PATH and exits.\n"
+		"--record-profile measures --sink, overwriting its start, and prints its\n"
+		"profile instead of flashing.\n"
+		"--journal records the progress of flashing a container --source into\n"
+		"--sink at PATH; run again after an interruption, it resumes there.\n"
+		"The image is tree hashed in parallel unless only --sha256 is\n"
+		"given, which hashes it on one core; backup archives and containers are\n"
+		"checked against the tree digest they carry.\n"
+		"--progress samples the pipeline to stderr five times a second, as the UI\n"
+		"would. Without --depth the queues are sized from MemAvailable.\n",
+		argv0);
+}
+
+Compression detect_compression_file(const char *path)
+{
+	uint8_t head[kDetectBytes];
+	FILE *f = fopen(path, "rb");
+	size_t n = f ? fread(head, 1, sizeof(head), f) : 0;
+	if (f)
+		fclose(f);
+	return detect_compression(head, n);
+}
+
+double mib_per_s(uint64_t bytes, uint64_t us)
+{
+	return us ? (double)bytes / (1 << 20) / (us / 1e6) : 0.0;
+}
+
+int write_image(Source &source, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "flash-bench: cannot create %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	std::vector<uint8_t> buf(1 << 20);
+	ssize_t n;
+	while ((n = source.read(buf.data(), buf.size())) > 0)
+		if (fwrite(buf.data(), 1, (size_t)n, f) != (size_t)n)
+			break;
+	if (fclose(f) != 0 || n != 0) {
+		fprintf(stderr, "flash-bench: cannot write %s\n", path);
+		return -EIO;
+	}
+	return 0;
+}
+
+void sample_progress(const FlashPipeline &pipeline, const std::atomic<bool> &done)
+{
+	while (!done) {
+		usleep(200 * 1000);
+		PipelineProgress p = pipeline.progress();
+		fprintf(stderr, "\r");
+		for (int s = 0; s < (int)Stage::Count; s++)
+			fprintf(stderr, "%s %6.1f MiB  ", stage_name((Stage)s), p.bytes[s] / 1048576.0);
+		if (p.source_size > 0)
+			fprintf(stderr, "%3u%%", (unsigned)(p.bytes[(int)Stage::Read] * 100 / (uint64_t)p.source_size));
+	}
+	fprintf(stderr, "\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	uint64_t size_mb = 256;
+	PipelineOptions options;
+	const char *source_path = nullptr;
+	const char *sink_path = nullptr;
+	const char *extract_dir = nullptr;
+	const char *decoder_name = nullptr;
+	const char *fake_path = nullptr;
+	const char *image_out = nullptr;
+	const char *journal_path = nullptr;
+	bool mixed = false;
+	bool record = false;
+	unsigned threads = default_decoder_threads();
+	bool delta = false;
+	bool show_progress = false;
+	bool direct = false;
+	HttpSourceOptions http_options;
+#ifdef HAVE_TRACE
+	const char *trace_path = nullptr;
+#endif
+
+	for (int i = 1; i < argc; i++) {
+		bool has_arg = i + 1 < argc;
+		if (!strcmp(argv[i], "--size") && has_arg)
+			size_mb = strtoull(argv[++i], nullptr, 0);
+		else if (!strcmp(argv[i], "--chunk") && has_arg)
+			options.chunk_size = (size_t)atoi(argv[++i]) * 1024;
+		else if (!strcmp(argv[i], "--depth") && has_arg)
+			options.queue_depth = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--source") && has_arg)
+			source_path = argv[++i];
+		else if (!strcmp(argv[i], "--sink") && has_arg)
+			sink_path = argv[++i];
+		else if (!strcmp(argv[i], "--extract") && has_arg)
+			extract_dir = argv[++i];
+		else if (!strcmp(argv[i], "--fake") && has_arg)
+			fake_path = argv[++i];
+		else if (!strcmp(argv[i], "--write-image") && has_arg)
+			image_out = argv[++i];
+		else if (!strcmp(argv[i], "--journal") && has_arg)
+			journal_path = argv[++i];
+		else if (!strcmp(argv[i], "--record-profile"))
+			record = true;
+		else if (!strcmp(argv[i], "--fill") && has_arg &&
+			 (!strcmp(argv[i + 1], "random") || !strcmp(argv[i + 1], "mixed")))
+			mixed = !strcmp(argv[++i], "mixed");
+		else if (!strcmp(argv[i], "--decoder") && has_arg)
+			decoder_name = argv[++i];
+		else if (!strcmp(argv[i], "--delta"))
+			delta = true;
+		else if (!strcmp(argv[i], "--progress"))
+			show_progress = true;
+		else if (!strcmp(argv[i], "--direct"))
+			direct = true;
+		else if (!strcmp(argv[i], "--connections") && has_arg)
+			http_options.connections = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && has_arg)
+			threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--sha256") && has_arg && sha256_from_hex(argv[i + 1], options.digest)) {
+			options.has_digest = true;
+			i++;
+		} else if (!strcmp(argv[i], "--tree-sha256") && has_arg &&
+			   sha256_from_hex(argv[i + 1], options.tree_digest)) {
+			options.has_tree_digest = true;
+			i++;
+		} else if (!strcmp(argv[i], "--leaf") && has_arg)
+			options.tree_leaf_size = (uint32_t)atoi(argv[++i]) * 1024;
+#ifdef HAVE_TRACE
+		else if (!strcmp(argv[i], "--trace") && has_arg)
+			trace_path = argv[++i];
+#endif
+		else if (!strcmp(argv[i], "--hash-threads") && has_arg)
+			options.hash_threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--hash-engine") && has_arg) {
+			const char *engine = argv[++i];
+			if (!strcmp(engine, "cpu"))
+				hash_engine_force(HashEngine::Cpu);
+			else if (!strcmp(engine, "af_alg"))
+				hash_engine_force(HashEngine::AfAlg);
+			else if (strcmp(engine, "auto")) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!options.chunk_size || !http_options.connections || !options.tree_leaf_size ||
+	    (delta && !sink_path && !fake_path) || (extract_dir && (sink_path || delta)) ||
+	    (fake_path && (sink_path || extract_dir)) || (record && !sink_path) ||
+	    (journal_path && (!sink_path || !source_path || delta || options.has_digest))) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	PatternSource pattern(size_mb << 20, mixed);
+	if (image_out)
+		return write_image(pattern, image_out) < 0 ? 1 : 0;
+	if (record) {
+		if (const platform::Partition *p = platform::find_partition(sink_path))
+			sink_path = p->device;
+		DeviceProfile profile;
+		int ret = record_profile(sink_path, &profile);
+		if (ret < 0) {
+			fprintf(stderr, "flash-bench: cannot profile %s: %s\n", sink_path, strerror(-ret));
+			return 1;
+		}
+		print_profile(stdout, profile);
+		return 0;
+	}
+	FileSource file_source;
+	HttpSource http_source(http_options);
+	bool is_url = source_path && (!strncmp(source_path, "http://", 7) || !strncmp(source_path, "https://", 8));
+	Source *source = &pattern;
+	if (is_url) {
+		if (http_source.open(source_path) < 0)
+			return 1;
+		source = &http_source;
+	} else if (source_path) {
+		if (file_source.open(source_path) < 0)
+			return 1;
+		source = &file_source;
+		// Backup archives and containers carry their own tree digest.
+		UniqueFd archive(open(source_path, O_RDONLY | O_CLOEXEC));
+		BackupIndex index;
+		ContainerHeader header;
+		bool known = options.has_digest || options.has_tree_digest || !archive;
+		if (!known && backup_index_load(archive.get(), &index) == 0) {
+			options.has_tree_digest = true;
+			memcpy(options.tree_digest, index.root, sizeof(options.tree_digest));
+			options.tree_leaf_size = index.chunk_size;
+		} else if (!known && pread(archive.get(), &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+			   container_index_size((const uint8_t *)&header, sizeof(header)) > 0) {
+			options.has_tree_digest = true;
+			memcpy(options.tree_digest, header.root, sizeof(options.tree_digest));
+			options.tree_leaf_size = header.chunk_size;
+		}
+	}
+
+	if (const platform::Partition *p = sink_path ? platform::find_partition(sink_path) : nullptr)
+		sink_path = p->device;
+	NullSink null_sink;
+	FileSink file_sink;
+	MtdSink mtd_sink;
+	Sink *sink = &null_sink;
+	if (sink_path && platform::flash_type(sink_path) == platform::FlashType::Mtd) {
+		if (mtd_sink.open(sink_path) < 0)
+			return 1;
+		sink = &mtd_sink;
+	} else if (sink_path) {
+		if (file_sink.open(sink_path, delta || journal_path, direct) < 0)
+			return 1;
+		sink = &file_sink;
+	}
+	DeviceProfile profile;
+	if (fake_path) {
+		int ret = load_profile(fake_path, &profile);
+		if (ret < 0) {
+			fprintf(stderr, "flash-bench: cannot load %s: %s\n", fake_path, strerror(-ret));
+			return 1;
+		}
+	}
+	FakeDevice fake(profile);
+	if (fake_path) {
+		if (fake.open() < 0)
+			return 1;
+		sink = &fake;
+	}
+	ExtractSink extract_sink;
+	if (extract_dir) {
+		if (extract_sink.open(extract_dir) < 0)
+			return 1;
+		sink = &extract_sink;
+	}
+	DeltaSink delta_sink(*sink, threads);
+	if (delta) {
+		if (delta_sink.start() < 0)
+			return 1;
+		sink = &delta_sink;
+	}
+
+	Compression compression = Compression::Raw;
+	if (decoder_name) {
+		if (!compression_from_name(decoder_name, &compression)) {
+			usage(argv[0]);
+			return 2;
+		}
+	} else if (source_path && !is_url) {
+		compression = detect_compression_file(source_path);
+	}
+	// Extracting wants the tar stream rather than its first member.
+	if (extract_dir && compression == Compression::Tar)
+		compression = Compression::Raw;
+	std::unique_ptr<Decoder> decoder = make_decoder(compression, threads);
+	if (!decoder)
+		return 1;
+
+	ContainerIndex index;
+	std::vector<uint8_t> leaves;
+	FlashJournal journal;
+	uint32_t resumed = 0;
+	if (journal_path) {
+		UniqueFd fd(open(source_path, O_RDONLY | O_CLOEXEC));
+		int ret = fd ? container_read_index(fd.get(), &index) : -errno;
+		if (ret == 0)
+			ret = journal.open(journal_path, index.header, sink_path);
+		if (ret < 0) {
+			fprintf(stderr, "flash-bench: cannot journal %s: %s\n", source_path, strerror(-ret));
+			return 1;
+		}
+		index.chunk_digests(leaves);
+		options.leaf_digests = leaves.data();
+		options.leaf_count = index.header.chunk_count;
+		options.journal = &journal;
+		resumed = journal.resume_point(index, *sink);
+		if (resumed) {
+			std::vector<std::pair<uint64_t, uint64_t>> ranges;
+			index.resume_ranges(resumed, ranges);
+			file_source.select(ranges);
+			decoder = make_resume_decoder(index, resumed, threads);
+			if (!decoder)
+				return 1;
+			options.resume_leaves = resumed;
+		}
+	}
+	// A raw image's size is known up front, so erases may run ahead of it.
+	if (sink == &mtd_sink && compression == Compression::Raw && source->size() > 0)
+		mtd_sink.set_image_size((uint64_t)source->size());
+
+	FlashPipeline pipeline(*source, *decoder, *sink, options);
+	std::atomic<bool> done{ false };
+	std::thread sampler;
+	if (show_progress)
+		sampler = std::thread(sample_progress, std::cref(pipeline), std::cref(done));
+	int ret = pipeline.run();
+	done = true;
+	if (sampler.joinable())
+		sampler.join();
+#ifdef HAVE_TRACE
+	if (trace_path && trace_dump_file(trace_path) < 0)
+		fprintf(stderr, "flash-bench: cannot write %s\n", trace_path);
+#endif
+	if (ret < 0) {
+		fprintf(stderr, "flash-bench: pipeline failed: %s\n", strerror(-ret));
+		return 1;
+	}
+	if (journal_path)
+		journal.discard();
+
+	const StageStats &written = pipeline.stats(Stage::Write);
+	printf("{\"decoder\":\"%s\",\"threads\":%u,\"sink\":\"%s\",\"chunk_kb\":%zu,\"depth\":%u,\"bytes\":%llu,"
+	       "\"elapsed_ms\":%.1f,\"total_mib_s\":%.1f,\"stages\":{",
+	       decoder->name(), threads, sink->name(), options.chunk_size / 1024, pipeline.queue_depth(),
+	       (unsigned long long)written.bytes, pipeline.elapsed_us() / 1000.0,
+	       mib_per_s(written.bytes, pipeline.elapsed_us()));
+	for (int s = 0; s < (int)Stage::Count; s++) {
+		const StageStats &st = pipeline.stats((Stage)s);
+		printf("%s\"%s\":{\"bytes\":%llu,\"mib_s\":%.1f,\"busy_ms\":%.1f,\"starved_ms\":%.1f,\"blocked_ms\":%.1f}",
+		       s ? "," : "", stage_name((Stage)s), (unsigned long long)st.bytes, mib_per_s(st.bytes, st.busy_us),
+		       st.busy_us / 1000.0, st.starved_us / 1000.0, st.blocked_us / 1000.0);
+	}
+	printf("}");
+	char hex[2 * Sha256::kDigestSize + 1];
+	printf(",\"hash\":{\"engine\":\"%s\"", hash_engine_name());
+	if (options.has_digest) {
+		sha256_to_hex(pipeline.digest(), hex);
+		printf(",\"sha256\":\"%s\"", hex);
+	}
+	if (pipeline.has_tree_digest()) {
+		sha256_to_hex(pipeline.tree_digest(), hex);
+		printf(",\"threads\":%u,\"leaf_kb\":%u,\"tree_sha256\":\"%s\"", pipeline.hash_threads(),
+		       options.tree_leaf_size / 1024, hex);
+	}
+	printf("}");
+	const ChunkPool &pool = pipeline.pool();
+	printf(",\"pool\":{\"chunks\":%zu,\"mib\":%.1f,\"stalls\":%llu,\"stall_ms\":%.1f}", pool.count(),
+	       pool.count() * pool.chunk_size() / 1048576.0, (unsigned long long)pool.stalls(), pool.stall_us() / 1000.0);
+	if (file_sink.direct())
+		printf(",\"direct_bytes\":%llu", (unsigned long long)file_sink.direct_bytes());
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		printf(",\"max_rss_kb\":%ld", usage.ru_maxrss);
+	if (extract_dir) {
+		const ExtractStats &st = extract_sink.stats();
+		printf(",\"extract\":{\"threads\":%u,\"files\":%llu,\"dirs\":%llu,\"links\":%llu,\"batches\":%llu,"
+		       "\"preallocated\":%llu}",
+		       extract_sink.threads(), (unsigned long long)st.files, (unsigned long long)st.dirs,
+		       (unsigned long long)st.links, (unsigned long long)st.batches, (unsigned long long)st.preallocated);
+	}
+	if (fake_path)
+		printf(",\"device\":{\"profile\":\"%s\",\"type\":\"%s\",\"commands\":%llu,\"erases\":%llu,"
+		       "\"busy_ms\":%.1f}",
+		       profile.name.c_str(), profile.mtd ? "mtd" : "emmc", (unsigned long long)fake.commands(),
+		       (unsigned long long)fake.erases(), fake.busy_us() / 1000.0);
+	if (journal_path)
+		printf(",\"journal\":{\"resumed_chunks\":%u,\"chunks\":%u}", resumed, index.header.chunk_count);
+	if (delta)
+		printf(",\"delta\":{\"written\":%llu,\"skipped\":%llu}", (unsigned long long)delta_sink.blocks_written(),
+		       (unsigned long long)delta_sink.blocks_skipped());
+	printf("}\n");
+	return 0;
+}
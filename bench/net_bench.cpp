@@ -0,0 +1,289 @@
+// Measures HttpSource throughput against a loopback server.
+//
+// The server emulates a distant mirror: every response waits --rtt-ms
+// and each connection is paced to --conn-mbit, which is what makes a single
+// stream slow on high-latency sites. --drop-every cuts each connection
+// after that many KiB so resuming is exercised too. The image is fetched
+// once per entry of --connections and checked byte for byte. Results are
+// printed as one JSON object.
+
+#include "common/clock.h"
+#include "flash/http_source.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+constexpr size_t kPatternSize = 1 << 20;
+
+struct ServerOptions {
+	uint64_t size = 64ull << 20;
+	unsigned rtt_ms = 20;
+	unsigned conn_mbit = 200;
+	uint64_t drop_every = 0;
+};
+
+std::vector<uint8_t> make_pattern()
+{
+	std::vector<uint8_t> pattern(kPatternSize);
+	uint32_t x = 0x9e3779b9;
+	for (uint8_t &b : pattern) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		b = (uint8_t)x;
+	}
+	return pattern;
+}
+
+// Minimal HTTP/1.1 file server with Range and keep-alive support.
+class LoopbackServer {
+public:
+	LoopbackServer(const ServerOptions &options, const std::vector<uint8_t> &pattern)
+		: m_options(options), m_pattern(pattern)
+	{
+	}
+
+	~LoopbackServer()
+	{
+		m_stop = true;
+		if (m_listen >= 0) {
+			shutdown(m_listen, SHUT_RDWR);
+			close(m_listen);
+		}
+		if (m_accept.joinable())
+			m_accept.join();
+		for (std::thread &t : m_clients)
+			t.join();
+	}
+
+	int start()
+	{
+		m_listen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (m_listen < 0 || bind(m_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_listen, 64) < 0 ||
+		    getsockname(m_listen, (struct sockaddr *)&addr, &len) < 0) {
+			perror("net-bench: listen");
+			return -1;
+		}
+		m_port = ntohs(addr.sin_port);
+		m_accept = std::thread([this] {
+			for (;;) {
+				int fd = accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC);
+				if (fd < 0 || m_stop) {
+					if (fd >= 0)
+						close(fd);
+					return;
+				}
+				m_clients.emplace_back(&LoopbackServer::serve, this, fd);
+			}
+		});
+		return 0;
+	}
+
+	unsigned port() const { return m_port; }
+
+private:
+	void serve(int fd)
+	{
+		struct timeval tv = { 5, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		std::string in;
+		uint64_t sent_on_conn = 0;
+		char buf[4096];
+
+		while (!m_stop) {
+			size_t end;
+			while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+				ssize_t n = recv(fd, buf, sizeof(buf), 0);
+				if (n <= 0) {
+					close(fd);
+					return;
+				}
+				in.append(buf, (size_t)n);
+			}
+			std::string request = in.substr(0, end);
+			in.erase(0, end + 4);
+
+			uint64_t first = 0, last = m_options.size - 1;
+			bool ranged = false;
+			const char *range = strcasestr(request.c_str(), "\r\nRange: bytes=");
+			if (range) {
+				unsigned long long a, b;
+				if (sscanf(range + 15, "%llu-%llu", &a, &b) == 2 && a <= b && a < m_options.size) {
+					first = a;
+					last = std::min<uint64_t>(b, m_options.size - 1);
+					ranged = true;
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_options.rtt_ms));
+			char header[256];
+			int len;
+			if (ranged)
+				len = snprintf(header, sizeof(header),
+					       "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %llu-%llu/%llu\r\n",
+					       (unsigned long long)first, (unsigned long long)last,
+					       (unsigned long long)m_options.size);
+			else
+				len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n");
+			len += snprintf(header + len, sizeof(header) - (size_t)len,
+					"Content-Length: %llu\r\nETag: \"bench\"\r\nAccept-Ranges: bytes\r\n\r\n",
+					(unsigned long long)(last - first + 1));
+			if (send(fd, header, (size_t)len, MSG_NOSIGNAL) != len)
+				break;
+
+			// Paced in 16 KiB steps to the per-connection rate.
+			uint64_t start = monotonic_us(), done = 0;
+			for (uint64_t off = first; off <= last && !m_stop;) {
+				size_t at = (size_t)(off % kPatternSize);
+				size_t step = (size_t)std::min<uint64_t>({ 16384, last + 1 - off, kPatternSize - at });
+				if (m_options.drop_every && sent_on_conn + step > m_options.drop_every) {
+					close(fd); // mid-body, as a flaky link would
+					return;
+				}
+				ssize_t n = send(fd, &m_pattern[at], step, MSG_NOSIGNAL);
+				if (n <= 0) {
+					close(fd);
+					return;
+				}
+				off += (uint64_t)n;
+				done += (uint64_t)n;
+				sent_on_conn += (uint64_t)n;
+				if (m_options.conn_mbit) {
+					uint64_t due = start + done * 8 / m_options.conn_mbit;
+					uint64_t now = monotonic_us();
+					if (due > now)
+						std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+				}
+			}
+		}
+		close(fd);
+	}
+
+	ServerOptions m_options;
+	const std::vector<uint8_t> &m_pattern;
+	int m_listen = -1;
+	unsigned m_port = 0;
+	std::atomic<bool> m_stop{ false };
+	std::thread m_accept;
+	std::vector<std::thread> m_clients;
+};
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [--size MB] [--rtt-ms MS] [--conn-mbit N] [--drop-every KB]\n"
+		"          [--connections N,N,...] [--range KB] [--url URL]\n"
+		"Defaults: 64 MiB, 20 ms, 200 Mbit/s per connection, no drops,\n"
+		"connections 1,2,4,8, 1024 KiB ranges. --url fetches a real server\n"
+		"instead and skips the content check.\n",
+		argv0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	ServerOptions server_options;
+	HttpSourceOptions source_options;
+	std::vector<unsigned> connections = { 1, 2, 4, 8 };
+	const char *url = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_arg = i + 1 < argc;
+		if (!strcmp(argv[i], "--size") && has_arg) {
+			server_options.size = strtoull(argv[++i], nullptr, 0) << 20;
+		} else if (!strcmp(argv[i], "--rtt-ms") && has_arg) {
+			server_options.rtt_ms = (unsigned)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--conn-mbit") && has_arg) {
+			server_options.conn_mbit = (unsigned)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--drop-every") && has_arg) {
+			server_options.drop_every = strtoull(argv[++i], nullptr, 0) << 10;
+		} else if (!strcmp(argv[i], "--range") && has_arg) {
+			source_options.range_size = (size_t)atoi(argv[++i]) * 1024;
+		} else if (!strcmp(argv[i], "--url") && has_arg) {
+			url = argv[++i];
+		} else if (!strcmp(argv[i], "--connections") && has_arg) {
+			connections.clear();
+			for (char *p = argv[++i]; *p;) {
+				connections.push_back((unsigned)strtoul(p, &p, 10));
+				if (*p == ',')
+					p++;
+				else if (*p)
+					break;
+			}
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!server_options.size || connections.empty()) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	std::vector<uint8_t> pattern = make_pattern();
+	LoopbackServer server(server_options, pattern);
+	std::string target;
+	if (url) {
+		target = url;
+	} else {
+		if (server.start() < 0)
+			return 1;
+		target = "http://127.0.0.1:" + std::to_string(server.port()) + "/image.img";
+	}
+
+	bool all_ok = true;
+	printf("{\"size_mb\":%llu,\"rtt_ms\":%u,\"conn_mbit\":%u,\"range_kb\":%zu,\"runs\":[",
+	       (unsigned long long)(server_options.size >> 20), server_options.rtt_ms, server_options.conn_mbit,
+	       source_options.range_size / 1024);
+	std::vector<uint8_t> buf(256 * 1024);
+	for (size_t r = 0; r < connections.size(); r++) {
+		source_options.connections = connections[r];
+		HttpSource source(source_options);
+		uint64_t start = monotonic_us();
+		int ret = source.open(target);
+		uint64_t total = 0;
+		bool ok = ret == 0;
+		while (ok) {
+			ssize_t n = source.read(buf.data(), buf.size());
+			if (n <= 0) {
+				ok = n == 0;
+				break;
+			}
+			// Chunks may straddle the pattern's wrap-around.
+			for (size_t done = 0; !url && done < (size_t)n;) {
+				size_t at = (size_t)((total + done) % kPatternSize);
+				size_t step = std::min((size_t)n - done, kPatternSize - at);
+				ok = ok && !memcmp(&buf[done], &pattern[at], step);
+				done += step;
+			}
+			total += (uint64_t)n;
+		}
+		ok = ok && (url || total == server_options.size);
+		uint64_t us = monotonic_us() - start;
+		all_ok = all_ok && ok;
+		printf("%s{\"connections\":%u,\"bytes\":%llu,\"mib_s\":%.1f,\"resumes\":%u,\"ok\":%s}", r ? "," : "",
+		       connections[r], (unsigned long long)total, us ? total / (double)(1 << 20) / (us / 1e6) : 0.0,
+		       source.resumes(), ok ? "true" : "false");
+	}
+	printf("]}\n");
+	return all_ok ? 0 : 1;
+}
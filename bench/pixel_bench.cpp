@@ -0,0 +1,191 @@
+// Measures the pixel kernels linked into libfb on full-HD scanlines.
+//
+// Each kernel runs over a 1920x1080 buffer until --ms milliseconds have
+// passed and reports Mpixel/s. Its output on a test pattern is compared
+// with the scalar reference, so a SIMD build also proves bit-exactness.
+// Results are printed as one JSON object; the exit status is 1 on a
+// mismatch.
+
+#include "common/clock.h"
+#include "fb/pixel_ops.h"
+#include "fb/pixel_ops_scalar.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+constexpr unsigned kWidth = 1920;
+constexpr unsigned kHeight = 1080;
+
+// xorshift fill so blends see every byte value.
+void fill_random(void *buf, size_t len, uint32_t seed)
+{
+	uint8_t *p = (uint8_t *)buf;
+	for (size_t i = 0; i < len; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		p[i] = (uint8_t)seed;
+	}
+}
+
+struct Buffers {
+	std::vector<uint32_t> dst32 = std::vector<uint32_t>(kWidth * kHeight);
+	std::vector<uint16_t> dst16 = std::vector<uint16_t>(kWidth * kHeight);
+	std::vector<uint8_t> mask = std::vector<uint8_t>(kWidth * kHeight);
+	std::vector<uint32_t> src32 = std::vector<uint32_t>(kWidth * kHeight);
+};
+
+// Runs one kernel over every scanline; |fast| selects the linked
+// implementation, otherwise the scalar reference.
+using KernelFn = void (*)(Buffers &b, unsigned y, unsigned n, bool fast);
+
+struct Kernel {
+	const char *name;
+	KernelFn fn;
+	size_t bytes_per_pixel;
+};
+
+const uint32_t kPixel32 = 0xff3080c0;
+const uint16_t kPixel16 = 0x3a6f;
+const uint8_t kAlpha = 0x9c;
+
+const Kernel kKernels[] = {
+	{ "fill32", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? fill_span32 : scalar::fill_span32)(&b.dst32[y * kWidth], kPixel32, n);
+	  }, 4 },
+	{ "fill16", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? fill_span16 : scalar::fill_span16)(&b.dst16[y * kWidth], kPixel16, n);
+	  }, 2 },
+	{ "blend32", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? blend_span32 : scalar::blend_span32)(&b.dst32[y * kWidth], kPixel32, kAlpha, n);
+	  }, 4 },
+	{ "blend16", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? blend_span16 : scalar::blend_span16)(&b.dst16[y * kWidth], kPixel16, kAlpha, n);
+	  }, 2 },
+	{ "mask32", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? blend_mask_span32 : scalar::blend_mask_span32)(&b.dst32[y * kWidth], &b.mask[y * kWidth],
+									 kPixel32, kAlpha, n);
+	  }, 4 },
+	{ "mask16", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? blend_mask_span16 : scalar::blend_mask_span16)(&b.dst16[y * kWidth], &b.mask[y * kWidth],
+									 kPixel16, kAlpha, n);
+	  }, 2 },
+	{ "blit32", [](Buffers &b, unsigned y, unsigned n, bool fast) {
+		  (fast ? blit_span : scalar::blit_span)((uint8_t *)&b.dst32[y * kWidth],
+							 (const uint8_t *)&b.src32[y * kWidth], n * 4);
+	  }, 4 },
+};
+
+void reset(Buffers &b)
+{
+	fill_random(b.dst32.data(), b.dst32.size() * 4, 0x1234567);
+	fill_random(b.dst16.data(), b.dst16.size() * 2, 0x89abcde);
+	fill_random(b.src32.data(), b.src32.size() * 4, 0x2468ace);
+	// Glyph-like coverage: mostly empty, solid runs, and edges.
+	fill_random(b.mask.data(), b.mask.size(), 0x13579bd);
+	for (size_t i = 0; i < b.mask.size(); i++) {
+		unsigned phase = (i / 24) % 4;
+		if (phase == 0)
+			b.mask[i] = 0;
+		else if (phase == 1)
+			b.mask[i] = 0xff;
+	}
+}
+
+// Runs |k| with both implementations on odd span widths, so every tail path
+// is exercised, and compares the results.
+bool check(const Kernel &k, Buffers &fast, Buffers &ref)
+{
+	reset(fast);
+	reset(ref);
+	for (unsigned y = 0; y < kHeight; y++) {
+		unsigned n = kWidth - (y % 37);
+		k.fn(fast, y, n, true);
+		k.fn(ref, y, n, false);
+	}
+	return fast.dst32 == ref.dst32 && fast.dst16 == ref.dst16;
+}
+
+double measure(const Kernel &k, Buffers &b, unsigned ms)
+{
+	reset(b);
+	uint64_t pixels = 0;
+	uint64_t start = monotonic_us(), now = start;
+	do {
+		for (unsigned y = 0; y < kHeight; y++)
+			k.fn(b, y, kWidth, true);
+		pixels += (uint64_t)kWidth * kHeight;
+		now = monotonic_us();
+	} while (now - start < (uint64_t)ms * 1000);
+	return (double)pixels / (double)(now - start);
+}
+
+void usage(FILE *out)
+{
+	fprintf(out,
+		"Usage: pixel-bench [--ms MS] [--kernel NAME]...\n"
+		"\n"
+		"  --ms MS        run each kernel for MS milliseconds (default 200)\n"
+		"  --kernel NAME  only run NAME (fill32, fill16, blend32, blend16,\n"
+		"                 mask32, mask16, blit32); may be repeated\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "ms", required_argument, nullptr, 'm' },
+		{ "kernel", required_argument, nullptr, 'k' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	unsigned ms = 200;
+	std::vector<const char *> only;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "m:k:h", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'm':
+			ms = (unsigned)strtoul(optarg, nullptr, 10);
+			break;
+		case 'k':
+			only.push_back(optarg);
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 2;
+		}
+	}
+
+	Buffers fast, ref;
+	bool all_exact = true;
+	printf("{\"impl\":\"%s\",\"width\":%u,\"height\":%u,\"kernels\":{", pixel_ops_name(), kWidth, kHeight);
+	bool first = true;
+	for (const Kernel &k : kKernels) {
+		bool wanted = only.empty();
+		for (const char *name : only)
+			wanted = wanted || !strcmp(name, k.name);
+		if (!wanted)
+			continue;
+
+		bool exact = check(k, fast, ref);
+		all_exact = all_exact && exact;
+		double mpix_s = measure(k, fast, ms);
+		printf("%s\"%s\":{\"mpix_s\":%.1f,\"mib_s\":%.1f,\"exact\":%s}", first ? "" : ",", k.name, mpix_s,
+		       mpix_s * 1e6 * (double)k.bytes_per_pixel / (1 << 20), exact ? "true" : "false");
+		first = false;
+	}
+	printf("},\"exact\":%s}\n", all_exact ? "true" : "false");
+	return all_exact ? 0 : 1;
+}
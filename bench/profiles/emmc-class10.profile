@@ -0,0 +1,8 @@
+# Slow eMMC 4.5 / class 10 SD, the low end still in the field.
+name = emmc-class10
+type = emmc
+write_mib_s = 18
+read_mib_s = 45
+op_latency_us = 350
+max_io_kb = 512
+capacity_mib = 1024
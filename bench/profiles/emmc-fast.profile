@@ -0,0 +1,8 @@
+# eMMC 5.1 HS400, as on the newer boxes.
+name = emmc-fast
+type = emmc
+write_mib_s = 120
+read_mib_s = 250
+op_latency_us = 80
+max_io_kb = 512
+capacity_mib = 4096
@@ -0,0 +1,10 @@
+# MLC NAND, 4 KiB pages in 512 KiB blocks.
+name = nand-mlc-512k
+type = mtd
+write_mib_s = 25
+read_mib_s = 30
+op_latency_us = 600
+max_io_kb = 4
+erase_block_kb = 512
+erase_ms = 4
+capacity_mib = 512
@@ -0,0 +1,11 @@
+# SLC NAND, 2 KiB pages in 128 KiB blocks. Each page program is tPROG
+# (op_latency_us) plus its transfer over the bus (write_mib_s).
+name = nand-slc-128k
+type = mtd
+write_mib_s = 20
+read_mib_s = 20
+op_latency_us = 200
+max_io_kb = 2
+erase_block_kb = 128
+erase_ms = 2
+capacity_mib = 256
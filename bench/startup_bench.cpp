@@ -0,0 +1,163 @@
+// Measures exec-to-first-frame latency and on-disk size of recovery-ui.
+//
+// The binary is started with --ready-fd pointing at a pipe; the time until the
+// first byte arrives is the time-to-first-frame, dynamic linking included.
+// Results are printed as one JSON object so image builders can archive them.
+
+#include "common/clock.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+const int kReadyFd = 3;
+const int kTimeoutMs = 10000;
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [--runs N] [--budget-ms MS] [--budget-kb KB] [--drop-caches] BINARY [ARGS...]\n"
+		"A budget of 0 disables that check. Exits 1 if a budget is exceeded.\n",
+		argv0);
+}
+
+void drop_caches()
+{
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || write(fd, "3\n", 2) != 2)
+		fprintf(stderr, "startup-bench: cannot drop caches, measuring warm starts\n");
+	if (fd >= 0)
+		close(fd);
+}
+
+// Returns the time to first frame in microseconds, or 0 on failure.
+uint64_t run_once(char **argv)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return 0;
+	}
+
+	uint64_t start = monotonic_us();
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+	if (pid == 0) {
+		dup2(fds[1], kReadyFd);
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0)
+			dup2(devnull, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	struct pollfd pfd = { fds[0], POLLIN, 0 };
+	uint64_t elapsed = 0;
+	char c;
+	int ret;
+	while ((ret = poll(&pfd, 1, kTimeoutMs)) < 0 && errno == EINTR)
+		;
+	if (ret > 0 && read(fds[0], &c, 1) == 1)
+		elapsed = std::max<uint64_t>(monotonic_us() - start, 1);
+	else
+		fprintf(stderr, "startup-bench: %s did not draw a frame\n", argv[0]);
+	close(fds[0]);
+
+	kill(pid, SIGTERM);
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+	return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	unsigned runs = 10;
+	unsigned budget_ms = 0;
+	unsigned budget_kb = 0;
+	bool cold = false;
+
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "--runs") && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--budget-ms") && i + 1 < argc)
+			budget_ms = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--budget-kb") && i + 1 < argc)
+			budget_kb = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--drop-caches"))
+			cold = true;
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (i >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	struct stat st;
+	if (stat(argv[i], &st) < 0) {
+		fprintf(stderr, "startup-bench: %s: %s\n", argv[i], strerror(errno));
+		return 2;
+	}
+
+	std::string ready_arg = "--ready-fd=" + std::to_string(kReadyFd);
+	std::vector<char *> child_argv(argv + i, argv + argc);
+	child_argv.push_back(&ready_arg[0]);
+	child_argv.push_back(nullptr);
+
+	std::vector<uint64_t> samples;
+	for (unsigned n = 0; n < runs; n++) {
+		if (cold)
+			drop_caches();
+		uint64_t us = run_once(child_argv.data());
+		if (!us)
+			return 2;
+		samples.push_back(us);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	double min_ms = samples.front() / 1000.0;
+	double median_ms = samples[samples.size() / 2] / 1000.0;
+	double max_ms = samples.back() / 1000.0;
+	unsigned size_kb = (unsigned)((st.st_size + 1023) / 1024);
+	bool time_ok = !budget_ms || median_ms <= budget_ms;
+	bool size_ok = !budget_kb || size_kb <= budget_kb;
+
+	printf("{\"binary\":\"%s\",\"size_bytes\":%lld,\"runs\":%u,\"cold\":%s,"
+	       "\"first_frame_ms\":{\"min\":%.2f,\"median\":%.2f,\"max\":%.2f},"
+	       "\"budget_ms\":%u,\"budget_kb\":%u,\"pass\":%s}\n",
+	       argv[i], (long long)st.st_size, runs, cold ? "true" : "false", min_ms, median_ms, max_ms,
+	       budget_ms, budget_kb, time_ok && size_ok ? "true" : "false");
+
+	if (!time_ok)
+		fprintf(stderr, "startup-bench: median %.2f ms exceeds budget of %u ms\n", median_ms, budget_ms);
+	if (!size_ok)
+		fprintf(stderr, "startup-bench: %u KiB exceeds budget of %u KiB\n", size_kb, budget_kb);
+	return time_ok && size_ok ? 0 : 1;
+}
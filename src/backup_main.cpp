@@ -0,0 +1,163 @@
+// recovery-backup: saves a partition before a risky update.
+//
+// The archive is an .img.zst that the UI finds and restores like any other
+// image, with an index that lets the restore verify it in parallel (see
+// flash/backup_index.h).
+
+#include "common/event_loop.h"
+#include "common/log.h"
+#include "flash/backup.h"
+#include "platform/platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+using namespace recovery;
+
+namespace {
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] PARTITION OUTPUT\n"
+		"PARTITION is a device or file, or a partition of this box by name.\n"
+		"OUTPUT is a file, usually NAME.img.zst on USB storage, or \"-\" to stream\n"
+		"the archive to stdout, e.g. into ssh or nc.\n"
+		"  -l, --level N     zstd level (default 3)\n"
+		"  -j, --threads N   compressor threads (default one per CPU)\n"
+		"  -c, --chunk KB    chunk size (default 1024)\n"
+		"  -v, --verbose     enable debug logging\n",
+		argv0);
+	if (platform::Machine::kPartitions.empty())
+		return;
+	fprintf(stderr, "Partitions of %s:\n", platform::Machine::kName);
+	for (const platform::Partition &p : platform::Machine::kPartitions)
+		fprintf(stderr, "  %-12s %s\n", p.name, p.device);
+}
+
+double mib_per_s(uint64_t bytes, uint64_t us)
+{
+	return us ? bytes / 1048576.0 / (us / 1e6) : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "level", required_argument, nullptr, 'l' },
+		{ "threads", required_argument, nullptr, 'j' },
+		{ "chunk", required_argument, nullptr, 'c' },
+		{ "verbose", no_argument, nullptr, 'v' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	BackupOptions options;
+	int c;
+	while ((c = getopt_long(argc, argv, "l:j:c:vh", long_options, nullptr)) != -1) {
+		switch (c) {
+		case 'l':
+			options.level = atoi(optarg);
+			break;
+		case 'j':
+			options.threads = (unsigned)atoi(optarg);
+			break;
+		case 'c':
+			options.chunk_size = (uint32_t)atoi(optarg) * 1024;
+			break;
+		case 'v':
+			log_set_level(LogLevel::Debug);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || !options.chunk_size) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *partition = argv[optind];
+	if (const platform::Partition *p = platform::find_partition(partition))
+		partition = p->device;
+	const char *output = argv[optind + 1];
+
+	FileSource source;
+	if (source.open(partition) < 0)
+		return EXIT_FAILURE;
+
+	// A file is written under a temporary name and only renamed into place
+	// once complete, so a half-written backup is never offered for restore.
+	bool to_stdout = !strcmp(output, "-");
+	std::string partial = std::string(output) + ".part";
+	UniqueFd out(to_stdout ? dup(STDOUT_FILENO)
+			       : open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+	if (!out) {
+		log_error("backup: cannot open %s: %s", to_stdout ? "stdout" : partial.c_str(), strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	EventLoop loop;
+	if (!loop.valid())
+		return EXIT_FAILURE;
+	BackupWriter writer(source, out.get(), options);
+	loop.add_signal(SIGTERM, [&writer] { writer.cancel(); });
+	loop.add_signal(SIGINT, [&writer] { writer.cancel(); });
+	// Without this a vanished ssh or nc would kill us before cleanup.
+	signal(SIGPIPE, SIG_IGN);
+
+	int64_t size = source.size();
+	unsigned last_percent = 0;
+	loop.add_timer(1000, true, [&] {
+		uint64_t done = writer.bytes_read();
+		if (size <= 0) {
+			log_info("backup: %llu MiB", (unsigned long long)(done >> 20));
+			return;
+		}
+		unsigned percent = (unsigned)(done * 100 / (uint64_t)size);
+		if (percent / 10 != last_percent / 10)
+			log_info("backup: %u%% (%llu of %llu MiB)", percent, (unsigned long long)(done >> 20),
+				 (unsigned long long)((uint64_t)size >> 20));
+		last_percent = percent;
+	});
+
+	int result = 0;
+	Notifier finished;
+	finished.attach(loop, [&loop] { loop.quit(); });
+	std::thread runner([&] {
+		result = writer.run();
+		finished.notify();
+	});
+	loop.run();
+	runner.join();
+	out.reset();
+
+	if (result < 0) {
+		if (!to_stdout)
+			unlink(partial.c_str());
+		return EXIT_FAILURE;
+	}
+	if (!to_stdout && rename(partial.c_str(), output) < 0) {
+		log_error("backup: cannot rename %s: %s", partial.c_str(), strerror(errno));
+		unlink(partial.c_str());
+		return EXIT_FAILURE;
+	}
+
+	const BackupStats &stats = writer.stats();
+	log_info("backup: %llu MiB in %.1f s (%.1f MiB/s), %.1f%% of the original, %u threads",
+		 (unsigned long long)(stats.bytes_in >> 20), stats.elapsed_us / 1e6,
+		 mib_per_s(stats.bytes_in, stats.elapsed_us),
+		 stats.bytes_in ? 100.0 * stats.bytes_out / stats.bytes_in : 0.0, writer.threads());
+	log_debug("backup: reader blocked %.1f s, writer starved %.1f s", stats.read_blocked_us / 1e6,
+		  stats.write_starved_us / 1e6);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+#include "common/arena.h"
+
+#include "common/log.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+size_t page_round(size_t size)
+{
+	static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return (size + page - 1) & ~(page - 1);
+}
+
+} // namespace
+
+Arena::Arena(size_t block_size) : m_block_size(page_round(block_size ? block_size : 1))
+{
+}
+
+Arena::~Arena()
+{
+	reset();
+	if (m_blocks) {
+		m_reserved -= m_blocks->size;
+		munmap(m_blocks, m_blocks->size);
+	}
+}
+
+void *Arena::alloc(size_t size, size_t align)
+{
+	uintptr_t cur = ((uintptr_t)m_cur + align - 1) & ~(uintptr_t)(align - 1);
+	if (!m_cur || cur > (uintptr_t)m_end || size > (uintptr_t)m_end - cur) {
+		if (!grow(size, align))
+			return nullptr;
+		cur = ((uintptr_t)m_cur + align - 1) & ~(uintptr_t)(align - 1);
+	}
+
+	m_used += cur + size - (uintptr_t)m_cur;
+	if (m_used > m_high_water)
+		m_high_water = m_used;
+	m_cur = (uint8_t *)(cur + size);
+	return (void *)cur;
+}
+
+// Maps a block big enough for |size| bytes at |align|: the usual block
+// size, or the request rounded up to pages if it is larger.
+bool Arena::grow(size_t size, size_t align)
+{
+	if (size > SIZE_MAX - kHeader - align - 4096)
+		return false;
+	size_t bytes = m_block_size;
+	if (kHeader + align + size > bytes)
+		bytes = page_round(kHeader + align + size);
+
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		log_error("arena: cannot map %zu KiB", bytes / 1024);
+		return false;
+	}
+
+	Block *block = (Block *)p;
+	block->size = bytes;
+	block->next = m_blocks;
+	if (m_blocks)
+		m_overflows++;
+	m_blocks = block;
+	m_reserved += bytes;
+	m_cur = (uint8_t *)p + kHeader;
+	m_end = (uint8_t *)p + bytes;
+	return true;
+}
+
+bool Arena::on_reset(void (*fn)(void *), void *obj)
+{
+	Cleanup *cleanup = (Cleanup *)alloc(sizeof(Cleanup), alignof(Cleanup));
+	if (!cleanup)
+		return false;
+	cleanup->fn = fn;
+	cleanup->obj = obj;
+	cleanup->next = m_cleanups;
+	m_cleanups = cleanup;
+	return true;
+}
+
+char *Arena::strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy = (char *)alloc(len, 1);
+	if (copy)
+		memcpy(copy, s, len);
+	return copy;
+}
+
+void Arena::reset()
+{
+	// Newest first, so objects may still use what they were built from.
+	for (Cleanup *c = m_cleanups; c; c = c->next)
+		c->fn(c->obj);
+	m_cleanups = nullptr;
+
+	if (!m_blocks)
+		return;
+	// Keep the first block mapped for whoever builds next.
+	while (m_blocks->next) {
+		Block *next = m_blocks->next;
+		m_reserved -= m_blocks->size;
+		munmap(m_blocks, m_blocks->size);
+		m_blocks = next;
+	}
+	m_cur = (uint8_t *)m_blocks + kHeader;
+	m_end = (uint8_t *)m_blocks + m_blocks->size;
+	m_used = 0;
+}
+
+} // namespace recovery
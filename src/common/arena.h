@@ -0,0 +1,135 @@
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+namespace recovery {
+
+// Bump allocator for state that dies all at once, such as the widget tree
+// of one screen. Memory comes from the kernel in whole-page blocks, never
+// from the heap, so building and dropping screens cannot fragment it.
+//
+// reset() runs the destructors of objects created with make() in reverse
+// order and returns every block except the first, which is kept for the
+// next screen. Not thread-safe.
+class Arena {
+public:
+	explicit Arena(size_t block_size = 64 * 1024);
+	~Arena();
+
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	// |size| bytes aligned to |align| (a power of two), or nullptr if out of
+	// memory. Never freed individually.
+	void *alloc(size_t size, size_t align = alignof(max_align_t));
+
+	template <typename T, typename... Args>
+	T *make(Args &&...args)
+	{
+		void *p = alloc(sizeof(T), alignof(T));
+		if (!p)
+			return nullptr;
+		T *obj = new (p) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value && !on_reset([](void *o) { ((T *)o)->~T(); }, obj)) {
+			obj->~T();
+			return nullptr;
+		}
+		return obj;
+	}
+
+	// Uninitialized array; T must be trivially destructible.
+	template <typename T>
+	T *make_array(size_t n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+		if (n > SIZE_MAX / sizeof(T))
+			return nullptr;
+		return (T *)alloc(n * sizeof(T), alignof(T));
+	}
+
+	char *strdup(const char *s);
+
+	// Drops everything allocated since construction or the last reset().
+	void reset();
+
+	// Bytes handed out since the last reset() and the most ever, including
+	// alignment padding.
+	size_t used() const { return m_used; }
+	size_t high_water() const { return m_high_water; }
+	// Bytes currently mapped for blocks.
+	size_t reserved() const { return m_reserved; }
+	// Blocks mapped beyond the first since construction; a screen that
+	// keeps growing the arena wants a bigger block_size.
+	unsigned overflows() const { return m_overflows; }
+
+private:
+	struct Block {
+		Block *next;
+		size_t size;
+	};
+	struct Cleanup {
+		void (*fn)(void *);
+		void *obj;
+		Cleanup *next;
+	};
+	// Block header, padded so the first allocation is maximally aligned.
+	static constexpr size_t kHeader = (sizeof(Block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	bool grow(size_t size, size_t align);
+	bool on_reset(void (*fn)(void *), void *obj);
+
+	size_t m_block_size;
+	Block *m_blocks = nullptr;
+	uint8_t *m_cur = nullptr;
+	uint8_t *m_end = nullptr;
+	Cleanup *m_cleanups = nullptr;
+	size_t m_used = 0;
+	size_t m_high_water = 0;
+	size_t m_reserved = 0;
+	unsigned m_overflows = 0;
+};
+
+// Adapter so standard containers can live in an arena. Deallocation is a
+// no-op; reserve() up front where the final size is known.
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(Arena &arena) : m_arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena())
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		T *p = n <= SIZE_MAX / sizeof(T) ? (T *)m_arena->alloc(n * sizeof(T), alignof(T)) : nullptr;
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+	void deallocate(T *, size_t) {}
+
+	Arena *arena() const { return m_arena; }
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U> &other) const
+	{
+		return m_arena == other.arena();
+	}
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U> &other) const
+	{
+		return m_arena != other.arena();
+	}
+
+private:
+	Arena *m_arena;
+};
+
+} // namespace recovery
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace recovery {
+
+// Fixed-capacity blocking FIFO used to hand work between threads.
+//
+// push() blocks while the ring is full, which is what bounds the memory a
+// fast producer can pin ahead of a slow consumer. close() lets consumers
+// drain what is queued and then see end-of-stream; abort() wakes everyone
+// immediately and makes every further call fail.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : m_slots(capacity ? capacity : 1) {}
+
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+	size_t capacity() const { return m_slots.size(); }
+
+	// Returns false if the queue was closed or aborted.
+	bool push(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_not_full.wait(lock, [this] { return m_count < m_slots.size() || m_closed || m_aborted; });
+		if (m_closed || m_aborted)
+			return false;
+		m_slots[(m_head + m_count) % m_slots.size()] = std::move(value);
+		m_count++;
+		lock.unlock();
+		m_not_empty.notify_one();
+		return true;
+	}
+
+	// Non-blocking push; false if full, closed or aborted.
+	bool try_push(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_count == m_slots.size() || m_closed || m_aborted)
+			return false;
+		m_slots[(m_head + m_count) % m_slots.size()] = std::move(value);
+		m_count++;
+		lock.unlock();
+		m_not_empty.notify_one();
+		return true;
+	}
+
+	// Blocks until an item is available. Returns false once the queue is
+	// closed and drained, or aborted.
+	bool pop(T &out)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_not_empty.wait(lock, [this] { return m_count || m_closed || m_aborted; });
+		if (m_aborted || !m_count)
+			return false;
+		take(out);
+		lock.unlock();
+		m_not_full.notify_one();
+		return true;
+	}
+
+	bool try_pop(T &out)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_aborted || !m_count)
+			return false;
+		take(out);
+		lock.unlock();
+		m_not_full.notify_one();
+		return true;
+	}
+
+	// No more pushes; consumers drain the remaining items.
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_not_empty.notify_all();
+		m_not_full.notify_all();
+	}
+
+	void abort()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_aborted = true;
+		m_not_empty.notify_all();
+		m_not_full.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_count;
+	}
+
+private:
+	void take(T &out)
+	{
+		out = std::move(m_slots[m_head]);
+		m_head = (m_head + 1) % m_slots.size();
+		m_count--;
+	}
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_not_empty;
+	std::condition_variable m_not_full;
+	std::vector<T> m_slots;
+	size_t m_head = 0;
+	size_t m_count = 0;
+	bool m_closed = false;
+	bool m_aborted = false;
+};
+
+} // namespace recovery
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+namespace recovery {
+
+// Monotonic time in microseconds; the only clock the UI and workers compare.
+static inline uint64_t monotonic_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+} // namespace recovery
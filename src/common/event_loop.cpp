@@ -0,0 +1,195 @@
+#include "common/event_loop.h"
+
+#include "common/log.h"
+#include "common/trace.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace recovery {
+
+EventLoop::EventLoop() : m_epoll(epoll_create1(EPOLL_CLOEXEC))
+{
+	if (!m_epoll)
+		log_error("event loop: epoll_create1: %s", strerror(errno));
+}
+
+EventLoop::~EventLoop() = default;
+
+int EventLoop::add_source(int fd, uint32_t events, FdCallback callback, UniqueFd owned)
+{
+	struct epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	m_sources[fd] = std::make_shared<Source>(Source{ fd, std::move(callback), std::move(owned) });
+	return 0;
+}
+
+int EventLoop::add_fd(int fd, uint32_t events, FdCallback callback)
+{
+	return add_source(fd, events, std::move(callback), UniqueFd());
+}
+
+int EventLoop::modify_fd(int fd, uint32_t events)
+{
+	struct epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+	return epoll_ctl(m_epoll.get(), EPOLL_CTL_MOD, fd, &ev) < 0 ? -errno : 0;
+}
+
+void EventLoop::remove_fd(int fd)
+{
+	auto it = m_sources.find(fd);
+	if (it == m_sources.end())
+		return;
+	epoll_ctl(m_epoll.get(), EPOLL_CTL_DEL, fd, nullptr);
+	m_sources.erase(it);
+}
+
+int EventLoop::add_timer(unsigned interval_ms, bool repeat, Callback callback)
+{
+	UniqueFd tfd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+	if (!tfd)
+		return -errno;
+
+	struct itimerspec spec = {};
+	spec.it_value.tv_sec = interval_ms / 1000;
+	spec.it_value.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+	if (!interval_ms)
+		spec.it_value.tv_nsec = 1; // zero would disarm it
+	if (repeat)
+		spec.it_interval = spec.it_value;
+	if (timerfd_settime(tfd.get(), 0, &spec, nullptr) < 0)
+		return -errno;
+
+	int id = tfd.get();
+	auto fire = [this, id, repeat, callback = std::move(callback)](uint32_t) {
+		uint64_t expirations;
+		if (read(id, &expirations, sizeof(expirations)) != sizeof(expirations))
+			return;
+		// run_once() holds a reference, so removing ourselves is safe.
+		if (!repeat)
+			cancel_timer(id);
+		callback();
+	};
+	int ret = add_source(id, EPOLLIN, std::move(fire), std::move(tfd));
+	return ret < 0 ? ret : id;
+}
+
+void EventLoop::cancel_timer(int id)
+{
+	remove_fd(id);
+}
+
+int EventLoop::add_signal(int signo, Callback callback)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	for (auto &sig : m_signals)
+		sigaddset(&mask, sig.first);
+	sigaddset(&mask, signo);
+	if (sigprocmask(SIG_BLOCK, &mask, nullptr) < 0)
+		return -errno;
+
+	if (!m_signal_fd) {
+		m_signal_fd.reset(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+		if (!m_signal_fd)
+			return -errno;
+		int ret = add_fd(m_signal_fd.get(), EPOLLIN, [this](uint32_t) {
+			struct signalfd_siginfo info;
+			while (read(m_signal_fd.get(), &info, sizeof(info)) == sizeof(info)) {
+				auto it = m_signals.find((int)info.ssi_signo);
+				if (it != m_signals.end())
+					it->second();
+			}
+		});
+		if (ret < 0)
+			return ret;
+	} else if (signalfd(m_signal_fd.get(), &mask, 0) < 0) {
+		return -errno;
+	}
+	m_signals[signo] = std::move(callback);
+	return 0;
+}
+
+int EventLoop::run_once(int timeout_ms)
+{
+	struct epoll_event events[16];
+	int n = epoll_wait(m_epoll.get(), events, 16, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (int i = 0; i < n; i++) {
+		auto it = m_sources.find(events[i].data.fd);
+		if (it == m_sources.end())
+			continue; // removed by an earlier callback of this batch
+		std::shared_ptr<Source> source = it->second;
+		TRACE_SCOPE("loop", "callback");
+		source->callback(events[i].events);
+	}
+	if (m_idle) {
+		TRACE_SCOPE("loop", "idle");
+		m_idle();
+	}
+	return 0;
+}
+
+int EventLoop::run()
+{
+	m_quit = false;
+	while (!m_quit) {
+		int ret = run_once(-1);
+		if (ret < 0) {
+			log_error("event loop: epoll_wait: %s", strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+Notifier::~Notifier()
+{
+	if (m_loop && m_fd)
+		m_loop->remove_fd(m_fd.get());
+}
+
+int Notifier::attach(EventLoop &loop, EventLoop::Callback callback)
+{
+	m_fd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	if (!m_fd)
+		return -errno;
+	int fd = m_fd.get();
+	int ret = loop.add_fd(fd, EPOLLIN, [fd, callback = std::move(callback)](uint32_t) {
+		uint64_t count;
+		if (read(fd, &count, sizeof(count)) == sizeof(count))
+			callback();
+	});
+	if (ret < 0) {
+		m_fd.reset();
+		return ret;
+	}
+	m_loop = &loop;
+	return 0;
+}
+
+void Notifier::notify()
+{
+	if (!m_fd)
+		return;
+	// Fails only with EAGAIN once the counter saturates, when a wakeup is
+	// pending anyway.
+	uint64_t one = 1;
+	ssize_t ret = write(m_fd.get(), &one, sizeof(one));
+	(void)ret;
+}
+
+} // namespace recovery
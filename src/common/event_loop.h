@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common/unique_fd.h"
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace recovery {
+
+// Single-threaded epoll loop that everything the UI waits on goes through:
+// input devices, timers, signals and notifications from worker threads.
+// The thread sleeps in epoll_wait() until one of them fires, so input is
+// handled the moment it arrives and an idle UI uses no CPU.
+//
+// Callbacks run on the loop thread. Any of them may add or remove sources,
+// including their own. After each batch of callbacks the idle hook runs;
+// that is where the UI repaints whatever the batch invalidated.
+class EventLoop {
+public:
+	// Receives the epoll events (EPOLLIN, EPOLLHUP, ...) that fired.
+	using FdCallback = std::function<void(uint32_t events)>;
+	using Callback = std::function<void()>;
+
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop &) = delete;
+	EventLoop &operator=(const EventLoop &) = delete;
+
+	bool valid() const { return m_epoll.valid(); }
+
+	// Watches |fd|, which stays owned by the caller. Returns 0 or -errno.
+	int add_fd(int fd, uint32_t events, FdCallback callback);
+	// Changes the events |fd| is watched for. Returns 0 or -errno.
+	int modify_fd(int fd, uint32_t events);
+	void remove_fd(int fd);
+
+	// Calls |callback| after |interval_ms|, then every |interval_ms| if
+	// |repeat|. Returns a timer id (> 0) or -errno.
+	int add_timer(unsigned interval_ms, bool repeat, Callback callback);
+	void cancel_timer(int id);
+
+	// Runs |callback| when |signo| is delivered; the signal is blocked for
+	// the whole process so it only arrives here. Call before starting
+	// threads so they inherit the mask. Returns 0 or -errno.
+	int add_signal(int signo, Callback callback);
+
+	void set_idle(Callback callback) { m_idle = std::move(callback); }
+
+	// Dispatches until quit(). Returns 0, or -errno if epoll fails.
+	int run();
+	// Dispatches one batch, waiting at most |timeout_ms| (-1: forever).
+	int run_once(int timeout_ms);
+	void quit() { m_quit = true; }
+
+private:
+	struct Source {
+		int fd;
+		FdCallback callback;
+		UniqueFd owned;
+	};
+
+	int add_source(int fd, uint32_t events, FdCallback callback, UniqueFd owned);
+
+	UniqueFd m_epoll;
+	std::unordered_map<int, std::shared_ptr<Source>> m_sources;
+	UniqueFd m_signal_fd;
+	std::unordered_map<int, Callback> m_signals;
+	Callback m_idle;
+	bool m_quit = false;
+};
+
+// Wakes an EventLoop from any thread. Notifications coalesce: however
+// often notify() is called between two loop iterations, the callback runs
+// once, so a producer can signal every chunk and the UI still redraws at
+// its own pace. The state to look at is published by the producer itself
+// (e.g. in atomics), not carried by the notification.
+class Notifier {
+public:
+	Notifier() = default;
+	~Notifier();
+
+	Notifier(const Notifier &) = delete;
+	Notifier &operator=(const Notifier &) = delete;
+
+	// Registers with |loop|; |callback| runs on the loop thread. Returns 0
+	// or -errno.
+	int attach(EventLoop &loop, EventLoop::Callback callback);
+
+	// Thread- and async-signal-safe.
+	void notify();
+
+private:
+	EventLoop *m_loop = nullptr;
+	UniqueFd m_fd;
+};
+
+} // namespace recovery
@@ -0,0 +1,50 @@
+#include "common/log.h"
+
+#include "common/clock.h"
+#include "common/log_store.h"
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace recovery {
+
+static LogLevel s_level = LogLevel::Info;
+static LogStore *s_store = nullptr;
+
+void log_set_level(LogLevel level)
+{
+	s_level = level;
+}
+
+void log_set_store(LogStore *store)
+{
+	s_store = store;
+}
+
+void log_message(LogLevel level, const char *fmt, ...)
+{
+	static const char *const prefix[] = { "D", "I", "W", "E" };
+
+	if (level < s_level)
+		return;
+
+	char line[512];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	fprintf(stderr, "recovery-ui[%s] %s\n", prefix[(int)level], line);
+
+	if (s_store) {
+		// The level letter is at a fixed column for the viewer to colour by.
+		uint64_t ms = monotonic_us() / 1000;
+		char entry[sizeof(line) + 32];
+		int n = snprintf(entry, sizeof(entry), "[%6llu.%03llu] %s %s", (unsigned long long)(ms / 1000),
+				 (unsigned long long)(ms % 1000), prefix[(int)level], line);
+		s_store->append(entry, std::min((size_t)n, sizeof(entry) - 1));
+	}
+}
+
+} // namespace recovery
@@ -0,0 +1,25 @@
+#pragma once
+
+namespace recovery {
+
+class LogStore;
+
+enum class LogLevel {
+	Debug,
+	Info,
+	Warning,
+	Error,
+};
+
+void log_set_level(LogLevel level);
+// Messages also go to |store| (null to stop), for the log viewer. Set it
+// before starting threads that log.
+void log_set_store(LogStore *store);
+void log_message(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+} // namespace recovery
+
+#define log_debug(...) ::recovery::log_message(::recovery::LogLevel::Debug, __VA_ARGS__)
+#define log_info(...) ::recovery::log_message(::recovery::LogLevel::Info, __VA_ARGS__)
+#define log_warning(...) ::recovery::log_message(::recovery::LogLevel::Warning, __VA_ARGS__)
+#define log_error(...) ::recovery::log_message(::recovery::LogLevel::Error, __VA_ARGS__)
@@ -0,0 +1,215 @@
+#include "common/log_store.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+const char kIndexMagic[4] = { 'R', 'U', 'L', 'I' };
+// Longest line kept; the rest is cut off.
+const size_t kMaxLine = 1024;
+// Mappings grow by at least this much.
+const size_t kMapStep = 1 << 20;
+
+} // namespace
+
+int LogStore::open(const char *path)
+{
+	std::string index_path = std::string(path) + ".idx";
+	const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC;
+	UniqueFd log(::open(path, flags, 0644));
+	if (!log)
+		return -errno;
+	UniqueFd index(::open(index_path.c_str(), flags, 0644));
+	if (!index)
+		return -errno;
+	LogIndexHeader header;
+	memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+	header.stride = kLogIndexStride;
+	if (write(index.get(), &header, sizeof(header)) != (ssize_t)sizeof(header))
+		return errno ? -errno : -EIO;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_log = std::move(log);
+	m_index = std::move(index);
+	m_size = 0;
+	m_lines = 0;
+	return 0;
+}
+
+void LogStore::append(const char *text, size_t len)
+{
+	char line[kMaxLine + 1];
+	len = std::min(len, kMaxLine);
+	for (size_t i = 0; i < len; i++)
+		line[i] = text[i] == '\n' ? ' ' : text[i];
+	line[len++] = '\n';
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_log)
+		return;
+	// The line goes first, so a reader never sees an index entry past the
+	// end of the text.
+	if (write(m_log.get(), line, len) != (ssize_t)len) {
+		m_log.reset();
+		return;
+	}
+	if (m_lines % kLogIndexStride == 0 && write(m_index.get(), &m_size, sizeof(m_size)) != sizeof(m_size)) {
+		m_log.reset();
+		return;
+	}
+	m_size += len;
+	m_lines++;
+}
+
+LogView::~LogView()
+{
+	close();
+}
+
+int LogView::open(const char *path)
+{
+	close();
+	m_log.reset(::open(path, O_RDONLY | O_CLOEXEC));
+	if (!m_log)
+		return -errno;
+	// Without an index the log is still shown, only found by scanning.
+	std::string index_path = std::string(path) + ".idx";
+	m_index.reset(::open(index_path.c_str(), O_RDONLY | O_CLOEXEC));
+	LogIndexHeader header;
+	if (m_index && (pread(m_index.get(), &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+			memcmp(header.magic, kIndexMagic, sizeof(header.magic)) || !header.stride))
+		m_index.reset();
+	if (m_index)
+		m_stride = header.stride;
+	refresh();
+	return 0;
+}
+
+void LogView::close()
+{
+	if (m_data)
+		munmap((void *)m_data, m_data_len);
+	if (m_index_data)
+		munmap((void *)m_index_data, m_index_len);
+	m_data = m_index_data = nullptr;
+	m_data_len = m_index_len = 0;
+	m_log.reset();
+	m_index.reset();
+	m_end = 0;
+	m_entries = 0;
+	m_lines = 0;
+}
+
+bool LogView::map(int fd, uint64_t size, const uint8_t **map, size_t *map_len)
+{
+	if (size <= *map_len)
+		return true;
+	// Beyond the end of the file the mapping is never touched; it is only
+	// there so the file can grow into it.
+	size_t len = (size_t)(size + size / 2 + kMapStep - 1) / kMapStep * kMapStep;
+	void *p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return false;
+	if (*map)
+		munmap((void *)*map, *map_len);
+	*map = (const uint8_t *)p;
+	*map_len = len;
+	return true;
+}
+
+bool LogView::refresh()
+{
+	struct stat st;
+	if (!m_log || fstat(m_log.get(), &st) < 0)
+		return false;
+	uint64_t size = (uint64_t)st.st_size;
+	if (size < m_end) {
+		// Started afresh by a new LogStore.
+		m_end = 0;
+		m_entries = 0;
+		m_lines = 0;
+	}
+	if (size == m_end || !map(m_log.get(), size, &m_data, &m_data_len))
+		return false;
+	const uint8_t *last = (const uint8_t *)memrchr(m_data + m_end, '\n', (size_t)(size - m_end));
+	if (!last)
+		return false;
+	uint64_t end = (uint64_t)(last - m_data) + 1;
+
+	// Index entries only ever point at complete lines, but those may end
+	// after |end| if a writer got in between the two fstat() calls.
+	size_t entries = 0;
+	if (m_index && fstat(m_index.get(), &st) == 0 && (uint64_t)st.st_size > sizeof(LogIndexHeader) &&
+	    map(m_index.get(), (uint64_t)st.st_size, &m_index_data, &m_index_len)) {
+		entries = (size_t)(((uint64_t)st.st_size - sizeof(LogIndexHeader)) / sizeof(uint64_t));
+		while (entries > m_entries) {
+			uint64_t offset;
+			memcpy(&offset, m_index_data + sizeof(LogIndexHeader) + (entries - 1) * sizeof(offset),
+			       sizeof(offset));
+			if (offset < end)
+				break;
+			entries--;
+		}
+	}
+
+	// Lines are counted from the last index entry, or from where the last
+	// refresh stopped if that is further on.
+	size_t before = m_lines;
+	if (entries > m_entries) {
+		m_entries = entries;
+		uint64_t offset = line_offset((m_entries - 1) * (size_t)m_stride);
+		if (offset > m_end) {
+			m_end = offset;
+			m_lines = (m_entries - 1) * (size_t)m_stride;
+		}
+	}
+	const uint8_t *p = m_data + m_end;
+	const uint8_t *stop = m_data + end;
+	while (p < stop && (p = (const uint8_t *)memchr(p, '\n', (size_t)(stop - p)))) {
+		p++;
+		m_lines++;
+	}
+	m_end = end;
+	return m_lines != before;
+}
+
+uint64_t LogView::line_offset(size_t n) const
+{
+	size_t entry = std::min(n / m_stride, m_entries ? m_entries - 1 : 0);
+	uint64_t offset = 0;
+	if (m_entries)
+		memcpy(&offset, m_index_data + sizeof(LogIndexHeader) + entry * sizeof(offset), sizeof(offset));
+	size_t skip = m_entries ? n - entry * m_stride : n;
+	const uint8_t *p = m_data + offset;
+	const uint8_t *stop = m_data + m_end;
+	while (skip-- && p < stop) {
+		p = (const uint8_t *)memchr(p, '\n', (size_t)(stop - p));
+		if (!p)
+			return m_end;
+		p++;
+	}
+	return (uint64_t)(p - m_data);
+}
+
+bool LogView::line(size_t n, const char **text, size_t *len) const
+{
+	if (n >= m_lines)
+		return false;
+	uint64_t offset = line_offset(n);
+	const uint8_t *start = m_data + offset;
+	const uint8_t *nl = (const uint8_t *)memchr(start, '\n', (size_t)(m_end - offset));
+	*text = (const char *)start;
+	*len = nl ? (size_t)(nl - start) : (size_t)(m_end - offset);
+	return true;
+}
+
+} // namespace recovery
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common/unique_fd.h"
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+// On-disk log: PATH holds the lines as plain text, so it can be read with
+// anything; PATH.idx is a sparse index of them, a LogIndexHeader followed
+// by the byte offset of every kLogIndexStride-th line (lines 0, stride,
+// 2 * stride, ...) as little-endian u64. Both files are only appended to.
+const uint32_t kLogIndexStride = 64;
+
+struct LogIndexHeader {
+	char magic[4]; // "RULI"
+	uint32_t stride;
+};
+static_assert(sizeof(LogIndexHeader) == 8, "log index header layout");
+
+// Appends lines to a log file and its index. Safe to call from any thread;
+// writers only ever wait for each other, never for a reader, since readers
+// (LogView) map the files and take no lock.
+class LogStore {
+public:
+	LogStore() = default;
+
+	LogStore(const LogStore &) = delete;
+	LogStore &operator=(const LogStore &) = delete;
+
+	// Starts both files afresh. Returns 0 or a negative errno.
+	int open(const char *path);
+	bool is_open() const { return m_log.valid(); }
+
+	// Adds |text| as one line; newlines in it are replaced by spaces. After
+	// a write error the store stops recording rather than fail callers.
+	void append(const char *text, size_t len);
+
+private:
+	std::mutex m_mutex;
+	UniqueFd m_log;
+	UniqueFd m_index;
+	uint64_t m_size = 0;
+	uint64_t m_lines = 0;
+};
+
+// Read-only view of a LogStore's files, for the UI. Nothing is copied: the
+// log is mapped and a line is found from the nearest index entry, so a
+// screenful costs the same at line 10 as at line 100000. refresh() picks
+// up what writers have appended since.
+class LogView {
+public:
+	LogView() = default;
+	~LogView();
+
+	LogView(const LogView &) = delete;
+	LogView &operator=(const LogView &) = delete;
+
+	// Returns 0 or a negative errno.
+	int open(const char *path);
+	void close();
+
+	// True if lines were added.
+	bool refresh();
+	size_t line_count() const { return m_lines; }
+	// Line |n| without its newline, valid until the next refresh() or
+	// close(). False if there is no such line.
+	bool line(size_t n, const char **text, size_t *len) const;
+
+private:
+	// Maps |fd| up to at least |size| bytes into |*map|, growing it in
+	// steps so appends rarely need a new mapping.
+	static bool map(int fd, uint64_t size, const uint8_t **map, size_t *map_len);
+	// Offset of line |n| from the index entry at or before it.
+	uint64_t line_offset(size_t n) const;
+
+	UniqueFd m_log;
+	UniqueFd m_index;
+	const uint8_t *m_data = nullptr;
+	size_t m_data_len = 0;
+	const uint8_t *m_index_data = nullptr;
+	size_t m_index_len = 0;
+	uint32_t m_stride = kLogIndexStride;
+	// Readable part of the log: up to its last complete line.
+	uint64_t m_end = 0;
+	size_t m_entries = 0;
+	size_t m_lines = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,33 @@
+#include "common/meminfo.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace recovery {
+
+uint64_t mem_available_bytes()
+{
+	FILE *f = fopen("/proc/meminfo", "re");
+	if (!f)
+		return 0;
+	unsigned long long available = 0, free_kb = 0, cached = 0, value;
+	bool has_available = false;
+	char key[64], line[128];
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63[^:]: %llu", key, &value) != 2)
+			continue;
+		if (!strcmp(key, "MemAvailable")) {
+			available = value;
+			has_available = true;
+			break;
+		}
+		if (!strcmp(key, "MemFree"))
+			free_kb = value;
+		else if (!strcmp(key, "Cached"))
+			cached = value;
+	}
+	fclose(f);
+	return (has_available ? available : free_kb + cached) * 1024;
+}
+
+} // namespace recovery
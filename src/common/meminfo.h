@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace recovery {
+
+// Memory the kernel reckons can be allocated without swapping, from
+// /proc/meminfo: MemAvailable, or MemFree + Cached on kernels before 3.14.
+// Returns 0 if it cannot be read.
+uint64_t mem_available_bytes();
+
+} // namespace recovery
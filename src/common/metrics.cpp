@@ -0,0 +1,247 @@
+#include "common/metrics.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace recovery {
+
+namespace {
+
+enum class MetricType { Counter, Gauge, Histogram };
+
+struct MetricDesc {
+	MetricType type;
+	const char *name;
+	const char *labels;
+	const char *help;
+	double scale;
+	unsigned slot;
+	// Histograms: their bounds; gauges: the value.
+	unsigned bounds;
+	const uint32_t *bound_us;
+	const Gauge *gauge;
+};
+
+// Written only by the thread holding it. The slot past the last is where
+// metrics that found no room count, unexported.
+struct alignas(64) MetricSlab {
+	std::atomic<uint64_t> slots[kMetricSlots + 1];
+	MetricSlab()
+	{
+		for (auto &slot : slots)
+			slot.store(0, std::memory_order_relaxed);
+	}
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::vector<MetricDesc> metrics;
+	unsigned next_slot = 0;
+	std::vector<std::unique_ptr<MetricSlab>> slabs;
+	std::vector<MetricSlab *> free_slabs;
+};
+
+Registry &registry()
+{
+	static Registry *r = new Registry(); // never destroyed: threads may count during exit
+	return *r;
+}
+
+// Metrics are defined at namespace scope, so this runs during static
+// initialisation, in no particular order across files.
+unsigned register_metric(MetricDesc desc, unsigned slots)
+{
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	if (r.next_slot + slots > kMetricSlots)
+		return kMetricSlots;
+	desc.slot = r.next_slot;
+	r.next_slot += slots;
+	r.metrics.push_back(desc);
+	return desc.slot;
+}
+
+struct ThreadSlab {
+	MetricSlab *slab = nullptr;
+
+	~ThreadSlab()
+	{
+		if (!slab)
+			return;
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.free_slabs.push_back(slab);
+	}
+};
+
+thread_local ThreadSlab t_slab;
+
+std::atomic<uint64_t> *thread_slots()
+{
+	if (!t_slab.slab) {
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (!r.free_slabs.empty()) {
+			t_slab.slab = r.free_slabs.back();
+			r.free_slabs.pop_back();
+		} else {
+			r.slabs.emplace_back(new MetricSlab());
+			t_slab.slab = r.slabs.back().get();
+		}
+	}
+	return t_slab.slab->slots;
+}
+
+// Only this thread writes its slab, so no read-modify-write is needed.
+inline void bump(std::atomic<uint64_t> &slot, uint64_t n)
+{
+	slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void append_sample(std::string &out, const char *name, const char *suffix, const char *labels, const char *extra,
+		   const char *value)
+{
+	out += name;
+	out += suffix;
+	if (*labels || *extra) {
+		out += '{';
+		out += labels;
+		if (*labels && *extra)
+			out += ',';
+		out += extra;
+		out += '}';
+	}
+	out += ' ';
+	out += value;
+	out += '\n';
+}
+
+const char *type_name(MetricType type)
+{
+	switch (type) {
+	case MetricType::Counter:
+		return "counter";
+	case MetricType::Gauge:
+		return "gauge";
+	default:
+		return "histogram";
+	}
+}
+
+} // namespace
+
+Counter::Counter(const char *name, const char *labels, const char *help, double scale)
+{
+	m_slot = register_metric(MetricDesc{ MetricType::Counter, name, labels, help, scale, 0, 0, nullptr, nullptr }, 1);
+}
+
+void Counter::add(uint64_t n)
+{
+	bump(thread_slots()[m_slot], n);
+}
+
+Gauge::Gauge(const char *name, const char *labels, const char *help)
+{
+	register_metric(MetricDesc{ MetricType::Gauge, name, labels, help, 1, 0, 0, nullptr, this }, 0);
+}
+
+Histogram::Histogram(const char *name, const char *labels, const char *help,
+		     std::initializer_list<uint32_t> bounds_us)
+	: m_bounds((unsigned)std::min<size_t>(bounds_us.size(), kMaxHistogramBounds))
+{
+	std::copy(bounds_us.begin(), bounds_us.begin() + m_bounds, m_bound_us);
+	// A slot per bucket, +Inf included, then the sum.
+	m_slot = register_metric(
+		MetricDesc{ MetricType::Histogram, name, labels, help, 1e-6, 0, m_bounds, m_bound_us, nullptr },
+		m_bounds + 2);
+}
+
+void Histogram::observe(uint64_t us)
+{
+	std::atomic<uint64_t> *slots = thread_slots();
+	if (m_slot == kMetricSlots) {
+		bump(slots[kMetricSlots], 1);
+		return;
+	}
+	unsigned bucket = 0;
+	while (bucket < m_bounds && us > m_bound_us[bucket])
+		bucket++;
+	bump(slots[m_slot + bucket], 1);
+	bump(slots[m_slot + m_bounds + 1], us);
+}
+
+std::string metrics_export_text()
+{
+	Registry &r = registry();
+	std::vector<MetricDesc> metrics;
+	std::vector<uint64_t> totals(kMetricSlots, 0);
+	{
+		std::lock_guard<std::mutex> lock(r.mutex);
+		metrics = r.metrics;
+		for (const auto &slab : r.slabs)
+			for (unsigned i = 0; i < r.next_slot; i++)
+				totals[i] += slab->slots[i].load(std::memory_order_relaxed);
+	}
+
+	std::string out;
+	char value[32], le[48];
+	std::vector<bool> done(metrics.size(), false);
+	for (size_t i = 0; i < metrics.size(); i++) {
+		if (done[i])
+			continue;
+		// One HELP and TYPE per family, then every labelled series of it.
+		const MetricDesc &family = metrics[i];
+		out += "# HELP ";
+		out += family.name;
+		out += ' ';
+		out += family.help;
+		out += "\n# TYPE ";
+		out += family.name;
+		out += ' ';
+		out += type_name(family.type);
+		out += '\n';
+		for (size_t j = i; j < metrics.size(); j++) {
+			const MetricDesc &m = metrics[j];
+			if (done[j] || strcmp(m.name, family.name))
+				continue;
+			done[j] = true;
+			switch (m.type) {
+			case MetricType::Counter:
+				if (m.scale == 1)
+					snprintf(value, sizeof(value), "%llu", (unsigned long long)totals[m.slot]);
+				else
+					snprintf(value, sizeof(value), "%.6f", totals[m.slot] * m.scale);
+				append_sample(out, m.name, "", m.labels, "", value);
+				break;
+			case MetricType::Gauge:
+				snprintf(value, sizeof(value), "%lld", (long long)m.gauge->value());
+				append_sample(out, m.name, "", m.labels, "", value);
+				break;
+			case MetricType::Histogram: {
+				uint64_t count = 0;
+				for (unsigned b = 0; b <= m.bounds; b++) {
+					count += totals[m.slot + b];
+					if (b < m.bounds)
+						snprintf(le, sizeof(le), "le=\"%g\"", m.bound_us[b] * m.scale);
+					else
+						snprintf(le, sizeof(le), "le=\"+Inf\"");
+					snprintf(value, sizeof(value), "%llu", (unsigned long long)count);
+					append_sample(out, m.name, "_bucket", m.labels, le, value);
+				}
+				snprintf(value, sizeof(value), "%.6f", totals[m.slot + m.bounds + 1] * m.scale);
+				append_sample(out, m.name, "_sum", m.labels, "", value);
+				snprintf(value, sizeof(value), "%llu", (unsigned long long)count);
+				append_sample(out, m.name, "_count", m.labels, "", value);
+				break;
+			}
+			}
+		}
+	}
+	return out;
+}
+
+} // namespace recovery
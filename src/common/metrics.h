@@ -0,0 +1,77 @@
+#pragma once
+
+// Always-on runtime metrics for the fleet dashboard, exported in the
+// Prometheus text format (see metrics_export_text()).
+//
+// Counters and histograms are kept per thread: each thread updates its own
+// slab of slots with a relaxed load and store, so an update takes no lock
+// and no locked instruction and never shares a cache line with another
+// thread. An export sums every slab. Slabs outlive their threads, like
+// trace rings, so totals survive the pipeline's threads coming and going.
+//
+// Metrics are defined once, at namespace scope, and live for the whole
+// program; names, labels and help must be string literals.
+
+#include <atomic>
+#include <initializer_list>
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// Slots all metrics together may use: one per counter, and a histogram's
+// buckets plus one.
+const unsigned kMetricSlots = 256;
+// Bucket bounds a histogram may have, +Inf not counted.
+const unsigned kMaxHistogramBounds = 16;
+
+// Monotonic count; |labels| is the inside of the braces, e.g.
+// "stage=\"read\"", or "" for none. Exported as the count times |scale|,
+// so microseconds can be counted and exported as seconds.
+class Counter {
+public:
+	Counter(const char *name, const char *labels, const char *help, double scale = 1);
+	Counter(const Counter &) = delete;
+	Counter &operator=(const Counter &) = delete;
+
+	void add(uint64_t n = 1);
+
+private:
+	unsigned m_slot;
+};
+
+// Last value set, from any thread.
+class Gauge {
+public:
+	Gauge(const char *name, const char *labels, const char *help);
+	Gauge(const Gauge &) = delete;
+	Gauge &operator=(const Gauge &) = delete;
+
+	void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+	int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t> m_value{ 0 };
+};
+
+// Distribution of durations, observed in microseconds and exported in
+// seconds. |bounds_us| are the buckets' upper bounds, ascending.
+class Histogram {
+public:
+	Histogram(const char *name, const char *labels, const char *help, std::initializer_list<uint32_t> bounds_us);
+	Histogram(const Histogram &) = delete;
+	Histogram &operator=(const Histogram &) = delete;
+
+	void observe(uint64_t us);
+
+private:
+	unsigned m_slot;
+	unsigned m_bounds;
+	uint32_t m_bound_us[kMaxHistogramBounds];
+};
+
+// Every metric with its current value, in the Prometheus text exposition
+// format (version 0.0.4). Safe from any thread.
+std::string metrics_export_text();
+
+} // namespace recovery
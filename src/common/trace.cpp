@@ -0,0 +1,237 @@
+#include "common/trace.h"
+
+#include "common/unique_fd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace recovery {
+
+namespace {
+
+struct TraceEvent {
+	const char *category;
+	const char *name;
+	uint64_t ts_us;
+	// Duration for spans, the value for counters.
+	int64_t arg;
+	uint32_t tid;
+	char phase; // Chrome's: X(complete), i(nstant) or C(ounter)
+};
+
+// Written only by the thread holding it. |head| counts events ever
+// written; it is published after each event so readers know what is
+// complete.
+struct TraceRing {
+	std::atomic<uint64_t> head{ 0 };
+	TraceEvent events[kTraceRingSize];
+};
+
+// Rings outlive their threads (pipeline workers come and go with every
+// flash) and are handed to the next thread that starts, so memory stays
+// bounded by the number of threads alive at once.
+struct Registry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<TraceRing>> rings;
+	std::vector<TraceRing *> free_rings;
+	std::unordered_map<uint32_t, std::string> thread_names;
+};
+
+Registry &registry()
+{
+	static Registry *r = new Registry(); // never destroyed: threads may trace during exit
+	return *r;
+}
+
+struct ThreadRing {
+	TraceRing *ring = nullptr;
+	uint32_t tid = 0;
+
+	~ThreadRing()
+	{
+		if (!ring)
+			return;
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.free_rings.push_back(ring);
+	}
+};
+
+thread_local ThreadRing t_ring;
+
+ThreadRing &thread_ring()
+{
+	if (!t_ring.ring) {
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (!r.free_rings.empty()) {
+			t_ring.ring = r.free_rings.back();
+			r.free_rings.pop_back();
+		} else {
+			r.rings.emplace_back(new TraceRing());
+			t_ring.ring = r.rings.back().get();
+		}
+		t_ring.tid = (uint32_t)syscall(SYS_gettid);
+	}
+	return t_ring;
+}
+
+void record(char phase, const char *category, const char *name, uint64_t ts_us, int64_t arg)
+{
+	ThreadRing &t = thread_ring();
+	uint64_t head = t.ring->head.load(std::memory_order_relaxed);
+	TraceEvent &e = t.ring->events[head % kTraceRingSize];
+	e.category = category;
+	e.name = name;
+	e.ts_us = ts_us;
+	e.arg = arg;
+	e.tid = t.tid;
+	e.phase = phase;
+	t.ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Copies the complete events of |ring| that its writer cannot be
+// overwriting right now.
+void snapshot(const TraceRing &ring, std::vector<TraceEvent> &out)
+{
+	uint64_t end = ring.head.load(std::memory_order_acquire);
+	uint64_t begin = end > kTraceRingSize ? end - kTraceRingSize : 0;
+	size_t first = out.size();
+	for (uint64_t i = begin; i < end; i++)
+		out.push_back(ring.events[i % kTraceRingSize]);
+	// Whatever the writer lapped while we copied is garbage; drop it.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t now = ring.head.load(std::memory_order_relaxed);
+	if (now + 1 > begin + kTraceRingSize) {
+		uint64_t lost = std::min<uint64_t>(now + 1 - kTraceRingSize - begin, end - begin);
+		out.erase(out.begin() + (ptrdiff_t)first, out.begin() + (ptrdiff_t)(first + lost));
+	}
+}
+
+void append_escaped(std::string &out, const char *s)
+{
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += (char)c;
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += (char)c;
+		}
+	}
+}
+
+} // namespace
+
+void trace_complete(const char *category, const char *name, uint64_t start_us, uint64_t end_us)
+{
+	record('X', category, name, start_us, (int64_t)(end_us - start_us));
+}
+
+void trace_instant(const char *category, const char *name)
+{
+	record('i', category, name, monotonic_us(), 0);
+}
+
+void trace_counter(const char *category, const char *name, int64_t value)
+{
+	record('C', category, name, monotonic_us(), value);
+}
+
+void trace_thread_name(const char *fmt, ...)
+{
+	char name[64];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+
+	ThreadRing &t = thread_ring();
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.thread_names[t.tid] = name;
+}
+
+std::string trace_export_json()
+{
+	std::vector<TraceEvent> events;
+	std::unordered_map<uint32_t, std::string> names;
+	{
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (const auto &ring : r.rings)
+			snapshot(*ring, events);
+		names = r.thread_names;
+	}
+
+	unsigned pid = (unsigned)getpid();
+	std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	char buf[128];
+	bool first = true;
+	for (const auto &entry : names) {
+		snprintf(buf, sizeof(buf), "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%u,\"tid\":%" PRIu32 ",",
+			 first ? "" : ",\n", pid, entry.first);
+		out += buf;
+		out += "\"args\":{\"name\":\"";
+		append_escaped(out, entry.second.c_str());
+		out += "\"}}";
+		first = false;
+	}
+	for (const TraceEvent &e : events) {
+		snprintf(buf, sizeof(buf), "%s{\"ph\":\"%c\",\"pid\":%u,\"tid\":%" PRIu32 ",\"ts\":%" PRIu64 ",",
+			 first ? "" : ",\n", e.phase, pid, e.tid, e.ts_us);
+		out += buf;
+		out += "\"cat\":\"";
+		append_escaped(out, e.category);
+		out += "\",\"name\":\"";
+		append_escaped(out, e.name);
+		out += '"';
+		if (e.phase == 'X')
+			snprintf(buf, sizeof(buf), ",\"dur\":%" PRId64 "}", e.arg);
+		else if (e.phase == 'C')
+			snprintf(buf, sizeof(buf), ",\"args\":{\"value\":%" PRId64 "}}", e.arg);
+		else
+			snprintf(buf, sizeof(buf), ",\"s\":\"t\"}");
+		out += buf;
+		first = false;
+	}
+	out += "]}\n";
+	return out;
+}
+
+int trace_dump_file(const char *path)
+{
+	std::string json = trace_export_json();
+	UniqueFd fd(::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+	if (!fd)
+		return -errno;
+	for (size_t done = 0; done < json.size();) {
+		ssize_t n = write(fd.get(), json.data() + done, json.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		done += (size_t)n;
+	}
+	// A stick pulled right after the dump should still have it.
+	if (fsync(fd.get()) < 0)
+		return -errno;
+	return 0;
+}
+
+} // namespace recovery
@@ -0,0 +1,84 @@
+#pragma once
+
+// Span tracing for finding out where a slow recovery spends its time.
+//
+// Built with WITH_TRACE=1, every thread records into its own fixed ring of
+// events; recording is a clock read and a few stores, with no lock and no
+// allocation. The newest events of all threads can be exported as Chrome
+// trace JSON (chrome://tracing, Perfetto) at any time. Without it the
+// macros below compile to nothing.
+//
+// Names and categories must be string literals: only the pointers are kept.
+
+#ifdef HAVE_TRACE
+
+#include "common/clock.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// Events kept per thread; older ones are overwritten.
+const size_t kTraceRingSize = 16384;
+
+void trace_complete(const char *category, const char *name, uint64_t start_us, uint64_t end_us);
+void trace_instant(const char *category, const char *name);
+void trace_counter(const char *category, const char *name, int64_t value);
+// Labels the calling thread in exports, printf style.
+void trace_thread_name(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Everything recorded so far as a Chrome trace JSON document.
+std::string trace_export_json();
+// Writes that document to |path| (e.g. on a USB stick). Returns 0 or -errno.
+int trace_dump_file(const char *path);
+
+// Records the enclosing scope as one span.
+class TraceScope {
+public:
+	TraceScope(const char *category, const char *name) : m_category(category), m_name(name), m_start(monotonic_us())
+	{
+	}
+	~TraceScope() { trace_complete(m_category, m_name, m_start, monotonic_us()); }
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+	const char *m_category;
+	const char *m_name;
+	uint64_t m_start;
+};
+
+} // namespace recovery
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(category, name) ::recovery::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+#define TRACE_INSTANT(category, name) ::recovery::trace_instant(category, name)
+#define TRACE_COUNTER(category, name, value) ::recovery::trace_counter(category, name, (int64_t)(value))
+#define TRACE_THREAD_NAME(...) ::recovery::trace_thread_name(__VA_ARGS__)
+
+#else
+
+#include <stdio.h>
+
+#define TRACE_SCOPE(category, name) \
+	do {                        \
+	} while (0)
+#define TRACE_INSTANT(category, name) \
+	do {                          \
+	} while (0)
+// Keeps |value| "used" without evaluating it.
+#define TRACE_COUNTER(category, name, value) \
+	do {                                 \
+		if (0)                       \
+			(void)(value);       \
+	} while (0)
+// Still type-checks the arguments, and keeps them "used".
+#define TRACE_THREAD_NAME(...)                               \
+	do {                                                 \
+		if (0)                                       \
+			::snprintf(nullptr, 0, __VA_ARGS__); \
+	} while (0)
+#endif
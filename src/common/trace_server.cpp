@@ -0,0 +1,88 @@
+#include "common/trace_server.h"
+
+#include "common/log.h"
+#include "common/trace.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+namespace recovery {
+
+TraceServer::~TraceServer()
+{
+	while (!m_clients.empty())
+		drop(m_clients.begin()->first);
+	if (m_listen)
+		m_loop.remove_fd(m_listen.get());
+}
+
+int TraceServer::listen(unsigned port)
+{
+	m_listen.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!m_listen)
+		return -errno;
+	int one = 1;
+	setsockopt(m_listen.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(m_listen.get(), (const struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(m_listen.get(), 4) < 0) {
+		int err = -errno;
+		log_error("trace: cannot listen on port %u: %s", port, strerror(-err));
+		m_listen.reset();
+		return err;
+	}
+	int ret = m_loop.add_fd(m_listen.get(), EPOLLIN, [this](uint32_t) { on_accept(); });
+	if (ret < 0) {
+		m_listen.reset();
+		return ret;
+	}
+	log_info("trace: serving on port %u", port);
+	return 0;
+}
+
+void TraceServer::on_accept()
+{
+	for (;;) {
+		int fd = accept4(m_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		std::unique_ptr<Client> client(new Client());
+		client->fd.reset(fd);
+		client->data = trace_export_json();
+		if (m_loop.add_fd(fd, EPOLLOUT, [this, fd](uint32_t) { on_writable(fd); }) < 0)
+			continue;
+		m_clients[fd] = std::move(client);
+	}
+}
+
+void TraceServer::on_writable(int fd)
+{
+	auto it = m_clients.find(fd);
+	if (it == m_clients.end())
+		return;
+	Client &client = *it->second;
+	while (client.sent < client.data.size()) {
+		ssize_t n = send(fd, client.data.data() + client.sent, client.data.size() - client.sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return;
+		if (n < 0)
+			break;
+		client.sent += (size_t)n;
+	}
+	drop(fd);
+}
+
+void TraceServer::drop(int fd)
+{
+	m_loop.remove_fd(fd);
+	m_clients.erase(fd);
+}
+
+} // namespace recovery
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace recovery {
+
+// Hands the current trace to anyone connecting to a TCP port, then
+// hangs up, so "nc box 7787 > trace.json" (or telnet with logging) pulls
+// one off a box in the field. Served from the EventLoop without blocking
+// it on a slow client.
+class TraceServer {
+public:
+	explicit TraceServer(EventLoop &loop) : m_loop(loop) {}
+	~TraceServer();
+
+	TraceServer(const TraceServer &) = delete;
+	TraceServer &operator=(const TraceServer &) = delete;
+
+	// Listens on |port| on all interfaces. Returns 0 or -errno.
+	int listen(unsigned port);
+
+private:
+	struct Client {
+		UniqueFd fd;
+		std::string data;
+		size_t sent = 0;
+	};
+
+	void on_accept();
+	void on_writable(int fd);
+	void drop(int fd);
+
+	EventLoop &m_loop;
+	UniqueFd m_listen;
+	std::unordered_map<int, std::unique_ptr<Client>> m_clients;
+};
+
+} // namespace recovery
@@ -0,0 +1,122 @@
+#include "crypto/af_alg.h"
+
+#include <errno.h>
+#include <linux/if_alg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+namespace recovery {
+
+int AfAlgSha256::open()
+{
+	m_tfm.reset(socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+	if (!m_tfm)
+		return -errno;
+	struct sockaddr_alg sa = {};
+	sa.salg_family = AF_ALG;
+	strcpy((char *)sa.salg_type, "hash");
+	strcpy((char *)sa.salg_name, "sha256");
+	if (bind(m_tfm.get(), (const struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		int err = -errno;
+		m_tfm.reset();
+		return err;
+	}
+	m_op.reset(accept4(m_tfm.get(), nullptr, nullptr, SOCK_CLOEXEC));
+	if (!m_op) {
+		int err = -errno;
+		m_tfm.reset();
+		return err;
+	}
+	return 0;
+}
+
+int AfAlgSha256::update(const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	while (len) {
+		ssize_t n = send(m_op.get(), p, len, MSG_MORE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int AfAlgSha256::final(uint8_t digest[Sha256::kDigestSize])
+{
+	// Reading the digest ends the hash; the next send starts a new one.
+	for (;;) {
+		ssize_t n = read(m_op.get(), digest, Sha256::kDigestSize);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		return n == (ssize_t)Sha256::kDigestSize ? 0 : -EIO;
+	}
+}
+
+std::string AfAlgSha256::hardware_driver()
+{
+	FILE *f = fopen("/proc/crypto", "re");
+	if (!f)
+		return std::string();
+
+	// /proc/crypto is blank-line separated "key : value" records, one per
+	// registered implementation. Offload engines are the asynchronous
+	// ahash ones; CPU code (generic, -ce, -neon, ...) is synchronous.
+	std::string best, name, driver;
+	long best_priority = -1, priority = 0;
+	bool async = false, internal = false;
+	char line[256];
+	for (;;) {
+		bool more = fgets(line, sizeof(line), f) != nullptr;
+		if (!more || line[0] == '\n') {
+			// The kernel uses the highest priority one; if that is
+			// software, ours is at least as fast.
+			if (name == "sha256" && !internal && priority > best_priority) {
+				best = async ? driver : std::string();
+				best_priority = priority;
+			}
+			name.clear();
+			driver.clear();
+			priority = 0;
+			async = internal = false;
+			if (!more)
+				break;
+			continue;
+		}
+		char *colon = strchr(line, ':');
+		if (!colon)
+			continue;
+		char *key_end = colon;
+		while (key_end > line && key_end[-1] == ' ')
+			key_end--;
+		*key_end = '\0';
+		char *value = colon + 1;
+		value += strspn(value, " ");
+		value[strcspn(value, "\n")] = '\0';
+		if (!strcmp(line, "name"))
+			name = value;
+		else if (!strcmp(line, "driver"))
+			driver = value;
+		else if (!strcmp(line, "priority"))
+			priority = strtol(value, nullptr, 10);
+		else if (!strcmp(line, "async"))
+			async = !strcmp(value, "yes");
+		else if (!strcmp(line, "internal"))
+			internal = !strcmp(value, "yes");
+	}
+	fclose(f);
+	return best;
+}
+
+} // namespace recovery
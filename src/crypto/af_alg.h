@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common/unique_fd.h"
+#include "crypto/sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// SHA-256 through the kernel's AF_ALG socket interface, which reaches
+// crypto engines (CAAM, SafeXcel, CESA...) that user space cannot drive
+// directly. Each instance is one hash in flight; it can be reused once
+// final() has returned.
+class AfAlgSha256 {
+public:
+	AfAlgSha256() = default;
+
+	AfAlgSha256(const AfAlgSha256 &) = delete;
+	AfAlgSha256 &operator=(const AfAlgSha256 &) = delete;
+
+	// Returns 0 or -errno (-EAFNOSUPPORT without CONFIG_CRYPTO_USER_API_HASH).
+	int open();
+	bool valid() const { return m_op.valid(); }
+
+	int update(const void *data, size_t len);
+	int final(uint8_t digest[Sha256::kDigestSize]);
+
+	// Driver the kernel would pick for "sha256" if it is an offload engine
+	// rather than another software implementation; empty otherwise. Going
+	// through a socket only pays off for the former.
+	static std::string hardware_driver();
+
+private:
+	UniqueFd m_tfm;
+	UniqueFd m_op;
+};
+
+} // namespace recovery
@@ -0,0 +1,86 @@
+#include "crypto/hasher.h"
+
+#include "common/log.h"
+
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+HashEngine g_forced = HashEngine::Auto;
+
+HashEngine pick_engine()
+{
+	if (g_forced == HashEngine::Cpu)
+		return HashEngine::Cpu;
+	if (g_forced == HashEngine::Auto) {
+		if (Sha256::cpu_accelerated())
+			return HashEngine::Cpu;
+		std::string driver = AfAlgSha256::hardware_driver();
+		if (driver.empty())
+			return HashEngine::Cpu;
+		log_info("crypto: hashing on %s through AF_ALG", driver.c_str());
+	}
+	AfAlgSha256 probe;
+	int ret = probe.open();
+	if (ret < 0) {
+		log_warning("crypto: AF_ALG sha256: %s, hashing on the CPU", strerror(-ret));
+		return HashEngine::Cpu;
+	}
+	return HashEngine::AfAlg;
+}
+
+HashEngine engine()
+{
+	static const HashEngine chosen = pick_engine();
+	return chosen;
+}
+
+} // namespace
+
+void hash_engine_force(HashEngine engine)
+{
+	g_forced = engine;
+}
+
+const char *hash_engine_name()
+{
+	if (engine() == HashEngine::AfAlg)
+		return "af_alg";
+	return Sha256::cpu_accelerated() ? "armv8-ce" : "scalar";
+}
+
+Hasher::Hasher()
+{
+	if (engine() != HashEngine::AfAlg)
+		return;
+	// Opened once already; failing now means running out of descriptors.
+	m_use_kernel = m_kernel.open() == 0;
+}
+
+void Hasher::update(const void *data, size_t len)
+{
+	if (!m_use_kernel) {
+		m_software.update(data, len);
+		return;
+	}
+	if (!m_error)
+		m_error = m_kernel.update(data, len);
+}
+
+int Hasher::final(uint8_t digest[Sha256::kDigestSize])
+{
+	if (!m_use_kernel) {
+		m_software.final(digest);
+		return 0;
+	}
+	// The kernel hash must be read out even after a failed send so the
+	// socket starts the next message clean.
+	int ret = m_kernel.final(digest);
+	int err = m_error ? m_error : ret;
+	m_error = 0;
+	return err;
+}
+
+} // namespace recovery
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "crypto/af_alg.h"
+#include "crypto/sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+// Where SHA-256 gets computed. Auto prefers the CPU's SHA-256
+// instructions, then a kernel offload engine, then the scalar code.
+enum class HashEngine {
+	Auto,
+	Cpu,
+	AfAlg,
+};
+
+// Overrides the choice for the whole process, e.g. for benchmarks. Must be
+// called before the first Hasher exists.
+void hash_engine_force(HashEngine engine);
+// "armv8-ce", "af_alg" or "scalar", as chosen for this process.
+const char *hash_engine_name();
+
+// SHA-256 on the engine above. Falls back to the CPU if the kernel socket
+// cannot be opened, so callers never have to care which one runs.
+class Hasher {
+public:
+	Hasher();
+
+	Hasher(const Hasher &) = delete;
+	Hasher &operator=(const Hasher &) = delete;
+
+	void update(const void *data, size_t len);
+	// Returns 0 or the -errno the offload engine failed with; either way
+	// the hasher is ready for the next message.
+	int final(uint8_t digest[Sha256::kDigestSize]);
+
+private:
+	Sha256 m_software;
+	AfAlgSha256 m_kernel;
+	bool m_use_kernel = false;
+	int m_error = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,228 @@
+#include "crypto/sha256.h"
+
+#include "crypto/sha256_blocks.h"
+
+#include <string.h>
+
+#ifdef HAVE_SHA256_CE
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace recovery {
+
+const uint32_t kSha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+namespace {
+
+inline uint32_t ror(uint32_t x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+inline void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+using BlocksFn = void (*)(uint32_t state[8], const uint8_t *blocks, size_t count);
+
+BlocksFn select_blocks()
+{
+#ifdef HAVE_SHA256_CE
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+		return sha256_blocks_armv8;
+#endif
+	return sha256_blocks_scalar;
+}
+
+} // namespace
+
+// One round with the working variables renamed instead of shifted; eight
+// of them bring the names back to where they started.
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, k, w)                                                           \
+	do {                                                                                                 \
+		uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + (g ^ (e & (f ^ g))) + (k) + (w);    \
+		d += t1;                                                                                     \
+		h = t1 + (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) | (c & (a | b)));                  \
+	} while (0)
+
+#define SHA256_ROUNDS8(j, W)                                         \
+	SHA256_ROUND(a, b, c, d, e, f, g, h, k[(j) + 0], W((j) + 0)); \
+	SHA256_ROUND(h, a, b, c, d, e, f, g, k[(j) + 1], W((j) + 1)); \
+	SHA256_ROUND(g, h, a, b, c, d, e, f, k[(j) + 2], W((j) + 2)); \
+	SHA256_ROUND(f, g, h, a, b, c, d, e, k[(j) + 3], W((j) + 3)); \
+	SHA256_ROUND(e, f, g, h, a, b, c, d, k[(j) + 4], W((j) + 4)); \
+	SHA256_ROUND(d, e, f, g, h, a, b, c, k[(j) + 5], W((j) + 5)); \
+	SHA256_ROUND(c, d, e, f, g, h, a, b, k[(j) + 6], W((j) + 6)); \
+	SHA256_ROUND(b, c, d, e, f, g, h, a, k[(j) + 7], W((j) + 7))
+
+// The schedule lives in a 16-word ring; with rounds taken sixteen at a
+// time every index is a constant and the ring stays in registers.
+#define SHA256_LOAD(j) (w[j] = load_be32(blocks + 4 * (j)))
+#define SHA256_SCHEDULE(j)                                                                              \
+	(w[j] += (ror(w[((j) + 1) & 15], 7) ^ ror(w[((j) + 1) & 15], 18) ^ (w[((j) + 1) & 15] >> 3)) + \
+		 w[((j) + 9) & 15] +                                                                    \
+		 (ror(w[((j) + 14) & 15], 17) ^ ror(w[((j) + 14) & 15], 19) ^ (w[((j) + 14) & 15] >> 10)))
+
+void sha256_blocks_scalar(uint32_t state[8], const uint8_t *blocks, size_t count)
+{
+	uint32_t w[16];
+
+	for (; count; count--, blocks += Sha256::kBlockSize) {
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+		const uint32_t *k = kSha256K;
+		SHA256_ROUNDS8(0, SHA256_LOAD);
+		SHA256_ROUNDS8(8, SHA256_LOAD);
+		for (k += 16; k < kSha256K + 64; k += 16) {
+			SHA256_ROUNDS8(0, SHA256_SCHEDULE);
+			SHA256_ROUNDS8(8, SHA256_SCHEDULE);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#undef SHA256_SCHEDULE
+#undef SHA256_LOAD
+#undef SHA256_ROUNDS8
+#undef SHA256_ROUND
+
+void Sha256::reset()
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(m_state, init, sizeof(m_state));
+	m_length = 0;
+	m_buffered = 0;
+}
+
+void Sha256::compress(const uint8_t *blocks, size_t count)
+{
+	static const BlocksFn fn = select_blocks();
+	fn(m_state, blocks, count);
+}
+
+bool Sha256::cpu_accelerated()
+{
+#ifdef HAVE_SHA256_CE
+	return select_blocks() != sha256_blocks_scalar;
+#else
+	return false;
+#endif
+}
+
+void Sha256::update(const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	m_length += len;
+
+	if (m_buffered) {
+		size_t n = kBlockSize - m_buffered;
+		if (n > len)
+			n = len;
+		memcpy(m_buffer + m_buffered, p, n);
+		m_buffered += n;
+		p += n;
+		len -= n;
+		if (m_buffered < kBlockSize)
+			return;
+		compress(m_buffer, 1);
+		m_buffered = 0;
+	}
+
+	// Hash whole blocks straight from the caller's buffer.
+	size_t blocks = len / kBlockSize;
+	if (blocks) {
+		compress(p, blocks);
+		p += blocks * kBlockSize;
+		len -= blocks * kBlockSize;
+	}
+
+	if (len) {
+		memcpy(m_buffer, p, len);
+		m_buffered = len;
+	}
+}
+
+void Sha256::final(uint8_t digest[kDigestSize])
+{
+	uint64_t bits = m_length * 8;
+	uint8_t pad[kBlockSize * 2] = { 0x80 };
+	size_t padlen = (m_buffered < 56 ? 56 : 120) - m_buffered;
+	for (int i = 0; i < 8; i++)
+		pad[padlen + i] = (uint8_t)(bits >> (56 - 8 * i));
+	update(pad, padlen + 8);
+
+	for (int i = 0; i < 8; i++)
+		store_be32(digest + 4 * i, m_state[i]);
+	reset();
+}
+
+void Sha256::digest(const void *data, size_t len, uint8_t out[kDigestSize])
+{
+	Sha256 ctx;
+	ctx.update(data, len);
+	ctx.final(out);
+}
+
+void sha256_to_hex(const uint8_t digest[Sha256::kDigestSize], char out[2 * Sha256::kDigestSize + 1])
+{
+	static const char hex[] = "0123456789abcdef";
+	for (size_t i = 0; i < Sha256::kDigestSize; i++) {
+		out[2 * i] = hex[digest[i] >> 4];
+		out[2 * i + 1] = hex[digest[i] & 0xf];
+	}
+	out[2 * Sha256::kDigestSize] = '\0';
+}
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool sha256_from_hex(const char *hex, uint8_t digest[Sha256::kDigestSize])
+{
+	for (size_t i = 0; i < Sha256::kDigestSize; i++) {
+		int hi = hex_value(hex[2 * i]);
+		int lo = hi < 0 ? -1 : hex_value(hex[2 * i + 1]);
+		if (lo < 0)
+			return false;
+		digest[i] = (uint8_t)(hi << 4 | lo);
+	}
+	return hex[2 * Sha256::kDigestSize] == '\0';
+}
+
+} // namespace recovery
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+// Incremental SHA-256 (FIPS 180-4).
+class Sha256 {
+public:
+	static const size_t kDigestSize = 32;
+	static const size_t kBlockSize = 64;
+
+	Sha256() { reset(); }
+
+	void reset();
+	void update(const void *data, size_t len);
+	void final(uint8_t digest[kDigestSize]);
+
+	// One-shot helper.
+	static void digest(const void *data, size_t len, uint8_t out[kDigestSize]);
+
+	// Whether blocks go through the CPU's SHA-256 instructions.
+	static bool cpu_accelerated();
+
+private:
+	void compress(const uint8_t *blocks, size_t count);
+
+	uint32_t m_state[8];
+	uint64_t m_length;
+	uint8_t m_buffer[kBlockSize];
+	size_t m_buffered;
+};
+
+// Lower-case hex <-> binary digests. parse returns false on malformed input.
+void sha256_to_hex(const uint8_t digest[Sha256::kDigestSize], char out[2 * Sha256::kDigestSize + 1]);
+bool sha256_from_hex(const char *hex, uint8_t digest[Sha256::kDigestSize]);
+
+} // namespace recovery
@@ -0,0 +1,40 @@
+// SHA-256 with the ARMv8 crypto extensions. Built with +crypto whatever
+// the rest of the tree targets; only reached when HWCAP_SHA2 is set.
+
+#include "crypto/sha256.h"
+#include "crypto/sha256_blocks.h"
+
+#include <arm_neon.h>
+
+namespace recovery {
+
+void sha256_blocks_armv8(uint32_t state[8], const uint8_t *blocks, size_t count)
+{
+	uint32x4_t abcd = vld1q_u32(state);
+	uint32x4_t efgh = vld1q_u32(state + 4);
+
+	for (; count; count--, blocks += Sha256::kBlockSize) {
+		uint32x4_t msg[4];
+		for (int i = 0; i < 4; i++)
+			msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+
+		uint32x4_t abcd0 = abcd, efgh0 = efgh;
+		// Four rounds per step; the last four steps need no more schedule.
+		for (int i = 0; i < 16; i++) {
+			uint32x4_t wk = vaddq_u32(msg[i & 3], vld1q_u32(kSha256K + 4 * i));
+			uint32x4_t prev = abcd;
+			abcd = vsha256hq_u32(abcd, efgh, wk);
+			efgh = vsha256h2q_u32(efgh, prev, wk);
+			if (i < 12)
+				msg[i & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]),
+							     msg[(i + 2) & 3], msg[(i + 3) & 3]);
+		}
+		abcd = vaddq_u32(abcd, abcd0);
+		efgh = vaddq_u32(efgh, efgh0);
+	}
+
+	vst1q_u32(state, abcd);
+	vst1q_u32(state + 4, efgh);
+}
+
+} // namespace recovery
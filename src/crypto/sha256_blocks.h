@@ -0,0 +1,19 @@
+#pragma once
+
+// Compression functions behind Sha256. Each consumes |count| 64-byte
+// blocks into |state|; Sha256 picks the fastest one the CPU runs once.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+extern const uint32_t kSha256K[64];
+
+void sha256_blocks_scalar(uint32_t state[8], const uint8_t *blocks, size_t count);
+#ifdef HAVE_SHA256_CE
+// ARMv8 crypto extensions; only call when the CPU reports HWCAP_SHA2.
+void sha256_blocks_armv8(uint32_t state[8], const uint8_t *blocks, size_t count);
+#endif
+
+} // namespace recovery
@@ -0,0 +1,148 @@
+#include "crypto/tree_hash.h"
+
+#include "common/trace.h"
+#include "platform/sched.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+// Pieces queued per worker; enough to cover a pipeline chunk split across
+// every worker a few times over.
+const size_t kWorkerDepth = 16;
+
+void put_be(uint8_t *p, uint64_t v, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; i++)
+		p[i] = (uint8_t)(v >> (8 * (bytes - 1 - i)));
+}
+
+} // namespace
+
+void tree_hash_root(uint64_t size, uint32_t leaf_size, const std::vector<uint8_t> &leaf_digests,
+		    uint8_t root[Sha256::kDigestSize])
+{
+	uint8_t geometry[12];
+	put_be(geometry, size, 8);
+	put_be(geometry + 8, leaf_size, 4);
+	Sha256 sha;
+	sha.update(geometry, sizeof(geometry));
+	sha.update(leaf_digests.data(), leaf_digests.size());
+	sha.final(root);
+}
+
+TreeHasher::TreeHasher(uint32_t leaf_size, unsigned threads) : m_leaf_size(leaf_size ? leaf_size : 1)
+{
+	if (!threads)
+		threads = 1;
+	for (unsigned i = 0; i < threads; i++)
+		m_workers.emplace_back(new Worker(kWorkerDepth));
+	for (unsigned i = 0; i < threads; i++)
+		m_workers[i]->thread = std::thread(&TreeHasher::run_worker, this, i, std::ref(*m_workers[i]));
+}
+
+TreeHasher::~TreeHasher()
+{
+	for (auto &worker : m_workers)
+		worker->queue.close();
+	for (auto &worker : m_workers) {
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+void TreeHasher::run_worker(unsigned index, Worker &worker)
+{
+	TRACE_THREAD_NAME("hash-%u", index);
+	sched_set_role(ThreadRole::Compute);
+	Hasher hasher;
+	Piece piece;
+	while (worker.queue.pop(piece)) {
+		TRACE_SCOPE("crypto", "sha256");
+		hasher.update(piece.data, piece.len);
+		if (piece.ends_leaf) {
+			uint8_t digest[Sha256::kDigestSize];
+			int ret = hasher.final(digest);
+			uint64_t leaf = m_first + worker.digests.size() / Sha256::kDigestSize * m_workers.size() + index;
+			if (!ret && m_expected &&
+			    (leaf >= m_expected_leaves ||
+			     memcmp(digest, m_expected + leaf * Sha256::kDigestSize, sizeof(digest))))
+				ret = -EBADMSG;
+			if (ret < 0) {
+				int expected = 0;
+				m_error.compare_exchange_strong(expected, ret);
+			}
+			worker.digests.insert(worker.digests.end(), digest, digest + sizeof(digest));
+		}
+		if (piece.pending && piece.pending->fetch_sub(1) == 1) {
+			// Taking the lock orders this against a waiter's check.
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_idle.notify_all();
+		}
+	}
+}
+
+void TreeHasher::push(uint64_t leaf, const Piece &piece)
+{
+	if (piece.pending)
+		piece.pending->fetch_add(1);
+	m_workers[(leaf - m_first) % m_workers.size()]->queue.push(piece);
+}
+
+void TreeHasher::expect(const uint8_t *digests, uint64_t leaves, uint64_t skip)
+{
+	m_expected = digests;
+	m_expected_leaves = leaves;
+	m_first = skip < leaves ? skip : leaves;
+	m_size = m_first * m_leaf_size;
+}
+
+void TreeHasher::update(const uint8_t *data, size_t len, std::atomic<unsigned> *pending)
+{
+	while (len) {
+		uint64_t leaf = m_size / m_leaf_size;
+		size_t room = m_leaf_size - (size_t)(m_size % m_leaf_size);
+		size_t n = len < room ? len : room;
+		push(leaf, Piece{ data, n, n == room, pending });
+		data += n;
+		len -= n;
+		m_size += n;
+	}
+}
+
+void TreeHasher::wait(const std::atomic<unsigned> *pending)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [pending] { return pending->load() == 0; });
+}
+
+int TreeHasher::final(uint8_t root[Sha256::kDigestSize])
+{
+	if (!m_final) {
+		m_final = true;
+		if (m_size % m_leaf_size)
+			push(m_size / m_leaf_size, Piece{ nullptr, 0, true, nullptr });
+		for (auto &worker : m_workers)
+			worker->queue.close();
+		for (auto &worker : m_workers)
+			worker->thread.join();
+
+		uint64_t leaves = (m_size + m_leaf_size - 1) / m_leaf_size;
+		m_leaf_digests.resize((size_t)leaves * Sha256::kDigestSize);
+		if (m_first)
+			memcpy(m_leaf_digests.data(), m_expected, (size_t)m_first * Sha256::kDigestSize);
+		for (uint64_t i = m_first; i < leaves; i++) {
+			const Worker &worker = *m_workers[(i - m_first) % m_workers.size()];
+			memcpy(&m_leaf_digests[(size_t)i * Sha256::kDigestSize],
+			       &worker.digests[(size_t)((i - m_first) / m_workers.size()) * Sha256::kDigestSize],
+			       Sha256::kDigestSize);
+		}
+	}
+	tree_hash_root(m_size, m_leaf_size, m_leaf_digests, root);
+	return m_error.load();
+}
+
+} // namespace recovery
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "common/bounded_queue.h"
+#include "crypto/hasher.h"
+#include "crypto/sha256.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+// Two-level tree digest: the stream is cut into |leaf_size| leaves (the
+// last one may be short), and the root is
+//
+//   SHA-256(be64 size || be32 leaf_size || SHA-256(leaf 0) || ...)
+//
+// Unlike a flat SHA-256 the leaves are independent, so they hash in
+// parallel, and a receiver can check each one as soon as it arrives. It is
+// the same construction recovery-fleet announces, so an image's tree
+// digest with a 256 KiB leaf equals its fleet root.
+void tree_hash_root(uint64_t size, uint32_t leaf_size, const std::vector<uint8_t> &leaf_digests,
+		    uint8_t root[Sha256::kDigestSize]);
+
+// Computes a tree digest of a stream fed in order, with leaf n hashed by
+// worker n % threads.
+class TreeHasher {
+public:
+	TreeHasher(uint32_t leaf_size, unsigned threads);
+	~TreeHasher();
+
+	TreeHasher(const TreeHasher &) = delete;
+	TreeHasher &operator=(const TreeHasher &) = delete;
+
+	unsigned threads() const { return (unsigned)m_workers.size(); }
+
+	// Leaf digests known up front, e.g. a container's chunk digests. Each
+	// leaf is checked against its entry as soon as it is hashed, failing
+	// the hasher with -EBADMSG, and the first |skip| are taken as they are
+	// rather than fed again. Call before update(); |digests| must outlive
+	// the hasher.
+	void expect(const uint8_t *digests, uint64_t leaves, uint64_t skip = 0);
+	// 0 or the first error so far; safe to call while hashing, and covers
+	// every leaf whose pieces have been waited for.
+	int error() const { return m_error.load(); }
+
+	// Queues the next |len| bytes of the stream and returns without
+	// hashing them. *pending counts the pieces still referencing |data|,
+	// which must stay valid until it drops back to zero.
+	void update(const uint8_t *data, size_t len, std::atomic<unsigned> *pending);
+	// Blocks until *pending is zero.
+	void wait(const std::atomic<unsigned> *pending);
+	// Waits for every leaf and computes the root. Returns 0 or the -errno
+	// of a failed offload engine. The hasher cannot be fed afterwards.
+	int final(uint8_t root[Sha256::kDigestSize]);
+
+	uint64_t size() const { return m_size; }
+	// Leaf digests in stream order, valid after final().
+	const std::vector<uint8_t> &leaf_digests() const { return m_leaf_digests; }
+
+private:
+	struct Piece {
+		const uint8_t *data;
+		size_t len;
+		bool ends_leaf;
+		std::atomic<unsigned> *pending;
+	};
+
+	struct Worker {
+		explicit Worker(size_t depth) : queue(depth) {}
+
+		BoundedQueue<Piece> queue;
+		std::vector<uint8_t> digests; // leaves w, w + threads, ...
+		std::thread thread;
+	};
+
+	void run_worker(unsigned index, Worker &worker);
+	void push(uint64_t leaf, const Piece &piece);
+
+	uint32_t m_leaf_size;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	const uint8_t *m_expected = nullptr;
+	uint64_t m_expected_leaves = 0;
+	// Leaves taken from m_expected; leaf m_first + n goes to worker
+	// n % threads.
+	uint64_t m_first = 0;
+	uint64_t m_size = 0;
+	bool m_final = false;
+
+	std::mutex m_mutex;
+	std::condition_variable m_idle;
+	std::atomic<int> m_error{ 0 };
+	std::vector<uint8_t> m_leaf_digests;
+};
+
+} // namespace recovery
@@ -0,0 +1,75 @@
+#include "fb/canvas.h"
+
+#include "fb/pixel_ops.h"
+
+namespace recovery {
+
+Canvas::Canvas(uint8_t *base, unsigned stride, unsigned width, unsigned height, const PixelFormat &format)
+	: m_base(base), m_stride(stride), m_width(width), m_height(height), m_format(format)
+{
+	reset_clip();
+}
+
+void Canvas::fill_rect(const Rect &rect, const Color &c)
+{
+	Rect r = rect.intersected(m_clip);
+	if (r.empty())
+		return;
+
+	uint32_t pixel = map(c.with_alpha(0xff));
+	for (int y = r.y; y < r.bottom(); y++) {
+		if (m_format.bits_per_pixel == 32)
+			fill_span32((uint32_t *)row(y) + r.x, pixel, r.w);
+		else
+			fill_span16((uint16_t *)row(y) + r.x, (uint16_t)pixel, r.w);
+	}
+}
+
+void Canvas::blend_rect(const Rect &rect, const Color &c)
+{
+	if (c.opaque()) {
+		fill_rect(rect, c);
+		return;
+	}
+	Rect r = rect.intersected(m_clip);
+	if (r.empty() || !c.a)
+		return;
+
+	uint32_t pixel = map(c.with_alpha(0xff));
+	for (int y = r.y; y < r.bottom(); y++) {
+		if (m_format.bits_per_pixel == 32)
+			blend_span32((uint32_t *)row(y) + r.x, pixel, c.a, r.w);
+		else
+			blend_span16((uint16_t *)row(y) + r.x, (uint16_t)pixel, c.a, r.w);
+	}
+}
+
+void Canvas::blend_mask(int x, int y, const uint8_t *mask, unsigned pitch, unsigned w, unsigned h, const Color &c)
+{
+	Rect r = Rect(x, y, (int)w, (int)h).intersected(m_clip);
+	if (r.empty() || !c.a)
+		return;
+
+	uint32_t pixel = map(c.with_alpha(0xff));
+	const uint8_t *m = mask + (size_t)(r.y - y) * pitch + (r.x - x);
+	for (int j = r.y; j < r.bottom(); j++, m += pitch) {
+		if (m_format.bits_per_pixel == 32)
+			blend_mask_span32((uint32_t *)row(j) + r.x, m, pixel, c.a, r.w);
+		else
+			blend_mask_span16((uint16_t *)row(j) + r.x, m, (uint16_t)pixel, c.a, r.w);
+	}
+}
+
+void Canvas::blit(int x, int y, const uint8_t *src, unsigned src_stride, unsigned w, unsigned h)
+{
+	Rect r = Rect(x, y, (int)w, (int)h).intersected(m_clip);
+	if (r.empty())
+		return;
+
+	unsigned bpp = m_format.bytes_per_pixel();
+	const uint8_t *s = src + (size_t)(r.y - y) * src_stride + (size_t)(r.x - x) * bpp;
+	for (int j = r.y; j < r.bottom(); j++, s += src_stride)
+		blit_span(row(j) + (size_t)r.x * bpp, s, r.w * bpp);
+}
+
+} // namespace recovery
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "fb/color.h"
+#include "fb/framebuffer.h"
+#include "fb/rect.h"
+
+#include <stdint.h>
+
+namespace recovery {
+
+// Draws straight into a block of pixels in framebuffer format, clipped to
+// the current clip rectangle. Holds no pixels of its own.
+class Canvas {
+public:
+	Canvas() = default;
+	Canvas(uint8_t *base, unsigned stride, unsigned width, unsigned height, const PixelFormat &format);
+
+	unsigned width() const { return m_width; }
+	unsigned height() const { return m_height; }
+	unsigned stride() const { return m_stride; }
+	const PixelFormat &format() const { return m_format; }
+	uint8_t *row(unsigned y) const { return m_base + (size_t)y * m_stride; }
+	Rect bounds() const { return Rect(0, 0, (int)m_width, (int)m_height); }
+
+	// The clip is always kept inside bounds().
+	void set_clip(const Rect &clip) { m_clip = clip.intersected(bounds()); }
+	void reset_clip() { m_clip = bounds(); }
+	const Rect &clip() const { return m_clip; }
+
+	uint32_t map(const Color &c) const { return m_format.map(c.r, c.g, c.b, c.a); }
+
+	// Replaces the pixels of |r|; alpha is ignored.
+	void fill_rect(const Rect &r, const Color &c);
+	// Composites |c| over the pixels of |r| using its alpha.
+	void blend_rect(const Rect &r, const Color &c);
+	// Composites |c| through an 8-bit coverage mask whose top-left lands
+	// at (x, y); used for glyphs.
+	void blend_mask(int x, int y, const uint8_t *mask, unsigned pitch, unsigned w, unsigned h, const Color &c);
+	// Copies pixels in canvas format from |src|, whose top-left lands at (x, y).
+	void blit(int x, int y, const uint8_t *src, unsigned src_stride, unsigned w, unsigned h);
+
+private:
+	uint8_t *m_base = nullptr;
+	unsigned m_stride = 0;
+	unsigned m_width = 0;
+	unsigned m_height = 0;
+	PixelFormat m_format;
+	Rect m_clip;
+};
+
+} // namespace recovery
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace recovery {
+
+// Device-independent 8-bit-per-channel colour. Alpha 0xff is opaque.
+struct Color {
+	uint8_t r = 0, g = 0, b = 0, a = 0xff;
+
+	constexpr Color() = default;
+	constexpr Color(uint8_t r_, uint8_t g_, uint8_t b_, uint8_t a_ = 0xff) : r(r_), g(g_), b(b_), a(a_) {}
+
+	// From 0xAARRGGBB.
+	static constexpr Color argb(uint32_t v)
+	{
+		return Color((uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v, (uint8_t)(v >> 24));
+	}
+
+	constexpr Color with_alpha(uint8_t alpha) const { return Color(r, g, b, alpha); }
+	constexpr bool opaque() const { return a == 0xff; }
+};
+
+} // namespace recovery
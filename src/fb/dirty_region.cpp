@@ -0,0 +1,78 @@
+#include "fb/dirty_region.h"
+
+namespace recovery {
+
+void DirtyRegion::add(const Rect &rect)
+{
+	Rect r = rect.intersected(m_bounds);
+	if (r.empty())
+		return;
+
+	for (bool merged = true; merged;) {
+		merged = false;
+		for (int i = 0; i < m_count; i++) {
+			const Rect &cur = m_rects[i];
+			if (cur.contains(r))
+				return;
+			Rect u = cur.united(r);
+			if (r.contains(cur) || u.area() <= cur.area() + r.area()) {
+				r = u;
+				remove(i);
+				merged = true;
+				break;
+			}
+		}
+	}
+
+	if (m_count == kMaxRects)
+		merge_cheapest_pair();
+	m_rects[m_count++] = r;
+
+	// Past ~3/4 of the screen, one big rect is cheaper than many small ones.
+	if (m_count > 1 && area() * 4 > m_bounds.area() * 3) {
+		Rect box = bounding_box();
+		m_count = 1;
+		m_rects[0] = box;
+	}
+}
+
+long DirtyRegion::area() const
+{
+	long a = 0;
+	for (int i = 0; i < m_count; i++)
+		a += m_rects[i].area();
+	return a;
+}
+
+Rect DirtyRegion::bounding_box() const
+{
+	Rect box;
+	for (int i = 0; i < m_count; i++)
+		box = box.united(m_rects[i]);
+	return box;
+}
+
+void DirtyRegion::remove(int i)
+{
+	m_rects[i] = m_rects[--m_count];
+}
+
+void DirtyRegion::merge_cheapest_pair()
+{
+	int best_i = 0, best_j = 1;
+	long best_waste = -1;
+	for (int i = 0; i < m_count; i++) {
+		for (int j = i + 1; j < m_count; j++) {
+			long waste = m_rects[i].united(m_rects[j]).area() - m_rects[i].area() - m_rects[j].area();
+			if (best_waste < 0 || waste < best_waste) {
+				best_waste = waste;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+	m_rects[best_i] = m_rects[best_i].united(m_rects[best_j]);
+	remove(best_j);
+}
+
+} // namespace recovery
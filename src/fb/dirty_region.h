@@ -0,0 +1,44 @@
+#pragma once
+
+#include "fb/rect.h"
+
+namespace recovery {
+
+// Set of screen areas that must be repainted before the next frame.
+//
+// Kept as a short list of disjoint-ish rectangles rather than a bitmap:
+// menus damage a handful of rows per key press, and a small list merges
+// cheaply. Rects whose union costs no more pixels than painting both are
+// merged; when the list is full the cheapest pair is merged, and once the
+// damage covers most of the screen it collapses to the bounding box.
+class DirtyRegion {
+public:
+	static const int kMaxRects = 16;
+
+	void set_bounds(const Rect &bounds) { m_bounds = bounds; }
+	const Rect &bounds() const { return m_bounds; }
+
+	void add(const Rect &r);
+	void add_all() { add(m_bounds); }
+	void clear() { m_count = 0; }
+
+	bool empty() const { return m_count == 0; }
+	int count() const { return m_count; }
+	const Rect &operator[](int i) const { return m_rects[i]; }
+	const Rect *begin() const { return m_rects; }
+	const Rect *end() const { return m_rects + m_count; }
+
+	// Number of pixels a repaint of this region will touch.
+	long area() const;
+	Rect bounding_box() const;
+
+private:
+	void remove(int i);
+	void merge_cheapest_pair();
+
+	Rect m_bounds;
+	Rect m_rects[kMaxRects];
+	int m_count = 0;
+};
+
+} // namespace recovery
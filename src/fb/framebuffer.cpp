@@ -0,0 +1,172 @@
+#include "fb/framebuffer.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+Framebuffer::~Framebuffer()
+{
+	close();
+}
+
+int Framebuffer::open(const char *path, unsigned width, unsigned height, bool double_buffer)
+{
+	close();
+
+	if (strncmp(path, "mem:", 4) != 0) {
+		m_fd = ::open(path, O_RDWR | O_CLOEXEC | (strncmp(path, "/dev/", 5) ? O_CREAT : 0), 0644);
+		if (m_fd < 0) {
+			int err = -errno;
+			log_error("fb: cannot open %s: %s", path, strerror(errno));
+			return err;
+		}
+	}
+
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	if (m_fd >= 0 && ioctl(m_fd, FBIOGET_VSCREENINFO, &var) == 0 &&
+	    ioctl(m_fd, FBIOGET_FSCREENINFO, &fix) == 0) {
+		m_is_device = true;
+		m_width = var.xres;
+		m_height = var.yres;
+		m_pages = 1;
+		// A second page is the lower half of a virtual screen twice as
+		// tall, shown by panning to it.
+		if (double_buffer && fix.ypanstep && var.yres % fix.ypanstep == 0 &&
+		    fix.smem_len >= 2ull * fix.line_length * var.yres) {
+			if (var.yres_virtual < 2 * var.yres) {
+				struct fb_var_screeninfo want = var;
+				want.yres_virtual = 2 * var.yres;
+				want.xoffset = want.yoffset = 0;
+				if (ioctl(m_fd, FBIOPUT_VSCREENINFO, &want) == 0 && want.yres_virtual >= 2 * var.yres) {
+					var = want;
+					ioctl(m_fd, FBIOGET_FSCREENINFO, &fix);
+				}
+			}
+			if (var.yres_virtual >= 2 * var.yres)
+				m_pages = 2;
+			else
+				log_debug("fb: %s cannot pan, drawing on screen", path);
+		}
+		m_front = m_pages > 1 && var.yoffset >= var.yres ? 1 : 0;
+		m_stride = fix.line_length;
+		m_map_size = fix.smem_len;
+		m_format.bits_per_pixel = var.bits_per_pixel;
+		m_format.red_offset = var.red.offset;
+		m_format.red_length = var.red.length;
+		m_format.green_offset = var.green.offset;
+		m_format.green_length = var.green.length;
+		m_format.blue_offset = var.blue.offset;
+		m_format.blue_length = var.blue.length;
+		m_format.alpha_offset = var.transp.offset;
+		m_format.alpha_length = var.transp.length;
+	} else {
+		m_is_device = false;
+		m_width = width;
+		m_height = height;
+		m_stride = width * 4;
+		m_pages = double_buffer && m_fd < 0 ? 2 : 1;
+		m_front = 0;
+		m_map_size = (size_t)m_stride * height * m_pages;
+		m_format = PixelFormat();
+		if (m_fd >= 0 && ftruncate(m_fd, (off_t)m_map_size) < 0) {
+			int err = -errno;
+			log_error("fb: cannot size %s: %s", path, strerror(errno));
+			close();
+			return err;
+		}
+	}
+
+	if (m_format.bits_per_pixel != 16 && m_format.bits_per_pixel != 32) {
+		log_error("fb: unsupported depth %u bpp", m_format.bits_per_pixel);
+		close();
+		return -EINVAL;
+	}
+
+	void *base = m_fd >= 0 ? mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0)
+			       : mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		int err = -errno;
+		log_error("fb: mmap of %zu bytes failed: %s", m_map_size, strerror(errno));
+		close();
+		return err;
+	}
+	m_base = (uint8_t *)base;
+
+	log_debug("fb: %s %ux%u %ubpp stride %u, %u page%s", path, m_width, m_height, m_format.bits_per_pixel,
+		  m_stride, m_pages, m_pages == 1 ? "" : "s");
+	return 0;
+}
+
+int Framebuffer::flip()
+{
+	if (m_pages < 2)
+		return 0;
+	unsigned next = m_front ^ 1;
+	if (!m_is_device) {
+		m_front = next;
+		return 0;
+	}
+
+	struct fb_var_screeninfo var;
+	if (ioctl(m_fd, FBIOGET_VSCREENINFO, &var) < 0)
+		return -errno;
+	var.xoffset = 0;
+	var.yoffset = next * m_height;
+	uint64_t pan_start = monotonic_us();
+	if (ioctl(m_fd, FBIOPAN_DISPLAY, &var) < 0) {
+		// Carry on drawing on screen rather than into a page never shown.
+		int err = -errno;
+		log_error("fb: cannot pan: %s, drawing on screen", strerror(errno));
+		m_pages = 1;
+		return err;
+	}
+	m_front = next;
+
+	// Many drivers already wait for the blank in the pan; waiting again
+	// would cost a whole frame. A pan that blocked shows the driver is one
+	// of those, and only the others, whose pan returns at once, are paced
+	// here, which keeps the next frame off the page still scanned out.
+	if (m_vsync && monotonic_us() - pan_start >= kPanWaitUs) {
+		log_debug("fb: the pan waits for vsync, not waiting again");
+		m_vsync = false;
+	}
+	if (m_vsync) {
+		__u32 crtc = 0;
+		while (ioctl(m_fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_debug("fb: no FBIO_WAITFORVSYNC (%s), not pacing frames", strerror(errno));
+			m_vsync = false;
+			break;
+		}
+	}
+	return 0;
+}
+
+void Framebuffer::close()
+{
+	if (m_base)
+		munmap(m_base, m_map_size);
+	m_base = nullptr;
+	m_map_size = 0;
+	m_pages = 1;
+	m_front = 0;
+	m_vsync = true;
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+	m_is_device = false;
+}
+
+} // namespace recovery
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+// Pixel layout of the mapped framebuffer, taken from fb_var_screeninfo.
+struct PixelFormat {
+	unsigned bits_per_pixel = 32;
+	unsigned red_offset = 16, red_length = 8;
+	unsigned green_offset = 8, green_length = 8;
+	unsigned blue_offset = 0, blue_length = 8;
+	unsigned alpha_offset = 24, alpha_length = 8;
+
+	unsigned bytes_per_pixel() const { return (bits_per_pixel + 7) / 8; }
+
+	// Converts 8-bit ARGB components into a native pixel value.
+	uint32_t map(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xff) const
+	{
+		return ((uint32_t)(r >> (8 - red_length)) << red_offset) |
+		       ((uint32_t)(g >> (8 - green_length)) << green_offset) |
+		       ((uint32_t)(b >> (8 - blue_length)) << blue_offset) |
+		       (alpha_length ? (uint32_t)(a >> (8 - alpha_length)) << alpha_offset : 0);
+	}
+};
+
+// A framebuffer mapped once into our address space. Backed either by a
+// Linux fbdev node or, for headless runs and benchmarks, by a regular file
+// or anonymous memory sized from the requested geometry.
+//
+// It may hold two pages, one on screen and one to draw the next frame in;
+// flip() pans between them, so the screen never shows a frame half drawn.
+class Framebuffer {
+public:
+	Framebuffer() = default;
+	~Framebuffer();
+
+	Framebuffer(const Framebuffer &) = delete;
+	Framebuffer &operator=(const Framebuffer &) = delete;
+
+	// Maps |path|. "mem:" maps anonymous memory; a regular file is resized
+	// to |width| x |height| at 32 bpp. Device nodes report their own geometry.
+	// With |double_buffer| a device gets a second page if its driver can pan
+	// and has the memory, and "mem:" always does; files keep one page so
+	// they stay a plain image. Returns 0 or a negative errno.
+	int open(const char *path, unsigned width = 1280, unsigned height = 720, bool double_buffer = false);
+	void close();
+
+	bool is_open() const { return m_base != nullptr; }
+	bool is_device() const { return m_is_device; }
+	int fd() const { return m_fd; }
+
+	unsigned width() const { return m_width; }
+	unsigned height() const { return m_height; }
+	// Bytes per scanline, which may include padding beyond width * bpp.
+	unsigned stride() const { return m_stride; }
+	const PixelFormat &format() const { return m_format; }
+
+	unsigned pages() const { return m_pages; }
+	// Start of the visible screen.
+	uint8_t *pixels() const { return page(m_front); }
+	uint8_t *row(unsigned y) const { return pixels() + (size_t)y * m_stride; }
+	// The page that is not on screen; the visible one if there is only one.
+	uint8_t *back() const { return page(m_pages > 1 ? m_front ^ 1 : m_front); }
+
+	// Puts the back page on screen from the next vertical blank and waits
+	// for that, so the page going off screen is no longer scanned out and
+	// can be drawn into. Pacing frames this way also caps them at the
+	// display's refresh rate. A no-op with one page. If the pan fails the
+	// framebuffer drops to the visible page alone. Returns 0 or -errno.
+	int flip();
+
+private:
+	int m_fd = -1;
+	bool m_is_device = false;
+	uint8_t *m_base = nullptr;
+	size_t m_map_size = 0;
+	unsigned m_pages = 1;
+	unsigned m_front = 0;
+	// A pan taking this long waited for the vertical blank itself.
+	static const uint64_t kPanWaitUs = 2000;
+
+	// Cleared once the driver turns out not to support FBIO_WAITFORVSYNC,
+	// or to wait in FBIOPAN_DISPLAY already.
+	bool m_vsync = true;
+	unsigned m_width = 0;
+	unsigned m_height = 0;
+	unsigned m_stride = 0;
+	PixelFormat m_format;
+
+	uint8_t *page(unsigned i) const { return m_base + (size_t)i * m_height * m_stride; }
+};
+
+} // namespace recovery
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace recovery {
+
+// Scanline kernels used by Canvas. Pixels are in the framebuffer's native
+// format; 32 bpp layouts must keep every channel byte-aligned (true for all
+// ARGB/ABGR/XRGB modes), 16 bpp is RGB565.
+//
+// |alpha| is the source coverage, 0 (leave dst) .. 255 (replace dst).
+//
+// One implementation is linked in, chosen by the Makefile from the target
+// flags: pixel_ops_neon.cpp, pixel_ops_msa.cpp or pixel_ops_scalar.cpp.
+// All of them produce bit-identical results.
+
+// "neon", "msa" or "scalar".
+const char *pixel_ops_name();
+
+void fill_span32(uint32_t *dst, uint32_t pixel, unsigned n);
+void fill_span16(uint16_t *dst, uint16_t pixel, unsigned n);
+
+void blend_span32(uint32_t *dst, uint32_t pixel, uint8_t alpha, unsigned n);
+void blend_span16(uint16_t *dst, uint16_t pixel, uint8_t alpha, unsigned n);
+
+// Blends |pixel| with per-pixel coverage |mask| scaled by |alpha|, as used
+// for anti-aliased glyphs.
+void blend_mask_span32(uint32_t *dst, const uint8_t *mask, uint32_t pixel, uint8_t alpha, unsigned n);
+void blend_mask_span16(uint16_t *dst, const uint8_t *mask, uint16_t pixel, uint8_t alpha, unsigned n);
+
+// Copies |bytes| bytes of one scanline.
+void blit_span(uint8_t *dst, const uint8_t *src, unsigned bytes);
+
+} // namespace recovery
@@ -0,0 +1,154 @@
+#include "fb/pixel_ops.h"
+
+#include "fb/pixel_ops_scalar.h"
+
+#include <msa.h>
+
+// MIPS SIMD Architecture kernels (-mmsa, P5600/I6400 class SoCs). Bytes are
+// loaded in memory order, so these work for either endianness and any
+// byte-aligned 32 bpp channel order. 16 bpp blends stay scalar.
+
+namespace recovery {
+
+namespace {
+
+// Per 16-bit lane: rounded t / 255, matching scalar::div255.
+inline v8i16 div255(v8i16 t)
+{
+	t = __msa_addv_h(t, __msa_fill_h(128));
+	return __msa_srli_h(__msa_addv_h(t, __msa_srli_h(t, 8)), 8);
+}
+
+// src * a + dst * (255 - a) / 255 for 16 bytes with per-byte weights.
+inline v16i8 blend16(v16i8 src, v16i8 dst, v16i8 a)
+{
+	v16i8 zero = __msa_ldi_b(0);
+	v16i8 inv = (v16i8)__msa_xori_b((v16u8)a, 0xff);
+	v8i16 lo = __msa_addv_h(__msa_mulv_h((v8i16)__msa_ilvr_b(zero, src), (v8i16)__msa_ilvr_b(zero, a)),
+				__msa_mulv_h((v8i16)__msa_ilvr_b(zero, dst), (v8i16)__msa_ilvr_b(zero, inv)));
+	v8i16 hi = __msa_addv_h(__msa_mulv_h((v8i16)__msa_ilvl_b(zero, src), (v8i16)__msa_ilvl_b(zero, a)),
+				__msa_mulv_h((v8i16)__msa_ilvl_b(zero, dst), (v8i16)__msa_ilvl_b(zero, inv)));
+	return __msa_pckev_b((v16i8)div255(hi), (v16i8)div255(lo));
+}
+
+// a * b / 255 for 16 bytes.
+inline v16i8 scale16(v16i8 a, v16i8 b)
+{
+	v16i8 zero = __msa_ldi_b(0);
+	v8i16 lo = __msa_mulv_h((v8i16)__msa_ilvr_b(zero, a), (v8i16)__msa_ilvr_b(zero, b));
+	v8i16 hi = __msa_mulv_h((v8i16)__msa_ilvl_b(zero, a), (v8i16)__msa_ilvl_b(zero, b));
+	return __msa_pckev_b((v16i8)div255(hi), (v16i8)div255(lo));
+}
+
+// Four copies of |pixel| in memory order.
+inline v16i8 splat_pixel(uint32_t pixel)
+{
+	const uint32_t rep[4] = { pixel, pixel, pixel, pixel };
+	return __msa_ld_b((void *)rep, 0);
+}
+
+// Byte shuffles spreading mask bytes 4k..4k+3 over four pixels each.
+const int8_t kSpread[4][16] = {
+	{ 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 },
+	{ 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 },
+	{ 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11 },
+	{ 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15 },
+};
+
+} // namespace
+
+const char *pixel_ops_name()
+{
+	return "msa";
+}
+
+void fill_span32(uint32_t *dst, uint32_t pixel, unsigned n)
+{
+	v4i32 v = __msa_fill_w((int)pixel);
+	unsigned i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__msa_st_w(v, dst + i, 0);
+		__msa_st_w(v, dst + i + 4, 0);
+	}
+	scalar::fill_span32(dst + i, pixel, n - i);
+}
+
+void fill_span16(uint16_t *dst, uint16_t pixel, unsigned n)
+{
+	v8i16 v = __msa_fill_h(pixel);
+	unsigned i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__msa_st_h(v, dst + i, 0);
+		__msa_st_h(v, dst + i + 8, 0);
+	}
+	scalar::fill_span16(dst + i, pixel, n - i);
+}
+
+void blend_span32(uint32_t *dst, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff) {
+		fill_span32(dst, pixel, n);
+		return;
+	}
+
+	v16i8 src = splat_pixel(pixel);
+	v16i8 a = __msa_fill_b(alpha);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4)
+		__msa_st_b(blend16(src, __msa_ld_b(dst + i, 0), a), dst + i, 0);
+	scalar::blend_span32(dst + i, pixel, alpha, n - i);
+}
+
+void blend_span16(uint16_t *dst, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff)
+		fill_span16(dst, pixel, n);
+	else
+		scalar::blend_span16(dst, pixel, alpha, n);
+}
+
+void blend_mask_span32(uint32_t *dst, const uint8_t *mask, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	v16i8 src = splat_pixel(pixel);
+	v16i8 global = __msa_fill_b(alpha);
+	v16i8 spread[4];
+	for (int k = 0; k < 4; k++)
+		spread[k] = __msa_ld_b((void *)kSpread[k], 0);
+	unsigned i = 0;
+
+	// Sixteen pixels per step: one mask vector, four pixel vectors.
+	for (; i + 16 <= n; i += 16) {
+		v16i8 m = __msa_ld_b((void *)(mask + i), 0);
+		if (__msa_test_bz_v((v16u8)m))
+			continue;
+		if (alpha != 0xff)
+			m = scale16(m, global);
+		for (int k = 0; k < 4; k++) {
+			uint32_t *p = dst + i + 4 * k;
+			v16i8 a = __msa_vshf_b(spread[k], m, m);
+			__msa_st_b(blend16(src, __msa_ld_b(p, 0), a), p, 0);
+		}
+	}
+	scalar::blend_mask_span32(dst + i, mask + i, pixel, alpha, n - i);
+}
+
+void blend_mask_span16(uint16_t *dst, const uint8_t *mask, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	scalar::blend_mask_span16(dst, mask, pixel, alpha, n);
+}
+
+void blit_span(uint8_t *dst, const uint8_t *src, unsigned bytes)
+{
+	unsigned i = 0;
+	for (; i + 64 <= bytes; i += 64) {
+		v16i8 a = __msa_ld_b((void *)(src + i), 0), b = __msa_ld_b((void *)(src + i + 16), 0);
+		v16i8 c = __msa_ld_b((void *)(src + i + 32), 0), d = __msa_ld_b((void *)(src + i + 48), 0);
+		__msa_st_b(a, dst + i, 0);
+		__msa_st_b(b, dst + i + 16, 0);
+		__msa_st_b(c, dst + i + 32, 0);
+		__msa_st_b(d, dst + i + 48, 0);
+	}
+	scalar::blit_span(dst + i, src + i, bytes - i);
+}
+
+} // namespace recovery
@@ -0,0 +1,137 @@
+#include "fb/pixel_ops.h"
+
+#include "fb/pixel_ops_scalar.h"
+
+#include <arm_neon.h>
+
+// ARM NEON kernels (ARMv7 with -mfpu=neon, and AArch64). Blends work on
+// bytes, so they are independent of the channel order of the 32 bpp mode.
+// 16 bpp blends stay scalar: RGB565 boxes are the ones too old for NEON.
+
+namespace recovery {
+
+namespace {
+
+// Rounded division by 255 of eight 16-bit products, narrowed to bytes;
+// matches scalar::div255.
+inline uint8x8_t div255(uint16x8_t t)
+{
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+// src * a + dst * (255 - a) / 255 for 16 bytes with per-byte weights.
+inline uint8x16_t blend16(uint8x16_t src, uint8x16_t dst, uint8x16_t a)
+{
+	uint8x16_t inv = vmvnq_u8(a);
+	uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(src), vget_low_u8(a)), vget_low_u8(dst), vget_low_u8(inv));
+	uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(src), vget_high_u8(a)), vget_high_u8(dst), vget_high_u8(inv));
+	return vcombine_u8(div255(lo), div255(hi));
+}
+
+// Four copies of |pixel| in memory order, whatever the endianness.
+inline uint8x16_t splat_pixel(uint32_t pixel)
+{
+	const uint32_t rep[4] = { pixel, pixel, pixel, pixel };
+	return vld1q_u8((const uint8_t *)rep);
+}
+
+} // namespace
+
+const char *pixel_ops_name()
+{
+	return "neon";
+}
+
+void fill_span32(uint32_t *dst, uint32_t pixel, unsigned n)
+{
+	uint32x4_t v = vdupq_n_u32(pixel);
+	unsigned i = 0;
+	for (; i + 8 <= n; i += 8) {
+		vst1q_u32(dst + i, v);
+		vst1q_u32(dst + i + 4, v);
+	}
+	scalar::fill_span32(dst + i, pixel, n - i);
+}
+
+void fill_span16(uint16_t *dst, uint16_t pixel, unsigned n)
+{
+	uint16x8_t v = vdupq_n_u16(pixel);
+	unsigned i = 0;
+	for (; i + 16 <= n; i += 16) {
+		vst1q_u16(dst + i, v);
+		vst1q_u16(dst + i + 8, v);
+	}
+	scalar::fill_span16(dst + i, pixel, n - i);
+}
+
+void blend_span32(uint32_t *dst, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff) {
+		fill_span32(dst, pixel, n);
+		return;
+	}
+
+	uint8x16_t src = splat_pixel(pixel);
+	uint8x16_t a = vdupq_n_u8(alpha);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		uint8_t *p = (uint8_t *)(dst + i);
+		vst1q_u8(p, blend16(src, vld1q_u8(p), a));
+	}
+	scalar::blend_span32(dst + i, pixel, alpha, n - i);
+}
+
+void blend_span16(uint16_t *dst, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff)
+		fill_span16(dst, pixel, n);
+	else
+		scalar::blend_span16(dst, pixel, alpha, n);
+}
+
+void blend_mask_span32(uint32_t *dst, const uint8_t *mask, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	const uint8_t *s = (const uint8_t *)&pixel;
+	uint8x8_t c0 = vdup_n_u8(s[0]), c1 = vdup_n_u8(s[1]), c2 = vdup_n_u8(s[2]), c3 = vdup_n_u8(s[3]);
+	uint8x8_t global = vdup_n_u8(alpha);
+	unsigned i = 0;
+
+	// Eight pixels per step, de-interleaved so each lane is one pixel.
+	for (; i + 8 <= n; i += 8) {
+		uint8x8_t a = vld1_u8(mask + i);
+		if (alpha != 0xff)
+			a = div255(vmull_u8(a, global));
+		if (!vget_lane_u64(vreinterpret_u64_u8(a), 0))
+			continue;
+		uint8x8_t inv = vmvn_u8(a);
+		uint8_t *p = (uint8_t *)(dst + i);
+		uint8x8x4_t d = vld4_u8(p);
+		d.val[0] = div255(vmlal_u8(vmull_u8(c0, a), d.val[0], inv));
+		d.val[1] = div255(vmlal_u8(vmull_u8(c1, a), d.val[1], inv));
+		d.val[2] = div255(vmlal_u8(vmull_u8(c2, a), d.val[2], inv));
+		d.val[3] = div255(vmlal_u8(vmull_u8(c3, a), d.val[3], inv));
+		vst4_u8(p, d);
+	}
+	scalar::blend_mask_span32(dst + i, mask + i, pixel, alpha, n - i);
+}
+
+void blend_mask_span16(uint16_t *dst, const uint8_t *mask, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	scalar::blend_mask_span16(dst, mask, pixel, alpha, n);
+}
+
+void blit_span(uint8_t *dst, const uint8_t *src, unsigned bytes)
+{
+	unsigned i = 0;
+	for (; i + 64 <= bytes; i += 64) {
+		uint8x16_t a = vld1q_u8(src + i), b = vld1q_u8(src + i + 16);
+		uint8x16_t c = vld1q_u8(src + i + 32), d = vld1q_u8(src + i + 48);
+		vst1q_u8(dst + i, a);
+		vst1q_u8(dst + i + 16, b);
+		vst1q_u8(dst + i + 32, c);
+		vst1q_u8(dst + i + 48, d);
+	}
+	scalar::blit_span(dst + i, src + i, bytes - i);
+}
+
+} // namespace recovery
@@ -0,0 +1,53 @@
+#include "fb/pixel_ops.h"
+
+#include "fb/pixel_ops_scalar.h"
+
+namespace recovery {
+
+const char *pixel_ops_name()
+{
+	return "scalar";
+}
+
+void fill_span32(uint32_t *dst, uint32_t pixel, unsigned n)
+{
+	scalar::fill_span32(dst, pixel, n);
+}
+
+void fill_span16(uint16_t *dst, uint16_t pixel, unsigned n)
+{
+	scalar::fill_span16(dst, pixel, n);
+}
+
+void blend_span32(uint32_t *dst, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff)
+		scalar::fill_span32(dst, pixel, n);
+	else
+		scalar::blend_span32(dst, pixel, alpha, n);
+}
+
+void blend_span16(uint16_t *dst, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	if (alpha == 0xff)
+		scalar::fill_span16(dst, pixel, n);
+	else
+		scalar::blend_span16(dst, pixel, alpha, n);
+}
+
+void blend_mask_span32(uint32_t *dst, const uint8_t *mask, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	scalar::blend_mask_span32(dst, mask, pixel, alpha, n);
+}
+
+void blend_mask_span16(uint16_t *dst, const uint8_t *mask, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	scalar::blend_mask_span16(dst, mask, pixel, alpha, n);
+}
+
+void blit_span(uint8_t *dst, const uint8_t *src, unsigned bytes)
+{
+	scalar::blit_span(dst, src, bytes);
+}
+
+} // namespace recovery
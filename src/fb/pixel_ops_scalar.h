@@ -0,0 +1,91 @@
+#pragma once
+
+// Portable span kernels. pixel_ops_scalar.cpp exports them directly; the
+// SIMD variants use them for span tails and 16 bpp modes they do not
+// vectorise, and pixel-bench checks the SIMD output against them.
+
+#include <stdint.h>
+#include <string.h>
+
+namespace recovery {
+namespace scalar {
+
+// Rounded t / 255 for t <= 255 * 255, in the form the SIMD kernels use:
+// ((t + 128) + ((t + 128) >> 8)) >> 8, which is exact over that range.
+static inline unsigned div255(unsigned t)
+{
+	t += 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline void fill_span32(uint32_t *dst, uint32_t pixel, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		dst[i] = pixel;
+}
+
+static inline void fill_span16(uint16_t *dst, uint16_t pixel, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		dst[i] = pixel;
+}
+
+// dst = (src * a + dst * (255 - a)) / 255 on every byte, two channels at a
+// time in 16-bit lanes.
+static inline uint32_t blend_pixel32(uint32_t src, uint32_t dst, unsigned a)
+{
+	unsigned inv = 0xff - a;
+	uint32_t rb = (src & 0x00ff00ff) * a + (dst & 0x00ff00ff) * inv + 0x00800080;
+	uint32_t ag = ((src >> 8) & 0x00ff00ff) * a + ((dst >> 8) & 0x00ff00ff) * inv + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+	return rb | ag;
+}
+
+// RGB565 in 5/6/5 precision with a 5-bit alpha, as fbdev drivers do.
+static inline uint16_t blend_pixel16(uint16_t src, uint16_t dst, unsigned a)
+{
+	uint32_t s = (src | ((uint32_t)src << 16)) & 0x07e0f81f;
+	uint32_t d = (dst | ((uint32_t)dst << 16)) & 0x07e0f81f;
+	unsigned a5 = (a + 4) >> 3;
+	d = (d + (((s - d) * a5) >> 5)) & 0x07e0f81f;
+	return (uint16_t)(d | (d >> 16));
+}
+
+static inline void blend_span32(uint32_t *dst, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		dst[i] = blend_pixel32(pixel, dst[i], alpha);
+}
+
+static inline void blend_span16(uint16_t *dst, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		dst[i] = blend_pixel16(pixel, dst[i], alpha);
+}
+
+static inline void blend_mask_span32(uint32_t *dst, const uint8_t *mask, uint32_t pixel, uint8_t alpha, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		unsigned a = alpha == 0xff ? mask[i] : div255(mask[i] * alpha);
+		if (a)
+			dst[i] = blend_pixel32(pixel, dst[i], a);
+	}
+}
+
+static inline void blend_mask_span16(uint16_t *dst, const uint8_t *mask, uint16_t pixel, uint8_t alpha, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		unsigned a = alpha == 0xff ? mask[i] : div255(mask[i] * alpha);
+		if (a)
+			dst[i] = blend_pixel16(pixel, dst[i], a);
+	}
+}
+
+static inline void blit_span(uint8_t *dst, const uint8_t *src, unsigned bytes)
+{
+	memcpy(dst, src, bytes);
+}
+
+} // namespace scalar
+} // namespace recovery
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+
+namespace recovery {
+
+// Axis-aligned rectangle in screen pixels. Empty when w or h is <= 0.
+struct Rect {
+	int x = 0, y = 0, w = 0, h = 0;
+
+	Rect() = default;
+	Rect(int x_, int y_, int w_, int h_) : x(x_), y(y_), w(w_), h(h_) {}
+
+	int right() const { return x + w; }
+	int bottom() const { return y + h; }
+	bool empty() const { return w <= 0 || h <= 0; }
+	long area() const { return empty() ? 0 : (long)w * h; }
+
+	bool contains(const Rect &o) const
+	{
+		return !o.empty() && o.x >= x && o.y >= y && o.right() <= right() && o.bottom() <= bottom();
+	}
+
+	bool intersects(const Rect &o) const
+	{
+		return !empty() && !o.empty() && o.x < right() && x < o.right() && o.y < bottom() && y < o.bottom();
+	}
+
+	Rect intersected(const Rect &o) const
+	{
+		int l = std::max(x, o.x), t = std::max(y, o.y);
+		int r = std::min(right(), o.right()), b = std::min(bottom(), o.bottom());
+		return r > l && b > t ? Rect(l, t, r - l, b - t) : Rect();
+	}
+
+	Rect united(const Rect &o) const
+	{
+		if (empty())
+			return o;
+		if (o.empty())
+			return *this;
+		int l = std::min(x, o.x), t = std::min(y, o.y);
+		return Rect(l, t, std::max(right(), o.right()) - l, std::max(bottom(), o.bottom()) - t);
+	}
+
+	bool operator==(const Rect &o) const { return x == o.x && y == o.y && w == o.w && h == o.h; }
+	bool operator!=(const Rect &o) const { return !(*this == o); }
+};
+
+} // namespace recovery
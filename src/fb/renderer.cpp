@@ -0,0 +1,64 @@
+#include "fb/renderer.h"
+
+namespace recovery {
+
+Renderer::Renderer(Framebuffer &fb)
+	: m_fb(fb), m_canvas(fb.back(), fb.stride(), fb.width(), fb.height(), fb.format())
+{
+	m_dirty.set_bounds(m_canvas.bounds());
+	// Whatever is in the back page at start is not the screen.
+	m_previous.set_bounds(m_canvas.bounds());
+	if (fb.pages() > 1)
+		m_previous.add_all();
+}
+
+void Renderer::catch_up()
+{
+	const uint8_t *front = m_fb.pixels();
+	unsigned stride = m_fb.stride();
+	unsigned bpp = m_fb.format().bytes_per_pixel();
+	for (const Rect &r : m_previous) {
+		bool repainted = false;
+		for (const Rect &d : m_dirty)
+			repainted |= d.contains(r);
+		if (repainted)
+			continue;
+		m_canvas.set_clip(r);
+		m_canvas.blit(r.x, r.y, front + (size_t)r.y * stride + (size_t)r.x * bpp, stride, (unsigned)r.w,
+			      (unsigned)r.h);
+		m_copied += (uint64_t)r.area();
+	}
+}
+
+long Renderer::repaint(const PaintFn &paint)
+{
+	if (m_dirty.empty())
+		return 0;
+
+	bool flip = m_fb.pages() > 1;
+	if (flip) {
+		m_canvas = Canvas(m_fb.back(), m_fb.stride(), m_fb.width(), m_fb.height(), m_fb.format());
+		catch_up();
+	}
+	long pixels = m_dirty.area();
+	for (const Rect &r : m_dirty) {
+		m_canvas.set_clip(r);
+		paint(m_canvas, r);
+	}
+	m_canvas.reset_clip();
+	if (flip) {
+		m_previous = m_dirty;
+		if (m_fb.flip() < 0) {
+			// That frame is not on screen; draw the whole screen again onto
+			// the single page left.
+			m_canvas = Canvas(m_fb.back(), m_fb.stride(), m_fb.width(), m_fb.height(), m_fb.format());
+			m_dirty.add_all();
+			return pixels;
+		}
+	}
+	m_dirty.clear();
+	m_frames++;
+	return pixels;
+}
+
+} // namespace recovery
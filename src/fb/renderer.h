@@ -0,0 +1,61 @@
+#pragma once
+
+#include "fb/canvas.h"
+#include "fb/dirty_region.h"
+#include "fb/framebuffer.h"
+
+#include <functional>
+
+namespace recovery {
+
+// Retained-mode repaint driver for a mapped framebuffer.
+//
+// Widgets report what changed through invalidate(); repaint() then asks the
+// painter to redraw only those rectangles, with the canvas clipped to each
+// one, directly into the mapped screen memory. An idle frame costs nothing
+// and a cursor move costs two rows.
+//
+// With a double-buffered framebuffer the frame is drawn into the back page
+// and flipped onto the screen. That page still holds the frame before last,
+// so what changed in the last frame is first copied over from the visible
+// page: a frame costs its own damage plus the previous one's, never a full
+// redraw, and nothing is flipped when nothing is dirty.
+class Renderer {
+public:
+	using PaintFn = std::function<void(Canvas &canvas, const Rect &dirty)>;
+
+	explicit Renderer(Framebuffer &fb);
+
+	Canvas &canvas() { return m_canvas; }
+	Rect bounds() const { return m_canvas.bounds(); }
+
+	void invalidate(const Rect &r) { m_dirty.add(r); }
+	void invalidate_all() { m_dirty.add_all(); }
+	bool needs_repaint() const { return !m_dirty.empty(); }
+	const DirtyRegion &dirty() const { return m_dirty; }
+
+	// Repaints every dirty rectangle, flips if double-buffered and clears
+	// the region. Returns the number of pixels painted, 0 if nothing was
+	// dirty.
+	long repaint(const PaintFn &paint);
+
+	// Frames put on screen, and pixels copied between pages to keep the
+	// back page current.
+	uint64_t frames() const { return m_frames; }
+	uint64_t copied_pixels() const { return m_copied; }
+
+private:
+	// Brings the back page up to the visible frame where this one will not
+	// paint anyway.
+	void catch_up();
+
+	Framebuffer &m_fb;
+	Canvas m_canvas;
+	DirtyRegion m_dirty;
+	// Damage of the frame on screen, which the back page does not have yet.
+	DirtyRegion m_previous;
+	uint64_t m_frames = 0;
+	uint64_t m_copied = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,218 @@
+#include "flash/backup.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "common/trace.h"
+#include "crypto/hasher.h"
+#include "crypto/tree_hash.h"
+#include "flash/decoder.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+
+namespace recovery {
+
+// Buffers beyond one per worker: one being read and one being written.
+static const unsigned kSpareSlots = 2;
+
+BackupWriter::BackupWriter(Source &source, int out_fd, const BackupOptions &options)
+	: m_source(source),
+	  m_out(out_fd),
+	  m_options(options),
+	  m_threads(options.threads ? options.threads : default_decoder_threads()),
+	  m_output_capacity(ZSTD_compressBound(options.chunk_size)),
+	  m_slots(m_threads + kSpareSlots),
+	  m_free(m_slots.size()),
+	  m_work(m_slots.size()),
+	  m_order(m_slots.size())
+{
+	for (unsigned i = 0; i < m_slots.size(); i++) {
+		m_slots[i].input.reset(new uint8_t[options.chunk_size]);
+		m_slots[i].output.reset(new uint8_t[m_output_capacity]);
+		m_free.push(i);
+	}
+}
+
+BackupWriter::~BackupWriter() = default;
+
+void BackupWriter::fail(int err)
+{
+	int expected = 0;
+	if (!m_error.compare_exchange_strong(expected, err))
+		return;
+	if (err != -ECANCELED)
+		log_error("backup: failed: %s", strerror(-err));
+	m_free.abort();
+	m_work.abort();
+	m_order.abort();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_compressed.notify_all();
+}
+
+int BackupWriter::run()
+{
+	uint64_t start = monotonic_us();
+	m_index = BackupIndex();
+	m_index.chunk_size = m_options.chunk_size;
+
+	std::thread reader(&BackupWriter::read_stage, this);
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < m_threads; i++)
+		workers.emplace_back(&BackupWriter::compress_worker, this);
+
+	TRACE_THREAD_NAME("backup-write");
+	unsigned index;
+	for (;;) {
+		uint64_t wait = monotonic_us();
+		if (!m_order.pop(index))
+			break;
+		Slot &slot = m_slots[index];
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_compressed.wait(lock, [&] { return slot.done || m_error.load(); });
+		}
+		m_stats.write_starved_us += monotonic_us() - wait;
+		if (m_error.load())
+			break;
+		if (slot.result < 0) {
+			fail(slot.result);
+			break;
+		}
+
+		int ret;
+		{
+			TRACE_SCOPE("backup", "write");
+			ret = write_out(slot.output.get(), slot.output_len);
+		}
+		if (ret < 0) {
+			fail(ret);
+			break;
+		}
+		m_index.frame_sizes.push_back((uint32_t)slot.output_len);
+		m_index.digests.insert(m_index.digests.end(), slot.digest, slot.digest + Sha256::kDigestSize);
+		m_index.image_size += slot.input_len;
+		slot.done = false;
+		m_free.push(index);
+	}
+
+	reader.join();
+	m_work.close();
+	for (std::thread &t : workers)
+		t.join();
+
+	int err = m_error.load();
+	if (!err) {
+		tree_hash_root(m_index.image_size, m_index.chunk_size, m_index.digests, m_index.root);
+		std::vector<uint8_t> trailer;
+		backup_index_encode(m_index, trailer);
+		err = write_out(trailer.data(), trailer.size());
+		// Pipes and sockets cannot be synced; the far end has to.
+		if (!err && fsync(m_out) < 0 && errno != EINVAL && errno != EROFS)
+			err = -errno;
+		if (err < 0)
+			fail(err);
+	}
+
+	m_stats.bytes_in = m_index.image_size;
+	m_stats.bytes_out = bytes_written();
+	m_stats.elapsed_us = monotonic_us() - start;
+	return err;
+}
+
+void BackupWriter::read_stage()
+{
+	TRACE_THREAD_NAME("backup-read");
+	unsigned index;
+	bool eof = false;
+	while (!eof) {
+		uint64_t wait = monotonic_us();
+		if (!m_free.pop(index))
+			break;
+		m_stats.read_blocked_us += monotonic_us() - wait;
+
+		Slot &slot = m_slots[index];
+		slot.input_len = 0;
+		{
+			TRACE_SCOPE("backup", "read");
+			while (slot.input_len < m_options.chunk_size) {
+				ssize_t n = m_source.read(slot.input.get() + slot.input_len,
+							  m_options.chunk_size - slot.input_len);
+				if (n < 0) {
+					fail((int)n);
+					return;
+				}
+				if (n == 0) {
+					eof = true;
+					break;
+				}
+				slot.input_len += (size_t)n;
+			}
+		}
+		if (!slot.input_len)
+			break;
+		m_bytes_read.fetch_add(slot.input_len, std::memory_order_relaxed);
+		// Queues hold every slot, so neither push can block.
+		if (!m_order.push(index) || !m_work.push(index))
+			break;
+	}
+	m_order.close();
+}
+
+void BackupWriter::compress_worker()
+{
+	TRACE_THREAD_NAME("backup-zstd");
+	ZSTD_CCtx *ctx = ZSTD_createCCtx();
+	if (ctx)
+		ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, m_options.level);
+	Hasher hash;
+	unsigned index;
+	while (m_work.pop(index)) {
+		Slot &slot = m_slots[index];
+		int result = 0;
+		if (!ctx) {
+			result = -ENOMEM;
+		} else {
+			TRACE_SCOPE("backup", "compress");
+			// One-shot frames record their content size, which is what lets
+			// the restore side decode each into place.
+			size_t n = ZSTD_compress2(ctx, slot.output.get(), m_output_capacity, slot.input.get(),
+						  slot.input_len);
+			if (ZSTD_isError(n)) {
+				log_error("backup: zstd: %s", ZSTD_getErrorName(n));
+				result = -ENOMEM;
+			} else {
+				slot.output_len = n;
+			}
+		}
+		if (!result) {
+			TRACE_SCOPE("backup", "sha256");
+			hash.update(slot.input.get(), slot.input_len);
+			result = hash.final(slot.digest);
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		slot.result = result;
+		slot.done = true;
+		m_compressed.notify_all();
+	}
+	ZSTD_freeCCtx(ctx);
+}
+
+int BackupWriter::write_out(const uint8_t *data, size_t len)
+{
+	while (len) {
+		ssize_t n = ::write(m_out, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		data += n;
+		len -= (size_t)n;
+		m_bytes_written.fetch_add((uint64_t)n, std::memory_order_relaxed);
+	}
+	return 0;
+}
+
+} // namespace recovery
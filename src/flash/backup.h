@@ -0,0 +1,109 @@
+#pragma once
+
+#include "common/bounded_queue.h"
+#include "flash/backup_index.h"
+#include "flash/source.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <errno.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+struct BackupOptions {
+	uint32_t chunk_size = kBackupChunkSize;
+	// zstd level. 3 compresses faster than USB 2 and most networks take it
+	// on a quad-core ARM box; higher levels rarely pay for themselves.
+	int level = 3;
+	// Compressor threads; 0 for one per CPU.
+	unsigned threads = 0;
+};
+
+struct BackupStats {
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+	uint64_t elapsed_us = 0;
+	// Reader waiting for a free buffer: compression or output is the
+	// bottleneck.
+	uint64_t read_blocked_us = 0;
+	// Writer waiting for the next chunk: reading or compression is.
+	uint64_t write_starved_us = 0;
+};
+
+// Streams a partition out as a backup archive (see BackupIndex): the
+// reverse of FlashPipeline, and its output restores through it.
+//
+// One thread reads the partition sequentially in whole chunks, |threads|
+// workers compress and SHA-256 them independently, and the calling thread
+// writes the frames out in order, followed by the index. Buffers are
+// allocated once, a few more than there are workers, so the reader never
+// runs far ahead and memory does not depend on the partition size. The
+// output only needs to be writable in sequence, so it may be a pipe to
+// the network as well as a file on USB storage.
+class BackupWriter {
+public:
+	BackupWriter(Source &source, int out_fd, const BackupOptions &options = BackupOptions());
+	~BackupWriter();
+
+	BackupWriter(const BackupWriter &) = delete;
+	BackupWriter &operator=(const BackupWriter &) = delete;
+
+	// Returns 0, -ECANCELED, or the -errno of whatever failed. The output
+	// is synced unless it is a pipe or socket.
+	int run();
+	// Safe from any thread.
+	void cancel() { fail(-ECANCELED); }
+
+	// Safe from any thread while running.
+	uint64_t bytes_read() const { return m_bytes_read.load(std::memory_order_relaxed); }
+	uint64_t bytes_written() const { return m_bytes_written.load(std::memory_order_relaxed); }
+	unsigned threads() const { return m_threads; }
+
+	// Valid after a successful run().
+	const BackupStats &stats() const { return m_stats; }
+	const BackupIndex &index() const { return m_index; }
+
+private:
+	struct Slot {
+		std::unique_ptr<uint8_t[]> input;
+		std::unique_ptr<uint8_t[]> output;
+		size_t input_len = 0;
+		size_t output_len = 0;
+		uint8_t digest[Sha256::kDigestSize];
+		int result = 0;
+		bool done = false;
+	};
+
+	void read_stage();
+	void compress_worker();
+	int write_out(const uint8_t *data, size_t len);
+	void fail(int err);
+
+	Source &m_source;
+	int m_out;
+	BackupOptions m_options;
+	unsigned m_threads;
+	size_t m_output_capacity;
+
+	std::vector<Slot> m_slots;
+	// Slot indices: free for the reader, read but not compressed, and all
+	// read slots in stream order for the writer.
+	BoundedQueue<unsigned> m_free;
+	BoundedQueue<unsigned> m_work;
+	BoundedQueue<unsigned> m_order;
+	std::mutex m_mutex;
+	std::condition_variable m_compressed;
+
+	std::atomic<int> m_error{ 0 };
+	std::atomic<uint64_t> m_bytes_read{ 0 };
+	std::atomic<uint64_t> m_bytes_written{ 0 };
+	BackupStats m_stats;
+	BackupIndex m_index;
+};
+
+} // namespace recovery
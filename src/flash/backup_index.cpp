@@ -0,0 +1,125 @@
+#include "flash/backup_index.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+const uint32_t kSkippableMagic = 0x184d2a5b;
+const uint32_t kIndexMagic = 0x4b425552; // "RUBK"
+const uint32_t kIndexVersion = 1;
+// Skippable header, fixed fields, root and footer.
+const size_t kIndexOverhead = 8 + 24 + Sha256::kDigestSize + 8;
+const size_t kEntrySize = 4 + Sha256::kDigestSize;
+
+void put_le32(std::vector<uint8_t> &out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+void put_le64(std::vector<uint8_t> &out, uint64_t v)
+{
+	put_le32(out, (uint32_t)v);
+	put_le32(out, (uint32_t)(v >> 32));
+}
+
+uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint64_t le64(const uint8_t *p)
+{
+	return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+int pread_full(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+	while (len) {
+		ssize_t n = pread(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return -EBADMSG;
+		buf += n;
+		len -= (size_t)n;
+		offset += n;
+	}
+	return 0;
+}
+
+} // namespace
+
+void backup_index_encode(const BackupIndex &index, std::vector<uint8_t> &out)
+{
+	uint32_t count = index.chunk_count();
+	uint32_t frame_size = (uint32_t)(kIndexOverhead + (size_t)count * kEntrySize);
+	put_le32(out, kSkippableMagic);
+	put_le32(out, frame_size - 8);
+	put_le32(out, kIndexMagic);
+	put_le32(out, kIndexVersion);
+	put_le32(out, index.chunk_size);
+	put_le32(out, count);
+	put_le64(out, index.image_size);
+	for (uint32_t i = 0; i < count; i++) {
+		put_le32(out, index.frame_sizes[i]);
+		const uint8_t *digest = &index.digests[(size_t)i * Sha256::kDigestSize];
+		out.insert(out.end(), digest, digest + Sha256::kDigestSize);
+	}
+	out.insert(out.end(), index.root, index.root + Sha256::kDigestSize);
+	put_le32(out, frame_size);
+	put_le32(out, kIndexMagic);
+}
+
+int backup_index_load(int fd, BackupIndex *index)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return -errno;
+	if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size < kIndexOverhead)
+		return -ENOENT;
+
+	uint8_t footer[8];
+	int ret = pread_full(fd, footer, sizeof(footer), st.st_size - 8);
+	if (ret < 0)
+		return ret;
+	uint32_t frame_size = le32(footer);
+	if (le32(footer + 4) != kIndexMagic)
+		return -ENOENT;
+	if (frame_size < kIndexOverhead || frame_size > (uint64_t)st.st_size ||
+	    (frame_size - kIndexOverhead) % kEntrySize)
+		return -EBADMSG;
+
+	std::vector<uint8_t> frame(frame_size);
+	ret = pread_full(fd, frame.data(), frame_size, st.st_size - frame_size);
+	if (ret < 0)
+		return ret;
+	const uint8_t *p = frame.data();
+	uint32_t count = (uint32_t)((frame_size - kIndexOverhead) / kEntrySize);
+	if (le32(p) != kSkippableMagic || le32(p + 4) != frame_size - 8 || le32(p + 8) != kIndexMagic ||
+	    le32(p + 12) != kIndexVersion || le32(p + 20) != count)
+		return -EBADMSG;
+
+	index->chunk_size = le32(p + 16);
+	index->image_size = le64(p + 24);
+	if (!index->chunk_size || (index->image_size + index->chunk_size - 1) / index->chunk_size != count)
+		return -EBADMSG;
+	index->frame_sizes.resize(count);
+	index->digests.resize((size_t)count * Sha256::kDigestSize);
+	p += 32;
+	for (uint32_t i = 0; i < count; i++, p += kEntrySize) {
+		index->frame_sizes[i] = le32(p);
+		memcpy(&index->digests[(size_t)i * Sha256::kDigestSize], p + 4, Sha256::kDigestSize);
+	}
+	memcpy(index->root, p, Sha256::kDigestSize);
+	return 0;
+}
+
+} // namespace recovery
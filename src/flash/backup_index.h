@@ -0,0 +1,47 @@
+#pragma once
+
+#include "crypto/sha256.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace recovery {
+
+// Default backup chunk: small enough that a compressor per core fits in a
+// 256 MB box, large enough for zstd to find its matches.
+const uint32_t kBackupChunkSize = 1 << 20;
+
+// Index of a backup archive (see BackupWriter). The archive is a plain
+// series of zstd frames, one per |chunk_size| piece of the partition, so
+// any zstd or the parallel restore decoder reads it as an .img.zst. The
+// index follows as a zstd skippable frame, which decoders pass over:
+//
+//	u32 0x184d2a5b, u32 payload length             skippable frame header
+//	u32 "RUBK", u32 version, u32 chunk_size, u32 chunk_count, u64 image_size
+//	chunk_count x { u32 frame size, SHA-256 of the chunk }
+//	tree digest root (see tree_hash.h, leaf = chunk_size)
+//	u32 index frame size, u32 "RUBK"                footer, found from EOF
+//
+// all little-endian, as zstd itself is. Frame sizes locate every chunk
+// without decompressing, and the digests are the tree digest's leaves, so
+// a restore can verify the image in parallel and tell which chunks of a
+// partition differ from the backup.
+struct BackupIndex {
+	uint32_t chunk_size = 0;
+	uint64_t image_size = 0;
+	std::vector<uint32_t> frame_sizes;
+	// Sha256::kDigestSize bytes per chunk.
+	std::vector<uint8_t> digests;
+	uint8_t root[Sha256::kDigestSize] = {};
+
+	uint32_t chunk_count() const { return (uint32_t)frame_sizes.size(); }
+};
+
+// Appends the index frame for |index| to |out|.
+void backup_index_encode(const BackupIndex &index, std::vector<uint8_t> &out);
+// Reads the index at the end of the archive open on |fd|. Returns 0,
+// -ENOENT if the file has none (e.g. an ordinary .zst), -EBADMSG if it is
+// corrupt, or another -errno.
+int backup_index_load(int fd, BackupIndex *index);
+
+} // namespace recovery
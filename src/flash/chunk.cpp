@@ -0,0 +1,143 @@
+#include "flash/chunk.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace recovery {
+
+static Counter s_pool_stalls("recovery_flash_pool_stalls_total", "", "Times a flash stage found the chunk pool empty.");
+static Counter s_pool_stall_time("recovery_flash_pool_stall_seconds_total", "",
+				 "Time flash stages waited for a free chunk.", 1e-6);
+
+ChunkPool::ChunkPool(size_t count, size_t chunk_size) : m_chunk_size(chunk_size), m_free(count)
+{
+	void *memory;
+	if (posix_memalign(&memory, 4096, count * chunk_size)) {
+		log_error("flash: cannot allocate %zu x %zu KiB chunks", count, chunk_size / 1024);
+		return;
+	}
+	m_memory = (uint8_t *)memory;
+
+	m_chunks.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		m_chunks[i].data = m_memory + i * chunk_size;
+		m_chunks[i].capacity = chunk_size;
+		m_free.push(&m_chunks[i]);
+	}
+}
+
+ChunkPool::~ChunkPool()
+{
+	free(m_memory);
+}
+
+Chunk *ChunkPool::get()
+{
+	Chunk *chunk;
+	if (!m_free.try_pop(chunk)) {
+		TRACE_SCOPE("flash", "pool_stall");
+		uint64_t start = monotonic_us();
+		bool ok = m_free.pop(chunk);
+		uint64_t waited = monotonic_us() - start;
+		m_stall_us.fetch_add(waited, std::memory_order_relaxed);
+		s_pool_stalls.add();
+		s_pool_stall_time.add(waited);
+		uint64_t stalls = m_stalls.fetch_add(1, std::memory_order_relaxed) + 1;
+		TRACE_COUNTER("flash", "pool_stalls", stalls);
+		if (!ok)
+			return nullptr;
+	}
+	chunk->size = 0;
+	chunk->offset = 0;
+	return chunk;
+}
+
+void ChunkPool::put(Chunk *chunk)
+{
+	if (chunk)
+		m_free.push(chunk);
+}
+
+ChunkWriter::~ChunkWriter()
+{
+	m_pool.put(m_current);
+}
+
+uint8_t *ChunkWriter::reserve(size_t *avail)
+{
+	if (!m_current) {
+		uint64_t start = monotonic_us();
+		m_current = m_pool.get();
+		m_stall_us += monotonic_us() - start;
+		if (!m_current)
+			return nullptr;
+		m_current->offset = m_offset;
+	}
+	*avail = m_current->capacity - m_current->size;
+	return m_current->data + m_current->size;
+}
+
+bool ChunkWriter::commit(size_t n)
+{
+	m_current->size += n;
+	m_offset += n;
+	if (m_current->size < m_current->capacity)
+		return true;
+	Chunk *full = m_current;
+	m_current = nullptr;
+	return push(full);
+}
+
+bool ChunkWriter::write(const uint8_t *data, size_t len)
+{
+	while (len) {
+		size_t avail;
+		uint8_t *dst = reserve(&avail);
+		if (!dst)
+			return false;
+		size_t n = avail < len ? avail : len;
+		memcpy(dst, data, n);
+		data += n;
+		len -= n;
+		if (!commit(n))
+			return false;
+	}
+	return true;
+}
+
+bool ChunkWriter::forward(Chunk *chunk)
+{
+	if (!flush()) {
+		m_pool.put(chunk);
+		return false;
+	}
+	chunk->offset = m_offset;
+	m_offset += chunk->size;
+	return push(chunk);
+}
+
+bool ChunkWriter::flush()
+{
+	if (!m_current || !m_current->size)
+		return true;
+	Chunk *partial = m_current;
+	m_current = nullptr;
+	return push(partial);
+}
+
+bool ChunkWriter::push(Chunk *chunk)
+{
+	uint64_t start = monotonic_us();
+	bool ok = m_queue.push(chunk);
+	m_stall_us += monotonic_us() - start;
+	if (!ok)
+		m_pool.put(chunk);
+	return ok;
+}
+
+} // namespace recovery
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "common/bounded_queue.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace recovery {
+
+// A buffer travelling down the flash pipeline. |offset| is the position of
+// data[0] in the stream the stage produces (compressed input for the
+// reader, the partition image after decoding).
+struct Chunk {
+	uint8_t *data = nullptr;
+	size_t capacity = 0;
+	size_t size = 0;
+	uint64_t offset = 0;
+};
+
+using ChunkQueue = BoundedQueue<Chunk *>;
+
+// Preallocated, page-aligned chunks shared by all stages of one pipeline.
+// Stages never allocate on the data path; they take a chunk here and the
+// last stage returns it.
+class ChunkPool {
+public:
+	ChunkPool(size_t count, size_t chunk_size);
+	~ChunkPool();
+
+	ChunkPool(const ChunkPool &) = delete;
+	ChunkPool &operator=(const ChunkPool &) = delete;
+
+	bool valid() const { return m_memory != nullptr; }
+	size_t count() const { return m_chunks.size(); }
+	size_t chunk_size() const { return m_chunk_size; }
+	size_t free_count() const { return m_free.size(); }
+	// get() calls that found the pool empty, and the time they waited.
+	uint64_t stalls() const { return m_stalls.load(std::memory_order_relaxed); }
+	uint64_t stall_us() const { return m_stall_us.load(std::memory_order_relaxed); }
+
+	// Blocks until a chunk is free; nullptr once the pool is aborted.
+	Chunk *get();
+	void put(Chunk *chunk);
+	void abort() { m_free.abort(); }
+
+private:
+	size_t m_chunk_size;
+	uint8_t *m_memory = nullptr;
+	std::vector<Chunk> m_chunks;
+	ChunkQueue m_free;
+	std::atomic<uint64_t> m_stalls{ 0 };
+	std::atomic<uint64_t> m_stall_us{ 0 };
+};
+
+// Output side of a stage: fills pool chunks and pushes each downstream once
+// full, numbering them with consecutive stream offsets. Decoders write into
+// reserve()d space directly so decoded data is never copied twice.
+class ChunkWriter {
+public:
+	// Offsets start at |offset|, e.g. where a resumed flash picks up.
+	ChunkWriter(ChunkPool &pool, ChunkQueue &queue, uint64_t offset = 0)
+		: m_pool(pool), m_queue(queue), m_start(offset), m_offset(offset)
+	{
+	}
+	~ChunkWriter();
+
+	// Returns writable space (at least one byte) and its size in |avail|,
+	// or nullptr if the pipeline was aborted.
+	uint8_t *reserve(size_t *avail);
+	// Accounts |n| bytes written into the last reserve()d space.
+	bool commit(size_t n);
+	// Copies |len| bytes; false if the pipeline was aborted.
+	bool write(const uint8_t *data, size_t len);
+	// Sends a chunk that already holds finished output, e.g. from a
+	// passthrough decoder. Any partial chunk is flushed first.
+	bool forward(Chunk *chunk);
+	// Pushes the partially filled chunk, if any.
+	bool flush();
+
+	// Bytes passed on so far.
+	uint64_t bytes() const { return m_offset - m_start; }
+	// Time spent blocked on the pool or on a full downstream queue.
+	uint64_t stall_us() const { return m_stall_us; }
+
+private:
+	bool push(Chunk *chunk);
+
+	ChunkPool &m_pool;
+	ChunkQueue &m_queue;
+	Chunk *m_current = nullptr;
+	uint64_t m_start;
+	uint64_t m_offset;
+	uint64_t m_stall_us = 0;
+};
+
+} // namespace recovery
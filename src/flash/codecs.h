@@ -0,0 +1,20 @@
+#pragma once
+
+// Factories for the optional decoders; each is only built when the Makefile
+// found its library. Use make_decoder() instead of calling these directly.
+
+#include "flash/decoder.h"
+
+namespace recovery {
+
+std::unique_ptr<Decoder> make_gzip_decoder();
+std::unique_ptr<Decoder> make_xz_decoder(unsigned threads);
+std::unique_ptr<Decoder> make_zstd_decoder(unsigned threads);
+std::unique_ptr<Decoder> make_bzip2_decoder(unsigned threads);
+// With |index|, resumes at |first_chunk| (see make_resume_decoder()).
+std::unique_ptr<Decoder> make_container_decoder(unsigned threads, const ContainerIndex *index = nullptr,
+						uint32_t first_chunk = 0);
+std::unique_ptr<Decoder> make_tar_decoder();
+std::unique_ptr<Decoder> make_zip_decoder();
+
+} // namespace recovery
@@ -0,0 +1,243 @@
+#include "flash/container.h"
+
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace recovery {
+
+static_assert(Sha256::kDigestSize == sizeof(ContainerBlob::digest), "blob digest size");
+
+// Loose upper bound on a compressed chunk, a little above zstd's own.
+static size_t max_stored_size(size_t raw)
+{
+	return raw + raw / 128 + 4096;
+}
+
+static size_t index_size(uint32_t chunk_count, uint32_t blob_count)
+{
+	return sizeof(ContainerHeader) + 4 * (size_t)chunk_count + sizeof(ContainerBlob) * (size_t)blob_count +
+	       Sha256::kDigestSize;
+}
+
+size_t ContainerIndex::chunk_length(uint32_t chunk) const
+{
+	uint64_t start = (uint64_t)chunk * header.chunk_size;
+	uint64_t left = header.image_size - start;
+	return left < header.chunk_size ? (size_t)left : header.chunk_size;
+}
+
+uint64_t ContainerIndex::blob_offset(uint32_t blob) const
+{
+	uint64_t offset = header.index_size;
+	for (uint32_t i = 0; i < blob; i++)
+		offset += blobs[i].stored_size;
+	return offset;
+}
+
+uint32_t ContainerIndex::resume_blobs(uint32_t chunk, std::vector<uint32_t> &kept) const
+{
+	uint32_t first_new = 0;
+	for (uint32_t i = 0; i < chunk && i < header.chunk_count; i++)
+		first_new = std::max(first_new, chunk_blob[i] + 1);
+	kept.clear();
+	for (uint32_t b = 0; b < first_new; b++) {
+		if (last_use[b] >= chunk)
+			kept.push_back(b);
+	}
+	return first_new;
+}
+
+void ContainerIndex::resume_ranges(uint32_t chunk, std::vector<std::pair<uint64_t, uint64_t>> &out) const
+{
+	std::vector<uint32_t> kept;
+	uint32_t first_new = resume_blobs(chunk, kept);
+	out.clear();
+	uint64_t offset = header.index_size;
+	size_t next = 0;
+	for (uint32_t b = 0; b < first_new; b++) {
+		if (next < kept.size() && kept[next] == b) {
+			out.emplace_back(offset, blobs[b].stored_size);
+			next++;
+		}
+		offset += blobs[b].stored_size;
+	}
+	uint64_t rest = 0;
+	for (uint32_t b = first_new; b < header.blob_count; b++)
+		rest += blobs[b].stored_size;
+	if (rest)
+		out.emplace_back(offset, rest);
+}
+
+void ContainerIndex::chunk_digests(std::vector<uint8_t> &out) const
+{
+	out.resize((size_t)header.chunk_count * Sha256::kDigestSize);
+	for (uint32_t i = 0; i < header.chunk_count; i++)
+		memcpy(&out[(size_t)i * Sha256::kDigestSize], blobs[chunk_blob[i]].digest, Sha256::kDigestSize);
+}
+
+ssize_t container_index_size(const uint8_t *data, size_t len)
+{
+	if (len < sizeof(ContainerHeader))
+		return 0;
+	ContainerHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, kContainerMagic, sizeof(kContainerMagic)) || header.version != kContainerVersion ||
+	    header.index_size < sizeof(ContainerHeader) || header.index_size > kContainerMaxIndex)
+		return -EBADMSG;
+	return header.index_size;
+}
+
+int container_parse_index(const uint8_t *data, size_t len, ContainerIndex *index)
+{
+	ssize_t size = container_index_size(data, len);
+	if (size <= 0 || (size_t)size > len)
+		return -EBADMSG;
+	ContainerHeader &h = index->header;
+	memcpy(&h, data, sizeof(h));
+	if (h.chunk_size < kContainerMinChunk || h.chunk_size > kContainerMaxChunk ||
+	    (h.image_size + h.chunk_size - 1) / h.chunk_size != h.chunk_count || h.blob_count > h.chunk_count ||
+	    index_size(h.chunk_count, h.blob_count) != (size_t)size)
+		return -EBADMSG;
+
+	uint8_t digest[Sha256::kDigestSize];
+	Sha256::digest(data, size - Sha256::kDigestSize, digest);
+	if (memcmp(digest, data + size - Sha256::kDigestSize, sizeof(digest)))
+		return -EBADMSG;
+
+	const uint8_t *p = data + sizeof(ContainerHeader);
+	index->chunk_blob.resize(h.chunk_count);
+	memcpy(index->chunk_blob.data(), p, 4 * (size_t)h.chunk_count);
+	p += 4 * (size_t)h.chunk_count;
+	index->blobs.resize(h.blob_count);
+	memcpy(index->blobs.data(), p, sizeof(ContainerBlob) * (size_t)h.blob_count);
+
+	// Blobs must first appear in order and have one raw size.
+	index->last_use.assign(h.blob_count, 0);
+	std::vector<size_t> raw(h.blob_count, 0);
+	uint32_t seen = 0;
+	for (uint32_t i = 0; i < h.chunk_count; i++) {
+		uint32_t b = index->chunk_blob[i];
+		if (b > seen || b >= h.blob_count)
+			return -EBADMSG;
+		if (b == seen) {
+			const ContainerBlob &blob = index->blobs[b];
+			raw[b] = index->chunk_length(i);
+			if (blob.codec > kContainerZstd || !blob.stored_size ||
+			    blob.stored_size > max_stored_size(raw[b]) ||
+			    (blob.codec == kContainerStored && blob.stored_size != raw[b]))
+				return -EBADMSG;
+			seen++;
+		} else if (raw[b] != index->chunk_length(i)) {
+			return -EBADMSG;
+		}
+		index->last_use[b] = i;
+	}
+	if (seen != h.blob_count)
+		return -EBADMSG;
+
+	// Replay what a streaming reader keeps for later chunks.
+	unsigned live = 0;
+	std::vector<bool> started(h.blob_count, false);
+	for (uint32_t i = 0; i < h.chunk_count; i++) {
+		uint32_t b = index->chunk_blob[i];
+		if (!started[b]) {
+			started[b] = true;
+			if (index->last_use[b] > i && ++live > kContainerMaxRetained)
+				return -EBADMSG;
+		} else if (index->last_use[b] == i) {
+			live--;
+		}
+	}
+	return 0;
+}
+
+int container_read_index(int fd, ContainerIndex *index)
+{
+	ContainerHeader header;
+	ssize_t n = pread(fd, &header, sizeof(header), 0);
+	if (n < 0)
+		return -errno;
+	ssize_t size = container_index_size((const uint8_t *)&header, (size_t)n);
+	if (size <= 0)
+		return -EBADMSG;
+	std::vector<uint8_t> data((size_t)size);
+	n = pread(fd, data.data(), data.size(), 0);
+	if (n < 0)
+		return -errno;
+	return container_parse_index(data.data(), (size_t)n, index);
+}
+
+void container_encode_index(ContainerIndex &index, std::vector<uint8_t> &out)
+{
+	ContainerHeader &h = index.header;
+	memcpy(h.magic, kContainerMagic, sizeof(kContainerMagic));
+	h.version = kContainerVersion;
+	h.chunk_count = (uint32_t)index.chunk_blob.size();
+	h.blob_count = (uint32_t)index.blobs.size();
+	h.index_size = (uint32_t)index_size(h.chunk_count, h.blob_count);
+
+	size_t start = out.size();
+	out.resize(start + h.index_size);
+	uint8_t *p = out.data() + start;
+	memcpy(p, &h, sizeof(h));
+	p += sizeof(h);
+	memcpy(p, index.chunk_blob.data(), 4 * index.chunk_blob.size());
+	p += 4 * index.chunk_blob.size();
+	memcpy(p, index.blobs.data(), sizeof(ContainerBlob) * index.blobs.size());
+	p += sizeof(ContainerBlob) * index.blobs.size();
+	Sha256::digest(out.data() + start, (size_t)(p - (out.data() + start)), p);
+}
+
+bool ContainerPlanner::Digest::operator==(const Digest &o) const
+{
+	return !memcmp(bytes, o.bytes, sizeof(bytes));
+}
+
+size_t ContainerPlanner::DigestHash::operator()(const Digest &d) const
+{
+	size_t h;
+	memcpy(&h, d.bytes, sizeof(h));
+	return h;
+}
+
+uint32_t ContainerPlanner::add(const uint8_t digest[32], bool *is_new)
+{
+	Digest key;
+	memcpy(key.bytes, digest, sizeof(key.bytes));
+	uint32_t chunk = m_chunk++;
+
+	auto it = m_by_digest.find(key);
+	if (it != m_by_digest.end()) {
+		// Holding the blob from its last use until now overlaps at most the
+		// retained blobs still needed after that use.
+		Use &use = it->second;
+		unsigned live = 1;
+		for (const Use &r : m_retained)
+			live += r.blob != use.blob && r.last > use.last;
+		if (live <= kContainerMaxRetained) {
+			bool found = false;
+			for (Use &r : m_retained) {
+				if (r.blob == use.blob) {
+					r.last = chunk;
+					found = true;
+				}
+			}
+			if (!found)
+				m_retained.push_back({ use.blob, chunk });
+			use.last = chunk;
+			*is_new = false;
+			return use.blob;
+		}
+	}
+
+	uint32_t blob = m_blob_count++;
+	m_by_digest[key] = { blob, chunk };
+	*is_new = true;
+	return blob;
+}
+
+} // namespace recovery
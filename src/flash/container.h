@@ -0,0 +1,81 @@
+#pragma once
+
+#include "flash/container_format.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace recovery {
+
+// A parsed container index (see container_format.h).
+struct ContainerIndex {
+	ContainerHeader header = {};
+	std::vector<uint32_t> chunk_blob;
+	std::vector<ContainerBlob> blobs;
+	// Last chunk referencing each blob.
+	std::vector<uint32_t> last_use;
+
+	// Raw size of |chunk|; only the last one may be short.
+	size_t chunk_length(uint32_t chunk) const;
+	// File offset of each blob, for range reads.
+	uint64_t blob_offset(uint32_t blob) const;
+	// What a reader picking up at |chunk| needs, in stream order: the blobs
+	// first used before |chunk| that later chunks repeat (at most
+	// kContainerMaxRetained, put in |kept|), then every blob from the first
+	// new one on, which is returned.
+	uint32_t resume_blobs(uint32_t chunk, std::vector<uint32_t> &kept) const;
+	// The (offset, length) ranges of the file holding them.
+	void resume_ranges(uint32_t chunk, std::vector<std::pair<uint64_t, uint64_t>> &out) const;
+	// SHA-256 of every chunk in order, the leaves of |root|.
+	void chunk_digests(std::vector<uint8_t> &out) const;
+};
+
+// Size of the whole index from the first sizeof(ContainerHeader) bytes of
+// a stream: 0 if more are needed, -EBADMSG if this is not a container.
+ssize_t container_index_size(const uint8_t *data, size_t len);
+// Checks the index digest, that blobs appear in first-use order and that
+// no more than kContainerMaxRetained are ever needed again at once.
+// Returns 0 or -EBADMSG.
+int container_parse_index(const uint8_t *data, size_t len, ContainerIndex *index);
+// Reads and parses the index at the start of the file |fd|. Returns 0,
+// -EBADMSG if it holds no valid container, or -errno.
+int container_read_index(int fd, ContainerIndex *index);
+// Serializes |index|, filling in index_size and the digest. The root and
+// blob table must be complete.
+void container_encode_index(ContainerIndex &index, std::vector<uint8_t> &out);
+
+// Decides, chunk by chunk, which blob each goes into: an earlier one with
+// the same digest whenever a reader can keep that blob until then within
+// kContainerMaxRetained, otherwise a new one.
+class ContainerPlanner {
+public:
+	// Returns the blob for the next chunk; *is_new when it must be stored.
+	uint32_t add(const uint8_t digest[32], bool *is_new);
+
+	uint32_t blob_count() const { return m_blob_count; }
+
+private:
+	struct Digest {
+		uint8_t bytes[32];
+		bool operator==(const Digest &o) const;
+	};
+	struct DigestHash {
+		size_t operator()(const Digest &d) const;
+	};
+	struct Use {
+		uint32_t blob;
+		uint32_t last;
+	};
+
+	std::unordered_map<Digest, Use, DigestHash> m_by_digest;
+	// Blobs used more than once, with their last use so far.
+	std::vector<Use> m_retained;
+	uint32_t m_chunk = 0;
+	uint32_t m_blob_count = 0;
+};
+
+} // namespace recovery
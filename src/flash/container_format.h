@@ -0,0 +1,69 @@
+#pragma once
+
+// On-disk layout of a RUIC image container, shared by tools/mkruic and the
+// runtime reader. All fields are little-endian.
+//
+//   ContainerHeader
+//   uint32_t[chunk_count]     blob holding each chunk of the image
+//   ContainerBlob[blob_count]
+//   SHA-256 of everything above
+//   blobs                     back to back in blob order, from index_size on
+//
+// The image is cut into |chunk_size| chunks (the last may be short), each
+// compressed and hashed on its own. Chunks with the same content share one
+// blob, named by its SHA-256, so the all-zero chunks of a filesystem image
+// cost one blob between them. Because the index comes first and gives
+// every blob's size, a reader can:
+//
+//   - decode blobs on all cores as they stream in,
+//   - fetch any chunk on its own with a range request, so a download
+//     resumes at the first missing blob and peers can trade blobs by name,
+//   - skip chunks whose digest matches what the partition already holds.
+//
+// Blobs are stored in the order their first chunk appears, so a streaming
+// reader never waits on a later one. A chunk repeating an earlier blob is
+// served from memory; the packer keeps no more than kContainerMaxRetained
+// blobs needed again at any point, which bounds what a reader holds.
+// |root| is the tree digest (see tree_hash.h) of the image with a leaf of
+// |chunk_size|, which the chunk digests are the leaves of.
+
+#include <stdint.h>
+
+namespace recovery {
+
+static const char kContainerMagic[4] = { 'R', 'U', 'I', 'C' };
+static const uint32_t kContainerVersion = 1;
+static const uint32_t kContainerMinChunk = 4096;
+static const uint32_t kContainerMaxChunk = 8 << 20;
+static const uint32_t kContainerMaxIndex = 16 << 20;
+static const unsigned kContainerMaxRetained = 8;
+
+enum ContainerCodec : uint8_t {
+	kContainerStored = 0,
+	kContainerZstd = 1,
+};
+
+struct ContainerHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+	uint64_t image_size;
+	uint32_t blob_count;
+	// Header, tables and their digest; the first blob starts here.
+	uint32_t index_size;
+	uint8_t root[32];
+};
+
+struct ContainerBlob {
+	uint32_t stored_size;
+	uint8_t codec;
+	uint8_t reserved[3];
+	// SHA-256 of the chunk's content, not of the stored bytes.
+	uint8_t digest[32];
+};
+
+static_assert(sizeof(ContainerHeader) == 64, "ContainerHeader layout");
+static_assert(sizeof(ContainerBlob) == 40, "ContainerBlob layout");
+
+} // namespace recovery
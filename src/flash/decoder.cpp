@@ -0,0 +1,140 @@
+#include "flash/decoder.h"
+
+#include "common/log.h"
+#include "flash/codecs.h"
+#include "flash/container_format.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace recovery {
+
+int RawDecoder::decode(const uint8_t *data, size_t len, ChunkWriter &out)
+{
+	return out.write(data, len) ? 0 : -ECANCELED;
+}
+
+static const struct {
+	Compression compression;
+	const char *name;
+} s_names[] = {
+	{ Compression::Raw, "raw" },
+	{ Compression::Gzip, "gz" },
+	{ Compression::Xz, "xz" },
+	{ Compression::Zstd, "zst" },
+	{ Compression::Bzip2, "bz2" },
+	{ Compression::Container, "ruic" },
+	{ Compression::Tar, "tar" },
+	{ Compression::Zip, "zip" },
+};
+
+const char *compression_name(Compression c)
+{
+	for (const auto &n : s_names)
+		if (n.compression == c)
+			return n.name;
+	return "?";
+}
+
+bool compression_from_name(const char *name, Compression *c)
+{
+	for (const auto &n : s_names) {
+		if (!strcmp(n.name, name)) {
+			*c = n.compression;
+			return true;
+		}
+	}
+	return false;
+}
+
+Compression detect_compression(const uint8_t *head, size_t len)
+{
+	static const uint8_t xz_magic[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+	static const uint8_t zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+	if (len >= sizeof(xz_magic) && !memcmp(head, xz_magic, sizeof(xz_magic)))
+		return Compression::Xz;
+	if (len >= sizeof(zstd_magic) && !memcmp(head, zstd_magic, sizeof(zstd_magic)))
+		return Compression::Zstd;
+	// pzstd output starts with a skippable frame, magic 0x184d2a5?.
+	if (len >= 4 && (head[0] & 0xf0) == 0x50 && head[1] == 0x2a && head[2] == 0x4d && head[3] == 0x18)
+		return Compression::Zstd;
+	if (len >= 4 && head[0] == 'B' && head[1] == 'Z' && head[2] == 'h' && head[3] >= '1' && head[3] <= '9')
+		return Compression::Bzip2;
+	if (len >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+		return Compression::Gzip;
+	if (len >= sizeof(kContainerMagic) && !memcmp(head, kContainerMagic, sizeof(kContainerMagic)))
+		return Compression::Container;
+	if (len >= 4 && head[0] == 'P' && head[1] == 'K' && head[2] == 3 && head[3] == 4)
+		return Compression::Zip;
+	// POSIX and GNU tar both have "ustar" at 257.
+	if (len >= 262 && !memcmp(head + 257, "ustar", 5))
+		return Compression::Tar;
+	return Compression::Raw;
+}
+
+unsigned default_decoder_threads()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+}
+
+std::unique_ptr<Decoder> make_decoder(Compression c, unsigned threads)
+{
+	std::unique_ptr<Decoder> decoder;
+	switch (c) {
+	case Compression::Raw:
+		decoder.reset(new RawDecoder());
+		break;
+	case Compression::Tar:
+		decoder = make_tar_decoder();
+		break;
+#ifdef HAVE_ZLIB
+	case Compression::Gzip:
+		decoder = make_gzip_decoder();
+		break;
+	case Compression::Zip:
+		decoder = make_zip_decoder();
+		break;
+#endif
+#ifdef HAVE_LZMA
+	case Compression::Xz:
+		decoder = make_xz_decoder(threads);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case Compression::Zstd:
+		decoder = make_zstd_decoder(threads);
+		break;
+	case Compression::Container:
+		decoder = make_container_decoder(threads);
+		break;
+#endif
+#ifdef HAVE_BZIP2
+	case Compression::Bzip2:
+		decoder = make_bzip2_decoder(threads);
+		break;
+#endif
+	default:
+		log_error("flash: %s images are not supported by this build", compression_name(c));
+		break;
+	}
+	(void)threads;
+	return decoder;
+}
+
+std::unique_ptr<Decoder> make_resume_decoder(const ContainerIndex &index, uint32_t first_chunk, unsigned threads)
+{
+#ifdef HAVE_ZSTD
+	return make_container_decoder(threads, &index, first_chunk);
+#else
+	(void)index;
+	(void)first_chunk;
+	(void)threads;
+	log_error("flash: ruic images are not supported by this build");
+	return nullptr;
+#endif
+}
+
+} // namespace recovery
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "flash/chunk.h"
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+struct ContainerIndex;
+
+// Turns the source stream into the partition image.
+class Decoder {
+public:
+	virtual ~Decoder() = default;
+
+	virtual const char *name() const = 0;
+	// Decodes |len| bytes of input, emitting output through |out|. Returns
+	// 0 or a negative errno; -EBADMSG for corrupt input.
+	virtual int decode(const uint8_t *data, size_t len, ChunkWriter &out) = 0;
+	// Called after the last input. Must fail if the stream was truncated.
+	virtual int finish(ChunkWriter &) { return 0; }
+	// Passthrough decoders let the pipeline forward input chunks untouched.
+	virtual bool passthrough() const { return false; }
+};
+
+// Uncompressed images.
+class RawDecoder : public Decoder {
+public:
+	const char *name() const override { return "raw"; }
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override;
+	bool passthrough() const override { return true; }
+};
+
+enum class Compression {
+	Raw,
+	Gzip,
+	Xz,
+	Zstd,
+	Bzip2,
+	// Chunked RUIC container, see container_format.h.
+	Container,
+	// Legacy archives holding a raw image.
+	Tar,
+	Zip,
+};
+
+const char *compression_name(Compression c);
+// Parses "raw", "gz", "xz", "zst", "bz2", "ruic", "tar" or "zip"; false if
+// unknown.
+bool compression_from_name(const char *name, Compression *c);
+// Identifies the compression from the first bytes of a stream; tar needs
+// kDetectBytes of them. Anything without a known magic is treated as a raw
+// image.
+const size_t kDetectBytes = 512;
+Compression detect_compression(const uint8_t *head, size_t len);
+
+// Number of worker threads decoders use by default: one per online CPU.
+unsigned default_decoder_threads();
+
+// Creates a decoder for |c| using up to |threads| threads. Returns nullptr
+// if support for |c| was not built in.
+std::unique_ptr<Decoder> make_decoder(Compression c, unsigned threads = default_decoder_threads());
+// Decodes the RUIC container described by |index| from chunk |first_chunk|
+// on, to resume an interrupted flash. The stream must be the file ranges
+// index.resume_ranges(first_chunk) back to back.
+// Returns nullptr if containers are not built in.
+std::unique_ptr<Decoder> make_resume_decoder(const ContainerIndex &index, uint32_t first_chunk,
+					     unsigned threads = default_decoder_threads());
+
+} // namespace recovery
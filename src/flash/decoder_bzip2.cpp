@@ -0,0 +1,152 @@
+#include "flash/codecs.h"
+#include "flash/parallel_decoder.h"
+
+#include <bzlib.h>
+#include <errno.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+// "BZh" + level + first block magic (pi in BCD).
+const uint8_t kBlockMagic[] = { 0x31, 0x41, 0x59, 0x26, 0x53, 0x59 };
+const size_t kHeaderSize = 4 + sizeof(kBlockMagic);
+
+bool is_stream_header(const uint8_t *p)
+{
+	return p[0] == 'B' && p[1] == 'Z' && p[2] == 'h' && p[3] >= '1' && p[3] <= '9' &&
+	       !memcmp(p + 4, kBlockMagic, sizeof(kBlockMagic));
+}
+
+// pbzip2 and lbzip2 write one bz2 stream per 900k block; every stream ends
+// byte-aligned and decodes on its own, which is what we parallelise over.
+// A plain bzip2 file is a single stream and ends up in the serial path.
+class Bzip2Decoder : public ParallelFrameDecoder {
+public:
+	explicit Bzip2Decoder(unsigned threads) : ParallelFrameDecoder(threads)
+	{
+		memset(&m_stream, 0, sizeof(m_stream));
+		start_workers();
+	}
+
+	~Bzip2Decoder() override
+	{
+		stop_workers();
+		if (m_stream_open)
+			BZ2_bzDecompressEnd(&m_stream);
+	}
+
+	const char *name() const override { return "bz2"; }
+
+protected:
+	ssize_t frame_length(const uint8_t *data, size_t len, bool at_end) override
+	{
+		if (len < kHeaderSize)
+			return at_end ? -EBADMSG : 0;
+		if (memcmp(data, "BZh", 3))
+			return -EBADMSG;
+
+		// Resume the search where the previous call for this frame stopped.
+		size_t from = m_searched > kHeaderSize ? m_searched - kHeaderSize + 1 : 1;
+		for (const uint8_t *p = data + from; len - (p - data) >= kHeaderSize; p++) {
+			p = (const uint8_t *)memchr(p, 'B', len - (p - data) - kHeaderSize + 1);
+			if (!p)
+				break;
+			if (is_stream_header(p)) {
+				m_searched = 0;
+				return p - data;
+			}
+		}
+		if (at_end) {
+			m_searched = 0;
+			return (ssize_t)len;
+		}
+		m_searched = len;
+		return 0;
+	}
+
+	int decode_frame(unsigned, uint64_t, const uint8_t *data, size_t len, std::vector<uint8_t> &out) override
+	{
+		bz_stream s;
+		memset(&s, 0, sizeof(s));
+		if (BZ2_bzDecompressInit(&s, 0, 0) != BZ_OK)
+			return -ENOMEM;
+
+		s.next_in = (char *)data;
+		s.avail_in = (unsigned)len;
+		int ret;
+		do {
+			size_t used = out.size();
+			if (used >= kMaxDecodedFrame) {
+				BZ2_bzDecompressEnd(&s);
+				return -E2BIG;
+			}
+			size_t grow = used ? used : 4 * len;
+			if (grow > kMaxDecodedFrame - used)
+				grow = kMaxDecodedFrame - used;
+			out.resize(used + grow);
+			s.next_out = (char *)out.data() + used;
+			s.avail_out = (unsigned)(out.size() - used);
+			ret = BZ2_bzDecompress(&s);
+			out.resize(out.size() - s.avail_out);
+		} while (ret == BZ_OK && (s.avail_in || !s.avail_out));
+		BZ2_bzDecompressEnd(&s);
+
+		// A frame boundary in the middle of a stream would surface here.
+		return ret == BZ_STREAM_END && !s.avail_in ? 0 : -EBADMSG;
+	}
+
+	int stream_decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		char *next_in = (char *)data;
+		unsigned avail_in = (unsigned)len;
+		for (;;) {
+			if (!m_stream_open) {
+				if (!avail_in)
+					return 0;
+				if (BZ2_bzDecompressInit(&m_stream, 0, 0) != BZ_OK)
+					return -ENOMEM;
+				m_stream_open = true;
+			}
+			size_t avail;
+			uint8_t *dst = out.reserve(&avail);
+			if (!dst)
+				return -ECANCELED;
+			m_stream.next_in = next_in;
+			m_stream.avail_in = avail_in;
+			m_stream.next_out = (char *)dst;
+			m_stream.avail_out = (unsigned)avail;
+			int ret = BZ2_bzDecompress(&m_stream);
+			next_in = m_stream.next_in;
+			avail_in = m_stream.avail_in;
+			if (!out.commit(avail - m_stream.avail_out))
+				return -ECANCELED;
+			if (ret == BZ_STREAM_END) {
+				// Concatenated streams: start over on the next one.
+				BZ2_bzDecompressEnd(&m_stream);
+				m_stream_open = false;
+			} else if (ret != BZ_OK) {
+				return -EBADMSG;
+			} else if (!avail_in && m_stream.avail_out) {
+				return 0;
+			}
+		}
+	}
+
+	int stream_finish(ChunkWriter &) override { return m_stream_open ? -EBADMSG : 0; }
+
+private:
+	size_t m_searched = 0;
+	bz_stream m_stream;
+	bool m_stream_open = false;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_bzip2_decoder(unsigned threads)
+{
+	return std::unique_ptr<Decoder>(new Bzip2Decoder(threads));
+}
+
+} // namespace recovery
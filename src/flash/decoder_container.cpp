@@ -0,0 +1,249 @@
+#include "common/log.h"
+#include "flash/codecs.h"
+#include "flash/container.h"
+#include "flash/parallel_decoder.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unordered_map>
+#include <zstd.h>
+
+namespace recovery {
+
+namespace {
+
+// RUIC containers (see container_format.h). The index is parsed on the
+// decode thread as it streams in; after it every blob is a frame of known
+// size, decoded on the workers. Chunks are then emitted in image order,
+// repeats of earlier blobs from the few kept for them.
+//
+// A resumed flash passes the index in instead, and the stream holds only
+// the blobs the remaining chunks need (see ContainerIndex::resume_blobs):
+// earlier ones they repeat, kept as they arrive, then the rest in order.
+class ContainerDecoder : public ParallelFrameDecoder {
+public:
+	ContainerDecoder(unsigned threads, const ContainerIndex *index, uint32_t first_chunk)
+		: ParallelFrameDecoder(threads), m_contexts(threads ? threads : 1)
+	{
+		for (ZSTD_DCtx *&ctx : m_contexts)
+			ctx = ZSTD_createDCtx();
+		if (index) {
+			m_index = *index;
+			adopt_index();
+			m_emitted = first_chunk;
+			m_prior_blobs = m_index.resume_blobs(first_chunk, m_resume_kept);
+		}
+		start_workers();
+	}
+
+	~ContainerDecoder() override
+	{
+		stop_workers();
+		for (ZSTD_DCtx *ctx : m_contexts)
+			ZSTD_freeDCtx(ctx);
+	}
+
+	const char *name() const override { return "ruic"; }
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		if (!m_have_index) {
+			size_t used = 0;
+			int ret = read_index(data, len, &used);
+			if (ret < 0 || !m_have_index)
+				return ret;
+			data += used;
+			len -= used;
+		}
+		return ParallelFrameDecoder::decode(data, len, out);
+	}
+
+	int finish(ChunkWriter &out) override
+	{
+		if (!m_have_index) {
+			log_error("flash: container index is cut short");
+			return -EBADMSG;
+		}
+		int ret = ParallelFrameDecoder::finish(out);
+		if (ret < 0)
+			return ret;
+		return m_emitted == m_index.header.chunk_count ? 0 : -EBADMSG;
+	}
+
+protected:
+	ssize_t frame_length(const uint8_t *, size_t len, bool at_end) override
+	{
+		uint32_t blob = blob_of(m_cut);
+		if (blob >= m_index.blobs.size())
+			return -EBADMSG;
+		size_t need = m_index.blobs[blob].stored_size;
+		if (len < need)
+			return at_end ? -EBADMSG : 0;
+		m_cut++;
+		return (ssize_t)need;
+	}
+
+	int decode_frame(unsigned worker, uint64_t frame, const uint8_t *data, size_t len,
+			 std::vector<uint8_t> &out) override
+	{
+		uint32_t index = blob_of(frame);
+		const ContainerBlob &blob = m_index.blobs[index];
+		out.resize(m_blob_length[index]);
+		if (blob.codec == kContainerStored) {
+			memcpy(out.data(), data, len);
+			return 0;
+		}
+		ZSTD_DCtx *ctx = m_contexts[worker];
+		if (!ctx)
+			return -ENOMEM;
+		size_t n = ZSTD_decompressDCtx(ctx, out.data(), out.size(), data, len);
+		return ZSTD_isError(n) || n != out.size() ? -EBADMSG : 0;
+	}
+
+	int emit_frame(uint64_t frame, const std::vector<uint8_t> &data, ChunkWriter &out) override
+	{
+		uint32_t blob = blob_of(frame);
+		if (blob < m_prior_blobs) {
+			// Resuming: first used before the resume point and kept for
+			// the repeats still to come.
+			m_kept[blob] = data;
+			return emit_repeats(out);
+		}
+		// The next chunk is this blob's first use; later chunks up to the
+		// next new blob repeat kept ones.
+		if (m_emitted == m_index.header.chunk_count || m_index.chunk_blob[m_emitted] != blob)
+			return -EBADMSG;
+		uint32_t chunk = m_emitted;
+		if (!emit_chunk(data.data(), data.size(), out))
+			return -ECANCELED;
+		if (m_index.last_use[blob] > chunk)
+			m_kept[blob] = data;
+		return emit_repeats(out);
+	}
+
+	int stream_decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		m_serial.insert(m_serial.end(), data, data + len);
+		size_t pos = 0;
+		int ret = 0;
+		while (pos < m_serial.size()) {
+			ssize_t n = frame_length(m_serial.data() + pos, m_serial.size() - pos, false);
+			if (n <= 0) {
+				ret = (int)n;
+				break;
+			}
+			uint64_t frame = m_cut - 1;
+			ret = decode_frame(0, frame, m_serial.data() + pos, (size_t)n, m_serial_out);
+			if (!ret)
+				ret = emit_frame(frame, m_serial_out, out);
+			pos += (size_t)n;
+			if (ret < 0)
+				break;
+		}
+		m_serial.erase(m_serial.begin(), m_serial.begin() + pos);
+		return ret;
+	}
+
+	int stream_finish(ChunkWriter &) override { return m_serial.empty() ? 0 : -EBADMSG; }
+
+private:
+	// Buffers the index; *used is how much of |data| it took.
+	int read_index(const uint8_t *data, size_t len, size_t *used)
+	{
+		*used = 0;
+		for (;;) {
+			size_t want = sizeof(ContainerHeader);
+			if (m_head.size() >= want) {
+				ssize_t size = container_index_size(m_head.data(), m_head.size());
+				if (size < 0) {
+					log_error("flash: not a container");
+					return (int)size;
+				}
+				want = (size_t)size;
+			}
+			if (m_head.size() >= want)
+				break;
+			size_t take = std::min(len - *used, want - m_head.size());
+			if (!take)
+				return 0;
+			m_head.insert(m_head.end(), data + *used, data + *used + take);
+			*used += take;
+		}
+
+		if (container_parse_index(m_head.data(), m_head.size(), &m_index) < 0) {
+			log_error("flash: container index is corrupt");
+			return -EBADMSG;
+		}
+		m_head.clear();
+		m_head.shrink_to_fit();
+		adopt_index();
+		return 0;
+	}
+
+	void adopt_index()
+	{
+		m_blob_length.assign(m_index.blobs.size(), 0);
+		for (uint32_t i = 0, seen = 0; i < m_index.header.chunk_count; i++) {
+			if (m_index.chunk_blob[i] == seen)
+				m_blob_length[seen++] = m_index.chunk_length(i);
+		}
+		m_have_index = true;
+	}
+
+	// Blob arriving as frame |frame| of the stream.
+	uint32_t blob_of(uint64_t frame) const
+	{
+		if (frame < m_resume_kept.size())
+			return m_resume_kept[(size_t)frame];
+		return m_prior_blobs + (uint32_t)(frame - m_resume_kept.size());
+	}
+
+	bool emit_chunk(const uint8_t *data, size_t len, ChunkWriter &out)
+	{
+		m_emitted++;
+		return out.write(data, len);
+	}
+
+	int emit_repeats(ChunkWriter &out)
+	{
+		while (m_emitted < m_index.header.chunk_count) {
+			uint32_t blob = m_index.chunk_blob[m_emitted];
+			auto it = m_kept.find(blob);
+			if (it == m_kept.end())
+				return 0; // a blob still to come
+			uint32_t chunk = m_emitted;
+			if (!emit_chunk(it->second.data(), it->second.size(), out))
+				return -ECANCELED;
+			if (m_index.last_use[blob] == chunk)
+				m_kept.erase(it);
+		}
+		return 0;
+	}
+
+	std::vector<ZSTD_DCtx *> m_contexts;
+	std::vector<uint8_t> m_head;
+	bool m_have_index = false;
+	ContainerIndex m_index;
+	std::vector<size_t> m_blob_length;
+	// Frames cut from the stream so far.
+	size_t m_cut = 0;
+	uint32_t m_emitted = 0;
+	// Resuming: blobs chunks before the resume point use, and those of
+	// them the stream starts with.
+	uint32_t m_prior_blobs = 0;
+	std::vector<uint32_t> m_resume_kept;
+	// Blobs some later chunk repeats, at most kContainerMaxRetained.
+	std::unordered_map<uint32_t, std::vector<uint8_t>> m_kept;
+	std::vector<uint8_t> m_serial;
+	std::vector<uint8_t> m_serial_out;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_container_decoder(unsigned threads, const ContainerIndex *index, uint32_t first_chunk)
+{
+	return std::unique_ptr<Decoder>(new ContainerDecoder(threads, index, first_chunk));
+}
+
+} // namespace recovery
@@ -0,0 +1,72 @@
+#include "flash/codecs.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zlib.h>
+
+namespace recovery {
+
+namespace {
+
+// Deflate has no independent blocks to split on, so this stays serial.
+// Concatenated members (pigz, cat a.gz b.gz) are decoded in sequence.
+class GzipDecoder : public Decoder {
+public:
+	GzipDecoder()
+	{
+		memset(&m_stream, 0, sizeof(m_stream));
+		m_ok = inflateInit2(&m_stream, 15 + 16) == Z_OK;
+	}
+
+	~GzipDecoder() override { inflateEnd(&m_stream); }
+
+	const char *name() const override { return "gz"; }
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		if (!m_ok)
+			return -ENOMEM;
+
+		m_stream.next_in = (Bytef *)data;
+		m_stream.avail_in = (uInt)len;
+		for (;;) {
+			if (m_member_done) {
+				if (!m_stream.avail_in)
+					return 0;
+				inflateReset(&m_stream);
+				m_member_done = false;
+			}
+			size_t avail;
+			uint8_t *dst = out.reserve(&avail);
+			if (!dst)
+				return -ECANCELED;
+			m_stream.next_out = dst;
+			m_stream.avail_out = (uInt)avail;
+			int ret = inflate(&m_stream, Z_NO_FLUSH);
+			if (!out.commit(avail - m_stream.avail_out))
+				return -ECANCELED;
+			if (ret == Z_STREAM_END)
+				m_member_done = true;
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return -EBADMSG;
+			else if (!m_stream.avail_in && m_stream.avail_out)
+				return 0;
+		}
+	}
+
+	int finish(ChunkWriter &) override { return m_member_done ? 0 : -EBADMSG; }
+
+private:
+	z_stream m_stream;
+	bool m_ok;
+	bool m_member_done = false;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_gzip_decoder()
+{
+	return std::unique_ptr<Decoder>(new GzipDecoder());
+}
+
+} // namespace recovery
@@ -0,0 +1,170 @@
+#include "common/log.h"
+#include "flash/codecs.h"
+#include "flash/tar_format.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+
+namespace recovery {
+
+namespace {
+
+const uint64_t kMaxExtendedHeader = 1024 * 1024;
+
+// Legacy tarball images (uncompressed tar). The first regular file is the
+// image, with the size and name pax or GNU long-name entries before it
+// give; directories before it are skipped, and whatever follows it is read
+// and dropped. Tar can only be walked from the front, so this is serial by
+// nature.
+class TarDecoder : public Decoder {
+public:
+	const char *name() const override { return "tar"; }
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		while (len) {
+			size_t n;
+			switch (m_state) {
+			case State::Header:
+				n = std::min(len, kTarBlock - m_fill);
+				memcpy(m_header + m_fill, data, n);
+				m_fill += n;
+				if (m_fill == kTarBlock) {
+					m_fill = 0;
+					int ret = parse_header();
+					if (ret < 0)
+						return ret;
+				}
+				break;
+			case State::Extended: {
+				n = (size_t)std::min<uint64_t>(len, m_left);
+				m_extended.insert(m_extended.end(), data, data + n);
+				m_left -= n;
+				int ret = m_left ? 0 : end_extended();
+				if (ret < 0)
+					return ret;
+				break;
+			}
+			case State::Skip:
+				n = (size_t)std::min<uint64_t>(len, m_left);
+				m_left -= n;
+				if (!m_left)
+					m_state = State::Header;
+				break;
+			case State::Image:
+				n = (size_t)std::min<uint64_t>(len, m_left);
+				if (!out.write(data, n))
+					return -ECANCELED;
+				m_left -= n;
+				if (!m_left)
+					m_state = State::Done;
+				break;
+			case State::Done:
+			default:
+				n = len;
+				break;
+			}
+			data += n;
+			len -= n;
+		}
+		return 0;
+	}
+
+	int finish(ChunkWriter &) override
+	{
+		if (m_state == State::Done)
+			return 0;
+		log_error("flash: tarball holds no complete image");
+		return -EBADMSG;
+	}
+
+private:
+	enum class State { Header, Extended, Skip, Image, Done };
+
+	int parse_header()
+	{
+		TarEntry entry;
+		int ret = tar_parse_header(m_header, &entry);
+		if (ret == 0) {
+			log_error("flash: tarball holds no image");
+			return -EBADMSG;
+		}
+		if (ret < 0) {
+			log_error("flash: not a tarball, or a corrupt header");
+			return ret;
+		}
+
+		uint64_t padded = entry.padded_size();
+		switch (entry.type) {
+		case TarType::PaxHeader:
+		case TarType::GnuLongName:
+		case TarType::GnuLongLink:
+			if (entry.size > kMaxExtendedHeader) {
+				log_error("flash: %llu byte extended tar header", (unsigned long long)entry.size);
+				return -EBADMSG;
+			}
+			m_extended_type = entry.type;
+			m_extended.clear();
+			m_state = State::Extended;
+			m_left = entry.size;
+			m_pad = padded - entry.size;
+			return m_left ? 0 : end_extended();
+		case TarType::PaxGlobal:
+			break;
+		default:
+			m_overrides.apply(&entry);
+			m_overrides.clear();
+			padded = entry.padded_size();
+			break;
+		}
+		if (entry.type == TarType::File && entry.size) {
+			log_debug("flash: tar member %s, %llu bytes", entry.path.c_str(), (unsigned long long)entry.size);
+			m_state = State::Image;
+			m_left = entry.size;
+		} else if (padded) {
+			m_state = State::Skip;
+			m_left = padded;
+		}
+		return 0;
+	}
+
+	// Takes what the extended header just read sets for the next entry.
+	int end_extended()
+	{
+		if (m_extended_type == TarType::PaxHeader) {
+			if (tar_parse_pax(m_extended.data(), m_extended.size(), &m_overrides) < 0) {
+				log_error("flash: corrupt pax header");
+				return -EBADMSG;
+			}
+		} else {
+			std::string name((const char *)m_extended.data(), m_extended.size());
+			name.resize(strnlen(name.c_str(), name.size()));
+			(m_extended_type == TarType::GnuLongName ? m_overrides.path : m_overrides.link) = name;
+		}
+		m_extended.clear();
+		m_state = m_pad ? State::Skip : State::Header;
+		m_left = m_pad;
+		return 0;
+	}
+
+	State m_state = State::Header;
+	uint8_t m_header[kTarBlock];
+	size_t m_fill = 0;
+	uint64_t m_left = 0;
+	// Extended header being read, and the padding after it.
+	TarType m_extended_type = TarType::PaxHeader;
+	std::vector<uint8_t> m_extended;
+	uint64_t m_pad = 0;
+	TarOverrides m_overrides;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_tar_decoder()
+{
+	return std::unique_ptr<Decoder>(new TarDecoder());
+}
+
+} // namespace recovery
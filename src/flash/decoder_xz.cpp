@@ -0,0 +1,97 @@
+#include "flash/codecs.h"
+
+#include "common/log.h"
+
+#include <errno.h>
+#include <lzma.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+// liblzma >= 5.4 decodes the blocks of a multi-block .xz (xz -T, pixz) on
+// its own thread pool and returns them in order. Single-block files and
+// older libraries decode serially.
+class XzDecoder : public Decoder {
+public:
+	explicit XzDecoder(unsigned threads) : m_stream(LZMA_STREAM_INIT)
+	{
+		lzma_ret ret;
+#if LZMA_VERSION >= 50040000
+		lzma_mt mt = {};
+		mt.flags = LZMA_CONCATENATED;
+		mt.threads = threads ? threads : 1;
+		mt.timeout = 0;
+		// Above this liblzma falls back to one thread instead of failing.
+		mt.memlimit_threading = threading_memlimit();
+		mt.memlimit_stop = UINT64_MAX;
+		ret = lzma_stream_decoder_mt(&m_stream, &mt);
+#else
+		(void)threads;
+		ret = lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+		m_ok = ret == LZMA_OK;
+		if (!m_ok)
+			log_error("flash: cannot set up xz decoder (%d)", (int)ret);
+	}
+
+	~XzDecoder() override { lzma_end(&m_stream); }
+
+	const char *name() const override { return "xz"; }
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		return run(data, len, LZMA_RUN, out);
+	}
+
+	int finish(ChunkWriter &out) override { return run(nullptr, 0, LZMA_FINISH, out); }
+
+private:
+	static uint64_t threading_memlimit()
+	{
+		// A quarter of RAM keeps room for the chunk pool and the UI.
+		long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+		return pages > 0 && page > 0 ? (uint64_t)pages * page / 4 : 64u << 20;
+	}
+
+	int run(const uint8_t *data, size_t len, lzma_action action, ChunkWriter &out)
+	{
+		if (!m_ok)
+			return -ENOMEM;
+
+		m_stream.next_in = data;
+		m_stream.avail_in = len;
+		for (;;) {
+			size_t avail;
+			uint8_t *dst = out.reserve(&avail);
+			if (!dst)
+				return -ECANCELED;
+			m_stream.next_out = dst;
+			m_stream.avail_out = avail;
+			lzma_ret ret = lzma_code(&m_stream, action);
+			if (!out.commit(avail - m_stream.avail_out))
+				return -ECANCELED;
+			if (ret == LZMA_STREAM_END)
+				return 0;
+			if (ret != LZMA_OK) {
+				log_error("flash: xz stream is corrupt (%d)", (int)ret);
+				return ret == LZMA_MEM_ERROR ? -ENOMEM : -EBADMSG;
+			}
+			if (action == LZMA_RUN && !m_stream.avail_in && m_stream.avail_out)
+				return 0;
+		}
+	}
+
+	lzma_stream m_stream;
+	bool m_ok;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_xz_decoder(unsigned threads)
+{
+	return std::unique_ptr<Decoder>(new XzDecoder(threads));
+}
+
+} // namespace recovery
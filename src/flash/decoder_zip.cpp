@@ -0,0 +1,253 @@
+#include "common/log.h"
+#include "flash/codecs.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+namespace recovery {
+
+namespace {
+
+const uint32_t kLocalHeaderMagic = 0x04034b50;
+const uint32_t kDescriptorMagic = 0x08074b50;
+const size_t kLocalHeaderSize = 30;
+const uint16_t kFlagEncrypted = 1 << 0;
+const uint16_t kFlagDescriptor = 1 << 3;
+
+uint16_t le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+// Legacy zip images: the first file entry, stored or deflated, is the
+// image, read from its local header on so the central directory at the
+// end is never needed. Its CRC-32 is checked, as zip images rarely come
+// with a digest of their own. Directory entries before it are skipped.
+// Deflate is serial, so this is no faster than gzip.
+class ZipDecoder : public Decoder {
+public:
+	ZipDecoder() { memset(&m_stream, 0, sizeof(m_stream)); }
+	~ZipDecoder() override
+	{
+		if (m_inflating)
+			inflateEnd(&m_stream);
+	}
+
+	const char *name() const override { return "zip"; }
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		while (len) {
+			size_t n = len;
+			int ret = 0;
+			switch (m_state) {
+			case State::Header:
+				n = std::min(len, m_want - m_header.size());
+				m_header.insert(m_header.end(), data, data + n);
+				if (m_header.size() == m_want)
+					ret = parse_header();
+				break;
+			case State::Skip:
+				n = (size_t)std::min<uint64_t>(len, m_left);
+				m_left -= n;
+				if (!m_left)
+					m_state = State::Header;
+				break;
+			case State::Stored:
+				n = (size_t)std::min<uint64_t>(len, m_left);
+				m_crc = crc32(m_crc, data, (uInt)n);
+				if (!out.write(data, n))
+					return -ECANCELED;
+				m_left -= n;
+				if (!m_left)
+					ret = end_of_data();
+				break;
+			case State::Deflated:
+				ret = inflate_some(data, &n, out);
+				break;
+			case State::Descriptor:
+				n = std::min(len, m_want - m_header.size());
+				m_header.insert(m_header.end(), data, data + n);
+				if (m_header.size() == m_want) {
+					const uint8_t *p = m_header.data();
+					m_expected_crc = le32(p) == kDescriptorMagic ? le32(p + 4) : le32(p);
+					ret = check_crc();
+				}
+				break;
+			case State::Done:
+				break;
+			}
+			if (ret < 0)
+				return ret;
+			data += n;
+			len -= n;
+		}
+		return 0;
+	}
+
+	int finish(ChunkWriter &) override
+	{
+		if (m_state == State::Done)
+			return 0;
+		log_error("flash: zip holds no complete image");
+		return -EBADMSG;
+	}
+
+private:
+	enum class State { Header, Skip, Stored, Deflated, Descriptor, Done };
+
+	int parse_header()
+	{
+		const uint8_t *p = m_header.data();
+		if (le32(p) != kLocalHeaderMagic) {
+			log_error("flash: zip holds no image");
+			return -EBADMSG;
+		}
+		uint16_t name_len = le16(p + 26), extra_len = le16(p + 28);
+		if (m_want == kLocalHeaderSize && name_len + extra_len) {
+			// Fetch the name and extra field too.
+			m_want += name_len + extra_len;
+			return 0;
+		}
+
+		uint16_t flags = le16(p + 6), method = le16(p + 8);
+		uint64_t compressed = le32(p + 18), size = le32(p + 22);
+		m_expected_crc = le32(p + 14);
+		const char *name = (const char *)p + kLocalHeaderSize;
+		parse_zip64(p + kLocalHeaderSize + name_len, extra_len, &size, &compressed);
+		m_header.clear();
+		m_want = kLocalHeaderSize;
+
+		if (name_len && name[name_len - 1] == '/') {
+			// Some tools deflate even an empty directory entry.
+			if (flags & kFlagDescriptor) {
+				log_error("flash: zip directory entry of unknown size");
+				return -EOPNOTSUPP;
+			}
+			m_left = compressed;
+			if (m_left)
+				m_state = State::Skip;
+			return 0;
+		}
+		if (flags & kFlagEncrypted) {
+			log_error("flash: encrypted zip images are not supported");
+			return -EOPNOTSUPP;
+		}
+		log_debug("flash: zip member %.*s", (int)name_len, name);
+		m_descriptor = flags & kFlagDescriptor;
+		if (method == 0 && !m_descriptor) {
+			m_state = State::Stored;
+			m_left = compressed;
+			return m_left ? 0 : end_of_data();
+		}
+		if (method != 8) {
+			log_error("flash: zip method %u%s is not supported", method,
+				  method == 0 ? " without sizes" : "");
+			return -EOPNOTSUPP;
+		}
+		if (inflateInit2(&m_stream, -15) != Z_OK)
+			return -ENOMEM;
+		m_inflating = true;
+		m_state = State::Deflated;
+		return 0;
+	}
+
+	// Sizes that do not fit 32 bits are in the zip64 extra field.
+	static void parse_zip64(const uint8_t *extra, size_t len, uint64_t *size, uint64_t *compressed)
+	{
+		while (len >= 4) {
+			uint16_t id = le16(extra), n = le16(extra + 2);
+			if (n > len - 4)
+				return;
+			const uint8_t *field = extra + 4;
+			if (id == 0x0001) {
+				size_t pos = 0;
+				if (*size == 0xffffffff && pos + 8 <= n) {
+					*size = le32(field + pos) | (uint64_t)le32(field + pos + 4) << 32;
+					pos += 8;
+				}
+				if (*compressed == 0xffffffff && pos + 8 <= n)
+					*compressed = le32(field + pos) | (uint64_t)le32(field + pos + 4) << 32;
+				return;
+			}
+			extra += 4 + n;
+			len -= 4 + n;
+		}
+	}
+
+	int inflate_some(const uint8_t *data, size_t *len, ChunkWriter &out)
+	{
+		m_stream.next_in = (Bytef *)data;
+		m_stream.avail_in = (uInt)*len;
+		for (;;) {
+			size_t avail;
+			uint8_t *dst = out.reserve(&avail);
+			if (!dst)
+				return -ECANCELED;
+			m_stream.next_out = dst;
+			m_stream.avail_out = (uInt)avail;
+			int ret = inflate(&m_stream, Z_NO_FLUSH);
+			size_t produced = avail - m_stream.avail_out;
+			m_crc = crc32(m_crc, dst, (uInt)produced);
+			if (!out.commit(produced))
+				return -ECANCELED;
+			if (ret == Z_STREAM_END) {
+				*len -= m_stream.avail_in;
+				return end_of_data();
+			}
+			if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				log_error("flash: zip image is corrupt");
+				return -EBADMSG;
+			}
+			if (!m_stream.avail_in && m_stream.avail_out)
+				return 0;
+		}
+	}
+
+	int end_of_data()
+	{
+		if (!m_descriptor)
+			return check_crc();
+		// Signature (optional) and CRC-32 are all that is needed.
+		m_state = State::Descriptor;
+		m_header.clear();
+		m_want = 8;
+		return 0;
+	}
+
+	int check_crc()
+	{
+		m_state = State::Done;
+		if (m_crc == m_expected_crc)
+			return 0;
+		log_error("flash: zip image CRC mismatch");
+		return -EBADMSG;
+	}
+
+	State m_state = State::Header;
+	std::vector<uint8_t> m_header;
+	size_t m_want = kLocalHeaderSize;
+	uint64_t m_left = 0;
+	bool m_descriptor = false;
+	z_stream m_stream;
+	bool m_inflating = false;
+	uLong m_crc = 0;
+	uint32_t m_expected_crc = 0;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_zip_decoder()
+{
+	return std::unique_ptr<Decoder>(new ZipDecoder());
+}
+
+} // namespace recovery
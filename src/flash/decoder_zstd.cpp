@@ -0,0 +1,122 @@
+#include "flash/codecs.h"
+#include "flash/parallel_decoder.h"
+
+#include <errno.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+
+namespace recovery {
+
+namespace {
+
+// zstd itself only decodes serially, but images compressed with pzstd (or
+// zstd --long=... -B) consist of many independent frames, each preceded by
+// a skippable frame carrying its size. Frames are spread over the workers.
+class ZstdDecoder : public ParallelFrameDecoder {
+public:
+	explicit ZstdDecoder(unsigned threads) : ParallelFrameDecoder(threads), m_contexts(threads ? threads : 1)
+	{
+		for (ZSTD_DCtx *&ctx : m_contexts)
+			ctx = ZSTD_createDCtx();
+		m_stream = ZSTD_createDStream();
+		start_workers();
+	}
+
+	~ZstdDecoder() override
+	{
+		stop_workers();
+		for (ZSTD_DCtx *ctx : m_contexts)
+			ZSTD_freeDCtx(ctx);
+		ZSTD_freeDStream(m_stream);
+	}
+
+	const char *name() const override { return "zst"; }
+
+protected:
+	ssize_t frame_length(const uint8_t *data, size_t len, bool at_end) override
+	{
+		size_t n = ZSTD_findFrameCompressedSize(data, len);
+		if (!ZSTD_isError(n))
+			return (ssize_t)n;
+		if (ZSTD_getErrorCode(n) == ZSTD_error_srcSize_wrong && !at_end)
+			return 0;
+		return -EBADMSG;
+	}
+
+	int decode_frame(unsigned worker, uint64_t, const uint8_t *data, size_t len, std::vector<uint8_t> &out) override
+	{
+		ZSTD_DCtx *ctx = m_contexts[worker];
+		if (!ctx)
+			return -ENOMEM;
+
+		unsigned long long size = ZSTD_getFrameContentSize(data, len);
+		if (size == ZSTD_CONTENTSIZE_ERROR)
+			return -EBADMSG;
+		if (size != ZSTD_CONTENTSIZE_UNKNOWN) {
+			if (size > kMaxDecodedFrame)
+				return -E2BIG;
+			out.resize(size);
+			size_t n = ZSTD_decompressDCtx(ctx, out.data(), out.size(), data, len);
+			return ZSTD_isError(n) || n != size ? -EBADMSG : 0;
+		}
+
+		ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+		ZSTD_inBuffer in = { data, len, 0 };
+		for (;;) {
+			size_t used = out.size();
+			if (used >= kMaxDecodedFrame)
+				return -E2BIG;
+			out.resize(used + ZSTD_DStreamOutSize());
+			ZSTD_outBuffer o = { out.data() + used, out.size() - used, 0 };
+			size_t ret = ZSTD_decompressStream(ctx, &o, &in);
+			out.resize(used + o.pos);
+			if (ZSTD_isError(ret))
+				return -EBADMSG;
+			if (!ret)
+				return 0;
+			if (in.pos == in.size && o.pos < o.size)
+				return -EBADMSG;
+		}
+	}
+
+	int stream_decode(const uint8_t *data, size_t len, ChunkWriter &out) override
+	{
+		if (!m_stream)
+			return -ENOMEM;
+
+		ZSTD_inBuffer in = { data, len, 0 };
+		for (;;) {
+			size_t avail;
+			uint8_t *dst = out.reserve(&avail);
+			if (!dst)
+				return -ECANCELED;
+			ZSTD_outBuffer o = { dst, avail, 0 };
+			m_last = ZSTD_decompressStream(m_stream, &o, &in);
+			if (ZSTD_isError(m_last))
+				return -EBADMSG;
+			if (!out.commit(o.pos))
+				return -ECANCELED;
+			// A return of 0 means a frame just ended; calling again with no
+			// input would start waiting for the next frame's header.
+			if (in.pos == in.size && (o.pos < o.size || !m_last))
+				return 0;
+		}
+	}
+
+	// Non-zero means the last frame was cut short.
+	int stream_finish(ChunkWriter &) override { return m_last ? -EBADMSG : 0; }
+
+private:
+	std::vector<ZSTD_DCtx *> m_contexts;
+	ZSTD_DStream *m_stream = nullptr;
+	size_t m_last = 0;
+};
+
+} // namespace
+
+std::unique_ptr<Decoder> make_zstd_decoder(unsigned threads)
+{
+	return std::unique_ptr<Decoder>(new ZstdDecoder(threads));
+}
+
+} // namespace recovery
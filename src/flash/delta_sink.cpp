@@ -0,0 +1,180 @@
+#include "flash/delta_sink.h"
+
+#include "common/log.h"
+#include "common/trace.h"
+#include "platform/sched.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace recovery {
+
+DeltaSink::DeltaSink(Sink &target, unsigned threads) : m_target(target), m_threads(threads ? threads : 1)
+{
+}
+
+DeltaSink::~DeltaSink()
+{
+	stop();
+}
+
+int DeltaSink::start()
+{
+	m_block_size = m_target.block_size();
+	if (!m_block_size || !m_target.capacity()) {
+		log_error("flash: %s sink cannot be delta flashed", m_target.name());
+		return -EOPNOTSUPP;
+	}
+	m_block_count = m_target.capacity() / m_block_size;
+	m_block.resize(m_block_size);
+	m_digests.resize(m_block_count);
+	m_states.assign(m_block_count, HashState::Pending);
+
+	for (unsigned i = 0; i < m_threads; i++)
+		m_workers.emplace_back(&DeltaSink::hasher, this);
+	return 0;
+}
+
+void DeltaSink::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_advanced.notify_all();
+	for (std::thread &t : m_workers)
+		t.join();
+	m_workers.clear();
+}
+
+void DeltaSink::hasher()
+{
+	TRACE_THREAD_NAME("delta-hash");
+	sched_set_role(ThreadRole::Compute);
+	std::vector<uint8_t> buf(m_block_size);
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;) {
+		// Stay within kLookahead blocks of the writer so a small image on a
+		// big partition does not read the whole partition.
+		m_advanced.wait(lock, [this] {
+			return m_stop || m_next_hash >= m_block_count || m_next_hash < m_writer_block + kLookahead;
+		});
+		if (m_stop || m_next_hash >= m_block_count)
+			return;
+		uint64_t index = m_next_hash++;
+		lock.unlock();
+
+		Digest digest;
+		bool ok;
+		{
+			TRACE_SCOPE("flash", "read_back");
+			ssize_t n = m_target.read_back(buf.data(), m_block_size, index * m_block_size);
+			ok = n == (ssize_t)m_block_size;
+			if (ok)
+				Sha256::digest(buf.data(), m_block_size, digest.data());
+		}
+
+		lock.lock();
+		m_digests[index] = digest;
+		m_states[index] = ok ? HashState::Ready : HashState::Failed;
+		m_hashed.notify_all();
+	}
+}
+
+bool DeltaSink::existing_digest(uint64_t index, Digest &out)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (index >= m_block_count)
+		return false;
+	if (m_writer_block != index) {
+		m_writer_block = index;
+		m_advanced.notify_all();
+	}
+	m_hashed.wait(lock, [&] { return m_states[index] != HashState::Pending; });
+	out = m_digests[index];
+	return m_states[index] == HashState::Ready;
+}
+
+int DeltaSink::flush_block(const uint8_t *data, uint64_t offset)
+{
+	Digest existing, incoming;
+	Sha256::digest(data, m_block_size, incoming.data());
+	int ret;
+	if (existing_digest(offset / m_block_size, existing) && existing == incoming) {
+		m_skipped++;
+		ret = m_target.skip(offset, m_block_size);
+	} else {
+		m_written++;
+		ret = m_target.write(data, m_block_size, offset);
+	}
+	if (ret == 0)
+		m_end = offset + m_block_size;
+	return ret;
+}
+
+int DeltaSink::write(const uint8_t *data, size_t len, uint64_t offset)
+{
+	if (!m_block_size)
+		return -EINVAL;
+
+	while (len) {
+		int ret;
+		if (!m_fill && offset % m_block_size == 0 && len >= m_block_size) {
+			// Whole blocks straight from the pipeline chunk.
+			ret = flush_block(data, offset);
+			if (ret < 0)
+				return ret;
+			data += m_block_size;
+			offset += m_block_size;
+			len -= m_block_size;
+			continue;
+		}
+
+		if (!m_fill)
+			m_block_offset = offset - offset % m_block_size;
+		if (offset != m_block_offset + m_fill)
+			return -EINVAL;
+		size_t n = m_block_size - m_fill;
+		if (n > len)
+			n = len;
+		memcpy(m_block.data() + m_fill, data, n);
+		m_fill += n;
+		data += n;
+		offset += n;
+		len -= n;
+		if (m_fill == m_block_size) {
+			ret = flush_block(m_block.data(), m_block_offset);
+			m_fill = 0;
+			if (ret < 0)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+int64_t DeltaSink::sync()
+{
+	int64_t ret = m_target.sync();
+	return ret < 0 ? ret : (int64_t)m_end;
+}
+
+int DeltaSink::finish()
+{
+	stop();
+
+	// A trailing partial block is always written.
+	if (m_fill) {
+		int ret = m_target.write(m_block.data(), m_fill, m_block_offset);
+		if (ret < 0)
+			return ret;
+		m_written++;
+		m_fill = 0;
+	}
+
+	log_info("flash: delta wrote %llu of %llu blocks", (unsigned long long)m_written,
+		 (unsigned long long)(m_written + m_skipped));
+	return m_target.finish();
+}
+
+} // namespace recovery
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "crypto/sha256.h"
+#include "flash/sink.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+// Writes only the blocks of an image that differ from what the target
+// partition already holds.
+//
+// Worker threads read the current partition and SHA-256 each block in
+// parallel, starting as soon as the sink is started and running a bounded
+// distance ahead of the writer. The writer hashes each incoming block and
+// hands only mismatching blocks to the target; equal blocks are skipped,
+// which on NAND also saves their erase cycle. Drop-in replacement for the
+// target sink in FlashPipeline.
+class DeltaSink : public Sink {
+public:
+	using Digest = std::array<uint8_t, Sha256::kDigestSize>;
+
+	// Blocks the hashers may run ahead of the writer.
+	static const unsigned kLookahead = 64;
+
+	// |target| must support block_size() and read_back().
+	DeltaSink(Sink &target, unsigned threads);
+	~DeltaSink() override;
+
+	// Starts hashing the target. Returns -EOPNOTSUPP if the target cannot
+	// be delta flashed.
+	int start();
+
+	const char *name() const override { return "delta"; }
+	int write(const uint8_t *data, size_t len, uint64_t offset) override;
+	int finish() override;
+	// Up to the block being assembled; a skipped block is as good as a
+	// written one.
+	int64_t sync() override;
+
+	uint32_t block_size() const override { return m_block_size; }
+	uint64_t capacity() const override { return m_target.capacity(); }
+
+	uint64_t blocks_written() const { return m_written; }
+	uint64_t blocks_skipped() const { return m_skipped; }
+
+private:
+	enum class HashState : uint8_t { Pending, Ready, Failed };
+
+	void hasher();
+	void stop();
+	// Writes or skips the whole block at |offset|.
+	int flush_block(const uint8_t *data, uint64_t offset);
+	// Waits until the existing block |index| is hashed; false if unknown.
+	bool existing_digest(uint64_t index, Digest &out);
+
+	Sink &m_target;
+	unsigned m_threads;
+	uint32_t m_block_size = 0;
+	uint64_t m_block_count = 0;
+
+	// Block assembly for writes that do not cover whole blocks.
+	std::vector<uint8_t> m_block;
+	size_t m_fill = 0;
+	uint64_t m_block_offset = 0;
+
+	std::vector<Digest> m_digests;
+	std::vector<HashState> m_states;
+	std::mutex m_mutex;
+	std::condition_variable m_hashed;
+	std::condition_variable m_advanced;
+	uint64_t m_next_hash = 0;
+	uint64_t m_writer_block = 0;
+	bool m_stop = false;
+	std::vector<std::thread> m_workers;
+
+	uint64_t m_written = 0;
+	uint64_t m_skipped = 0;
+	// End of the last block written or skipped.
+	uint64_t m_end = 0;
+};
+
+} // namespace recovery
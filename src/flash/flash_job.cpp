@@ -0,0 +1,198 @@
+#include "flash/flash_job.h"
+
+#include "common/log.h"
+#include "common/metrics.h"
+#include "flash/container.h"
+#include "flash/delta_sink.h"
+#include "platform/platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace recovery {
+
+static Counter s_runs_done("recovery_flash_runs_total", "result=\"done\"", "Flashes finished, by outcome.");
+static Counter s_runs_cancelled("recovery_flash_runs_total", "result=\"cancelled\"", "Flashes finished, by outcome.");
+static Counter s_runs_failed("recovery_flash_runs_total", "result=\"failed\"", "Flashes finished, by outcome.");
+static Counter s_resumed_chunks("recovery_flash_resumed_chunks_total", "",
+				"Chunks a resumed flash did not have to write again.");
+
+const char *flash_state_name(FlashState state)
+{
+	switch (state) {
+	case FlashState::Idle:
+		return "idle";
+	case FlashState::Running:
+		return "running";
+	case FlashState::Done:
+		return "done";
+	case FlashState::Failed:
+		return "failed";
+	case FlashState::Cancelled:
+		return "cancelled";
+	}
+	return "unknown";
+}
+
+FlashJob::~FlashJob()
+{
+	cancel();
+	wait();
+}
+
+void FlashJob::wait()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+int FlashJob::start(const std::string &image, const std::string &device, DoneFn on_done, FlashMode mode)
+{
+	if (state() == FlashState::Running)
+		return -EBUSY;
+	wait();
+
+	std::unique_ptr<FileSource> source(new FileSource());
+	int ret = source->open(image.c_str());
+	if (ret < 0)
+		return ret;
+	uint8_t head[kDetectBytes];
+	UniqueFd fd(open(image.c_str(), O_RDONLY | O_CLOEXEC));
+	ssize_t n = fd ? pread(fd.get(), head, sizeof(head), 0) : -1;
+	Compression compression = detect_compression(head, n > 0 ? (size_t)n : 0);
+	std::unique_ptr<Decoder> decoder = make_decoder(compression);
+	if (!decoder)
+		return -ENOTSUP;
+
+	bool container = compression == Compression::Container;
+	// Declared first so that a DeltaSink in |sink| goes before it.
+	std::unique_ptr<Sink> target;
+	std::unique_ptr<Sink> sink;
+	MtdSink *mtd_sink = nullptr;
+	if (platform::flash_type(device.c_str()) == platform::FlashType::Mtd) {
+		std::unique_ptr<MtdSink> mtd(new MtdSink());
+		ret = mtd->open(device.c_str());
+		mtd_sink = mtd.get();
+		sink = std::move(mtd);
+	} else {
+		// Straight to the device, so the flash does not push the UI's
+		// pages out of the cache. Containers may resume and delta
+		// flashes compare, both reading back what is there.
+		std::unique_ptr<FileSink> file(new FileSink());
+		ret = file->open(device.c_str(), container || mode == FlashMode::Delta, true);
+		sink = std::move(file);
+	}
+	if (ret < 0)
+		return ret;
+	if (mode == FlashMode::Delta) {
+		std::unique_ptr<DeltaSink> delta(new DeltaSink(*sink, default_decoder_threads()));
+		ret = delta->start();
+		if (ret < 0)
+			return ret;
+		target = std::move(sink);
+		sink = std::move(delta);
+	}
+
+	PipelineOptions options;
+	std::vector<uint8_t> leaves;
+	std::unique_ptr<FlashJournal> journal;
+	uint32_t resumed = 0;
+	ContainerIndex index;
+	// Erases may run ahead of the data when the decoded size is known up
+	// front: a raw image's is its file's, a container's is in its index.
+	uint64_t image_size = compression == Compression::Raw && source->size() > 0 ? (uint64_t)source->size() : 0;
+	if (container && container_read_index(fd.get(), &index) == 0) {
+		image_size = index.header.image_size;
+		options.has_tree_digest = true;
+		memcpy(options.tree_digest, index.header.root, sizeof(options.tree_digest));
+		options.tree_leaf_size = index.header.chunk_size;
+		index.chunk_digests(leaves);
+		options.leaf_digests = leaves.data();
+		options.leaf_count = index.header.chunk_count;
+
+		// A delta flash rerun after a power cut skips what was done
+		// anyway, so only full ones are journaled.
+		std::string path = platform::Machine::kJournal ? platform::Machine::kJournal : image + ".journal";
+		if (mode == FlashMode::Full)
+			journal.reset(new FlashJournal());
+		ret = journal ? journal->open(path.c_str(), index.header, device.c_str()) : 0;
+		if (ret < 0) {
+			// A read-only stick still flashes, just not resumably.
+			log_info("flash: no journal at %s: %s", path.c_str(), strerror(-ret));
+			journal.reset();
+		} else if (journal) {
+			options.journal = journal.get();
+			resumed = journal->resume_point(index, *sink);
+		}
+		if (resumed) {
+			std::vector<std::pair<uint64_t, uint64_t>> ranges;
+			index.resume_ranges(resumed, ranges);
+			source->select(ranges);
+			decoder = make_resume_decoder(index, resumed);
+			if (!decoder)
+				return -ENOTSUP;
+			options.resume_leaves = resumed;
+			log_info("flash: resuming at chunk %u of %u", resumed, index.header.chunk_count);
+		}
+	}
+
+	// Not for delta flashes: a block erased ahead can no longer be skipped.
+	if (mtd_sink && image_size && mode == FlashMode::Full)
+		mtd_sink->set_image_size(image_size);
+
+	m_pipeline.reset();
+	m_image = image;
+	m_device = device;
+	m_compression = compression;
+	m_mode = mode;
+	m_source = std::move(source);
+	m_decoder = std::move(decoder);
+	m_sink = std::move(sink);
+	m_target = std::move(target);
+	m_leaves = std::move(leaves);
+	m_journal = std::move(journal);
+	m_resumed = resumed;
+	s_resumed_chunks.add(resumed);
+	m_pipeline.reset(new FlashPipeline(*m_source, *m_decoder, *m_sink, options));
+	m_result = 0;
+	m_state.store(FlashState::Running, std::memory_order_release);
+	log_info("flash: %s (%s) to %s%s", image.c_str(), compression_name(compression), device.c_str(),
+		 mode == FlashMode::Delta ? ", changed blocks only" : "");
+
+	m_boost.acquire();
+	m_thread = std::thread([this, on_done] {
+		int result = m_pipeline->run();
+		m_boost.release();
+		if (result == 0 && m_journal)
+			m_journal->discard();
+		m_result = result;
+		(result == 0 ? s_runs_done : result == -ECANCELED ? s_runs_cancelled : s_runs_failed).add();
+		if (result == 0)
+			log_info("flash: %s done in %.1f s", m_device.c_str(), m_pipeline->elapsed_us() / 1e6);
+		else if (result == -ECANCELED)
+			log_info("flash: %s cancelled", m_device.c_str());
+		else
+			log_error("flash: %s failed: %s", m_device.c_str(), strerror(-result));
+		m_state.store(result == 0 ? FlashState::Done : result == -ECANCELED ? FlashState::Cancelled
+										  : FlashState::Failed,
+			      std::memory_order_release);
+		if (on_done)
+			on_done();
+	});
+	return 0;
+}
+
+void FlashJob::cancel()
+{
+	if (state() == FlashState::Running)
+		m_pipeline->cancel();
+}
+
+PipelineProgress FlashJob::progress() const
+{
+	return m_pipeline ? m_pipeline->progress() : PipelineProgress();
+}
+
+} // namespace recovery
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "flash/decoder.h"
+#include "flash/flash_journal.h"
+#include "flash/pipeline.h"
+#include "flash/sink.h"
+#include "flash/source.h"
+#include "platform/sched.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+enum class FlashState {
+	Idle,
+	Running,
+	Done,
+	Failed,
+	Cancelled,
+};
+
+const char *flash_state_name(FlashState state);
+
+enum class FlashMode {
+	// Every block of the image is written.
+	Full,
+	// Only blocks that differ from what the target holds are (see
+	// delta_sink.h): quicker when little changed, and it spares NAND the
+	// erase cycles.
+	Delta,
+};
+
+// One image being flashed onto one partition in the background, for front
+// ends that must keep serving input meanwhile. The pipeline runs on a
+// thread of its own; progress() samples its lock-free counters, so asking
+// for progress as often as wanted costs the flash nothing. Clocks are
+// held up for the run where the machine's SchedPolicy asks for it.
+//
+// RUIC containers are checked chunk by chunk against their index, and
+// their progress is journaled (see flash_journal.h): starting the same
+// image onto the same device after a power cut picks up where it stopped.
+// Delta flashes are not journaled: run again, they skip what is done.
+class FlashJob {
+public:
+	// Called on the job's thread when the run ends.
+	using DoneFn = std::function<void()>;
+
+	FlashJob() = default;
+	// Cancels a run and waits for it.
+	~FlashJob();
+
+	FlashJob(const FlashJob &) = delete;
+	FlashJob &operator=(const FlashJob &) = delete;
+
+	// Opens |image| and |device| and starts flashing. Fails with -EBUSY
+	// while a run is in progress; otherwise returns 0 or -errno from
+	// opening either end, leaving the previous run's state as it was.
+	int start(const std::string &image, const std::string &device, DoneFn on_done,
+		  FlashMode mode = FlashMode::Full);
+	void cancel();
+	// Waits for a run to end.
+	void wait();
+
+	// Safe from any thread.
+	FlashState state() const { return m_state.load(std::memory_order_acquire); }
+	// Lock-free against the run, but only on the thread that calls
+	// start(), which replaces the pipeline it samples.
+	PipelineProgress progress() const;
+
+	// Describe the latest run; read them on the thread that calls start().
+	const std::string &image() const { return m_image; }
+	const std::string &device() const { return m_device; }
+	Compression compression() const { return m_compression; }
+	FlashMode mode() const { return m_mode; }
+	// 0 or the -errno the run failed with, once it has ended.
+	int result() const { return m_result; }
+	// Chunks a resumed run found already done, 0 if it started afresh.
+	uint32_t resumed_chunks() const { return m_resumed; }
+
+private:
+	std::string m_image;
+	std::string m_device;
+	Compression m_compression = Compression::Raw;
+	FlashMode m_mode = FlashMode::Full;
+	// Built afresh for each run, and kept until the next one.
+	std::unique_ptr<FileSource> m_source;
+	std::unique_ptr<Decoder> m_decoder;
+	// The device, and what the pipeline writes to: the same sink, or a
+	// DeltaSink in front of it.
+	std::unique_ptr<Sink> m_target;
+	std::unique_ptr<Sink> m_sink;
+	std::unique_ptr<FlashPipeline> m_pipeline;
+	std::vector<uint8_t> m_leaves;
+	std::unique_ptr<FlashJournal> m_journal;
+	uint32_t m_resumed = 0;
+	std::thread m_thread;
+	CpufreqBoost m_boost;
+	std::atomic<FlashState> m_state{ FlashState::Idle };
+	int m_result = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,204 @@
+#include "flash/flash_journal.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace recovery {
+
+namespace {
+
+const char kJournalMagic[4] = { 'R', 'U', 'I', 'J' };
+const uint32_t kJournalVersion = 1;
+
+struct JournalHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t session;
+	// The image and target; the rest must match for a journal to be
+	// picked up.
+	uint64_t image_size;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+	uint8_t root[32];
+	char device[56];
+	// Leading bytes of the SHA-256 of everything above.
+	uint8_t check[8];
+};
+
+struct JournalRecord {
+	// Slot number; record n lives at sizeof(JournalHeader) + n * 16.
+	uint32_t sequence;
+	uint32_t chunks;
+	// Leading bytes of SHA-256(session, sequence, chunks).
+	uint8_t check[8];
+};
+
+static_assert(sizeof(JournalHeader) == 128, "JournalHeader layout");
+static_assert(sizeof(JournalRecord) == 16, "JournalRecord layout");
+
+// Identity fields, from image_size up to the check.
+const size_t kIdentityStart = offsetof(JournalHeader, image_size);
+const size_t kIdentityEnd = offsetof(JournalHeader, check);
+
+void header_check(const JournalHeader &h, uint8_t check[8])
+{
+	uint8_t digest[Sha256::kDigestSize];
+	Sha256::digest((const uint8_t *)&h, offsetof(JournalHeader, check), digest);
+	memcpy(check, digest, 8);
+}
+
+void record_check(uint64_t session, const JournalRecord &r, uint8_t check[8])
+{
+	uint8_t digest[Sha256::kDigestSize];
+	Sha256 sha;
+	sha.update((const uint8_t *)&session, sizeof(session));
+	sha.update((const uint8_t *)&r, offsetof(JournalRecord, check));
+	sha.final(digest);
+	memcpy(check, digest, 8);
+}
+
+// Whether |have| is a journal of the run |want| describes.
+bool header_matches(const JournalHeader &have, const JournalHeader &want)
+{
+	if (memcmp(have.magic, kJournalMagic, sizeof(kJournalMagic)) || have.version != kJournalVersion)
+		return false;
+	uint8_t check[8];
+	header_check(have, check);
+	return !memcmp(check, have.check, sizeof(check)) &&
+	       !memcmp((const uint8_t *)&have + kIdentityStart, (const uint8_t *)&want + kIdentityStart,
+		       kIdentityEnd - kIdentityStart);
+}
+
+int pwrite_sync(int fd, const void *data, size_t len, uint64_t offset)
+{
+	ssize_t n = pwrite(fd, data, len, (off_t)offset);
+	if (n < 0)
+		return -errno;
+	if ((size_t)n != len)
+		return -ENOSPC;
+	return fdatasync(fd) < 0 ? -errno : 0;
+}
+
+uint64_t record_offset(uint32_t sequence)
+{
+	return sizeof(JournalHeader) + (uint64_t)sequence * sizeof(JournalRecord);
+}
+
+} // namespace
+
+int FlashJournal::open(const char *path, const ContainerHeader &image, const char *device)
+{
+	m_path = path;
+	m_fd.reset(::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+	if (!m_fd)
+		return -errno;
+	struct stat st;
+	m_regular = fstat(m_fd.get(), &st) == 0 && S_ISREG(st.st_mode);
+	m_sequence = 0;
+	m_committed = 0;
+
+	JournalHeader want = {};
+	memcpy(want.magic, kJournalMagic, sizeof(kJournalMagic));
+	want.version = kJournalVersion;
+	want.image_size = image.image_size;
+	want.chunk_size = image.chunk_size;
+	want.chunk_count = image.chunk_count;
+	memcpy(want.root, image.root, sizeof(want.root));
+	memcpy(want.device, device, std::min(strlen(device), sizeof(want.device) - 1));
+
+	JournalHeader have;
+	if (pread(m_fd.get(), &have, sizeof(have), 0) != (ssize_t)sizeof(have) || !header_matches(have, want))
+		return start_fresh((const uint8_t *)&want, sizeof(want));
+
+	m_session = have.session;
+	JournalRecord record;
+	uint8_t check[8];
+	while (pread(m_fd.get(), &record, sizeof(record), (off_t)record_offset(m_sequence)) == (ssize_t)sizeof(record)) {
+		record_check(m_session, record, check);
+		if (record.sequence != m_sequence || memcmp(check, record.check, sizeof(check)) ||
+		    record.chunks < m_committed || record.chunks > image.chunk_count)
+			break;
+		m_committed = record.chunks;
+		m_sequence++;
+	}
+	log_info("flash: journal %s: %u of %u chunks done", path, m_committed, image.chunk_count);
+	return 0;
+}
+
+int FlashJournal::start_fresh(const uint8_t *header, size_t len)
+{
+	JournalHeader h;
+	memcpy(&h, header, len);
+	if (getrandom(&m_session, sizeof(m_session), 0) != (ssize_t)sizeof(m_session))
+		m_session = monotonic_us() ^ ((uint64_t)getpid() << 32);
+	h.session = m_session;
+	header_check(h, h.check);
+	int ret = m_regular && ftruncate(m_fd.get(), 0) < 0 ? -errno : pwrite_sync(m_fd.get(), &h, sizeof(h), 0);
+	if (ret < 0)
+		m_fd.reset();
+	return ret;
+}
+
+uint32_t FlashJournal::resume_point(const ContainerIndex &index, Sink &sink) const
+{
+	uint32_t chunk = m_committed;
+	if (!chunk)
+		return 0;
+	// The target may have been written since; its last committed chunk
+	// must still be there.
+	size_t len = index.chunk_length(chunk - 1);
+	std::vector<uint8_t> buf(len);
+	uint8_t digest[Sha256::kDigestSize];
+	ssize_t n = sink.read_back(buf.data(), len, (uint64_t)(chunk - 1) * index.header.chunk_size);
+	if (n == (ssize_t)len)
+		Sha256::digest(buf.data(), len, digest);
+	if (n != (ssize_t)len || memcmp(digest, index.blobs[index.chunk_blob[chunk - 1]].digest, sizeof(digest))) {
+		log_info("flash: journal: chunk %u is not on the target, starting over", chunk - 1);
+		return 0;
+	}
+	return chunk;
+}
+
+int FlashJournal::commit(uint32_t chunks)
+{
+	if (!m_fd)
+		return -EBADF;
+	if (chunks <= m_committed)
+		return 0;
+	JournalRecord record = {};
+	record.sequence = m_sequence;
+	record.chunks = chunks;
+	record_check(m_session, record, record.check);
+	int ret = pwrite_sync(m_fd.get(), &record, sizeof(record), record_offset(m_sequence));
+	if (ret < 0)
+		return ret;
+	m_sequence++;
+	m_committed = chunks;
+	return 0;
+}
+
+void FlashJournal::discard()
+{
+	if (!m_fd)
+		return;
+	if (m_regular) {
+		unlink(m_path.c_str());
+	} else {
+		JournalHeader blank = {};
+		pwrite_sync(m_fd.get(), &blank, sizeof(blank), 0);
+	}
+	m_fd.reset();
+}
+
+} // namespace recovery
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common/unique_fd.h"
+#include "flash/container.h"
+#include "flash/sink.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// Power-fail-safe record of how far a flash of a RUIC container got, so a
+// flash cut short by a power loss picks up where it stopped instead of
+// starting over.
+//
+// The journal is a header naming the image (its root digest and geometry)
+// and the target, followed by fixed-size commit records, each saying that
+// the first N chunks are on the target and were checked against their
+// digests. FlashPipeline appends one every kCommitBytes, after flushing the
+// target, and records are written in place and synced one by one: a record
+// torn by the power cut fails its check and the one before it stands.
+// Records carry the header's random session, so those of an older journal
+// in a reused area never count.
+//
+// It lives in a file next to the image on the USB source, or in a small
+// reserved partition (see Machine::kJournal), which is used as is.
+class FlashJournal {
+public:
+	// Image bytes between commits: at most this much is written again after
+	// a power cut. Each commit flushes the target's write cache and syncs
+	// the journal.
+	static const uint64_t kCommitBytes = 32 << 20;
+
+	FlashJournal() = default;
+	FlashJournal(const FlashJournal &) = delete;
+	FlashJournal &operator=(const FlashJournal &) = delete;
+
+	// Opens or creates the journal at |path| for flashing the container
+	// |image| onto |device|. One left by an interrupted flash of the same
+	// image onto the same device is picked up; anything else is started
+	// afresh. Returns 0 or -errno.
+	int open(const char *path, const ContainerHeader &image, const char *device);
+
+	bool valid() const { return m_fd.valid(); }
+	// Chunks the journal says are done.
+	uint32_t committed() const { return m_committed; }
+	// The chunk a flash onto |sink| picks up at: the committed count, as
+	// long as the last committed chunk reads back from |sink| with its
+	// digest; 0 to start over.
+	uint32_t resume_point(const ContainerIndex &index, Sink &sink) const;
+
+	// Records that the first |chunks| chunks are done. Returns 0 or -errno.
+	int commit(uint32_t chunks);
+	// The flash completed: removes the file, or invalidates a reserved
+	// area's header.
+	void discard();
+
+private:
+	int start_fresh(const uint8_t *header, size_t len);
+
+	std::string m_path;
+	UniqueFd m_fd;
+	bool m_regular = false;
+	uint64_t m_session = 0;
+	uint32_t m_sequence = 0;
+	uint32_t m_committed = 0;
+};
+
+} // namespace recovery
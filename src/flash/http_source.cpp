@@ -0,0 +1,323 @@
+#include "flash/http_source.h"
+
+#include "common/log.h"
+#include "common/trace.h"
+#include "platform/sched.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+constexpr unsigned kMaxRedirects = 5;
+
+std::string range_header(uint64_t first, uint64_t last)
+{
+	return "Range: bytes=" + std::to_string(first) + "-" + std::to_string(last) + "\r\n";
+}
+
+bool is_redirect(int status)
+{
+	return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+// Worth retrying on another connection rather than failing the download.
+bool is_transient(int status)
+{
+	return status == 408 || status == 429 || status >= 500;
+}
+
+} // namespace
+
+HttpSource::HttpSource(const HttpSourceOptions &options) : m_options(options)
+{
+	m_options.connections = std::max(m_options.connections, 1u);
+	m_options.range_size = std::max<size_t>(m_options.range_size, 64 * 1024);
+}
+
+HttpSource::~HttpSource()
+{
+	abort();
+	for (std::thread &t : m_threads)
+		t.join();
+}
+
+int HttpSource::open(const std::string &text)
+{
+	if (!parse_url(text, &m_url)) {
+		log_error("net: invalid URL %s", text.c_str());
+		return -EINVAL;
+	}
+
+	// The probe asks for the first range; a 206 both proves range support
+	// and carries range 0, so the connection goes on to be a downloader.
+	auto conn = std::unique_ptr<HttpConnection>(new HttpConnection);
+	HttpResponse response;
+	for (unsigned redirects = 0;; redirects++) {
+		int ret = conn->connect(m_url, m_options.timeout_ms);
+		if (ret == 0)
+			ret = conn->get(m_url, range_header(0, m_options.range_size - 1), &response);
+		if (ret < 0) {
+			log_error("net: %s: %s", m_url.str().c_str(), strerror(-ret));
+			return ret;
+		}
+		if (!is_redirect(response.status))
+			break;
+		Url next;
+		if (redirects == kMaxRedirects || !resolve_url(m_url, response.location, &next)) {
+			log_error("net: %s: bad or too many redirects", m_url.str().c_str());
+			return -ELOOP;
+		}
+		log_debug("net: redirected to %s", next.str().c_str());
+		conn->close();
+		m_url = next;
+	}
+
+	if (response.status == 416) {
+		m_size = 0; // empty file: no range is satisfiable
+		return 0;
+	}
+	if (response.status == 200) {
+		m_size = response.content_length;
+		m_stream = std::move(conn);
+		log_info("net: %s: %lld bytes, no range support, single stream", m_url.str().c_str(),
+			 (long long)m_size);
+		return 0;
+	}
+	if (response.status != 206 || response.range_start != 0 || response.total_size < 0) {
+		log_error("net: %s: HTTP %d", m_url.str().c_str(), response.status);
+		return -EIO;
+	}
+
+	m_size = response.total_size;
+	// If-Range only takes a strong ETag or a date.
+	if (!response.etag.empty() && response.etag.compare(0, 2, "W/"))
+		m_validator = response.etag;
+	else
+		m_validator = response.last_modified;
+	m_ranged = true;
+	m_ranges = ((uint64_t)m_size + m_options.range_size - 1) / m_options.range_size;
+	if (!m_ranges)
+		return 0;
+
+	size_t slots = (size_t)std::min<uint64_t>(m_options.connections + 1, m_ranges);
+	m_slots.resize(slots);
+	for (Slot &slot : m_slots)
+		slot.data.reset(new (std::nothrow) uint8_t[m_options.range_size]);
+	for (Slot &slot : m_slots)
+		if (!slot.data)
+			return -ENOMEM;
+
+	m_slots[0].range = 0;
+	m_slots[0].length = (size_t)std::min<uint64_t>(m_options.range_size, (uint64_t)m_size);
+	m_next_range = 1;
+
+	unsigned threads = (unsigned)std::min<uint64_t>(m_options.connections, m_ranges);
+	log_info("net: %s: %lld bytes, %llu ranges over %u connections", m_url.str().c_str(), (long long)m_size,
+		 (unsigned long long)m_ranges, threads);
+	m_threads.emplace_back(&HttpSource::worker, this, 0u, std::move(conn), (size_t)1);
+	for (unsigned i = 1; i < threads; i++)
+		m_threads.emplace_back(&HttpSource::worker, this, i, std::unique_ptr<HttpConnection>(new HttpConnection),
+				       (size_t)0);
+	return 0;
+}
+
+void HttpSource::worker(unsigned id, std::unique_ptr<HttpConnection> conn, size_t carried)
+{
+	TRACE_THREAD_NAME("http-%u", id);
+	sched_set_role(ThreadRole::Io);
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_active.push_back(conn.get());
+	}
+
+	for (bool first = true;; first = false) {
+		uint64_t range;
+		Slot *slot;
+		if (first && carried) {
+			range = 0;
+			slot = &m_slots[0];
+		} else {
+			std::unique_lock<std::mutex> lock(m_lock);
+			// Stay within the reorder window: range k may only start once
+			// range k - slots has been read.
+			m_space.wait(lock, [&] { return m_error || m_next_range < m_read_range + m_slots.size(); });
+			if (m_error || m_next_range >= m_ranges)
+				break;
+			range = m_next_range++;
+			slot = &m_slots[range % m_slots.size()];
+			slot->range = range;
+			slot->filled = 0;
+			slot->length = (size_t)std::min<uint64_t>(m_options.range_size,
+								  (uint64_t)m_size - range * m_options.range_size);
+		}
+
+		TRACE_SCOPE("net", "range");
+		int ret = fetch(*conn, range, *slot);
+		if (ret < 0) {
+			fail(ret);
+			break;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_active.erase(std::find(m_active.begin(), m_active.end(), conn.get()));
+	log_debug("net: connection %u done", id);
+}
+
+// Fills |slot| with range |range|, reopening the connection and resuming
+// from the first missing byte whenever it fails.
+int HttpSource::fetch(HttpConnection &conn, uint64_t range, Slot &slot)
+{
+	uint64_t base = range * m_options.range_size;
+	unsigned failures = 0;
+	int err = 0;
+
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_error)
+				return m_error;
+		}
+		if (failures > m_options.max_retries) {
+			log_error("net: range %llu failed %u times: %s", (unsigned long long)range, failures,
+				  strerror(-err));
+			return err;
+		}
+		if (failures) {
+			unsigned delay_ms = 100u << std::min(failures - 1, 5u);
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+		}
+
+		// A fresh request unless the connection still carries our body
+		// (range 0 from the probe).
+		if (!conn.connected() || conn.body_left() == 0) {
+			int ret = conn.connect(m_url, m_options.timeout_ms);
+			HttpResponse response;
+			uint64_t first = base + slot.filled;
+			std::string headers = range_header(first, base + slot.length - 1);
+			if (!m_validator.empty())
+				headers += "If-Range: " + m_validator + "\r\n";
+			if (ret == 0)
+				ret = conn.get(m_url, headers, &response);
+			if (ret < 0) {
+				err = ret;
+				failures++;
+				continue;
+			}
+			if (response.status == 200) {
+				log_error("net: %s changed on the server during download", m_url.str().c_str());
+				return -ESTALE;
+			}
+			if (response.status != 206 || response.range_start != (int64_t)first) {
+				conn.close();
+				err = -EIO;
+				if (!is_transient(response.status)) {
+					log_error("net: range %llu: HTTP %d", (unsigned long long)range, response.status);
+					return err;
+				}
+				failures++;
+				continue;
+			}
+			if (slot.filled)
+				m_resumes++;
+		}
+
+		size_t before = slot.filled;
+		int ret = fetch_into(conn, slot);
+		if (ret > 0)
+			return 0;
+		if (slot.filled > before)
+			failures = 0;
+		if (ret < 0) {
+			if (ret == -ECANCELED)
+				return ret;
+			log_debug("net: range %llu interrupted at %zu: %s", (unsigned long long)range, slot.filled,
+				  strerror(-ret));
+			conn.close();
+			err = ret;
+			failures++;
+		}
+	}
+}
+
+// Reads the current response body into |slot|. Returns 1 once the slot is
+// full, 0 if the body ended first, or -errno once the connection fails.
+// A full slot can be read and handed to another range at any moment, so
+// the caller must not look at it again after a return of 1.
+int HttpSource::fetch_into(HttpConnection &conn, Slot &slot)
+{
+	while (conn.body_left() != 0) {
+		// Only this thread writes past |filled|, so no lock while reading.
+		ssize_t n = conn.read_body(slot.data.get() + slot.filled, slot.length - slot.filled);
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_error)
+			return -ECANCELED;
+		if (n <= 0)
+			return n < 0 ? (int)n : -ECONNRESET;
+		slot.filled += (size_t)n;
+		if (slot.range == m_read_range)
+			m_filled.notify_one();
+		if (slot.filled == slot.length)
+			return 1;
+	}
+	return 0;
+}
+
+ssize_t HttpSource::read(uint8_t *buf, size_t len)
+{
+	if (!m_ranged) {
+		if (!m_stream)
+			return 0;
+		ssize_t n = m_stream->read_body(buf, len);
+		if (n < 0)
+			log_error("net: %s: %s", m_url.str().c_str(), strerror((int)-n));
+		return n;
+	}
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_read_range >= m_ranges)
+		return 0;
+	Slot &slot = m_slots[m_read_range % m_slots.size()];
+	m_filled.wait(lock, [&] { return m_error || (slot.range == m_read_range && slot.filled > m_read_pos); });
+	if (m_error)
+		return m_error;
+
+	// Bytes below |filled| are final; copy them without holding the lock.
+	size_t n = std::min(len, slot.filled - m_read_pos);
+	const uint8_t *src = slot.data.get() + m_read_pos;
+	lock.unlock();
+	memcpy(buf, src, n);
+	lock.lock();
+
+	m_read_pos += n;
+	if (m_read_pos == slot.length) {
+		m_read_range++;
+		m_read_pos = 0;
+		m_space.notify_all();
+	}
+	return (ssize_t)n;
+}
+
+void HttpSource::fail(int err)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_error)
+		return;
+	m_error = err;
+	for (HttpConnection *conn : m_active)
+		conn->shutdown();
+	m_filled.notify_all();
+	m_space.notify_all();
+}
+
+void HttpSource::abort()
+{
+	fail(-ECANCELED);
+}
+
+} // namespace recovery
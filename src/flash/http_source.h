@@ -0,0 +1,94 @@
+#pragma once
+
+#include "flash/source.h"
+#include "net/http_connection.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+struct HttpSourceOptions {
+	// Parallel connections. One TCP stream cannot fill a long fat pipe;
+	// several in flight can.
+	unsigned connections = 4;
+	// Bytes per range request. Memory use is (connections + 1) ranges.
+	size_t range_size = 1 << 20;
+	// Per socket operation; a stalled connection is dropped and resumed.
+	unsigned timeout_ms = 10000;
+	// Consecutive failures of one range before the download gives up.
+	unsigned max_retries = 8;
+};
+
+// Downloads an image over HTTP(S) for the flash pipeline.
+//
+// The file is split into ranges fetched by several connections at once
+// with keep-alive Range requests; read() hands them out strictly in
+// order, streaming the head range while it is still arriving. Ranges are
+// taken in order too, so the reorder buffer stays within one range per
+// connection. A connection that drops is reopened and continues its range
+// where it stopped (If-Range pins the ETag, so a file changed on the
+// mirror fails instead of mixing versions). Servers without range support
+// are read as a single stream.
+class HttpSource : public Source {
+public:
+	explicit HttpSource(const HttpSourceOptions &options = HttpSourceOptions());
+	~HttpSource() override;
+
+	// Probes |url|, following redirects, and starts the downloaders.
+	// Returns 0 or -errno.
+	int open(const std::string &url);
+
+	ssize_t read(uint8_t *buf, size_t len) override;
+	int64_t size() const override { return m_size; }
+
+	// Stops all transfers; read() then fails with -ECANCELED.
+	void abort();
+
+	// Times a connection was reopened to resume a range.
+	unsigned resumes() const { return m_resumes.load(); }
+	const Url &url() const { return m_url; }
+
+private:
+	struct Slot {
+		std::unique_ptr<uint8_t[]> data;
+		uint64_t range = UINT64_MAX;
+		size_t filled = 0;
+		size_t length = 0;
+	};
+
+	void worker(unsigned id, std::unique_ptr<HttpConnection> conn, size_t carried);
+	int fetch(HttpConnection &conn, uint64_t range, Slot &slot);
+	int fetch_into(HttpConnection &conn, Slot &slot);
+	void fail(int err);
+
+	HttpSourceOptions m_options;
+	Url m_url;
+	int64_t m_size = -1;
+	std::string m_validator;
+	bool m_ranged = false;
+
+	// Single-stream mode.
+	std::unique_ptr<HttpConnection> m_stream;
+
+	// Ranged mode: range k lives in slot k % slots until read.
+	std::mutex m_lock;
+	std::condition_variable m_filled;
+	std::condition_variable m_space;
+	std::vector<Slot> m_slots;
+	std::vector<HttpConnection *> m_active;
+	uint64_t m_ranges = 0;
+	uint64_t m_next_range = 0;
+	uint64_t m_read_range = 0;
+	size_t m_read_pos = 0;
+	int m_error = 0;
+	std::vector<std::thread> m_threads;
+	std::atomic<unsigned> m_resumes{ 0 };
+};
+
+} // namespace recovery
@@ -0,0 +1,206 @@
+#include "flash/parallel_decoder.h"
+
+#include "common/trace.h"
+#include "platform/sched.h"
+
+#include <errno.h>
+
+namespace recovery {
+
+ParallelFrameDecoder::ParallelFrameDecoder(unsigned threads)
+	: m_threads(threads ? threads : 1), m_streaming(m_threads == 1), m_slots(m_threads)
+{
+}
+
+ParallelFrameDecoder::~ParallelFrameDecoder()
+{
+	stop_workers();
+}
+
+void ParallelFrameDecoder::stop_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work.notify_all();
+	for (std::thread &t : m_workers)
+		t.join();
+	m_workers.clear();
+}
+
+void ParallelFrameDecoder::start_workers()
+{
+	if (m_streaming)
+		return;
+	for (unsigned i = 0; i < m_threads; i++)
+		m_workers.emplace_back(&ParallelFrameDecoder::worker, this, i);
+}
+
+void ParallelFrameDecoder::worker(unsigned index)
+{
+	TRACE_THREAD_NAME("decode-%u", index);
+	sched_set_role(ThreadRole::Compute);
+	Slot &slot = m_slots[index];
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_work.wait(lock, [&] { return m_stop || slot.state == SlotState::Queued; });
+		if (m_stop)
+			return;
+		lock.unlock();
+		slot.output.clear();
+		TRACE_SCOPE("flash", "decode_frame");
+		int result = decode_frame(index, slot.frame, slot.input.data(), slot.input.size(), slot.output);
+		lock.lock();
+		slot.result = result;
+		slot.state = SlotState::Done;
+		m_done.notify_all();
+	}
+}
+
+int ParallelFrameDecoder::decode(const uint8_t *data, size_t len, ChunkWriter &out)
+{
+	if (m_streaming)
+		return stream_decode(data, len, out);
+	m_pending.insert(m_pending.end(), data, data + len);
+	return cut_frames(out, false);
+}
+
+int ParallelFrameDecoder::finish(ChunkWriter &out)
+{
+	if (m_streaming)
+		return stream_finish(out);
+
+	int ret = cut_frames(out, true);
+	if (ret < 0)
+		return ret;
+	ret = collect_all(out);
+	if (ret < 0)
+		return ret;
+	if (m_streaming) {
+		ret = stream_pending(out);
+		return ret < 0 ? ret : stream_finish(out);
+	}
+	return m_pending_pos < m_pending.size() ? -EBADMSG : 0;
+}
+
+int ParallelFrameDecoder::cut_frames(ChunkWriter &out, bool at_end)
+{
+	while (m_pending_pos < m_pending.size()) {
+		ssize_t n = frame_length(m_pending.data() + m_pending_pos, m_pending.size() - m_pending_pos, at_end);
+		if (n < 0)
+			return (int)n;
+		if (n == 0)
+			break;
+		int ret = submit(m_pending.data() + m_pending_pos, (size_t)n, out);
+		if (ret < 0)
+			return ret;
+		m_pending_pos += (size_t)n;
+		// An earlier frame turned out too large to decode whole.
+		if (m_streaming)
+			return stream_pending(out);
+	}
+
+	// Keep the buffer from creeping: drop consumed bytes once they dominate.
+	if (m_pending_pos && m_pending_pos * 2 >= m_pending.size()) {
+		m_pending.erase(m_pending.begin(), m_pending.begin() + m_pending_pos);
+		m_pending_pos = 0;
+	}
+
+	if (!at_end && m_pending.size() - m_pending_pos > kMaxBufferedFrame) {
+		// This frame is too big to buffer; drain in order, then decode the
+		// rest of the stream sequentially.
+		int ret = collect_all(out);
+		if (ret < 0)
+			return ret;
+		m_streaming = true;
+		return stream_pending(out);
+	}
+	return 0;
+}
+
+int ParallelFrameDecoder::stream_pending(ChunkWriter &out)
+{
+	int ret = 0;
+	if (m_pending_pos < m_pending.size())
+		ret = stream_decode(m_pending.data() + m_pending_pos, m_pending.size() - m_pending_pos, out);
+	m_pending.clear();
+	m_pending.shrink_to_fit();
+	m_pending_pos = 0;
+	return ret;
+}
+
+int ParallelFrameDecoder::fall_back(Slot &slot, ChunkWriter &out)
+{
+	m_streaming = true;
+	int ret = stream_decode(slot.input.data(), slot.input.size(), out);
+	// Later frames are decoded again in order; what workers made of them
+	// is dropped.
+	for (uint64_t frame = slot.frame + 1; frame < m_submitted; frame++) {
+		Slot &next = m_slots[frame % m_threads];
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [&] { return next.state == SlotState::Done; });
+			next.state = SlotState::Idle;
+		}
+		if (ret == 0)
+			ret = stream_decode(next.input.data(), next.input.size(), out);
+	}
+	for (Slot &s : m_slots) {
+		std::vector<uint8_t>().swap(s.input);
+		std::vector<uint8_t>().swap(s.output);
+	}
+	return ret;
+}
+
+int ParallelFrameDecoder::submit(const uint8_t *data, size_t len, ChunkWriter &out)
+{
+	Slot &slot = m_slots[m_submitted % m_threads];
+	int ret = collect(slot, out);
+	if (ret < 0 || m_streaming)
+		return ret < 0 ? ret : stream_decode(data, len, out);
+
+	slot.input.assign(data, data + len);
+	slot.frame = m_submitted;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		slot.state = SlotState::Queued;
+	}
+	m_work.notify_all();
+	m_submitted++;
+	return 0;
+}
+
+int ParallelFrameDecoder::collect(Slot &slot, ChunkWriter &out)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (slot.state == SlotState::Idle)
+			return 0;
+		m_done.wait(lock, [&] { return slot.state == SlotState::Done; });
+		slot.state = SlotState::Idle;
+	}
+	if (slot.result == -E2BIG)
+		return fall_back(slot, out);
+	if (slot.result < 0)
+		return slot.result;
+	return emit_frame(slot.frame, slot.output, out);
+}
+
+int ParallelFrameDecoder::emit_frame(uint64_t, const std::vector<uint8_t> &data, ChunkWriter &out)
+{
+	return out.write(data.data(), data.size()) ? 0 : -ECANCELED;
+}
+
+int ParallelFrameDecoder::collect_all(ChunkWriter &out)
+{
+	// Oldest first: slot of the next submission holds the oldest frame.
+	for (unsigned i = 0; i < m_threads; i++) {
+		int ret = collect(m_slots[(m_submitted + i) % m_threads], out);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+} // namespace recovery
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "flash/decoder.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+// Base for formats made of independently decodable frames (pzstd output,
+// pbzip2/lbzip2 multi-stream bz2).
+//
+// Input is cut into complete frames on the pipeline's decode thread, and
+// frame k is decoded by worker k % threads. Results are emitted strictly in
+// submission order, so the writer sees the same byte stream as a serial
+// decoder. A stream with a frame that outgrows kMaxBufferedFrame (e.g. a
+// plain single-stream bzip2 file), or that decodes to more than
+// kMaxDecodedFrame, is finished through the subclass's sequential decoder
+// from that frame on, so memory stays bounded either way: at most
+// |threads| frames of each size are held.
+class ParallelFrameDecoder : public Decoder {
+public:
+	static const size_t kMaxBufferedFrame = 16 << 20;
+	static const size_t kMaxDecodedFrame = 32 << 20;
+
+	explicit ParallelFrameDecoder(unsigned threads);
+	~ParallelFrameDecoder() override;
+
+	int decode(const uint8_t *data, size_t len, ChunkWriter &out) override;
+	int finish(ChunkWriter &out) override;
+
+protected:
+	// Must be called by the subclass constructor once it is fully set up;
+	// workers call decode_frame() from then on. Subclass destructors must
+	// call stop_workers() before tearing down what decode_frame() uses.
+	void start_workers();
+	void stop_workers();
+
+	// Length of the complete frame at the start of |data|; 0 if more input
+	// is needed, or -EBADMSG. With |at_end| no more input will follow.
+	virtual ssize_t frame_length(const uint8_t *data, size_t len, bool at_end) = 0;
+	// Decodes frame number |frame| into |out| (cleared by the caller). Runs
+	// concurrently on worker |worker| < threads. Returns -E2BIG, before
+	// growing |out| past kMaxDecodedFrame, for a frame too large to hold;
+	// stream_decode() is then handed that frame and all after it.
+	virtual int decode_frame(unsigned worker, uint64_t frame, const uint8_t *data, size_t len,
+				 std::vector<uint8_t> &out) = 0;
+	// Passes a decoded frame downstream, on the decode thread and in frame
+	// order. Formats whose output is not just the frames concatenated
+	// override this.
+	virtual int emit_frame(uint64_t frame, const std::vector<uint8_t> &data, ChunkWriter &out);
+	// Sequential decoding of whatever follows once frames got too large.
+	virtual int stream_decode(const uint8_t *data, size_t len, ChunkWriter &out) = 0;
+	virtual int stream_finish(ChunkWriter &out) = 0;
+
+	unsigned threads() const { return m_threads; }
+
+private:
+	enum class SlotState { Idle, Queued, Done };
+
+	struct Slot {
+		SlotState state = SlotState::Idle;
+		std::vector<uint8_t> input;
+		std::vector<uint8_t> output;
+		uint64_t frame = 0;
+		int result = 0;
+	};
+
+	int cut_frames(ChunkWriter &out, bool at_end);
+	// Switches to stream_decode(), starting with the frame in |slot|, the
+	// oldest outstanding, and the frames queued after it.
+	int fall_back(Slot &slot, ChunkWriter &out);
+	// Streams the input not yet cut into frames.
+	int stream_pending(ChunkWriter &out);
+	int submit(const uint8_t *data, size_t len, ChunkWriter &out);
+	// Waits for |slot| and writes its output downstream.
+	int collect(Slot &slot, ChunkWriter &out);
+	int collect_all(ChunkWriter &out);
+	void worker(unsigned index);
+
+	unsigned m_threads;
+	bool m_streaming;
+	std::vector<uint8_t> m_pending;
+	size_t m_pending_pos = 0;
+	uint64_t m_submitted = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work;
+	std::condition_variable m_done;
+	std::vector<Slot> m_slots;
+	std::vector<std::thread> m_workers;
+	bool m_stop = false;
+};
+
+} // namespace recovery
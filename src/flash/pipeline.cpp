@@ -0,0 +1,503 @@
+#include "flash/pipeline.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "common/meminfo.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "crypto/hasher.h"
+#include "flash/flash_journal.h"
+#include "platform/sched.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+
+namespace recovery {
+
+// Chunks the verifier keeps in flight per hash worker, so workers never
+// wait on the next chunk being handed out.
+static const unsigned kHashChunksPerThread = 2;
+
+// Automatic queue depth: the pool may take this share of available memory,
+// within these bounds. Past 32 deeper queues no longer smooth out sink
+// stalls, they only pin RAM; 4 is used if /proc/meminfo cannot be read.
+static const unsigned kPoolMemoryShare = 8;
+static const unsigned kMinQueueDepth = 2;
+static const unsigned kMaxQueueDepth = 32;
+static const unsigned kDefaultQueueDepth = 4;
+
+// Chunks the pool needs beyond the queues themselves: one in hand per
+// stage, two for the decoder, and those being tree hashed.
+static size_t pool_spare_chunks(bool tree, unsigned hash_threads)
+{
+	return 5 + (tree ? kHashChunksPerThread * (size_t)hash_threads : 0);
+}
+
+static PipelineOptions resolve_options(const PipelineOptions &options, bool tree, unsigned hash_threads)
+{
+	PipelineOptions resolved = options;
+	if (options.queue_depth)
+		return resolved;
+	uint64_t available = mem_available_bytes();
+	if (!available) {
+		resolved.queue_depth = kDefaultQueueDepth;
+		return resolved;
+	}
+	uint64_t chunks = available / kPoolMemoryShare / options.chunk_size;
+	size_t spare = pool_spare_chunks(tree, hash_threads);
+	uint64_t depth = chunks > spare ? (chunks - spare) / 3 : 0;
+	resolved.queue_depth = (unsigned)std::min<uint64_t>(std::max<uint64_t>(depth, kMinQueueDepth), kMaxQueueDepth);
+	log_debug("flash: %llu MiB available, queue depth %u", (unsigned long long)(available >> 20),
+		  resolved.queue_depth);
+	return resolved;
+}
+
+const char *stage_name(Stage stage)
+{
+	switch (stage) {
+	case Stage::Read:
+		return "read";
+	case Stage::Decode:
+		return "decode";
+	case Stage::Verify:
+		return "verify";
+	case Stage::Write:
+		return "write";
+	default:
+		return "?";
+	}
+}
+
+// Totals over every flash since start, for the metrics export; indexed by
+// Stage.
+static Counter s_stage_bytes[] = {
+	{ "recovery_flash_stage_bytes_total", "stage=\"read\"", "Bytes through each flash pipeline stage." },
+	{ "recovery_flash_stage_bytes_total", "stage=\"decode\"", "Bytes through each flash pipeline stage." },
+	{ "recovery_flash_stage_bytes_total", "stage=\"verify\"", "Bytes through each flash pipeline stage." },
+	{ "recovery_flash_stage_bytes_total", "stage=\"write\"", "Bytes through each flash pipeline stage." },
+};
+static Counter s_stage_starved[] = {
+	{ "recovery_flash_stage_starved_seconds_total", "stage=\"read\"", "Time each stage waited for input.", 1e-6 },
+	{ "recovery_flash_stage_starved_seconds_total", "stage=\"decode\"", "Time each stage waited for input.", 1e-6 },
+	{ "recovery_flash_stage_starved_seconds_total", "stage=\"verify\"", "Time each stage waited for input.", 1e-6 },
+	{ "recovery_flash_stage_starved_seconds_total", "stage=\"write\"", "Time each stage waited for input.", 1e-6 },
+};
+static Counter s_stage_blocked[] = {
+	{ "recovery_flash_stage_blocked_seconds_total", "stage=\"read\"",
+	  "Time each stage waited for room downstream or a free chunk.", 1e-6 },
+	{ "recovery_flash_stage_blocked_seconds_total", "stage=\"decode\"",
+	  "Time each stage waited for room downstream or a free chunk.", 1e-6 },
+	{ "recovery_flash_stage_blocked_seconds_total", "stage=\"verify\"",
+	  "Time each stage waited for room downstream or a free chunk.", 1e-6 },
+	{ "recovery_flash_stage_blocked_seconds_total", "stage=\"write\"",
+	  "Time each stage waited for room downstream or a free chunk.", 1e-6 },
+};
+// Chunks waiting in front of decode, verify and write, as each last took one.
+static Gauge s_queued[] = {
+	{ "recovery_flash_queued_chunks", "stage=\"decode\"", "Chunks queued in front of each stage." },
+	{ "recovery_flash_queued_chunks", "stage=\"verify\"", "Chunks queued in front of each stage." },
+	{ "recovery_flash_queued_chunks", "stage=\"write\"", "Chunks queued in front of each stage." },
+};
+
+// Pops from |queue|, charging the wait to |stats|.
+static bool pop_timed(ChunkQueue &queue, Chunk *&chunk, Stage stage, StageStats &stats)
+{
+	uint64_t start = monotonic_us();
+	bool ok = queue.pop(chunk);
+	uint64_t waited = monotonic_us() - start;
+	stats.starved_us += waited;
+	s_stage_starved[(int)stage].add(waited);
+	s_queued[(int)stage - 1].set((int64_t)queue.size());
+	return ok;
+}
+
+static bool push_timed(ChunkQueue &queue, Chunk *chunk, Stage stage, StageStats &stats)
+{
+	uint64_t start = monotonic_us();
+	bool ok = queue.push(chunk);
+	uint64_t waited = monotonic_us() - start;
+	stats.blocked_us += waited;
+	s_stage_blocked[(int)stage].add(waited);
+	return ok;
+}
+
+static_assert(sizeof(s_stage_bytes) / sizeof(s_stage_bytes[0]) == (size_t)Stage::Count, "a counter per stage");
+
+static bool digest_matches(const char *what, const uint8_t *got, const uint8_t *want)
+{
+	if (!memcmp(got, want, Sha256::kDigestSize))
+		return true;
+	char got_hex[2 * Sha256::kDigestSize + 1], want_hex[2 * Sha256::kDigestSize + 1];
+	sha256_to_hex(got, got_hex);
+	sha256_to_hex(want, want_hex);
+	log_error("flash: %s mismatch, got %s expected %s", what, got_hex, want_hex);
+	return false;
+}
+
+FlashPipeline::FlashPipeline(Source &source, Decoder &decoder, Sink &sink, const PipelineOptions &options)
+	: m_source(source),
+	  m_decoder(decoder),
+	  m_sink(sink),
+	  m_options(resolve_options(options, options.has_tree_digest || !options.has_digest,
+				    options.hash_threads ? options.hash_threads : default_decoder_threads())),
+	  m_read_queue(m_options.queue_depth),
+	  m_decode_queue(m_options.queue_depth),
+	  m_verify_queue(m_options.queue_depth),
+	  m_use_tree(options.has_tree_digest || !options.has_digest),
+	  m_hash_threads(options.hash_threads ? options.hash_threads : default_decoder_threads())
+{
+	// Every queue full plus the spare chunks in hand can never starve the
+	// pool, so stages cannot deadlock on it.
+	size_t count = 3 * (size_t)m_options.queue_depth + pool_spare_chunks(m_use_tree, m_hash_threads);
+	m_pool.reset(new ChunkPool(count, m_options.chunk_size));
+}
+
+void FlashPipeline::fail(int err)
+{
+	int expected = 0;
+	if (!m_error.compare_exchange_strong(expected, err))
+		return;
+	if (err != -ECANCELED)
+		log_error("flash: pipeline failed: %s", strerror(-err));
+	m_read_queue.abort();
+	m_decode_queue.abort();
+	m_verify_queue.abort();
+	m_pool->abort();
+}
+
+void FlashPipeline::cancel()
+{
+	fail(-ECANCELED);
+}
+
+int FlashPipeline::run()
+{
+	if (!m_pool->valid())
+		return -ENOMEM;
+	if ((m_options.resume_leaves || m_options.journal) && (!m_options.leaf_digests || m_options.has_digest))
+		return -EINVAL;
+
+	TRACE_COUNTER("flash", "pool_chunks", m_pool->count());
+	TRACE_COUNTER("flash", "queue_depth", m_options.queue_depth);
+	uint64_t start = monotonic_us();
+	m_start_us.store(start, std::memory_order_relaxed);
+	std::thread reader(&FlashPipeline::read_stage, this);
+	std::thread decoder(&FlashPipeline::decode_stage, this);
+	std::thread verifier(&FlashPipeline::verify_stage, this);
+	write_stage();
+	reader.join();
+	decoder.join();
+	verifier.join();
+	m_elapsed_us = monotonic_us() - start;
+	m_finished.store(true, std::memory_order_release);
+
+	int err = m_error.load();
+	if (err)
+		return err;
+
+	if (m_options.has_digest && !digest_matches("checksum", m_digest, m_options.digest))
+		return -EBADMSG;
+	if (m_options.has_tree_digest && !digest_matches("tree digest", m_tree_digest, m_options.tree_digest))
+		return -EBADMSG;
+	return 0;
+}
+
+void FlashPipeline::publish(Stage stage, uint64_t bytes)
+{
+	// Only |stage| stores its count, so it can read back what it last
+	// published.
+	uint64_t last = m_live[(int)stage].bytes.load(std::memory_order_relaxed);
+	if (bytes > last)
+		s_stage_bytes[(int)stage].add(bytes - last);
+	m_live[(int)stage].bytes.store(bytes, std::memory_order_relaxed);
+}
+
+PipelineProgress FlashPipeline::progress() const
+{
+	PipelineProgress p;
+	p.finished = m_finished.load(std::memory_order_acquire);
+	for (int s = 0; s < (int)Stage::Count; s++)
+		p.bytes[s] = m_live[s].bytes.load(std::memory_order_relaxed);
+	p.source_size = m_source.size();
+	uint64_t start = m_start_us.load(std::memory_order_relaxed);
+	if (p.finished)
+		p.elapsed_us = m_elapsed_us;
+	else if (start)
+		p.elapsed_us = monotonic_us() - start;
+	return p;
+}
+
+void FlashPipeline::read_stage()
+{
+	StageStats &stats = m_stats[(int)Stage::Read];
+	uint64_t start = monotonic_us();
+	TRACE_THREAD_NAME("flash-read");
+	sched_set_role(ThreadRole::Io);
+	uint64_t offset = 0;
+	bool eof = false;
+
+	while (!eof) {
+		uint64_t wait = monotonic_us();
+		Chunk *chunk = m_pool->get();
+		wait = monotonic_us() - wait;
+		stats.blocked_us += wait;
+		s_stage_blocked[(int)Stage::Read].add(wait);
+		if (!chunk)
+			break;
+
+		// Fill whole chunks so downstream writes stay page aligned.
+		while (chunk->size < chunk->capacity) {
+			TRACE_SCOPE("flash", "read");
+			ssize_t n = m_source.read(chunk->data + chunk->size, chunk->capacity - chunk->size);
+			if (n < 0) {
+				fail((int)n);
+				break;
+			}
+			if (n == 0) {
+				eof = true;
+				break;
+			}
+			chunk->size += n;
+		}
+		if (!chunk->size || m_error.load()) {
+			m_pool->put(chunk);
+			break;
+		}
+
+		chunk->offset = offset;
+		offset += chunk->size;
+		stats.bytes += chunk->size;
+		publish(Stage::Read, stats.bytes);
+		if (!push_timed(m_read_queue, chunk, Stage::Read, stats)) {
+			m_pool->put(chunk);
+			break;
+		}
+		TRACE_COUNTER("flash", "read_queue", m_read_queue.size());
+	}
+	m_read_queue.close();
+	stats.busy_us = monotonic_us() - start - stats.blocked_us;
+}
+
+void FlashPipeline::decode_stage()
+{
+	StageStats &stats = m_stats[(int)Stage::Decode];
+	uint64_t start = monotonic_us();
+	TRACE_THREAD_NAME("flash-decode");
+	sched_set_role(ThreadRole::Compute);
+	ChunkWriter out(*m_pool, m_decode_queue, m_options.resume_leaves * m_options.tree_leaf_size);
+	bool passthrough = m_decoder.passthrough();
+	Chunk *chunk;
+	// The writer times its own waits; they are exported as they happen.
+	uint64_t stall_reported = 0;
+	auto report = [&] {
+		publish(Stage::Decode, out.bytes());
+		s_stage_blocked[(int)Stage::Decode].add(out.stall_us() - stall_reported);
+		stall_reported = out.stall_us();
+	};
+
+	while (pop_timed(m_read_queue, chunk, Stage::Decode, stats)) {
+		if (passthrough) {
+			if (!out.forward(chunk))
+				break;
+			report();
+			continue;
+		}
+		TRACE_SCOPE("flash", "decode");
+		int ret = m_decoder.decode(chunk->data, chunk->size, out);
+		m_pool->put(chunk);
+		if (ret < 0) {
+			fail(ret);
+			break;
+		}
+		report();
+	}
+
+	if (!m_error.load()) {
+		int ret = m_decoder.finish(out);
+		if (ret < 0)
+			fail(ret);
+		else if (!out.flush())
+			fail(-ECANCELED);
+	}
+	m_decode_queue.close();
+
+	stats.bytes = out.bytes();
+	report();
+	stats.blocked_us = out.stall_us();
+	stats.busy_us = monotonic_us() - start - stats.starved_us - stats.blocked_us;
+}
+
+void FlashPipeline::verify_stage()
+{
+	StageStats &stats = m_stats[(int)Stage::Verify];
+	uint64_t start = monotonic_us();
+	TRACE_THREAD_NAME("flash-verify");
+	sched_set_role(ThreadRole::Compute);
+	Hasher hash;
+	Chunk *chunk;
+
+	if (!m_use_tree) {
+		while (pop_timed(m_decode_queue, chunk, Stage::Verify, stats)) {
+			TRACE_SCOPE("flash", "sha256");
+			hash.update(chunk->data, chunk->size);
+			stats.bytes += chunk->size;
+			if (!pass_verified(chunk, stats))
+				break;
+		}
+	} else {
+		// Chunks being tree hashed, oldest first; each leaves for the
+		// writer once its pieces are done, so order is kept.
+		struct InFlight {
+			Chunk *chunk = nullptr;
+			std::atomic<unsigned> pending{ 0 };
+		};
+		size_t capacity = kHashChunksPerThread * (size_t)m_hash_threads;
+		std::unique_ptr<InFlight[]> ring(new InFlight[capacity]);
+		size_t head = 0, count = 0;
+		TreeHasher tree(m_options.tree_leaf_size, m_hash_threads);
+		if (m_options.leaf_digests)
+			tree.expect(m_options.leaf_digests, m_options.leaf_count, m_options.resume_leaves);
+		bool ok = true;
+		// Passes on a hashed chunk unless a leaf failed its check.
+		auto release = [&](Chunk *done) {
+			int err = tree.error();
+			if (!err)
+				return pass_verified(done, stats);
+			if (err == -EBADMSG)
+				log_error("flash: image data does not match its chunk digests");
+			fail(err);
+			m_pool->put(done);
+			return false;
+		};
+
+		while (ok && pop_timed(m_decode_queue, chunk, Stage::Verify, stats)) {
+			if (m_options.has_digest) {
+				TRACE_SCOPE("flash", "sha256");
+				hash.update(chunk->data, chunk->size);
+			}
+			if (count == capacity) {
+				TRACE_SCOPE("flash", "hash_wait");
+				tree.wait(&ring[head].pending);
+				ok = release(ring[head].chunk);
+				head = (head + 1) % capacity;
+				count--;
+			}
+			InFlight &slot = ring[(head + count++) % capacity];
+			slot.chunk = chunk;
+			tree.update(chunk->data, chunk->size, &slot.pending);
+			stats.bytes += chunk->size;
+			while (ok && count && ring[head].pending.load() == 0) {
+				ok = release(ring[head].chunk);
+				head = (head + 1) % capacity;
+				count--;
+			}
+		}
+		// Workers may still be reading what is queued, abort or not.
+		for (; count; head = (head + 1) % capacity, count--) {
+			tree.wait(&ring[head].pending);
+			if (ok)
+				ok = release(ring[head].chunk);
+			else
+				m_pool->put(ring[head].chunk);
+		}
+		int ret = tree.final(m_tree_digest);
+		if (ret < 0)
+			fail(ret);
+	}
+
+	int ret = hash.final(m_digest);
+	if (ret < 0)
+		fail(ret);
+	m_verify_queue.close();
+	stats.busy_us = monotonic_us() - start - stats.starved_us - stats.blocked_us;
+}
+
+int FlashPipeline::commit_progress()
+{
+	TRACE_SCOPE("flash", "commit");
+	int64_t durable = m_sink.sync();
+	if (durable == -EOPNOTSUPP) {
+		log_info("flash: %s sink cannot be journaled", m_sink.name());
+		m_options.journal = nullptr;
+		return 0;
+	}
+	if (durable < 0)
+		return (int)durable;
+
+	// Only whole leaves count, and a resumed write must start on a block
+	// the sink can start at (an erase block on MTD).
+	uint64_t leaf = m_options.tree_leaf_size;
+	uint64_t unit = leaf;
+	if (uint32_t block = m_sink.block_size()) {
+		uint64_t a = unit, b = block;
+		while (b) {
+			uint64_t t = a % b;
+			a = b;
+			b = t;
+		}
+		unit = unit / a * block;
+	}
+	uint64_t chunks = (uint64_t)durable / unit * unit / leaf;
+	int ret = m_options.journal->commit((uint32_t)chunks);
+	if (ret < 0) {
+		// The flash itself is fine; it just cannot be resumed any more.
+		log_error("flash: cannot write the journal: %s", strerror(-ret));
+		m_options.journal = nullptr;
+	}
+	return 0;
+}
+
+bool FlashPipeline::pass_verified(Chunk *chunk, StageStats &stats)
+{
+	size_t size = chunk->size;
+	if (push_timed(m_verify_queue, chunk, Stage::Verify, stats)) {
+		m_verified += size;
+		publish(Stage::Verify, m_verified);
+		return true;
+	}
+	m_pool->put(chunk);
+	return false;
+}
+
+void FlashPipeline::write_stage()
+{
+	StageStats &stats = m_stats[(int)Stage::Write];
+	uint64_t start = monotonic_us();
+	TRACE_THREAD_NAME("flash-write");
+	sched_set_role(ThreadRole::Writer);
+	Chunk *chunk;
+	uint64_t committed = 0;
+
+	while (pop_timed(m_verify_queue, chunk, Stage::Write, stats)) {
+		TRACE_COUNTER("flash", "verify_queue", m_verify_queue.size());
+		int ret;
+		{
+			TRACE_SCOPE("flash", "write");
+			ret = m_sink.write(chunk->data, chunk->size, chunk->offset);
+		}
+		stats.bytes += chunk->size;
+		m_pool->put(chunk);
+		TRACE_COUNTER("flash", "pool_free", m_pool->free_count());
+		if (ret == 0 && m_options.journal && stats.bytes - committed >= FlashJournal::kCommitBytes) {
+			committed = stats.bytes;
+			ret = commit_progress();
+		}
+		if (ret < 0) {
+			fail(ret);
+			break;
+		}
+		publish(Stage::Write, stats.bytes);
+	}
+
+	if (!m_error.load()) {
+		TRACE_SCOPE("flash", "sync");
+		int ret = m_sink.finish();
+		if (ret < 0)
+			fail(ret);
+	}
+	stats.busy_us = monotonic_us() - start - stats.starved_us;
+}
+
+} // namespace recovery
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "crypto/sha256.h"
+#include "crypto/tree_hash.h"
+#include "flash/chunk.h"
+#include "flash/decoder.h"
+#include "flash/sink.h"
+#include "flash/source.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+namespace recovery {
+
+class FlashJournal;
+
+// Default tree digest leaf; matches recovery-fleet's default chunk.
+const uint32_t kTreeLeafSize = 256 * 1024;
+
+// The four pipeline stages, each running on its own thread.
+enum class Stage {
+	Read,
+	Decode,
+	Verify,
+	Write,
+	Count,
+};
+
+const char *stage_name(Stage stage);
+
+struct StageStats {
+	// Bytes leaving the stage (compressed bytes for Read).
+	uint64_t bytes = 0;
+	// Time spent doing work, excluding stalls.
+	uint64_t busy_us = 0;
+	// Time blocked waiting for input.
+	uint64_t starved_us = 0;
+	// Time blocked on a full downstream queue or an empty pool.
+	uint64_t blocked_us = 0;
+};
+
+struct PipelineOptions {
+	size_t chunk_size = 256 * 1024;
+	// Chunks each inter-stage queue may hold; 0 sizes the queues, and so
+	// the chunk pool, from the memory available when the pipeline is built.
+	unsigned queue_depth = 0;
+	// Expected SHA-256 of the decoded image; the run fails with -EBADMSG on
+	// a mismatch. A flat SHA-256 cannot be split across cores, so it is
+	// only computed when asked for.
+	bool has_digest = false;
+	uint8_t digest[Sha256::kDigestSize] = {};
+	// Expected tree digest (see tree_hash.h) with |tree_leaf_size| leaves,
+	// checked the same way. It is hashed on |hash_threads| workers (0: one
+	// per CPU) and computed whenever the flat digest is not requested.
+	bool has_tree_digest = false;
+	uint8_t tree_digest[Sha256::kDigestSize] = {};
+	uint32_t tree_leaf_size = kTreeLeafSize;
+	unsigned hash_threads = 0;
+	// Digests of the tree's leaves, if known up front (a container's chunk
+	// digests): each leaf is then checked as soon as it is hashed, and a
+	// chunk whose leaf does not match never reaches the sink. Must outlive
+	// the pipeline.
+	const uint8_t *leaf_digests = nullptr;
+	uint64_t leaf_count = 0;
+	// Resuming an interrupted flash: the first |resume_leaves| leaves are
+	// on the sink already and are neither hashed nor written again. The
+	// decoder's output starts after them. Needs |leaf_digests| and no flat
+	// digest.
+	uint64_t resume_leaves = 0;
+	// Records durable progress every FlashJournal::kCommitBytes; needs
+	// |leaf_digests|, so that only checked data is ever committed.
+	FlashJournal *journal = nullptr;
+};
+
+// Where a running pipeline is, as sampled by FlashPipeline::progress().
+struct PipelineProgress {
+	// Bytes each stage has passed on so far (compressed bytes for Read).
+	uint64_t bytes[(int)Stage::Count] = {};
+	// Compressed input size, or -1 if the source cannot tell.
+	int64_t source_size = -1;
+	uint64_t elapsed_us = 0;
+	bool finished = false;
+};
+
+// Streams an image from a Source through a Decoder and SHA-256 into a Sink.
+//
+// Stages are connected by bounded chunk queues and overlap fully: while
+// chunk N is being written, N+1 is hashed, N+2 decoded and N+3 read. RAM
+// use is fixed at construction (the chunk pool) regardless of image size,
+// so nothing is staged in tmpfs. The digest is checked once the last chunk
+// has been written; a mismatch fails the run. With a tree digest the verify
+// stage fans chunks out to hash workers and passes them on in order, so it
+// keeps up with the sink on multi-core boxes.
+class FlashPipeline {
+public:
+	FlashPipeline(Source &source, Decoder &decoder, Sink &sink, const PipelineOptions &options = PipelineOptions());
+
+	// Runs to completion on the calling thread plus three workers. Returns
+	// 0, -EBADMSG on digest mismatch, -ECANCELED, or a stage's -errno.
+	int run();
+	// Safe from any thread.
+	void cancel();
+
+	// Safe from any thread at any time, and never slows the stages down:
+	// each publishes its byte count with a plain atomic store per chunk,
+	// on a cache line of its own. The UI reads this once per frame rather
+	// than being called back for every chunk.
+	PipelineProgress progress() const;
+
+	// Valid after run().
+	const StageStats &stats(Stage stage) const { return m_stats[(int)stage]; }
+	uint64_t elapsed_us() const { return m_elapsed_us; }
+	// Digests of the decoded image, valid after a completed run() that
+	// computed them (see PipelineOptions).
+	const uint8_t *digest() const { return m_digest; }
+	const uint8_t *tree_digest() const { return m_tree_digest; }
+	bool has_tree_digest() const { return m_use_tree; }
+	unsigned hash_threads() const { return m_hash_threads; }
+	unsigned queue_depth() const { return m_options.queue_depth; }
+	// Its stall counters may be read while running.
+	const ChunkPool &pool() const { return *m_pool; }
+
+private:
+	void read_stage();
+	void decode_stage();
+	void verify_stage();
+	// Hands |chunk| to the writer; false once the pipeline is aborted.
+	bool pass_verified(Chunk *chunk, StageStats &stats);
+	void write_stage();
+	// Syncs the sink and commits what is now durable to the journal.
+	int commit_progress();
+	void fail(int err);
+	// Stores |stage|'s byte count for progress() and the metrics export.
+	void publish(Stage stage, uint64_t bytes);
+
+	Source &m_source;
+	Decoder &m_decoder;
+	Sink &m_sink;
+	PipelineOptions m_options;
+
+	std::unique_ptr<ChunkPool> m_pool;
+	ChunkQueue m_read_queue;
+	ChunkQueue m_decode_queue;
+	ChunkQueue m_verify_queue;
+
+	std::atomic<int> m_error{ 0 };
+	StageStats m_stats[(int)Stage::Count];
+	uint64_t m_elapsed_us = 0;
+
+	// Written by one stage each, read by progress().
+	struct alignas(64) LiveBytes {
+		std::atomic<uint64_t> bytes{ 0 };
+	};
+	LiveBytes m_live[(int)Stage::Count];
+	uint64_t m_verified = 0; // verify thread only
+	std::atomic<uint64_t> m_start_us{ 0 };
+	std::atomic<bool> m_finished{ false };
+	uint8_t m_digest[Sha256::kDigestSize] = {};
+	bool m_use_tree;
+	unsigned m_hash_threads;
+	uint8_t m_tree_digest[Sha256::kDigestSize] = {};
+};
+
+} // namespace recovery
@@ -0,0 +1,334 @@
+#include "flash/sink.h"
+
+#include "common/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <mtd/mtd-user.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+static int pwrite_all(int fd, const uint8_t *data, size_t len, uint64_t offset)
+{
+	while (len) {
+		ssize_t n = pwrite(fd, data, len, (off_t)offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static ssize_t pread_all(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, buf + done, len - done, (off_t)(offset + done));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return (ssize_t)done;
+}
+
+int FileSink::open(const char *path, bool keep_contents, bool direct)
+{
+	struct stat st;
+	bool exists = stat(path, &st) == 0;
+	int flags = (keep_contents ? O_RDWR : O_WRONLY) | O_CLOEXEC;
+	if (!exists || S_ISREG(st.st_mode))
+		flags |= O_CREAT | (keep_contents ? 0 : O_TRUNC);
+
+	m_fd.reset(::open(path, flags, 0644));
+	if (!m_fd) {
+		int err = -errno;
+		log_error("flash: cannot open %s: %s", path, strerror(errno));
+		return err;
+	}
+
+	uint64_t size = 0;
+	bool block_device = exists && S_ISBLK(st.st_mode);
+	if (block_device)
+		ioctl(m_fd.get(), BLKGETSIZE64, &size);
+	else if (keep_contents && exists)
+		size = st.st_size;
+	m_capacity = size;
+
+	m_direct.reset();
+	m_direct_bytes = 0;
+	if (direct) {
+		// Offsets, lengths and buffers must be multiples of the logical
+		// block size; file systems are happy with a page.
+		int sector = 0;
+		m_align = block_device && ioctl(m_fd.get(), BLKSSZGET, &sector) == 0 && sector > 0 ? (size_t)sector
+												 : 4096;
+		m_direct.reset(::open(path, O_WRONLY | O_DIRECT | O_CLOEXEC));
+		if (!m_direct)
+			log_info("flash: %s: no O_DIRECT (%s), writing through the page cache", path, strerror(errno));
+	}
+	return 0;
+}
+
+int FileSink::write(const uint8_t *data, size_t len, uint64_t offset)
+{
+	if (m_direct && (uintptr_t)data % m_align == 0 && offset % m_align == 0) {
+		size_t aligned = len - len % m_align;
+		if (aligned) {
+			int ret = pwrite_all(m_direct.get(), data, aligned, offset);
+			if (ret == -EINVAL) {
+				// Some file systems (FUSE ones, tmpfs on older kernels)
+				// open with O_DIRECT but refuse the writes.
+				log_info("flash: O_DIRECT write refused, writing through the page cache");
+				m_direct.reset();
+			} else if (ret < 0) {
+				return ret;
+			} else {
+				m_direct_bytes += aligned;
+				data += aligned;
+				len -= aligned;
+				offset += aligned;
+			}
+		}
+	}
+	int ret = pwrite_all(m_fd.get(), data, len, offset);
+	if (ret == 0)
+		m_end = offset + len;
+	return ret;
+}
+
+int FileSink::finish()
+{
+	// Flushes the buffered tail and, on a device, its write cache with it.
+	return fdatasync(m_fd.get()) < 0 && errno != EINVAL ? -errno : 0;
+}
+
+int64_t FileSink::sync()
+{
+	if (fdatasync(m_fd.get()) < 0)
+		return errno == EINVAL ? -EOPNOTSUPP : -errno;
+	return (int64_t)m_end;
+}
+
+ssize_t FileSink::read_back(uint8_t *buf, size_t len, uint64_t offset)
+{
+	return pread_all(m_fd.get(), buf, len, offset);
+}
+
+int MtdSink::open(const char *path)
+{
+	m_fd.reset(::open(path, O_RDWR | O_CLOEXEC));
+	if (!m_fd) {
+		int err = -errno;
+		log_error("flash: cannot open %s: %s", path, strerror(errno));
+		return err;
+	}
+
+	struct mtd_info_user info;
+	if (ioctl(m_fd.get(), MEMGETINFO, &info) < 0) {
+		int err = -errno;
+		log_error("flash: %s is not an MTD device: %s", path, strerror(errno));
+		m_fd.reset();
+		return err;
+	}
+	m_erase_size = info.erasesize;
+	m_write_size = info.writesize ? info.writesize : 1;
+	m_pad.assign(m_write_size, 0xff);
+
+	bool nand = info.type == MTD_NANDFLASH || info.type == MTD_MLCNANDFLASH;
+	m_good_blocks.clear();
+	for (uint64_t block = 0; block + m_erase_size <= info.size; block += m_erase_size) {
+		if (nand) {
+			__kernel_loff_t pos = (__kernel_loff_t)block;
+			int bad = ioctl(m_fd.get(), MEMGETBADBLOCK, &pos);
+			if (bad < 0) {
+				int err = -errno;
+				log_error("flash: bad block check at 0x%llx failed: %s", (unsigned long long)block,
+					  strerror(errno));
+				return err;
+			}
+			if (bad) {
+				log_info("flash: skipping bad block at 0x%llx", (unsigned long long)block);
+				continue;
+			}
+		}
+		m_good_blocks.push_back(block);
+	}
+
+	log_debug("flash: %s %u bytes, erase %u, write %u, %zu good blocks%s", path, (unsigned)info.size,
+		  m_erase_size, m_write_size, m_good_blocks.size(), nand ? ", nand" : "");
+	return 0;
+}
+
+void MtdSink::set_image_size(uint64_t size)
+{
+	m_image_blocks = (size + m_erase_size - 1) / m_erase_size;
+}
+
+int MtdSink::erase_blocks(uint64_t first, uint64_t end)
+{
+	while (first < end) {
+		uint64_t run = 1;
+		while (first + run < end && m_good_blocks[first + run] == m_good_blocks[first] + run * m_erase_size)
+			run++;
+		struct erase_info_user64 erase = { m_good_blocks[first], run * m_erase_size };
+		if (ioctl(m_fd.get(), MEMERASE64, &erase) < 0) {
+			int err = -errno;
+			log_error("flash: erase of %llu blocks at 0x%llx failed: %s", (unsigned long long)run,
+				  (unsigned long long)erase.start, strerror(errno));
+			return err;
+		}
+		first += run;
+	}
+	return 0;
+}
+
+int MtdSink::program(uint64_t index, const uint8_t *data, size_t len)
+{
+	if (index >= m_good_blocks.size()) {
+		log_error("flash: image does not fit the partition");
+		return -ENOSPC;
+	}
+	if (index >= m_erased_end) {
+		// Everything this write() covers in one batch, plus whatever may
+		// run ahead of it.
+		uint64_t end = std::max(m_write_last, index) + 1;
+		if (m_image_blocks)
+			end = std::max(end, std::min<uint64_t>(index + kEraseAhead, m_image_blocks));
+		end = std::min<uint64_t>(end, m_good_blocks.size());
+		int ret = erase_blocks(index, end);
+		if (ret < 0)
+			return ret;
+		m_erased_end = end;
+	}
+
+	uint64_t phys = m_good_blocks[index];
+	size_t aligned = len - len % m_write_size;
+	int ret = pwrite_all(m_fd.get(), data, aligned, phys);
+	if (ret < 0)
+		return ret;
+	if (aligned < len) {
+		memcpy(m_pad.data(), data + aligned, len - aligned);
+		memset(m_pad.data() + (len - aligned), 0xff, m_write_size - (len - aligned));
+		ret = pwrite_all(m_fd.get(), m_pad.data(), m_write_size, phys + aligned);
+		if (ret < 0)
+			return ret;
+		m_padded = true;
+	}
+	return 0;
+}
+
+int MtdSink::flush_staged()
+{
+	if (!m_staged_len)
+		return 0;
+	int ret = program(m_staged_index, m_staged.data(), m_staged_len);
+	m_staged_len = 0;
+	return ret;
+}
+
+int MtdSink::write(const uint8_t *data, size_t len, uint64_t offset)
+{
+	// Only the final write of an image may end off a page boundary.
+	if (m_padded || offset % m_write_size)
+		return -EINVAL;
+	if (!len)
+		return 0;
+	m_write_last = (offset + len - 1) / m_erase_size;
+
+	while (len) {
+		uint64_t index = offset / m_erase_size;
+		size_t in_block = (size_t)(offset % m_erase_size);
+		size_t n = std::min<size_t>(m_erase_size - in_block, len);
+		int ret = m_staged_index != index ? flush_staged() : 0;
+		if (ret < 0)
+			return ret;
+		if (!in_block && n == m_erase_size) {
+			ret = program(index, data, n);
+		} else {
+			// Offsets only grow, so a block is staged from its start.
+			if (in_block != m_staged_len)
+				return -EINVAL;
+			if (m_staged.empty())
+				m_staged.resize(m_erase_size);
+			memcpy(m_staged.data() + in_block, data, n);
+			m_staged_index = index;
+			m_staged_len = in_block + n;
+			ret = m_staged_len == m_erase_size ? flush_staged() : 0;
+		}
+		if (ret < 0)
+			return ret;
+		data += n;
+		len -= n;
+		offset += n;
+	}
+	m_end = offset;
+	return 0;
+}
+
+int MtdSink::finish()
+{
+	return flush_staged();
+}
+
+int64_t MtdSink::sync()
+{
+	return (int64_t)(m_staged_len ? m_staged_index * m_erase_size : m_end);
+}
+
+ssize_t MtdSink::read_back(uint8_t *buf, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < len) {
+		uint64_t index = (offset + done) / m_erase_size;
+		if (index >= m_good_blocks.size())
+			break;
+		uint64_t in_block = (offset + done) % m_erase_size;
+		size_t n = m_erase_size - in_block;
+		if (n > len - done)
+			n = len - done;
+		// ECC failures come back as -EBADMSG; the block then counts as changed.
+		ssize_t ret = pread_all(m_fd.get(), buf + done, n, m_good_blocks[index] + in_block);
+		if (ret < 0)
+			return ret;
+		done += ret;
+		if ((size_t)ret < n)
+			break;
+	}
+	return (ssize_t)done;
+}
+
+int MtdSink::skip(uint64_t offset, uint64_t len)
+{
+	if (!len)
+		return 0;
+	if (offset % m_erase_size || len % m_erase_size)
+		return -EINVAL;
+	int ret = flush_staged();
+	if (ret < 0)
+		return ret;
+	uint64_t last = (offset + len) / m_erase_size - 1;
+	if (last >= m_good_blocks.size())
+		return -ENOSPC;
+	if (offset / m_erase_size < m_erased_end)
+		return -EBUSY; // erased ahead, the old contents are gone
+	m_erased_end = last + 1;
+	return 0;
+}
+
+} // namespace recovery
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "common/unique_fd.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace recovery {
+
+// Where the decoded image goes. write() and skip() are called from one
+// thread with consecutive, increasing offsets.
+class Sink {
+public:
+	virtual ~Sink() = default;
+
+	virtual const char *name() const = 0;
+	// Returns 0 or a negative errno.
+	virtual int write(const uint8_t *data, size_t len, uint64_t offset) = 0;
+	// Makes everything written durable.
+	virtual int finish() { return 0; }
+	// Checkpoint for resumable flashing: makes what has been written so far
+	// durable, save for data a sink still holds back (a partial erase
+	// block), and returns the offset this reaches. Negative errno, or
+	// -EOPNOTSUPP if the sink cannot tell.
+	virtual int64_t sync() { return -EOPNOTSUPP; }
+
+	// Delta flashing support. block_size() is the unit that can be left
+	// untouched (an erase block on MTD), 0 if the sink cannot do that.
+	virtual uint32_t block_size() const { return 0; }
+	// Bytes the target can hold from offset 0.
+	virtual uint64_t capacity() const { return 0; }
+	// Reads what the target currently holds at |offset|; safe to call from
+	// several threads. Returns the count or a negative errno.
+	virtual ssize_t read_back(uint8_t *, size_t, uint64_t) { return -EOPNOTSUPP; }
+	// Leaves block-aligned [offset, offset + len) as it is.
+	virtual int skip(uint64_t, uint64_t) { return 0; }
+};
+
+// Block devices (eMMC partitions, USB disks) and plain files.
+class FileSink : public Sink {
+public:
+	// Granularity delta flashing compares at on block devices.
+	static const uint32_t kDeltaBlockSize = 64 * 1024;
+
+	// Regular files are created and, unless |keep_contents|, truncated;
+	// devices are opened as is. With |direct|, aligned writes (all of them
+	// but an image's tail, given pool chunks) bypass the page cache with
+	// O_DIRECT: flashing then neither copies every byte through it nor
+	// evicts what the decoder is working on. Where the file system refuses
+	// O_DIRECT, at open or at the first write, the sink quietly stays
+	// buffered.
+	int open(const char *path, bool keep_contents = false, bool direct = false);
+
+	const char *name() const override { return "file"; }
+	int write(const uint8_t *data, size_t len, uint64_t offset) override;
+	int finish() override;
+	int64_t sync() override;
+
+	uint32_t block_size() const override { return kDeltaBlockSize; }
+	uint64_t capacity() const override { return m_capacity; }
+	ssize_t read_back(uint8_t *buf, size_t len, uint64_t offset) override;
+
+	bool direct() const { return m_direct.valid(); }
+	uint64_t direct_bytes() const { return m_direct_bytes; }
+
+private:
+	UniqueFd m_fd;
+	// Second descriptor on the same file; read_back() and unaligned
+	// writes keep using m_fd.
+	UniqueFd m_direct;
+	size_t m_align = 0;
+	uint64_t m_direct_bytes = 0;
+	uint64_t m_capacity = 0;
+	// End of the last write.
+	uint64_t m_end = 0;
+};
+
+// Raw NAND/NOR through /dev/mtdN. Bad blocks are skipped the way nandwrite
+// does, so the image lands on the next good block.
+//
+// Data goes to the chip one whole erase block per write, straight from the
+// caller's buffer when a chunk covers the block and staged otherwise.
+// Erases are issued before the writes that need them, one MEMERASE per run
+// of adjacent good blocks, like flash_erase followed by nandwrite.
+class MtdSink : public Sink {
+public:
+	// Erase blocks erased ahead of the data once the image size is known.
+	static const unsigned kEraseAhead = 16;
+
+	int open(const char *path);
+	// Lets erases run up to kEraseAhead blocks ahead of the data, but not
+	// past an image of |size| bytes. Without it only what each write()
+	// covers is erased, which skip() (delta flashing) relies on: skipping
+	// a block already erased ahead fails with -EBUSY.
+	void set_image_size(uint64_t size);
+
+	const char *name() const override { return "mtd"; }
+	int write(const uint8_t *data, size_t len, uint64_t offset) override;
+	// Writes the staged tail of the image.
+	int finish() override;
+	// Blocks are on the chip once written; only a staged one is not.
+	int64_t sync() override;
+
+	uint32_t block_size() const override { return m_erase_size; }
+	uint64_t capacity() const override { return (uint64_t)m_good_blocks.size() * m_erase_size; }
+	ssize_t read_back(uint8_t *buf, size_t len, uint64_t offset) override;
+	int skip(uint64_t offset, uint64_t len) override;
+
+	uint32_t erase_size() const { return m_erase_size; }
+	uint32_t write_size() const { return m_write_size; }
+
+private:
+	// Erases logical blocks [first, end), one ioctl per physical run.
+	int erase_blocks(uint64_t first, uint64_t end);
+	// Writes |len| bytes at the start of logical block |index|.
+	int program(uint64_t index, const uint8_t *data, size_t len);
+	int flush_staged();
+
+	UniqueFd m_fd;
+	uint32_t m_erase_size = 0;
+	uint32_t m_write_size = 1;
+	// Physical offsets of the good erase blocks; logical block i of the
+	// image lives at m_good_blocks[i].
+	std::vector<uint64_t> m_good_blocks;
+	// Logical blocks below this are erased, written or skipped.
+	uint64_t m_erased_end = 0;
+	// Furthest block erases may run ahead to; 0 until set_image_size().
+	uint64_t m_image_blocks = 0;
+	// Last block the write() in progress touches.
+	uint64_t m_write_last = 0;
+	bool m_padded = false;
+	std::vector<uint8_t> m_pad;
+	// Head of a block not yet fully written.
+	std::vector<uint8_t> m_staged;
+	uint64_t m_staged_index = 0;
+	size_t m_staged_len = 0;
+	// End of the last write.
+	uint64_t m_end = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,81 @@
+#include "flash/source.h"
+
+#include "common/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+int FileSource::open(const char *path)
+{
+	m_fd.reset(::open(path, O_RDONLY | O_CLOEXEC));
+	if (!m_fd) {
+		int err = -errno;
+		log_error("flash: cannot open %s: %s", path, strerror(errno));
+		return err;
+	}
+
+	struct stat st;
+	uint64_t bytes;
+	bool known = fstat(m_fd.get(), &st) == 0;
+	if (known && S_ISREG(st.st_mode))
+		m_size = st.st_size;
+	else if (known && S_ISBLK(st.st_mode) && ioctl(m_fd.get(), BLKGETSIZE64, &bytes) == 0)
+		m_size = (int64_t)bytes;
+	else
+		m_size = -1;
+	// USB sticks benefit a lot from the kernel reading well ahead of us.
+	posix_fadvise(m_fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+	return 0;
+}
+
+void FileSource::select(const std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+{
+	m_ranges = ranges;
+	m_selected = true;
+	m_range = 0;
+	m_range_pos = 0;
+	m_size = 0;
+	for (const auto &range : ranges)
+		m_size += (int64_t)range.second;
+}
+
+ssize_t FileSource::read(uint8_t *buf, size_t len)
+{
+	while (m_selected) {
+		if (m_range == m_ranges.size())
+			return 0;
+		const auto &range = m_ranges[m_range];
+		if (m_range_pos == range.second) {
+			m_range++;
+			m_range_pos = 0;
+			continue;
+		}
+		size_t want = (size_t)std::min<uint64_t>(len, range.second - m_range_pos);
+		ssize_t n = pread(m_fd.get(), buf, want, (off_t)(range.first + m_range_pos));
+		if (n > 0) {
+			m_range_pos += (uint64_t)n;
+			return n;
+		}
+		if (n == 0)
+			return -EIO; // shorter than the ranges say
+		if (errno != EINTR)
+			return -errno;
+	}
+	for (;;) {
+		ssize_t n = ::read(m_fd.get(), buf, len);
+		if (n >= 0)
+			return n;
+		if (errno != EINTR)
+			return -errno;
+	}
+}
+
+} // namespace recovery
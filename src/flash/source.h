@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common/unique_fd.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace recovery {
+
+// Where image bytes come from: a file on USB/SD/HDD, the network, or a
+// partition being backed up.
+class Source {
+public:
+	virtual ~Source() = default;
+
+	// Reads up to |len| bytes. Returns the count, 0 at end of stream, or a
+	// negative errno.
+	virtual ssize_t read(uint8_t *buf, size_t len) = 0;
+	// Total stream size for progress reporting, or -1 if unknown.
+	virtual int64_t size() const { return -1; }
+};
+
+class FileSource : public Source {
+public:
+	// Returns 0 or a negative errno.
+	int open(const char *path);
+	// Streams only these (offset, length) ranges of the file, back to
+	// back, e.g. the container blobs a resumed flash needs; size() is then
+	// their total.
+	void select(const std::vector<std::pair<uint64_t, uint64_t>> &ranges);
+
+	ssize_t read(uint8_t *buf, size_t len) override;
+	int64_t size() const override { return m_size; }
+
+private:
+	UniqueFd m_fd;
+	int64_t m_size = -1;
+	std::vector<std::pair<uint64_t, uint64_t>> m_ranges;
+	bool m_selected = false;
+	size_t m_range = 0;
+	uint64_t m_range_pos = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,549 @@
+#include "flash/tar_extract.h"
+
+#include "common/log.h"
+#include "platform/sched.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+// Pax and GNU long-name headers are small; anything bigger is corrupt.
+const uint64_t kMaxExtendedHeader = 1024 * 1024;
+
+// Drops empty and "." components. False if a ".." would leave the target.
+bool clean_path(const std::string &in, std::string *out)
+{
+	out->clear();
+	size_t pos = 0;
+	while (pos <= in.size()) {
+		size_t end = in.find('/', pos);
+		if (end == std::string::npos)
+			end = in.size();
+		std::string part = in.substr(pos, end - pos);
+		pos = end + 1;
+		if (part.empty() || part == ".")
+			continue;
+		if (part == "..")
+			return false;
+		if (!out->empty())
+			*out += '/';
+		*out += part;
+	}
+	return true;
+}
+
+void split_path(const std::string &path, std::string *parent, std::string *name)
+{
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos) {
+		parent->clear();
+		*name = path;
+	} else {
+		*parent = path.substr(0, slash);
+		*name = path.substr(slash + 1);
+	}
+}
+
+int write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len) {
+		ssize_t n = ::write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		data += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+} // namespace
+
+ExtractSink::ExtractSink(const ExtractOptions &options)
+	: m_options(options), m_queue([&options] {
+		  unsigned threads = options.threads;
+		  if (!threads)
+			  threads = std::min(16u, std::max(1u, std::thread::hardware_concurrency()));
+		  return (size_t)threads * 2;
+	  }())
+{
+	m_options.threads = (unsigned)m_queue.capacity() / 2;
+}
+
+ExtractSink::~ExtractSink()
+{
+	m_queue.abort();
+	for (std::thread &t : m_threads)
+		t.join();
+}
+
+int ExtractSink::open(const char *dir)
+{
+	m_root.reset(::open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	if (!m_root) {
+		int err = -errno;
+		log_error("extract: cannot open %s: %s", dir, strerror(errno));
+		return err;
+	}
+	m_chown = m_options.same_owner && geteuid() == 0;
+	m_umask = umask(0);
+	umask(m_umask);
+	for (unsigned i = 0; i < m_options.threads; i++)
+		m_threads.emplace_back([this] { worker(); });
+	log_debug("extract: into %s with %u writer threads", dir, m_options.threads);
+	return 0;
+}
+
+void ExtractSink::fail(int err)
+{
+	int expected = 0;
+	m_error.compare_exchange_strong(expected, err);
+	m_queue.abort();
+}
+
+int ExtractSink::write(const uint8_t *data, size_t len, uint64_t)
+{
+	while (len) {
+		int err = m_error.load(std::memory_order_relaxed);
+		if (err)
+			return err;
+		size_t n = (size_t)std::min<uint64_t>(len, m_left);
+		switch (m_state) {
+		case State::Header:
+			n = std::min(len, kTarBlock - m_fill);
+			memcpy(m_header + m_fill, data, n);
+			m_fill += n;
+			if (m_fill == kTarBlock) {
+				m_fill = 0;
+				int ret = parse_header();
+				if (ret < 0)
+					return ret;
+			}
+			data += n;
+			len -= n;
+			continue;
+		case State::Extended:
+			m_extended.insert(m_extended.end(), data, data + n);
+			break;
+		case State::SmallFile:
+			m_batch->data.insert(m_batch->data.end(), data, data + n);
+			break;
+		case State::LargeFile: {
+			int ret = write_all(m_large.get(), data, n);
+			if (ret < 0) {
+				log_error("extract: cannot write %s: %s", m_entry.path.c_str(), strerror(-ret));
+				return ret;
+			}
+			break;
+		}
+		case State::Skip:
+			break;
+		case State::End:
+		default:
+			return 0;
+		}
+		data += n;
+		len -= n;
+		m_left -= n;
+		if (!m_left) {
+			int ret = end_data();
+			if (ret < 0)
+				return ret;
+		}
+	}
+	return m_error.load();
+}
+
+int ExtractSink::end_data()
+{
+	int ret = 0;
+	if (m_state == State::Extended) {
+		if (m_entry.type == TarType::PaxHeader) {
+			ret = tar_parse_pax(m_extended.data(), m_extended.size(), &m_overrides);
+			if (ret < 0)
+				log_error("extract: corrupt pax header");
+		} else {
+			std::string name((const char *)m_extended.data(), m_extended.size());
+			name.resize(strnlen(name.c_str(), name.size()));
+			(m_entry.type == TarType::GnuLongName ? m_overrides.path : m_overrides.link) = name;
+		}
+	} else if (m_state == State::LargeFile) {
+		ret = finish_large();
+	}
+	if (m_pad) {
+		m_state = State::Skip;
+		m_left = m_pad;
+	} else {
+		m_state = State::Header;
+	}
+	m_pad = 0;
+	return ret;
+}
+
+int ExtractSink::parse_header()
+{
+	TarEntry entry;
+	int ret = tar_parse_header(m_header, &entry);
+	if (ret == 0) {
+		m_state = State::End;
+		return 0;
+	}
+	if (ret < 0) {
+		log_error("extract: not a tarball, or a corrupt header");
+		return ret;
+	}
+
+	switch (entry.type) {
+	case TarType::PaxHeader:
+	case TarType::GnuLongName:
+	case TarType::GnuLongLink:
+		if (entry.size > kMaxExtendedHeader) {
+			log_error("extract: %llu byte extended header", (unsigned long long)entry.size);
+			return -EBADMSG;
+		}
+		m_entry = entry;
+		m_extended.clear();
+		m_state = State::Extended;
+		m_left = entry.size;
+		m_pad = entry.padded_size() - entry.size;
+		break;
+	case TarType::PaxGlobal:
+		m_state = State::Skip;
+		m_left = entry.padded_size();
+		m_pad = 0;
+		break;
+	default:
+		m_overrides.apply(&entry);
+		m_overrides.clear();
+		m_pad = entry.padded_size() - entry.size;
+		ret = begin_entry(entry);
+		if (ret < 0)
+			return ret;
+		break;
+	}
+	// An empty file or header ends right here.
+	return m_left ? 0 : end_data();
+}
+
+int ExtractSink::begin_entry(const TarEntry &entry)
+{
+	std::string path;
+	if (!clean_path(entry.path, &path) || (path.empty() && entry.type != TarType::Directory)) {
+		log_error("extract: refusing path '%s'", entry.path.c_str());
+		return -EBADMSG;
+	}
+	m_entry = entry;
+	m_entry.path = path;
+	Meta meta = { entry.mode, entry.uid, entry.gid, entry.mtime };
+	std::string parent, name;
+	split_path(path, &parent, &name);
+
+	m_state = State::Skip;
+	m_left = entry.size;
+	switch (entry.type) {
+	case TarType::File: {
+		int ret = ensure_dir(parent);
+		if (ret < 0)
+			return ret;
+		if (entry.size <= m_options.small_file_size) {
+			// Checked before the file's data arrives, so a batch may
+			// run over by one small file.
+			if (m_batch && (m_batch->jobs.size() >= m_options.batch_entries ||
+					m_batch->data.size() >= m_options.batch_bytes)) {
+				ret = flush_batch();
+				if (ret < 0)
+					return ret;
+			}
+			queue_small(path, entry);
+			return 0;
+		}
+		return open_large(path, entry);
+	}
+	case TarType::Directory: {
+		int ret = ensure_dir(path);
+		if (ret < 0)
+			return ret;
+		m_deferred.push_back({ path, std::string(), entry.type, meta, 0 });
+		m_stats.dirs++;
+		return 0;
+	}
+	case TarType::HardLink: {
+		std::string target;
+		if (!clean_path(entry.link, &target) || target.empty()) {
+			log_error("extract: refusing link target '%s'", entry.link.c_str());
+			return -EBADMSG;
+		}
+		int ret = ensure_dir(parent);
+		if (ret < 0)
+			return ret;
+		m_deferred.push_back({ path, target, entry.type, meta, 0 });
+		m_stats.links++;
+		return 0;
+	}
+	case TarType::Symlink:
+	case TarType::CharDevice:
+	case TarType::BlockDevice:
+	case TarType::Fifo: {
+		int ret = ensure_dir(parent);
+		if (ret < 0)
+			return ret;
+		m_deferred.push_back({ path, entry.link, entry.type, meta, makedev(entry.dev_major, entry.dev_minor) });
+		m_stats.links += entry.type == TarType::Symlink;
+		return 0;
+	}
+	default:
+		log_debug("extract: skipping %s of type '%c'", path.c_str(), (char)entry.type);
+		return 0;
+	}
+}
+
+int ExtractSink::ensure_dir(const std::string &path)
+{
+	if (path.empty() || m_dirs.count(path))
+		return 0;
+	std::string parent, name;
+	split_path(path, &parent, &name);
+	int ret = ensure_dir(parent);
+	if (ret < 0)
+		return ret;
+	// The archive's mode is applied by finish(), once nothing more goes in.
+	// Directories only implied by a path keep this one.
+	if (mkdirat(m_root.get(), path.c_str(), 0755) < 0) {
+		struct stat st;
+		if (errno != EEXIST) {
+			ret = -errno;
+		} else if (fstatat(m_root.get(), path.c_str(), &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			ret = -errno;
+		} else if (!S_ISDIR(st.st_mode)) {
+			ret = -ENOTDIR;
+		}
+		if (ret < 0) {
+			log_error("extract: cannot create directory %s: %s", path.c_str(), strerror(-ret));
+			return ret;
+		}
+	}
+	m_dirs.insert(path);
+	return 0;
+}
+
+void ExtractSink::queue_small(const std::string &path, const TarEntry &entry)
+{
+	if (!m_batch) {
+		m_batch.reset(new Batch());
+		m_batch->data.reserve(m_options.batch_bytes + m_options.small_file_size);
+	}
+	Job job;
+	split_path(path, &job.parent, &job.name);
+	job.meta = { entry.mode, entry.uid, entry.gid, entry.mtime };
+	job.offset = m_batch->data.size();
+	job.size = (size_t)entry.size;
+	m_batch->jobs.push_back(std::move(job));
+	m_stats.bytes += entry.size;
+	m_state = State::SmallFile;
+}
+
+int ExtractSink::flush_batch()
+{
+	if (!m_batch || m_batch->jobs.empty())
+		return 0;
+	m_stats.batches++;
+	if (!m_queue.push(std::move(m_batch)))
+		return m_error.load() ? m_error.load() : -ECANCELED;
+	m_batch.reset();
+	return 0;
+}
+
+int ExtractSink::open_large(const std::string &path, const TarEntry &entry)
+{
+	m_large.reset(openat(m_root.get(), path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+			     entry.mode & 0777));
+	if (!m_large) {
+		int err = -errno;
+		log_error("extract: cannot create %s: %s", path.c_str(), strerror(errno));
+		return err;
+	}
+	// Reserves the extents in one go, so the file is laid out contiguously
+	// and a full filesystem fails here rather than mid-file.
+	if (fallocate(m_large.get(), 0, 0, (off_t)entry.size) == 0) {
+		m_stats.preallocated++;
+	} else if (errno != EOPNOTSUPP && errno != ENOSYS) {
+		int err = -errno;
+		log_error("extract: cannot allocate %s: %s", path.c_str(), strerror(errno));
+		return err;
+	}
+	m_large_meta = { entry.mode, entry.uid, entry.gid, entry.mtime };
+	m_stats.bytes += entry.size;
+	m_state = State::LargeFile;
+	return 0;
+}
+
+int ExtractSink::finish_large()
+{
+	int ret = apply_meta(m_large.get(), m_large_meta, m_large_meta.mode & 0777);
+	if (ret < 0)
+		log_error("extract: cannot set metadata of %s: %s", m_entry.path.c_str(), strerror(-ret));
+	m_large.reset();
+	m_stats.files++;
+	return ret;
+}
+
+int ExtractSink::apply_meta(int fd, const Meta &meta, mode_t created)
+{
+	if (m_chown && fchown(fd, meta.uid, meta.gid) < 0)
+		return -errno;
+	// Only when |created| less the umask is not it already: usually not
+	// for files, which are created with their permission bits. Set-id bits
+	// (which fchown also clears) always need this.
+	if ((meta.mode & 07777) != (created & ~m_umask) && fchmod(fd, meta.mode & 07777) < 0)
+		return -errno;
+	struct timespec times[2] = { { meta.mtime, 0 }, { meta.mtime, 0 } };
+	if (futimens(fd, times) < 0)
+		return -errno;
+	return 0;
+}
+
+void ExtractSink::worker()
+{
+	sched_set_role(ThreadRole::Writer);
+	// Consecutive files mostly share a directory; it is looked up once.
+	std::string parent;
+	UniqueFd dir;
+	bool have_dir = false;
+	std::unique_ptr<Batch> batch;
+	while (m_queue.pop(batch)) {
+		for (const Job &job : batch->jobs) {
+			if (!have_dir || job.parent != parent) {
+				if (!job.parent.empty()) {
+					dir.reset(openat(m_root.get(), job.parent.c_str(),
+							 O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+					if (!dir) {
+						int err = -errno;
+						log_error("extract: cannot open %s: %s", job.parent.c_str(), strerror(-err));
+						fail(err);
+						return;
+					}
+				}
+				parent = job.parent;
+				have_dir = true;
+			}
+			int ret = write_job(job.parent.empty() ? m_root.get() : dir.get(), job,
+					    batch->data.data() + job.offset);
+			if (ret < 0) {
+				log_error("extract: cannot write %s/%s: %s", job.parent.c_str(), job.name.c_str(),
+					  strerror(-ret));
+				fail(ret);
+				return;
+			}
+		}
+		m_files_written.fetch_add(batch->jobs.size(), std::memory_order_relaxed);
+	}
+}
+
+int ExtractSink::write_job(int dirfd, const Job &job, const uint8_t *data)
+{
+	UniqueFd fd(openat(dirfd, job.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+			   job.meta.mode & 0777));
+	if (!fd)
+		return -errno;
+	int ret = write_all(fd.get(), data, job.size);
+	if (ret < 0)
+		return ret;
+	return apply_meta(fd.get(), job.meta, job.meta.mode & 0777);
+}
+
+int ExtractSink::apply_deferred()
+{
+	int root = m_root.get();
+	// Links and nodes first: creating them changes their directory.
+	for (const Deferred &d : m_deferred) {
+		const char *path = d.path.c_str();
+		int ret = 0;
+		switch (d.type) {
+		case TarType::Symlink:
+			unlinkat(root, path, 0);
+			ret = symlinkat(d.link.c_str(), root, path);
+			break;
+		case TarType::HardLink:
+			unlinkat(root, path, 0);
+			ret = linkat(root, d.link.c_str(), root, path, 0);
+			break;
+		case TarType::CharDevice:
+		case TarType::BlockDevice:
+		case TarType::Fifo: {
+			mode_t type = d.type == TarType::CharDevice ? S_IFCHR
+				      : d.type == TarType::BlockDevice ? S_IFBLK
+								       : S_IFIFO;
+			unlinkat(root, path, 0);
+			ret = mknodat(root, path, type | (d.meta.mode & 07777), d.dev);
+			if (ret == 0)
+				ret = fchmodat(root, path, d.meta.mode & 07777, 0);
+			break;
+		}
+		default:
+			continue;
+		}
+		if (ret == 0 && d.type != TarType::HardLink) {
+			struct timespec times[2] = { { d.meta.mtime, 0 }, { d.meta.mtime, 0 } };
+			if (m_chown)
+				ret = fchownat(root, path, d.meta.uid, d.meta.gid, AT_SYMLINK_NOFOLLOW);
+			if (ret == 0)
+				ret = utimensat(root, path, times, AT_SYMLINK_NOFOLLOW);
+		}
+		if (ret < 0) {
+			ret = -errno;
+			log_error("extract: cannot create %s: %s", path, strerror(errno));
+			return ret;
+		}
+	}
+
+	// Directories last, deepest first, so their times stick and a
+	// read-only one does not stop what goes inside it.
+	for (auto it = m_deferred.rbegin(); it != m_deferred.rend(); ++it) {
+		if (it->type != TarType::Directory)
+			continue;
+		const char *path = it->path.empty() ? "." : it->path.c_str();
+		UniqueFd fd(openat(root, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+		int ret = fd ? apply_meta(fd.get(), it->meta, 0755) : -errno;
+		if (ret < 0) {
+			log_error("extract: cannot set metadata of %s: %s", path, strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int ExtractSink::finish()
+{
+	int ret = m_error.load();
+	if (!ret && m_state != State::Header && m_state != State::End) {
+		log_error("extract: archive ends inside %s", m_entry.path.c_str());
+		ret = -EBADMSG;
+	}
+	if (!ret)
+		ret = flush_batch();
+	m_queue.close();
+	for (std::thread &t : m_threads)
+		t.join();
+	m_threads.clear();
+	m_stats.files += m_files_written.load();
+	if (!ret)
+		ret = m_error.load();
+	if (!ret)
+		ret = apply_deferred();
+	if (!ret && syncfs(m_root.get()) < 0) {
+		ret = -errno;
+		log_error("extract: sync failed: %s", strerror(errno));
+	}
+	return ret;
+}
+
+} // namespace recovery
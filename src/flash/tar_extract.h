@@ -0,0 +1,150 @@
+#pragma once
+
+#include "common/bounded_queue.h"
+#include "common/unique_fd.h"
+#include "flash/sink.h"
+#include "flash/tar_format.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace recovery {
+
+struct ExtractOptions {
+	// Writer threads for small files; 0 is one per CPU. Creating files is
+	// mostly CPU time in the filesystem, so more only add lock contention.
+	unsigned threads = 0;
+	// Files up to this size are copied out of the stream and written by
+	// the pool; larger ones are preallocated and written in place.
+	uint32_t small_file_size = 256 * 1024;
+	// A batch goes to the pool at this many bytes or entries.
+	uint32_t batch_bytes = 1024 * 1024;
+	uint32_t batch_entries = 128;
+	// Set owners from the archive; only done when running as root.
+	bool same_owner = true;
+};
+
+struct ExtractStats {
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	uint64_t links = 0;
+	uint64_t bytes = 0;
+	uint64_t batches = 0;
+	// Files written in place with fallocate().
+	uint64_t preallocated = 0;
+};
+
+// Unpacks a tar stream into a directory, as the sink of a FlashPipeline, so
+// a .tar.zst or .tar.gz backup restores onto a freshly made filesystem at
+// the speed of the decoder rather than of one file at a time.
+//
+// Creating a small file is a handful of metadata syscalls that each wait on
+// the filesystem, so they are not done on the pipeline's thread. Entries
+// are gathered into batches (a directory's files usually share one) and a
+// pool of writer threads creates them relative to one parent descriptor
+// per run, setting mode, owner and times through the open file. Large files
+// are preallocated and written straight from the pipeline chunks, which is
+// as fast as a raw image. Directories are created as they appear; their
+// own metadata, symlinks and hard links are applied by finish(), after
+// every file is in place, so no link can redirect a later write.
+//
+// Paths are taken relative to the target; ".." components are rejected.
+class ExtractSink : public Sink {
+public:
+	explicit ExtractSink(const ExtractOptions &options = ExtractOptions());
+	// Joins the pool without applying deferred metadata.
+	~ExtractSink() override;
+
+	ExtractSink(const ExtractSink &) = delete;
+	ExtractSink &operator=(const ExtractSink &) = delete;
+
+	// |dir| must exist. Returns 0 or a negative errno.
+	int open(const char *dir);
+
+	const char *name() const override { return "extract"; }
+	int write(const uint8_t *data, size_t len, uint64_t offset) override;
+	// Waits for the pool, applies what was deferred and syncs the
+	// filesystem.
+	int finish() override;
+
+	unsigned threads() const { return m_options.threads; }
+	// Valid after finish().
+	const ExtractStats &stats() const { return m_stats; }
+
+private:
+	struct Meta {
+		uint32_t mode, uid, gid;
+		int64_t mtime;
+	};
+	// A small file, with its data at [offset, offset + size) of the batch.
+	struct Job {
+		std::string parent;
+		std::string name;
+		Meta meta;
+		size_t offset;
+		size_t size;
+	};
+	struct Batch {
+		std::vector<Job> jobs;
+		std::vector<uint8_t> data;
+	};
+	struct Deferred {
+		std::string path;
+		std::string link;
+		TarType type;
+		Meta meta;
+		dev_t dev;
+	};
+
+	enum class State { Header, Extended, SmallFile, LargeFile, Skip, End };
+
+	int parse_header();
+	// The current entry's data is complete.
+	int end_data();
+	int begin_entry(const TarEntry &entry);
+	int ensure_dir(const std::string &path);
+	int open_large(const std::string &path, const TarEntry &entry);
+	int finish_large();
+	void queue_small(const std::string &path, const TarEntry &entry);
+	int flush_batch();
+	void worker();
+	int write_job(int dirfd, const Job &job, const uint8_t *data);
+	// |created| is the mode |fd| was created with.
+	int apply_meta(int fd, const Meta &meta, mode_t created);
+	int apply_deferred();
+	void fail(int err);
+
+	ExtractOptions m_options;
+	UniqueFd m_root;
+	bool m_chown = false;
+	mode_t m_umask = 022;
+
+	// Parser, on the pipeline's write thread.
+	State m_state = State::Header;
+	uint8_t m_header[kTarBlock];
+	size_t m_fill = 0;
+	uint64_t m_left = 0;
+	uint64_t m_pad = 0;
+	TarEntry m_entry;
+	TarOverrides m_overrides;
+	std::vector<uint8_t> m_extended;
+	std::unique_ptr<Batch> m_batch;
+	UniqueFd m_large;
+	Meta m_large_meta = {};
+	std::unordered_set<std::string> m_dirs;
+	std::vector<Deferred> m_deferred;
+	ExtractStats m_stats;
+
+	BoundedQueue<std::unique_ptr<Batch>> m_queue;
+	std::vector<std::thread> m_threads;
+	std::atomic<uint64_t> m_files_written{ 0 };
+	std::atomic<int> m_error{ 0 };
+};
+
+} // namespace recovery
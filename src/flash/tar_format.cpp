@@ -0,0 +1,137 @@
+#include "flash/tar_format.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+// Octal, or GNU base-256 for sizes past 8 GiB.
+bool parse_number(const uint8_t *field, size_t len, uint64_t *value)
+{
+	uint64_t v = 0;
+	if (field[0] & 0x80) {
+		for (size_t i = 1; i < len; i++)
+			v = v << 8 | field[i];
+		*value = v;
+		return true;
+	}
+	size_t i = 0;
+	while (i < len && field[i] == ' ')
+		i++;
+	bool digits = false;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++, digits = true)
+		v = v << 3 | (uint64_t)(field[i] - '0');
+	*value = v;
+	return digits;
+}
+
+std::string field_string(const uint8_t *field, size_t len)
+{
+	const uint8_t *end = (const uint8_t *)memchr(field, 0, len);
+	return std::string((const char *)field, end ? (size_t)(end - field) : len);
+}
+
+} // namespace
+
+void TarOverrides::apply(TarEntry *entry) const
+{
+	if (!path.empty())
+		entry->path = path;
+	if (!link.empty())
+		entry->link = link;
+	if (has_size)
+		entry->size = size;
+	if (has_mtime)
+		entry->mtime = mtime;
+	if (has_uid)
+		entry->uid = uid;
+	if (has_gid)
+		entry->gid = gid;
+}
+
+int tar_parse_header(const uint8_t *block, TarEntry *entry)
+{
+	static const uint8_t zero[kTarBlock] = {};
+	if (!memcmp(block, zero, kTarBlock))
+		return 0;
+
+	uint64_t checksum;
+	if (!parse_number(block + 148, 8, &checksum))
+		return -EBADMSG;
+	uint64_t sum = 8 * ' ';
+	for (size_t i = 0; i < kTarBlock; i++)
+		sum += i >= 148 && i < 156 ? 0 : block[i];
+	if (sum != checksum)
+		return -EBADMSG;
+
+	uint64_t size, mode = 0, uid = 0, gid = 0, mtime = 0, major = 0, minor = 0;
+	if (!parse_number(block + 124, 12, &size))
+		return -EBADMSG;
+	// Missing ones are left at 0, as tar does.
+	parse_number(block + 100, 8, &mode);
+	parse_number(block + 108, 8, &uid);
+	parse_number(block + 116, 8, &gid);
+	parse_number(block + 136, 12, &mtime);
+	parse_number(block + 329, 8, &major);
+	parse_number(block + 337, 8, &minor);
+
+	char type = (char)block[156];
+	entry->type = type == '\0' || type == '7' ? TarType::File : (TarType)type;
+	entry->path = field_string(block, 100);
+	// POSIX ustar splits long paths over the prefix field; GNU tar uses
+	// those bytes for other things and says so with "ustar  ".
+	if (!memcmp(block + 257, "ustar\0", 6) && block[345])
+		entry->path = field_string(block + 345, 155) + "/" + entry->path;
+	entry->link = field_string(block + 157, 100);
+	entry->mode = (uint32_t)mode;
+	entry->uid = (uint32_t)uid;
+	entry->gid = (uint32_t)gid;
+	entry->mtime = (int64_t)mtime;
+	entry->size = size;
+	entry->dev_major = (uint32_t)major;
+	entry->dev_minor = (uint32_t)minor;
+	return 1;
+}
+
+int tar_parse_pax(const uint8_t *data, size_t len, TarOverrides *overrides)
+{
+	const char *p = (const char *)data;
+	const char *end = p + len;
+	while (p < end && *p) {
+		char *space;
+		unsigned long record = strtoul(p, &space, 10);
+		if (*space != ' ' || record < 5 || record > (size_t)(end - p) || p[record - 1] != '\n')
+			return -EBADMSG;
+		const char *key = space + 1;
+		const char *eq = (const char *)memchr(key, '=', (size_t)(p + record - key));
+		if (!eq)
+			return -EBADMSG;
+		std::string name(key, (size_t)(eq - key));
+		std::string value(eq + 1, (size_t)(p + record - 1 - (eq + 1)));
+		if (name == "path") {
+			overrides->path = value;
+		} else if (name == "linkpath") {
+			overrides->link = value;
+		} else if (name == "size") {
+			overrides->has_size = true;
+			overrides->size = strtoull(value.c_str(), nullptr, 10);
+		} else if (name == "mtime") {
+			// Fractional seconds are dropped.
+			overrides->has_mtime = true;
+			overrides->mtime = strtoll(value.c_str(), nullptr, 10);
+		} else if (name == "uid") {
+			overrides->has_uid = true;
+			overrides->uid = (uint32_t)strtoul(value.c_str(), nullptr, 10);
+		} else if (name == "gid") {
+			overrides->has_gid = true;
+			overrides->gid = (uint32_t)strtoul(value.c_str(), nullptr, 10);
+		}
+		p += record;
+	}
+	return 0;
+}
+
+} // namespace recovery
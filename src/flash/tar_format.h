@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// POSIX ustar with the pax and GNU extensions GNU tar and libarchive write.
+const size_t kTarBlock = 512;
+
+enum class TarType : char {
+	File = '0',
+	HardLink = '1',
+	Symlink = '2',
+	CharDevice = '3',
+	BlockDevice = '4',
+	Directory = '5',
+	Fifo = '6',
+	// Header data that applies to the next entry.
+	PaxHeader = 'x',
+	PaxGlobal = 'g',
+	GnuLongName = 'L',
+	GnuLongLink = 'K',
+};
+
+struct TarEntry {
+	std::string path;
+	// Target of a link; relative to the archive root for hard links.
+	std::string link;
+	TarType type = TarType::File;
+	uint32_t mode = 0;
+	uint32_t uid = 0;
+	uint32_t gid = 0;
+	int64_t mtime = 0;
+	uint64_t size = 0;
+	uint32_t dev_major = 0;
+	uint32_t dev_minor = 0;
+
+	// Bytes of data blocks following the header.
+	uint64_t padded_size() const { return (size + kTarBlock - 1) / kTarBlock * kTarBlock; }
+};
+
+// What pax and GNU long-name headers set for the next entry.
+struct TarOverrides {
+	std::string path;
+	std::string link;
+	bool has_size = false;
+	uint64_t size = 0;
+	bool has_mtime = false;
+	int64_t mtime = 0;
+	bool has_uid = false, has_gid = false;
+	uint32_t uid = 0, gid = 0;
+
+	void clear() { *this = TarOverrides(); }
+	void apply(TarEntry *entry) const;
+};
+
+// Parses one header block. Returns 1 for an entry, 0 for the all-zero
+// block that ends the archive, or -EBADMSG. Regular files written as the
+// old '\0' or '7' types come back as TarType::File.
+int tar_parse_header(const uint8_t *block, TarEntry *entry);
+
+// Adds the records of a pax extended header ("LEN key=value\n" each) to
+// |overrides|. Returns 0 or -EBADMSG.
+int tar_parse_pax(const uint8_t *data, size_t len, TarOverrides *overrides);
+
+} // namespace recovery
@@ -0,0 +1,150 @@
+// recovery-fleet: hands one image to every box on a LAN at once.
+//
+// The box that has the image (downloaded once from the mirror, or on local
+// storage) runs "send"; the others run "receive" and then flash the result
+// as usual.
+
+#include "common/event_loop.h"
+#include "common/log.h"
+#include "net/mcast_receiver.h"
+#include "net/mcast_sender.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace recovery;
+
+namespace {
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s send IMAGE [options]\n"
+		"       %s receive OUTPUT [options]\n"
+		"  -g, --group ADDR[:PORT]  multicast group (default 239.255.77.1:7789)\n"
+		"  -i, --iface NAME         interface to use (default: by route)\n"
+		"      --ttl N              multicast hops (default 1, this LAN only)\n"
+		"send:\n"
+		"  -r, --rate MBIT          pace to MBIT Mbit/s (default 100)\n"
+		"  -c, --chunk KB           chunk size (default 256)\n"
+		"  -l, --linger SEC         exit after SEC without requests, 0 = never (default 30)\n"
+		"receive:\n"
+		"  -e, --expect HEX         only accept the sender announcing this root\n"
+		"  -t, --timeout SEC        give up when the sender is silent (default 60, 0 = never)\n"
+		"  -v, --verbose            enable debug logging\n",
+		argv0, argv0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "group", required_argument, nullptr, 'g' },
+		{ "iface", required_argument, nullptr, 'i' },
+		{ "ttl", required_argument, nullptr, 'T' },
+		{ "rate", required_argument, nullptr, 'r' },
+		{ "chunk", required_argument, nullptr, 'c' },
+		{ "linger", required_argument, nullptr, 'l' },
+		{ "expect", required_argument, nullptr, 'e' },
+		{ "timeout", required_argument, nullptr, 't' },
+		{ "verbose", no_argument, nullptr, 'v' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	McastOptions options;
+	uint8_t expect[Sha256::kDigestSize];
+	bool has_expect = false;
+	int c;
+	while ((c = getopt_long(argc, argv, "g:i:r:c:l:e:t:vh", long_options, nullptr)) != -1) {
+		switch (c) {
+		case 'g':
+			if (!mcast_parse_group(optarg, &options)) {
+				fprintf(stderr, "invalid group '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'i':
+			options.iface = optarg;
+			break;
+		case 'T':
+			options.ttl = (unsigned)atoi(optarg);
+			break;
+		case 'r':
+			options.rate_mbit = (unsigned)atoi(optarg);
+			break;
+		case 'c':
+			options.chunk_size = (uint32_t)atoi(optarg) * 1024;
+			break;
+		case 'l':
+			options.linger_ms = (unsigned)atoi(optarg) * 1000;
+			break;
+		case 'e':
+			if (!sha256_from_hex(optarg, expect)) {
+				fprintf(stderr, "invalid root '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			has_expect = true;
+			break;
+		case 't':
+			options.timeout_ms = (unsigned)atoi(optarg) * 1000;
+			break;
+		case 'v':
+			log_set_level(LogLevel::Debug);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || !options.rate_mbit || options.chunk_size < kMcastMinChunkSize ||
+	    options.chunk_size > kMcastMaxChunkSize) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *mode = argv[optind];
+	const char *path = argv[optind + 1];
+	bool send = !strcmp(mode, "send");
+	if (!send && strcmp(mode, "receive")) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	EventLoop loop;
+	if (!loop.valid())
+		return EXIT_FAILURE;
+	loop.add_signal(SIGTERM, [&loop] { loop.quit(); });
+	loop.add_signal(SIGINT, [&loop] { loop.quit(); });
+
+	int result = -EINTR;
+	auto done = [&](int ret) {
+		result = ret;
+		loop.quit();
+	};
+
+	McastSender sender(loop, options);
+	McastReceiver receiver(loop, options);
+	unsigned last_percent = 0;
+	int ret;
+	if (send) {
+		ret = sender.start(path, done);
+	} else {
+		ret = receiver.start(path, has_expect ? expect : nullptr,
+				     [&](uint32_t have, uint32_t total) {
+					     unsigned percent = (unsigned)((uint64_t)have * 100 / total);
+					     if (percent / 10 != last_percent / 10)
+						     log_info("fleet: %u%% (%u of %u chunks)", percent, have, total);
+					     last_percent = percent;
+				     },
+				     done);
+	}
+	if (ret < 0)
+		return EXIT_FAILURE;
+	loop.run();
+	return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
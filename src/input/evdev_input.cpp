@@ -0,0 +1,167 @@
+#include "input/evdev_input.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+bool is_event_node(const char *name)
+{
+	return !strncmp(name, "event", 5);
+}
+
+// True if the device can send at least one key the UI maps.
+bool has_ui_keys(int fd)
+{
+	uint8_t bits[KEY_MAX / 8 + 1] = {};
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0)
+		return false;
+	for (unsigned code = 0; code <= KEY_MAX; code++)
+		if ((bits[code / 8] & (1u << (code % 8))) && key_from_code(code) != Key::None)
+			return true;
+	return false;
+}
+
+} // namespace
+
+EvdevInput::EvdevInput(EventLoop &loop, KeyHandler handler) : m_loop(loop), m_handler(std::move(handler))
+{
+}
+
+EvdevInput::~EvdevInput()
+{
+	for (auto &dev : m_devices) {
+		m_loop.remove_fd(dev.first);
+		close(dev.first);
+	}
+	if (m_inotify)
+		m_loop.remove_fd(m_inotify.get());
+}
+
+int EvdevInput::start(const char *dir)
+{
+	m_dir = dir;
+
+	// Watch first so a device appearing during the scan is not missed.
+	m_inotify.reset(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+	if (m_inotify && inotify_add_watch(m_inotify.get(), dir, IN_CREATE | IN_ATTRIB) >= 0)
+		m_loop.add_fd(m_inotify.get(), EPOLLIN, [this](uint32_t) { read_inotify(); });
+	else
+		log_warning("input: cannot watch %s: %s", dir, strerror(errno));
+
+	DIR *d = opendir(dir);
+	if (!d) {
+		int err = -errno;
+		log_error("input: cannot open %s: %s", dir, strerror(errno));
+		return err;
+	}
+	while (struct dirent *entry = readdir(d))
+		if (is_event_node(entry->d_name))
+			open_device(m_dir + "/" + entry->d_name);
+	closedir(d);
+	return (int)m_devices.size();
+}
+
+void EvdevInput::open_device(const std::string &path)
+{
+	for (auto &dev : m_devices)
+		if (dev.second == path)
+			return;
+
+	int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		// udev may not have set permissions yet; IN_ATTRIB brings us back.
+		log_debug("input: cannot open %s: %s", path.c_str(), strerror(errno));
+		return;
+	}
+	char name[64] = "?";
+	ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+	if (!has_ui_keys(fd)) {
+		log_debug("input: ignoring %s (%s), no usable keys", path.c_str(), name);
+		close(fd);
+		return;
+	}
+	if (m_loop.add_fd(fd, EPOLLIN, [this, fd](uint32_t events) {
+		    if (events & (EPOLLERR | EPOLLHUP))
+			    close_device(fd);
+		    else
+			    read_device(fd);
+	    }) < 0) {
+		close(fd);
+		return;
+	}
+	m_devices[fd] = path;
+	log_info("input: %s (%s)", path.c_str(), name);
+}
+
+void EvdevInput::close_device(int fd)
+{
+	auto it = m_devices.find(fd);
+	if (it == m_devices.end())
+		return;
+	log_info("input: %s removed", it->second.c_str());
+	m_loop.remove_fd(fd);
+	close(fd);
+	m_devices.erase(it);
+}
+
+void EvdevInput::read_device(int fd)
+{
+	struct input_event events[32];
+	for (;;) {
+		ssize_t n = read(fd, events, sizeof(events));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				close_device(fd); // ENODEV once unplugged
+			return;
+		}
+		if (n == 0)
+			return;
+
+		uint64_t now = monotonic_us();
+		for (size_t i = 0; i < (size_t)n / sizeof(events[0]); i++) {
+			const struct input_event &ev = events[i];
+			if (ev.type != EV_KEY || ev.value > 2)
+				continue;
+			KeyEvent key;
+			key.key = key_from_code(ev.code);
+			if (key.key == Key::None)
+				continue;
+			key.action = ev.value == 0 ? KeyAction::Release : ev.value == 1 ? KeyAction::Press : KeyAction::Repeat;
+			key.time_us = now;
+			m_handler(key);
+		}
+	}
+}
+
+void EvdevInput::read_inotify()
+{
+	alignas(struct inotify_event) char buf[4096];
+	for (;;) {
+		ssize_t n = read(m_inotify.get(), buf, sizeof(buf));
+		if (n <= 0)
+			return;
+		for (char *p = buf; p < buf + n;) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->len && is_event_node(ev->name))
+				open_device(m_dir + "/" + ev->name);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+} // namespace recovery
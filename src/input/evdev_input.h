@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+#include "input/keys.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace recovery {
+
+// Key input from every evdev node under a directory (normally /dev/input):
+// USB and built-in keyboards, IR receivers decoded by the kernel's rc-core,
+// and front-panel buttons, which are gpio-keys or keypad drivers on all
+// supported boxes. Nodes without any key the UI uses (mice, sensors) are
+// ignored. Hotplugged devices are picked up through inotify and unplugged
+// ones dropped.
+class EvdevInput {
+public:
+	EvdevInput(EventLoop &loop, KeyHandler handler);
+	~EvdevInput();
+
+	EvdevInput(const EvdevInput &) = delete;
+	EvdevInput &operator=(const EvdevInput &) = delete;
+
+	// Opens the devices present now and watches for new ones. Returns the
+	// number of devices opened or -errno.
+	int start(const char *dir = "/dev/input");
+
+	size_t device_count() const { return m_devices.size(); }
+
+private:
+	void open_device(const std::string &path);
+	void close_device(int fd);
+	void read_device(int fd);
+	void read_inotify();
+
+	EventLoop &m_loop;
+	KeyHandler m_handler;
+	std::string m_dir;
+	UniqueFd m_inotify;
+	// fd -> path
+	std::unordered_map<int, std::string> m_devices;
+};
+
+} // namespace recovery
@@ -0,0 +1,89 @@
+#include "input/keys.h"
+
+#include <linux/input-event-codes.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+struct KeyMapping {
+	unsigned code;
+	const char *name;
+	Key key;
+};
+
+// Keyboards, IR remotes (rc-core keymaps) and front-panel keys (gpio-keys,
+// keypad drivers) all use these codes.
+const KeyMapping kKeyMap[] = {
+	{ KEY_UP, "KEY_UP", Key::Up },
+	{ KEY_DOWN, "KEY_DOWN", Key::Down },
+	{ KEY_LEFT, "KEY_LEFT", Key::Left },
+	{ KEY_RIGHT, "KEY_RIGHT", Key::Right },
+	{ KEY_ENTER, "KEY_ENTER", Key::Ok },
+	{ KEY_KPENTER, "KEY_KPENTER", Key::Ok },
+	{ KEY_OK, "KEY_OK", Key::Ok },
+	{ KEY_SELECT, "KEY_SELECT", Key::Ok },
+	{ KEY_ESC, "KEY_ESC", Key::Back },
+	{ KEY_BACK, "KEY_BACK", Key::Back },
+	{ KEY_EXIT, "KEY_EXIT", Key::Back },
+	{ KEY_BACKSPACE, "KEY_BACKSPACE", Key::Back },
+	{ KEY_MENU, "KEY_MENU", Key::Menu },
+	{ KEY_HOME, "KEY_HOME", Key::Home },
+	{ KEY_HOMEPAGE, "KEY_HOMEPAGE", Key::Home },
+	{ KEY_PAGEUP, "KEY_PAGEUP", Key::PageUp },
+	{ KEY_CHANNELUP, "KEY_CHANNELUP", Key::PageUp },
+	{ KEY_PAGEDOWN, "KEY_PAGEDOWN", Key::PageDown },
+	{ KEY_CHANNELDOWN, "KEY_CHANNELDOWN", Key::PageDown },
+	{ KEY_POWER, "KEY_POWER", Key::Power },
+};
+
+} // namespace
+
+const char *key_name(Key key)
+{
+	switch (key) {
+	case Key::Up:
+		return "up";
+	case Key::Down:
+		return "down";
+	case Key::Left:
+		return "left";
+	case Key::Right:
+		return "right";
+	case Key::Ok:
+		return "ok";
+	case Key::Back:
+		return "back";
+	case Key::Menu:
+		return "menu";
+	case Key::Home:
+		return "home";
+	case Key::PageUp:
+		return "page-up";
+	case Key::PageDown:
+		return "page-down";
+	case Key::Power:
+		return "power";
+	default:
+		return "none";
+	}
+}
+
+Key key_from_code(unsigned code)
+{
+	for (const KeyMapping &m : kKeyMap)
+		if (m.code == code)
+			return m.key;
+	return Key::None;
+}
+
+Key key_from_name(const char *name)
+{
+	for (const KeyMapping &m : kKeyMap)
+		if (!strcmp(m.name, name))
+			return m.key;
+	return Key::None;
+}
+
+} // namespace recovery
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+
+namespace recovery {
+
+// The handful of keys the UI understands, whichever device they come from.
+// A remote's OK, a front panel's select button and a keyboard's Enter all
+// arrive as Key::Ok.
+enum class Key {
+	None,
+	Up,
+	Down,
+	Left,
+	Right,
+	Ok,
+	Back,
+	Menu,
+	Home,
+	PageUp,
+	PageDown,
+	Power,
+};
+
+enum class KeyAction {
+	Press,
+	Repeat,
+	Release,
+};
+
+struct KeyEvent {
+	Key key = Key::None;
+	KeyAction action = KeyAction::Press;
+	// monotonic_us() when the event was read.
+	uint64_t time_us = 0;
+};
+
+using KeyHandler = std::function<void(const KeyEvent &event)>;
+
+const char *key_name(Key key);
+// Maps a Linux KEY_* code (as sent by evdev) to a UI key, Key::None if it
+// has no meaning here.
+Key key_from_code(unsigned code);
+// Same for the KEY_* names used in lircd.conf ("KEY_UP", "KEY_OK", ...).
+Key key_from_name(const char *name);
+
+} // namespace recovery
@@ -0,0 +1,139 @@
+#include "input/lirc_input.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+constexpr unsigned kRetryMs = 3000;
+
+} // namespace
+
+LircInput::LircInput(EventLoop &loop, KeyHandler handler) : m_loop(loop), m_handler(std::move(handler))
+{
+}
+
+LircInput::~LircInput()
+{
+	if (m_retry_timer > 0)
+		m_loop.cancel_timer(m_retry_timer);
+	disconnect();
+}
+
+int LircInput::start(const char *socket_path)
+{
+	m_path = socket_path;
+	int ret = connect_socket();
+	if (ret < 0) {
+		log_debug("input: lircd at %s not available: %s", socket_path, strerror(-ret));
+		schedule_retry();
+	}
+	return ret;
+}
+
+int LircInput::connect_socket()
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (m_path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	memcpy(addr.sun_path, m_path.c_str(), m_path.size() + 1);
+
+	UniqueFd fd(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!fd)
+		return -errno;
+	if (connect(fd.get(), (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		return -errno;
+
+	// On hangup read_socket() drains what is left, then sees EOF.
+	int ret = m_loop.add_fd(fd.get(), EPOLLIN | EPOLLRDHUP, [this](uint32_t) { read_socket(); });
+	if (ret < 0)
+		return ret;
+	m_fd = std::move(fd);
+	m_pending.clear();
+	log_info("input: lircd %s", m_path.c_str());
+	return 0;
+}
+
+void LircInput::disconnect()
+{
+	if (!m_fd)
+		return;
+	m_loop.remove_fd(m_fd.get());
+	m_fd.reset();
+}
+
+void LircInput::schedule_retry()
+{
+	if (m_retry_timer > 0)
+		return;
+	m_retry_timer = m_loop.add_timer(kRetryMs, true, [this]() {
+		if (connect_socket() < 0)
+			return;
+		m_loop.cancel_timer(m_retry_timer);
+		m_retry_timer = -1;
+	});
+}
+
+void LircInput::read_socket()
+{
+	char buf[512];
+	for (;;) {
+		ssize_t n = read(m_fd.get(), buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return;
+		if (n <= 0) {
+			log_warning("input: lircd connection lost");
+			disconnect();
+			schedule_retry();
+			return;
+		}
+
+		m_pending.append(buf, (size_t)n);
+		size_t start = 0, end;
+		while ((end = m_pending.find('\n', start)) != std::string::npos) {
+			m_pending[end] = '\0';
+			handle_line(&m_pending[start]);
+			start = end + 1;
+		}
+		m_pending.erase(0, start);
+		// A line never gets this long; drop garbage rather than grow.
+		if (m_pending.size() > 1024)
+			m_pending.clear();
+	}
+}
+
+// "<code> <repeat> <button> <remote>", repeat in hex and 0 for a press.
+// Replies to commands (BEGIN ... END blocks) never match this shape.
+void LircInput::handle_line(const char *line)
+{
+	unsigned long long code;
+	unsigned repeat;
+	char button[64];
+	if (sscanf(line, "%llx %x %63s", &code, &repeat, button) != 3)
+		return;
+
+	KeyEvent key;
+	key.key = key_from_name(button);
+	if (key.key == Key::None) {
+		log_debug("input: unmapped lirc button %s", button);
+		return;
+	}
+	key.action = repeat ? KeyAction::Repeat : KeyAction::Press;
+	key.time_us = monotonic_us();
+	m_handler(key);
+}
+
+} // namespace recovery
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+#include "input/keys.h"
+
+#include <string>
+
+namespace recovery {
+
+// Key input from a lircd socket, for remotes decoded in user space rather
+// than by rc-core (which shows up as evdev instead). Button names follow
+// the KEY_* convention of lircd.conf. lircd reports presses and repeats
+// only, so no Release events are produced.
+//
+// If lircd is not running yet or restarts, the connection is retried every
+// few seconds from the event loop.
+class LircInput {
+public:
+	LircInput(EventLoop &loop, KeyHandler handler);
+	~LircInput();
+
+	LircInput(const LircInput &) = delete;
+	LircInput &operator=(const LircInput &) = delete;
+
+	// Returns 0 once connected, or -errno with a retry scheduled.
+	int start(const char *socket_path = "/var/run/lirc/lircd");
+
+	bool connected() const { return m_fd.valid(); }
+
+private:
+	int connect_socket();
+	void disconnect();
+	void schedule_retry();
+	void read_socket();
+	void handle_line(const char *line);
+
+	EventLoop &m_loop;
+	KeyHandler m_handler;
+	std::string m_path;
+	UniqueFd m_fd;
+	int m_retry_timer = -1;
+	std::string m_pending;
+};
+
+} // namespace recovery
@@ -0,0 +1,365 @@
+#include "common/clock.h"
+#include "common/event_loop.h"
+#include "common/log.h"
+#include "common/log_store.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/trace_server.h"
+#include "fb/framebuffer.h"
+#include "fb/renderer.h"
+#include "input/evdev_input.h"
+#include "input/lirc_input.h"
+#include "net/http_server.h"
+#include "net/remote_api.h"
+#include "platform/platform.h"
+#include "platform/sched.h"
+#include "scan/image_preview.h"
+#include "scan/image_scanner.h"
+#include "text/font_atlas.h"
+#include "text/text_renderer.h"
+#include "ui/image_list_screen.h"
+#include "ui/log_screen.h"
+#include "ui/screen.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+struct Options {
+	const char *fb_path = platform::Machine::kDisplay.device;
+	const char *font_path = nullptr;
+	const char *input_dir = "/dev/input";
+	const char *lirc_path = "/var/run/lirc/lircd";
+	const char *log_path = "/tmp/recovery-ui.log";
+	unsigned width = platform::Machine::kDisplay.width;
+	unsigned height = platform::Machine::kDisplay.height;
+	bool double_buffer = true;
+	int ready_fd = -1;
+	// Mount points to look for images in; all storage mounts if empty.
+	std::vector<std::string> scan_roots;
+	// Where SIGUSR1 and exit dump the trace, and the port serving it.
+	const char *trace_file = nullptr;
+	unsigned trace_port = 0;
+	// Port of the remote control API, 0 for none.
+	unsigned http_port = 0;
+	// Flash only changed blocks unless a request says otherwise.
+	bool delta = false;
+	// Unix socket serving GET /metrics, empty for none.
+	const char *metrics_path = "/tmp/recovery-ui.metrics";
+};
+
+Histogram s_frame_time("recovery_ui_frame_seconds", "", "Time taken to repaint a frame.",
+		       { 1000, 2000, 4000, 8000, 16667, 33333, 50000, 100000, 250000 });
+Histogram s_input_latency("recovery_ui_input_latency_seconds", "",
+			  "Time from reading a key to the frame showing its effect.",
+			  { 5000, 10000, 20000, 33333, 50000, 100000, 200000, 500000, 1000000 });
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -f, --fb PATH         framebuffer device, file or \"mem:\" (default %s)\n"
+		"  -g, --geometry WxH    size of a file/memory framebuffer (default %ux%u)\n"
+		"      --font PATH       font atlas (default " FONT_DIR "/ui-<size>.atlas)\n"
+		"      --delta           flash only the blocks that changed, unless an API\n"
+		"                        request asks for a full flash\n"
+		"      --http-port N     serve the JSON control API on port N\n"
+		"      --input DIR       evdev directory (default /dev/input, \"\" for none)\n"
+		"      --lirc PATH       lircd socket (default /var/run/lirc/lircd, \"\" for none)\n"
+		"      --log PATH        keep the log for the viewer in PATH and PATH.idx\n"
+		"                        (default /tmp/recovery-ui.log, \"\" for none)\n"
+		"      --metrics PATH    serve GET /metrics on the Unix socket PATH\n"
+		"                        (default /tmp/recovery-ui.metrics, \"\" for none)\n"
+		"      --single-buffer   draw on the visible page instead of flipping pages\n"
+		"  -r, --ready-fd FD     write one byte to FD once the first frame is drawn\n"
+		"  -s, --scan DIR        look for images under DIR (repeatable; default all\n"
+		"                        mounted storage devices)\n"
+#ifdef HAVE_TRACE
+		"      --trace-file PATH write a Chrome trace to PATH on SIGUSR1 and at exit\n"
+		"      --trace-port N    serve the trace to TCP clients on port N\n"
+#endif
+		"  -v, --verbose         enable debug logging\n"
+		"  -h, --help            show this help\n"
+		"Built for %s.\n",
+		argv0, platform::Machine::kDisplay.device, platform::Machine::kDisplay.width,
+		platform::Machine::kDisplay.height, platform::Machine::kName);
+}
+
+bool parse_options(int argc, char **argv, Options &opts)
+{
+	static const struct option long_options[] = {
+		{ "delta", no_argument, nullptr, 'D' },
+		{ "fb", required_argument, nullptr, 'f' },
+		{ "geometry", required_argument, nullptr, 'g' },
+		{ "font", required_argument, nullptr, 'F' },
+		{ "http-port", required_argument, nullptr, 'H' },
+		{ "input", required_argument, nullptr, 'I' },
+		{ "lirc", required_argument, nullptr, 'L' },
+		{ "log", required_argument, nullptr, 'l' },
+		{ "metrics", required_argument, nullptr, 'M' },
+		{ "ready-fd", required_argument, nullptr, 'r' },
+		{ "single-buffer", no_argument, nullptr, 'S' },
+		{ "scan", required_argument, nullptr, 's' },
+#ifdef HAVE_TRACE
+		{ "trace-file", required_argument, nullptr, 'T' },
+		{ "trace-port", required_argument, nullptr, 'P' },
+#endif
+		{ "verbose", no_argument, nullptr, 'v' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "f:g:r:s:vh", long_options, nullptr)) != -1) {
+		switch (c) {
+		case 'D':
+			opts.delta = true;
+			break;
+		case 'f':
+			opts.fb_path = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%ux%u", &opts.width, &opts.height) != 2 || !opts.width || !opts.height) {
+				fprintf(stderr, "invalid geometry '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'F':
+			opts.font_path = optarg;
+			break;
+		case 'H':
+			opts.http_port = (unsigned)atoi(optarg);
+			break;
+		case 'I':
+			opts.input_dir = optarg;
+			break;
+		case 'L':
+			opts.lirc_path = optarg;
+			break;
+		case 'l':
+			opts.log_path = optarg;
+			break;
+		case 'M':
+			opts.metrics_path = optarg;
+			break;
+		case 'r':
+			opts.ready_fd = atoi(optarg);
+			break;
+		case 'S':
+			opts.double_buffer = false;
+			break;
+		case 's':
+			opts.scan_roots.emplace_back(optarg);
+			break;
+		case 'T':
+			opts.trace_file = optarg;
+			break;
+		case 'P':
+			opts.trace_port = (unsigned)atoi(optarg);
+			break;
+		case 'v':
+			log_set_level(LogLevel::Debug);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Font atlases are built per size; pick the one matching the screen.
+int open_font(FontAtlas &atlas, const Options &opts, const Framebuffer &fb)
+{
+	if (opts.font_path)
+		return atlas.open(opts.font_path);
+	char path[256];
+	snprintf(path, sizeof(path), "%s/ui-%u.atlas", FONT_DIR, fb.height() >= 1080 ? 28 : 20);
+	return atlas.open(path);
+}
+
+void signal_ready(int fd)
+{
+	if (fd < 0)
+		return;
+	char c = 1;
+	while (write(fd, &c, 1) < 0 && errno == EINTR)
+		;
+	close(fd);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	uint64_t start = monotonic_us();
+
+	// Declared first so it outlives every thread that logs.
+	LogStore log_store;
+	Options opts;
+	if (!parse_options(argc, argv, opts))
+		return EXIT_FAILURE;
+	if (*opts.log_path) {
+		int ret = log_store.open(opts.log_path);
+		if (ret < 0)
+			log_warning("log: cannot create %s: %s", opts.log_path, strerror(-ret));
+		else
+			log_set_store(&log_store);
+	}
+
+	// Signals are blocked and read from the loop, so this comes before any
+	// thread is started.
+	EventLoop loop;
+	if (!loop.valid())
+		return EXIT_FAILURE;
+	loop.add_signal(SIGTERM, [&] { loop.quit(); });
+	loop.add_signal(SIGINT, [&] { loop.quit(); });
+	TRACE_THREAD_NAME("ui");
+	sched_set_role(ThreadRole::Ui);
+#ifdef HAVE_TRACE
+	TraceServer trace_server(loop);
+	if (opts.trace_port)
+		trace_server.listen(opts.trace_port);
+	auto dump_trace = [&opts] {
+		int ret = trace_dump_file(opts.trace_file);
+		if (ret < 0)
+			log_error("trace: cannot write %s: %s", opts.trace_file, strerror(-ret));
+		else
+			log_info("trace: written to %s", opts.trace_file);
+	};
+	if (opts.trace_file)
+		loop.add_signal(SIGUSR1, dump_trace);
+#endif
+
+	Framebuffer fb;
+	if (fb.open(opts.fb_path, opts.width, opts.height, opts.double_buffer) < 0)
+		return EXIT_FAILURE;
+
+	FontAtlas atlas;
+	if (open_font(atlas, opts, fb) < 0)
+		log_warning("no font atlas, drawing without text");
+	TextRenderer text(atlas);
+	const TextRenderer *text_ptr = atlas.is_open() ? &text : nullptr;
+
+	Renderer renderer(fb);
+	ScreenManager screens(renderer);
+	ImageListScreen image_list(renderer, text_ptr);
+	image_list.set_activate_handler([](const ImageInfo &image) { log_info("selected %s", image.path.c_str()); });
+	LogScreen log_screen(renderer, text_ptr, opts.log_path);
+	if (!screens.show(image_list))
+		return EXIT_FAILURE;
+	screens.repaint();
+	log_debug("first frame after %llu us", (unsigned long long)(monotonic_us() - start));
+	signal_ready(opts.ready_fd);
+
+	// Input, timers and worker notifications wake this one thread; whatever a
+	// batch of them invalidated is repainted once afterwards.
+	uint64_t first_key_us = 0; // oldest key of the batch, 0 if none
+	KeyHandler on_key = [&](const KeyEvent &event) {
+		if (event.action != KeyAction::Release && !first_key_us)
+			first_key_us = event.time_us;
+		log_debug("key %s %s", key_name(event.key),
+			  event.action == KeyAction::Press ? "press" : event.action == KeyAction::Repeat ? "repeat" : "release");
+		if (screens.on_key(event) || event.action != KeyAction::Press)
+			return;
+		// Menu opens the log from the list, Back returns.
+		if (event.key == Key::Menu && screens.current() == &image_list && log_store.is_open())
+			screens.show(log_screen);
+		else if (event.key == Key::Back && screens.current() == &log_screen)
+			screens.show(image_list);
+	};
+	EvdevInput evdev(loop, on_key);
+	if (*opts.input_dir)
+		evdev.start(opts.input_dir);
+	LircInput lirc(loop, on_key);
+	if (*opts.lirc_path)
+		lirc.start(opts.lirc_path);
+	// Remote control; the job and server outlive the API that drives them.
+	FlashJob flash_job;
+	HttpServer http(loop);
+	RemoteApi api(loop, http, flash_job);
+	api.set_flash_mode(opts.delta ? FlashMode::Delta : FlashMode::Full);
+	if (opts.http_port)
+		http.listen(opts.http_port);
+	HttpServer metrics_http(loop);
+	serve_metrics(metrics_http);
+	if (*opts.metrics_path)
+		metrics_http.listen_unix(opts.metrics_path);
+	// Scanner threads queue what they find; the notifier hands it to the
+	// list on this thread, so rows appear as each device reports.
+	std::vector<std::string> roots = opts.scan_roots.empty() ? find_scan_roots() : opts.scan_roots;
+	std::mutex found_lock;
+	std::vector<ImageInfo> found;
+	unsigned pending = (unsigned)roots.size();
+	Notifier scan_notifier;
+	scan_notifier.attach(loop, [&] {
+		std::vector<ImageInfo> batch;
+		unsigned left;
+		{
+			std::lock_guard<std::mutex> lock(found_lock);
+			batch.swap(found);
+			left = pending;
+		}
+		for (const ImageInfo &image : batch) {
+			image_list.add(image);
+			api.add_image(image);
+		}
+		image_list.set_devices_pending(left);
+		api.set_devices_pending(left);
+	});
+	image_list.set_devices_pending(pending);
+	// Headers and details are read for what the list shows as it shows it.
+	Notifier preview_notifier;
+	preview_notifier.attach(loop, [&] { image_list.preview_ready(); });
+	ImagePreview preview;
+	preview.start([&] { preview_notifier.notify(); });
+	image_list.set_preview(&preview);
+	ImageScanner scanner;
+	scanner.start(
+		roots,
+		[&](const ImageInfo &image) {
+			std::lock_guard<std::mutex> lock(found_lock);
+			found.push_back(image);
+			scan_notifier.notify();
+		},
+		[&](const ScanResult &) {
+			std::lock_guard<std::mutex> lock(found_lock);
+			pending--;
+			scan_notifier.notify();
+		});
+
+	loop.add_timer(250, true, [&] {
+		if (screens.current() == &log_screen)
+			log_screen.refresh();
+	});
+
+	loop.set_idle([&] {
+		if (renderer.needs_repaint()) {
+			uint64_t begin = monotonic_us();
+			screens.repaint();
+			uint64_t end = monotonic_us();
+			s_frame_time.observe(end - begin);
+			if (first_key_us)
+				s_input_latency.observe(end - first_key_us);
+		}
+		first_key_us = 0;
+	});
+
+	int ret = loop.run();
+#ifdef HAVE_TRACE
+	if (opts.trace_file)
+		dump_trace();
+#endif
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,352 @@
+#include "net/http_connection.h"
+
+#include "common/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+namespace recovery {
+
+namespace {
+
+// Connects |fd| (non-blocking) to |addr| within |timeout_ms|.
+int connect_timed(int fd, const struct sockaddr *addr, socklen_t len, unsigned timeout_ms)
+{
+	if (::connect(fd, addr, len) == 0)
+		return 0;
+	if (errno != EINPROGRESS)
+		return -errno;
+
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+	int n;
+	while ((n = poll(&pfd, 1, (int)timeout_ms)) < 0 && errno == EINTR)
+		;
+	if (n == 0)
+		return -ETIMEDOUT;
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+	if (n < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+		return -errno;
+	return -err;
+}
+
+bool header_is(const char *line, const char *name, const char **value)
+{
+	size_t n = strlen(name);
+	if (strncasecmp(line, name, n) || line[n] != ':')
+		return false;
+	const char *v = line + n + 1;
+	while (*v == ' ' || *v == '\t')
+		v++;
+	*value = v;
+	return true;
+}
+
+} // namespace
+
+HttpConnection::~HttpConnection()
+{
+	close();
+}
+
+int HttpConnection::connect(const Url &url, unsigned timeout_ms)
+{
+	std::string server = (url.tls ? "https://" : "http://") + url.authority();
+	if (m_fd && m_keep_alive && m_body_left == 0 && server == m_server)
+		return 0;
+	close();
+
+#ifndef HAVE_OPENSSL
+	if (url.tls) {
+		log_error("net: %s: built without TLS support", url.host.c_str());
+		return -EPROTONOSUPPORT;
+	}
+#endif
+	// A peer resetting a TLS connection must not kill the process.
+	static std::once_flag ignore_sigpipe;
+	std::call_once(ignore_sigpipe, [] { signal(SIGPIPE, SIG_IGN); });
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *res;
+	std::string port = std::to_string(url.port);
+	int gai = getaddrinfo(url.host.c_str(), port.c_str(), &hints, &res);
+	if (gai) {
+		log_warning("net: cannot resolve %s: %s", url.host.c_str(), gai_strerror(gai));
+		return -EHOSTUNREACH;
+	}
+
+	int err = -EHOSTUNREACH;
+	UniqueFd fd;
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd.reset(socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol));
+		if (!fd) {
+			err = -errno;
+			continue;
+		}
+		err = connect_timed(fd.get(), ai->ai_addr, ai->ai_addrlen, timeout_ms);
+		if (!err)
+			break;
+		fd.reset();
+	}
+	freeaddrinfo(res);
+	if (err) {
+		log_warning("net: cannot connect to %s: %s", server.c_str(), strerror(-err));
+		return err;
+	}
+
+	// Blocking from here on, with every operation bounded by the timeout.
+	fcntl(fd.get(), F_SETFL, fcntl(fd.get(), F_GETFL) & ~O_NONBLOCK);
+	struct timeval tv = { (time_t)(timeout_ms / 1000), (suseconds_t)(timeout_ms % 1000) * 1000 };
+	setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd.get(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	int one = 1;
+	setsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+#ifdef HAVE_OPENSSL
+	if (url.tls) {
+		m_ctx = SSL_CTX_new(TLS_client_method());
+		m_ssl = m_ctx ? SSL_new(m_ctx) : nullptr;
+		if (m_ssl) {
+			SSL_CTX_set_default_verify_paths(m_ctx);
+			SSL_set_verify(m_ssl, SSL_VERIFY_PEER, nullptr);
+			SSL_set1_host(m_ssl, url.host.c_str());
+			SSL_set_tlsext_host_name(m_ssl, url.host.c_str());
+			SSL_set_fd(m_ssl, fd.get());
+		}
+		if (!m_ssl || SSL_connect(m_ssl) != 1) {
+			char msg[256];
+			ERR_error_string_n(ERR_get_error(), msg, sizeof(msg));
+			log_warning("net: TLS handshake with %s failed: %s", url.host.c_str(), msg);
+			close();
+			return -ECONNREFUSED;
+		}
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(m_fd_lock);
+	m_fd = std::move(fd);
+	m_server = server;
+	m_keep_alive = true;
+	m_body_left = 0;
+	m_buf_pos = m_buf_len = 0;
+	return 0;
+}
+
+void HttpConnection::close()
+{
+#ifdef HAVE_OPENSSL
+	if (m_ssl)
+		SSL_free(m_ssl);
+	if (m_ctx)
+		SSL_CTX_free(m_ctx);
+	m_ssl = nullptr;
+	m_ctx = nullptr;
+#endif
+	{
+		std::lock_guard<std::mutex> lock(m_fd_lock);
+		m_fd.reset();
+	}
+	m_server.clear();
+	m_body_left = 0;
+	m_buf_pos = m_buf_len = 0;
+}
+
+void HttpConnection::shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_fd_lock);
+	if (m_fd)
+		::shutdown(m_fd.get(), SHUT_RDWR);
+}
+
+ssize_t HttpConnection::raw_read(void *buf, size_t len)
+{
+	for (;;) {
+#ifdef HAVE_OPENSSL
+		if (m_ssl) {
+			int n = SSL_read(m_ssl, buf, (int)std::min<size_t>(len, 1 << 30));
+			if (n > 0)
+				return n;
+			int e = SSL_get_error(m_ssl, n);
+			if (e == SSL_ERROR_ZERO_RETURN)
+				return 0;
+			if (e == SSL_ERROR_SYSCALL && errno == EINTR)
+				continue;
+			return e == SSL_ERROR_SYSCALL && (errno == EAGAIN || errno == EWOULDBLOCK) ? -ETIMEDOUT
+												    : -ECONNRESET;
+		}
+#endif
+		ssize_t n = recv(m_fd.get(), buf, len, 0);
+		if (n >= 0)
+			return n;
+		if (errno == EINTR)
+			continue;
+		return errno == EAGAIN || errno == EWOULDBLOCK ? -ETIMEDOUT : -errno;
+	}
+}
+
+int HttpConnection::raw_write(const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	while (len) {
+		ssize_t n;
+#ifdef HAVE_OPENSSL
+		if (m_ssl) {
+			n = SSL_write(m_ssl, p, (int)len);
+			if (n <= 0)
+				return -ECONNRESET;
+		} else
+#endif
+		{
+			n = send(m_fd.get(), p, len, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				return errno == EAGAIN || errno == EWOULDBLOCK ? -ETIMEDOUT : -errno;
+			}
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int HttpConnection::get(const Url &url, const std::string &extra_headers, HttpResponse *response)
+{
+	if (!m_fd)
+		return -ENOTCONN;
+
+	std::string request = "GET " + url.target + " HTTP/1.1\r\nHost: " + url.authority() +
+			      "\r\nUser-Agent: recovery-ui\r\nAccept-Encoding: identity\r\n" + extra_headers + "\r\n";
+	int ret = raw_write(request.data(), request.size());
+	if (ret == 0)
+		ret = read_header(response);
+	if (ret < 0)
+		close();
+	return ret;
+}
+
+int HttpConnection::read_header(HttpResponse *response)
+{
+	// Collect bytes until the blank line; whatever follows is body.
+	size_t end = 0;
+	m_buf_pos = 0;
+	m_buf_len = 0;
+	for (;;) {
+		char *hdr_end = (char *)memmem(m_buf, m_buf_len, "\r\n\r\n", 4);
+		if (hdr_end) {
+			end = (size_t)(hdr_end - m_buf) + 4;
+			break;
+		}
+		if (m_buf_len == sizeof(m_buf) - 1)
+			return -EPROTO;
+		ssize_t n = raw_read(m_buf + m_buf_len, sizeof(m_buf) - 1 - m_buf_len);
+		if (n <= 0)
+			return n < 0 ? (int)n : -ECONNRESET;
+		m_buf_len += (size_t)n;
+	}
+	m_buf[m_buf_len] = '\0';
+
+	HttpResponse r;
+	int minor;
+	if (sscanf(m_buf, "HTTP/1.%d %d", &minor, &r.status) != 2)
+		return -EPROTO;
+	r.keep_alive = minor >= 1;
+
+	bool chunked = false;
+	// Lines are found within the header, which may hold NUL bytes.
+	for (char *line = (char *)memmem(m_buf, end, "\r\n", 2) + 2; line < m_buf + end - 2;) {
+		char *eol = (char *)memmem(line, (size_t)(m_buf + end - line), "\r\n", 2);
+		if (!eol)
+			return -EPROTO;
+		*eol = '\0';
+		const char *v;
+		if (header_is(line, "Content-Length", &v)) {
+			r.content_length = strtoll(v, nullptr, 10);
+		} else if (header_is(line, "Content-Range", &v)) {
+			long long a, b;
+			if (sscanf(v, "bytes %lld-%lld/", &a, &b) == 2) {
+				r.range_start = a;
+				r.range_end = b;
+				const char *slash = strchr(v, '/');
+				r.total_size = slash && slash[1] != '*' ? strtoll(slash + 1, nullptr, 10) : -1;
+			}
+		} else if (header_is(line, "Accept-Ranges", &v)) {
+			r.accept_ranges = !strncasecmp(v, "bytes", 5);
+		} else if (header_is(line, "Connection", &v)) {
+			if (!strncasecmp(v, "close", 5))
+				r.keep_alive = false;
+			else if (!strncasecmp(v, "keep-alive", 10))
+				r.keep_alive = true;
+		} else if (header_is(line, "Transfer-Encoding", &v)) {
+			chunked = strstr(v, "chunked") != nullptr;
+		} else if (header_is(line, "ETag", &v)) {
+			r.etag = v;
+		} else if (header_is(line, "Last-Modified", &v)) {
+			r.last_modified = v;
+		} else if (header_is(line, "Location", &v)) {
+			r.location = v;
+		}
+		line = eol + 2;
+	}
+	if (chunked) {
+		log_warning("net: chunked responses are not supported");
+		return -ENOTSUP;
+	}
+	if (r.status == 204 || r.status == 304 || (r.status >= 100 && r.status < 200))
+		r.content_length = 0;
+	if (r.content_length < 0)
+		r.keep_alive = false;
+
+	m_keep_alive = r.keep_alive;
+	m_body_left = r.content_length;
+	m_buf_pos = end;
+	*response = r;
+	return 0;
+}
+
+ssize_t HttpConnection::read_body(uint8_t *buf, size_t len)
+{
+	if (m_body_left == 0)
+		return 0;
+	if (m_body_left > 0)
+		len = (size_t)std::min<int64_t>((int64_t)len, m_body_left);
+
+	ssize_t n;
+	if (m_buf_pos < m_buf_len) {
+		n = (ssize_t)std::min(len, m_buf_len - m_buf_pos);
+		memcpy(buf, m_buf + m_buf_pos, (size_t)n);
+		m_buf_pos += (size_t)n;
+	} else {
+		n = raw_read(buf, len);
+		if (n == 0 && m_body_left > 0)
+			n = -ECONNRESET; // closed mid-body
+		if (n <= 0) {
+			bool eof = n == 0;
+			close();
+			return eof ? 0 : n;
+		}
+	}
+	if (m_body_left > 0)
+		m_body_left -= n;
+	return n;
+}
+
+} // namespace recovery
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common/unique_fd.h"
+#include "net/url.h"
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+#ifdef HAVE_OPENSSL
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+#endif
+
+namespace recovery {
+
+struct HttpResponse {
+	int status = 0;
+	// Body length; -1 if delimited by connection close.
+	int64_t content_length = -1;
+	// From Content-Range on a 206; total is -1 if the server sent '*'.
+	int64_t range_start = -1;
+	int64_t range_end = -1;
+	int64_t total_size = -1;
+	bool accept_ranges = false;
+	bool keep_alive = true;
+	std::string etag;
+	std::string last_modified;
+	std::string location;
+};
+
+// One HTTP/1.1 connection, optionally over TLS, reused for consecutive
+// requests to the same server. Blocking, with a timeout on every socket
+// operation so a dead link fails instead of hanging; shutdown() may be
+// called from another thread to abort a transfer in progress.
+//
+// Bodies must be read to the end before the next request; chunked
+// transfer encoding is not supported (mirrors send Content-Length for
+// files).
+class HttpConnection {
+public:
+	HttpConnection() = default;
+	~HttpConnection();
+
+	HttpConnection(const HttpConnection &) = delete;
+	HttpConnection &operator=(const HttpConnection &) = delete;
+
+	// Connects unless already connected to the same server. Returns 0 or
+	// -errno (-EHOSTUNREACH when name resolution fails, -EPROTONOSUPPORT for
+	// https without TLS support).
+	int connect(const Url &url, unsigned timeout_ms);
+	void close();
+	bool connected() const { return m_fd.valid(); }
+	// Unblocks a read or write in progress on another thread.
+	void shutdown();
+
+	// Sends a GET for |url.target| with |extra_headers| ("Name: value\r\n"
+	// lines) and reads the response header. Returns 0 or -errno; -EPROTO
+	// for a malformed response.
+	int get(const Url &url, const std::string &extra_headers, HttpResponse *response);
+
+	// Reads the body of the last response. Returns the byte count, 0 at
+	// its end, or -errno.
+	ssize_t read_body(uint8_t *buf, size_t len);
+	// Body bytes still expected, -1 if unknown.
+	int64_t body_left() const { return m_body_left; }
+
+private:
+	ssize_t raw_read(void *buf, size_t len);
+	int raw_write(const void *buf, size_t len);
+	int read_header(HttpResponse *response);
+
+	// Guards m_fd against shutdown() racing with close().
+	std::mutex m_fd_lock;
+	UniqueFd m_fd;
+	std::string m_server;
+#ifdef HAVE_OPENSSL
+	SSL_CTX *m_ctx = nullptr;
+	SSL *m_ssl = nullptr;
+#endif
+	bool m_keep_alive = false;
+	int64_t m_body_left = 0;
+	// Bytes read past the header, served before the socket.
+	char m_buf[16384];
+	size_t m_buf_pos = 0;
+	size_t m_buf_len = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,461 @@
+#include "net/http_server.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+const uint32_t kReadEvents = EPOLLIN | EPOLLRDHUP;
+
+const char *status_text(int status)
+{
+	switch (status) {
+	case 200:
+		return "OK";
+	case 202:
+		return "Accepted";
+	case 400:
+		return "Bad Request";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 409:
+		return "Conflict";
+	case 413:
+		return "Payload Too Large";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return status < 500 ? "Error" : "Internal Server Error";
+	}
+}
+
+int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+std::string url_decode(const char *s, size_t len)
+{
+	std::string out;
+	out.reserve(len);
+	for (size_t i = 0; i < len; i++) {
+		int hi, lo;
+		if (s[i] == '+')
+			out += ' ';
+		else if (s[i] == '%' && i + 2 < len && (hi = hex_digit(s[i + 1])) >= 0 &&
+			 (lo = hex_digit(s[i + 2])) >= 0) {
+			out += (char)(hi << 4 | lo);
+			i += 2;
+		} else {
+			out += s[i];
+		}
+	}
+	return out;
+}
+
+// Looks |name| up in "a=1&b=2".
+bool form_value(const std::string &form, const char *name, std::string *value)
+{
+	size_t name_len = strlen(name);
+	size_t pos = 0;
+	while (pos < form.size()) {
+		size_t end = form.find('&', pos);
+		if (end == std::string::npos)
+			end = form.size();
+		size_t eq = form.find('=', pos);
+		size_t key_end = eq < end ? eq : end;
+		if (key_end - pos == name_len && !form.compare(pos, name_len, name)) {
+			*value = eq < end ? url_decode(form.data() + eq + 1, end - eq - 1) : std::string();
+			return true;
+		}
+		pos = end + 1;
+	}
+	return false;
+}
+
+} // namespace
+
+bool HttpRequest::param(const char *name, std::string *value) const
+{
+	return form_value(query, name, value) || form_value(body, name, value);
+}
+
+void append_json_string(std::string &out, const std::string &s)
+{
+	out += '"';
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += (char)c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out += esc;
+		} else {
+			out += (char)c;
+		}
+	}
+	out += '"';
+}
+
+HttpServer::~HttpServer()
+{
+	while (!m_clients.empty())
+		drop(m_clients.begin()->first);
+	if (m_timer > 0)
+		m_loop.cancel_timer(m_timer);
+	if (m_listen)
+		m_loop.remove_fd(m_listen.get());
+	if (!m_unix_path.empty())
+		unlink(m_unix_path.c_str());
+}
+
+int HttpServer::listen(unsigned port)
+{
+	m_listen.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!m_listen)
+		return -errno;
+	int one = 1;
+	setsockopt(m_listen.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	char where[32];
+	snprintf(where, sizeof(where), "port %u", port);
+	if (bind(m_listen.get(), (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = -errno;
+		log_error("http: cannot listen on %s: %s", where, strerror(-err));
+		m_listen.reset();
+		return err;
+	}
+	return start(where);
+}
+
+int HttpServer::listen_unix(const char *path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+	m_listen.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!m_listen)
+		return -errno;
+	unlink(path);
+	if (bind(m_listen.get(), (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = -errno;
+		log_error("http: cannot listen on %s: %s", path, strerror(-err));
+		m_listen.reset();
+		return err;
+	}
+	m_unix_path = path;
+	return start(path);
+}
+
+int HttpServer::start(const char *where)
+{
+	if (::listen(m_listen.get(), 16) < 0) {
+		int err = -errno;
+		log_error("http: cannot listen on %s: %s", where, strerror(-err));
+		m_listen.reset();
+		return err;
+	}
+	int ret = m_loop.add_fd(m_listen.get(), EPOLLIN, [this](uint32_t) { on_accept(); });
+	if (ret < 0) {
+		m_listen.reset();
+		return ret;
+	}
+	m_timer = m_loop.add_timer(kRequestTimeoutMs / 2, true, [this] { expire(); });
+	log_info("http: serving on %s", where);
+	return 0;
+}
+
+void HttpServer::route(const char *method, const char *path, Handler handler)
+{
+	m_routes.push_back(Route{ method, path, std::move(handler) });
+}
+
+void HttpServer::stream(const char *path, StreamOpenFn on_open)
+{
+	m_stream_path = path;
+	m_on_stream = std::move(on_open);
+}
+
+void HttpServer::format_event(std::string &out, const char *event, const std::string &data)
+{
+	// |data| is one line of JSON; a newline would end the event early.
+	out += "event: ";
+	out += event;
+	out += "\ndata: ";
+	out += data;
+	out += "\n\n";
+}
+
+void HttpServer::publish(const char *event, const std::string &data)
+{
+	if (!m_streams)
+		return;
+	std::string message;
+	format_event(message, event, data);
+	std::vector<int> fds;
+	for (const auto &it : m_clients)
+		if (it.second->state == State::Streaming)
+			fds.push_back(it.first);
+	for (int fd : fds) {
+		Client &client = *m_clients[fd];
+		if (client.out.size() - client.sent + message.size() > kMaxQueued) {
+			log_warning("http: dropping a client that stopped reading events");
+			drop(fd);
+			continue;
+		}
+		client.out += message;
+		flush(client);
+	}
+}
+
+void HttpServer::on_accept()
+{
+	for (;;) {
+		int fd = accept4(m_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		UniqueFd owned(fd);
+		if (m_clients.size() >= kMaxClients) {
+			log_warning("http: too many clients, refusing one");
+			continue;
+		}
+		// Events are small and should leave at once.
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (m_loop.add_fd(fd, kReadEvents, [this, fd](uint32_t events) { on_event(fd, events); }) < 0)
+			continue;
+		std::unique_ptr<Client> client(new Client());
+		client->fd = std::move(owned);
+		client->start_us = monotonic_us();
+		m_clients[fd] = std::move(client);
+	}
+}
+
+void HttpServer::on_event(int fd, uint32_t events)
+{
+	auto it = m_clients.find(fd);
+	if (it == m_clients.end())
+		return;
+	Client &client = *it->second;
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		drop(fd);
+		return;
+	}
+	if ((events & EPOLLOUT) && !flush(client))
+		return;
+	if (events & (EPOLLIN | EPOLLRDHUP))
+		on_readable(client);
+}
+
+void HttpServer::on_readable(Client &client)
+{
+	int fd = client.fd.get();
+	char buf[4096];
+	for (;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			break;
+		if (n <= 0) {
+			drop(fd);
+			return;
+		}
+		// Once answered, whatever else a client sends is ignored.
+		if (client.state != State::Reading)
+			continue;
+		client.in.append(buf, (size_t)n);
+		if (client.in.size() > kMaxRequest)
+			break;
+	}
+	if (client.state != State::Reading)
+		return;
+
+	HttpRequest request;
+	int error = 0;
+	if (parse(client, request, &error))
+		dispatch(client, request);
+	else if (error)
+		respond(client, error, "text/plain", std::string(status_text(error)) + "\n");
+}
+
+bool HttpServer::parse(Client &client, HttpRequest &request, int *error)
+{
+	const std::string &in = client.in;
+	size_t head_end = in.find("\r\n\r\n");
+	if (head_end == std::string::npos) {
+		if (in.size() > kMaxRequest)
+			*error = 413;
+		return false;
+	}
+
+	// "GET /path?query HTTP/1.1"
+	size_t line_end = in.find("\r\n");
+	size_t sp1 = in.find(' ');
+	size_t sp2 = sp1 < line_end ? in.find(' ', sp1 + 1) : std::string::npos;
+	if (sp2 >= line_end || in.compare(sp2 + 1, 7, "HTTP/1.") || in[sp1 + 1] != '/') {
+		*error = 400;
+		return false;
+	}
+	request.method.assign(in, 0, sp1);
+	std::string target(in, sp1 + 1, sp2 - sp1 - 1);
+	size_t q = target.find('?');
+	request.path.assign(target, 0, q);
+	if (q != std::string::npos)
+		request.query.assign(target, q + 1, std::string::npos);
+
+	size_t content_length = 0;
+	size_t pos = line_end + 2;
+	while (pos < head_end) {
+		size_t end = in.find("\r\n", pos);
+		static const char kLength[] = "Content-Length:";
+		if (!strncasecmp(in.c_str() + pos, kLength, sizeof(kLength) - 1))
+			content_length = strtoul(in.c_str() + pos + sizeof(kLength) - 1, nullptr, 10);
+		pos = end + 2;
+	}
+	size_t body = head_end + 4;
+	if (content_length > kMaxRequest - std::min(body, kMaxRequest)) {
+		*error = 413;
+		return false;
+	}
+	if (in.size() < body + content_length)
+		return false;
+	request.body.assign(in, body, content_length);
+	return true;
+}
+
+void HttpServer::dispatch(Client &client, const HttpRequest &request)
+{
+	if (!m_stream_path.empty() && request.path == m_stream_path && request.method == "GET") {
+		client.state = State::Streaming;
+		client.in.clear();
+		m_streams++;
+		client.out = "HTTP/1.1 200 OK\r\n"
+			     "Content-Type: text/event-stream\r\n"
+			     "Cache-Control: no-cache\r\n"
+			     "\r\n";
+		if (m_on_stream)
+			m_on_stream(client.out);
+		flush(client);
+		return;
+	}
+
+	bool path_found = false;
+	for (const Route &route : m_routes) {
+		if (route.path != request.path)
+			continue;
+		path_found = true;
+		if (route.method != request.method)
+			continue;
+		HttpResponse response;
+		route.handler(request, response);
+		respond(client, response.status, response.content_type, response.body);
+		return;
+	}
+	int status = path_found ? 405 : 404;
+	respond(client, status, "text/plain", std::string(status_text(status)) + "\n");
+}
+
+void HttpServer::respond(Client &client, int status, const char *content_type, const std::string &body)
+{
+	char head[192];
+	snprintf(head, sizeof(head),
+		 "HTTP/1.1 %d %s\r\n"
+		 "Content-Type: %s\r\n"
+		 "Content-Length: %zu\r\n"
+		 "Connection: close\r\n"
+		 "\r\n",
+		 status, status_text(status), content_type, body.size());
+	client.state = State::Responding;
+	client.in.clear();
+	client.out = head;
+	client.out += body;
+	client.sent = 0;
+	flush(client);
+}
+
+bool HttpServer::flush(Client &client)
+{
+	int fd = client.fd.get();
+	while (client.sent < client.out.size()) {
+		ssize_t n = send(fd, client.out.data() + client.sent, client.out.size() - client.sent,
+				 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN) {
+			// The rest goes out when the socket drains.
+			if (!client.want_write && m_loop.modify_fd(fd, kReadEvents | EPOLLOUT) == 0)
+				client.want_write = true;
+			return true;
+		}
+		if (n < 0) {
+			drop(fd);
+			return false;
+		}
+		client.sent += (size_t)n;
+	}
+	client.out.clear();
+	client.sent = 0;
+	if (client.state == State::Responding) {
+		drop(fd);
+		return false;
+	}
+	if (client.want_write && m_loop.modify_fd(fd, kReadEvents) == 0)
+		client.want_write = false;
+	return true;
+}
+
+void HttpServer::expire()
+{
+	uint64_t now = monotonic_us();
+	std::vector<int> stale;
+	for (const auto &it : m_clients)
+		if (it.second->state == State::Reading && now - it.second->start_us > kRequestTimeoutMs * 1000ull)
+			stale.push_back(it.first);
+	for (int fd : stale)
+		drop(fd);
+}
+
+void HttpServer::drop(int fd)
+{
+	auto it = m_clients.find(fd);
+	if (it == m_clients.end())
+		return;
+	if (it->second->state == State::Streaming)
+		m_streams--;
+	m_loop.remove_fd(fd);
+	m_clients.erase(it);
+}
+
+} // namespace recovery
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace recovery {
+
+struct HttpRequest {
+	std::string method;
+	std::string path;
+	// Raw, after the '?'.
+	std::string query;
+	std::string body;
+
+	// Value of |name| from the query string or a form-encoded body,
+	// URL-decoded. False if it is not there.
+	bool param(const char *name, std::string *value) const;
+};
+
+struct HttpResponse {
+	int status = 200;
+	const char *content_type = "application/json";
+	std::string body;
+};
+
+// Appends |s| to |out| as a JSON string literal, quotes included.
+void append_json_string(std::string &out, const std::string &s);
+
+// Small HTTP/1.1 server for remote control, run entirely on the EventLoop:
+// sockets are non-blocking, each connection is a state machine driven by
+// epoll, and nothing here is ever called from a worker thread.
+//
+// Plain requests get one response and the connection is closed. A GET of
+// the path given to stream() instead stays open as a server-sent event
+// stream, and publish() formats an event once and queues it on every
+// such client. A client that stops reading is dropped once its queue is
+// full, so one stuck browser cannot grow memory or hold up the others.
+class HttpServer {
+public:
+	using Handler = std::function<void(const HttpRequest &request, HttpResponse &response)>;
+	// Gets the stream's first events (formatted with format_event()), so a
+	// client starts from the current state rather than waiting for a change.
+	using StreamOpenFn = std::function<void(std::string &events)>;
+
+	// Connections beyond this are refused.
+	static const size_t kMaxClients = 64;
+	// Largest request head plus body accepted.
+	static const size_t kMaxRequest = 16 * 1024;
+	// Output a stream client may have pending before it is dropped.
+	static const size_t kMaxQueued = 256 * 1024;
+	// Time a client gets to send its whole request.
+	static const unsigned kRequestTimeoutMs = 10000;
+
+	explicit HttpServer(EventLoop &loop) : m_loop(loop) {}
+	~HttpServer();
+
+	HttpServer(const HttpServer &) = delete;
+	HttpServer &operator=(const HttpServer &) = delete;
+
+	// Listens on |port| on all interfaces. Returns 0 or -errno.
+	int listen(unsigned port);
+	// Listens on a Unix stream socket at |path| instead, for local
+	// clients; a stale socket there is replaced, and it is removed again
+	// with the server. Returns 0 or -errno.
+	int listen_unix(const char *path);
+
+	// |method| is "GET", "POST", ...; |path| matches exactly.
+	void route(const char *method, const char *path, Handler handler);
+	void stream(const char *path, StreamOpenFn on_open);
+
+	// Sends one event to every stream client.
+	void publish(const char *event, const std::string &data);
+	size_t stream_clients() const { return m_streams; }
+
+	static void format_event(std::string &out, const char *event, const std::string &data);
+
+private:
+	enum class State { Reading, Responding, Streaming };
+
+	struct Client {
+		UniqueFd fd;
+		State state = State::Reading;
+		std::string in;
+		std::string out;
+		size_t sent = 0;
+		uint64_t start_us = 0;
+		bool want_write = false;
+	};
+	struct Route {
+		std::string method;
+		std::string path;
+		Handler handler;
+	};
+
+	// Serves the bound m_listen, named |where| in the log.
+	int start(const char *where);
+	void on_accept();
+	void on_event(int fd, uint32_t events);
+	void on_readable(Client &client);
+	// Parses a complete request from client.in; false while it is not.
+	bool parse(Client &client, HttpRequest &request, int *error);
+	void dispatch(Client &client, const HttpRequest &request);
+	void respond(Client &client, int status, const char *content_type, const std::string &body);
+	// Sends what is queued without blocking; false if the client is gone.
+	bool flush(Client &client);
+	void expire();
+	void drop(int fd);
+
+	EventLoop &m_loop;
+	UniqueFd m_listen;
+	// Removed again on destruction.
+	std::string m_unix_path;
+	int m_timer = 0;
+	std::vector<Route> m_routes;
+	std::string m_stream_path;
+	StreamOpenFn m_on_stream;
+	std::unordered_map<int, std::unique_ptr<Client>> m_clients;
+	size_t m_streams = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,257 @@
+#include "net/mcast_protocol.h"
+
+#include "common/log.h"
+#include "crypto/tree_hash.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+namespace recovery {
+
+namespace {
+
+const size_t kHeaderSize = 12;
+const uint32_t kIdleFlag = 1;
+
+void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, (uint16_t)(v >> 16));
+	put16(p + 2, (uint16_t)v);
+}
+
+void put64(uint8_t *p, uint64_t v)
+{
+	put32(p, (uint32_t)(v >> 32));
+	put32(p + 4, (uint32_t)v);
+}
+
+uint16_t get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)get16(p) << 16 | get16(p + 2);
+}
+
+uint64_t get64(const uint8_t *p)
+{
+	return (uint64_t)get32(p) << 32 | get32(p + 4);
+}
+
+uint8_t *put_header(uint8_t *buf, McastType type, uint32_t session)
+{
+	put32(buf, kMcastMagic);
+	buf[4] = kMcastVersion;
+	buf[5] = (uint8_t)type;
+	put16(buf + 6, 0);
+	put32(buf + 8, session);
+	return buf + kHeaderSize;
+}
+
+} // namespace
+
+size_t mcast_encode_announce(uint8_t *buf, uint32_t session, const McastAnnounce &announce)
+{
+	uint8_t *p = put_header(buf, McastType::Announce, session);
+	put64(p, announce.image_size);
+	put32(p + 8, announce.chunk_size);
+	put32(p + 12, announce.chunk_count);
+	put32(p + 16, announce.idle ? kIdleFlag : 0);
+	memcpy(p + 20, announce.root, sizeof(announce.root));
+	return kHeaderSize + 20 + sizeof(announce.root);
+}
+
+size_t mcast_encode_digests(uint8_t *buf, uint32_t session, uint32_t first, const uint8_t *digests, size_t count)
+{
+	uint8_t *p = put_header(buf, McastType::Digests, session);
+	put32(p, first);
+	put16(p + 4, (uint16_t)count);
+	put16(p + 6, 0);
+	memcpy(p + 8, digests, count * Sha256::kDigestSize);
+	return kHeaderSize + 8 + count * Sha256::kDigestSize;
+}
+
+size_t mcast_encode_data(uint8_t *buf, uint32_t session, uint32_t chunk, uint32_t offset, const uint8_t *data,
+			 size_t len)
+{
+	uint8_t *p = put_header(buf, McastType::Data, session);
+	put32(p, chunk);
+	put32(p + 4, offset);
+	put16(p + 8, (uint16_t)len);
+	put16(p + 10, 0);
+	memcpy(p + 12, data, len);
+	return kHeaderSize + 12 + len;
+}
+
+size_t mcast_encode_nack(uint8_t *buf, uint32_t session, bool digests, const McastRange *ranges, size_t count)
+{
+	uint8_t *p = put_header(buf, McastType::Nack, session);
+	p[0] = digests ? 1 : 0;
+	p[1] = 0;
+	put16(p + 2, (uint16_t)count);
+	for (size_t i = 0; i < count; i++) {
+		put32(p + 4 + 8 * i, ranges[i].first);
+		put32(p + 8 + 8 * i, ranges[i].count);
+	}
+	return kHeaderSize + 4 + 8 * count;
+}
+
+bool mcast_parse(const uint8_t *buf, size_t len, McastPacket *packet)
+{
+	if (len < kHeaderSize || get32(buf) != kMcastMagic || buf[4] != kMcastVersion)
+		return false;
+	packet->type = (McastType)buf[5];
+	packet->session = get32(buf + 8);
+	const uint8_t *p = buf + kHeaderSize;
+	len -= kHeaderSize;
+
+	switch (packet->type) {
+	case McastType::Announce: {
+		McastAnnounce &a = packet->announce;
+		if (len < 20 + sizeof(a.root))
+			return false;
+		a.image_size = get64(p);
+		a.chunk_size = get32(p + 8);
+		a.chunk_count = get32(p + 12);
+		a.idle = get32(p + 16) & kIdleFlag;
+		memcpy(a.root, p + 20, sizeof(a.root));
+		return a.chunk_size >= kMcastMinChunkSize && a.chunk_size <= kMcastMaxChunkSize &&
+		       a.chunk_count <= kMcastMaxChunks && a.image_size <= (uint64_t)a.chunk_count * a.chunk_size &&
+		       a.chunk_count == (a.image_size + a.chunk_size - 1) / a.chunk_size;
+	}
+	case McastType::Digests: {
+		if (len < 8)
+			return false;
+		packet->index = get32(p);
+		packet->payload = p + 8;
+		packet->payload_len = (size_t)get16(p + 4) * Sha256::kDigestSize;
+		return packet->payload_len && packet->payload_len <= len - 8;
+	}
+	case McastType::Data: {
+		if (len < 12)
+			return false;
+		packet->index = get32(p);
+		packet->offset = get32(p + 4);
+		packet->payload = p + 12;
+		packet->payload_len = get16(p + 8);
+		return packet->payload_len && packet->payload_len <= len - 12;
+	}
+	case McastType::Nack: {
+		if (len < 4)
+			return false;
+		packet->nack_digests = p[0] & 1;
+		size_t count = get16(p + 2);
+		if (count > (len - 4) / 8)
+			return false;
+		packet->ranges.resize(count);
+		for (size_t i = 0; i < count; i++)
+			packet->ranges[i] = { get32(p + 4 + 8 * i), get32(p + 8 + 8 * i) };
+		return true;
+	}
+	}
+	return false;
+}
+
+void mcast_digest_root(uint64_t image_size, uint32_t chunk_size, const std::vector<uint8_t> &digests,
+		       uint8_t root[Sha256::kDigestSize])
+{
+	tree_hash_root(image_size, chunk_size, digests, root);
+}
+
+bool mcast_parse_group(const char *text, McastOptions *options)
+{
+	std::string addr = text;
+	size_t colon = addr.rfind(':');
+	unsigned port = options->port;
+	if (colon != std::string::npos) {
+		char *end;
+		unsigned long p = strtoul(addr.c_str() + colon + 1, &end, 10);
+		if (*end || !p || p > 65535)
+			return false;
+		port = (unsigned)p;
+		addr.resize(colon);
+	}
+	struct in_addr in;
+	if (inet_pton(AF_INET, addr.c_str(), &in) != 1)
+		return false;
+	options->group = addr;
+	options->port = port;
+	return true;
+}
+
+int mcast_open_socket(const McastOptions &options, bool receiver, UniqueFd *fd, struct sockaddr_in *group)
+{
+	memset(group, 0, sizeof(*group));
+	group->sin_family = AF_INET;
+	group->sin_port = htons((uint16_t)options.port);
+	if (inet_pton(AF_INET, options.group.c_str(), &group->sin_addr) != 1)
+		return -EINVAL;
+	bool multicast = IN_MULTICAST(ntohl(group->sin_addr.s_addr));
+
+	int ifindex = 0;
+	if (!options.iface.empty()) {
+		ifindex = (int)if_nametoindex(options.iface.c_str());
+		if (!ifindex) {
+			log_error("fleet: no interface %s", options.iface.c_str());
+			return -ENODEV;
+		}
+	}
+
+	UniqueFd sock(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!sock)
+		return -errno;
+	// Bursts of a whole chunk arrive faster than one loop iteration drains.
+	int buf_size = 4 << 20;
+	setsockopt(sock.get(), SOL_SOCKET, receiver ? SO_RCVBUF : SO_SNDBUF, &buf_size, sizeof(buf_size));
+
+	struct sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	if (receiver) {
+		int one = 1;
+		setsockopt(sock.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		local.sin_port = group->sin_port;
+		local.sin_addr.s_addr = multicast ? group->sin_addr.s_addr : htonl(INADDR_ANY);
+	}
+	if (bind(sock.get(), (struct sockaddr *)&local, sizeof(local)) < 0) {
+		int err = -errno;
+		log_error("fleet: cannot bind port %u: %s", receiver ? options.port : 0, strerror(-err));
+		return err;
+	}
+
+	if (multicast && receiver) {
+		struct ip_mreqn mreq = {};
+		mreq.imr_multiaddr = group->sin_addr;
+		mreq.imr_ifindex = ifindex;
+		if (setsockopt(sock.get(), IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+			int err = -errno;
+			log_error("fleet: cannot join %s: %s", options.group.c_str(), strerror(-err));
+			return err;
+		}
+	} else if (multicast) {
+		struct ip_mreqn mreq = {};
+		mreq.imr_ifindex = ifindex;
+		if (ifindex)
+			setsockopt(sock.get(), IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+		int ttl = (int)options.ttl;
+		setsockopt(sock.get(), IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		// A receiver on the sending box (or a test) sees the stream too.
+		int loop = 1;
+		setsockopt(sock.get(), IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+	}
+	*fd = std::move(sock);
+	return 0;
+}
+
+} // namespace recovery
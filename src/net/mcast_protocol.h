@@ -0,0 +1,121 @@
+#pragma once
+
+#include "common/unique_fd.h"
+#include "crypto/sha256.h"
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace recovery {
+
+// Wire format of fleet distribution: one sender multicasts an image to
+// every receiver on the LAN at once, receivers ask it (unicast) for the
+// pieces they are missing.
+//
+// The image is cut into chunks, each verified on its own against a SHA-256
+// from the digest table. The table itself is pinned by its root, which the
+// sender announces and operators can pass to receivers out of band. All
+// fields are big-endian; every datagram starts with a McastHeader.
+//
+//   Announce  sender -> group, twice a second: geometry, root, idle flag
+//   Digests   sender -> group: a run of chunk digests
+//   Data      sender -> group: one fragment of a chunk
+//   Nack      receiver -> sender: ranges of digests or chunks to resend
+
+const uint32_t kMcastMagic = 0x52554d43; // "RUMC"
+const uint8_t kMcastVersion = 1;
+
+// Keeps every datagram within a 1500-byte Ethernet MTU.
+const size_t kMcastFragmentSize = 1400;
+const size_t kMcastDigestsPerPacket = 40;
+const size_t kMcastMaxNackRanges = 160;
+const size_t kMcastMaxPacket = 1472;
+// Receivers buffer partial chunks; this bounds what a sender may ask for.
+// Chunks are at least a fragment.
+const uint32_t kMcastMinChunkSize = kMcastFragmentSize;
+const uint32_t kMcastMaxChunkSize = 16 << 20;
+// Receivers keep a digest per chunk, 32 MiB of them at most.
+const uint32_t kMcastMaxChunks = 1 << 20;
+
+enum class McastType : uint8_t {
+	Announce = 1,
+	Digests = 2,
+	Data = 3,
+	Nack = 4,
+};
+
+struct McastAnnounce {
+	uint64_t image_size = 0;
+	uint32_t chunk_size = 0;
+	uint32_t chunk_count = 0;
+	// Nothing queued: the first pass is over and every repair sent.
+	bool idle = false;
+	uint8_t root[Sha256::kDigestSize] = {};
+};
+
+struct McastRange {
+	uint32_t first;
+	uint32_t count;
+};
+
+// Decoded datagram; only the members for |type| are set. |payload| points
+// into the buffer that was parsed.
+struct McastPacket {
+	McastType type;
+	uint32_t session = 0;
+	McastAnnounce announce;
+	// Digests: index of the first digest and how many follow.
+	// Data: chunk index and byte offset within the chunk.
+	uint32_t index = 0;
+	uint32_t offset = 0;
+	const uint8_t *payload = nullptr;
+	size_t payload_len = 0;
+	// Nack
+	bool nack_digests = false;
+	std::vector<McastRange> ranges;
+};
+
+// Each returns the datagram length.
+size_t mcast_encode_announce(uint8_t *buf, uint32_t session, const McastAnnounce &announce);
+size_t mcast_encode_digests(uint8_t *buf, uint32_t session, uint32_t first, const uint8_t *digests, size_t count);
+size_t mcast_encode_data(uint8_t *buf, uint32_t session, uint32_t chunk, uint32_t offset, const uint8_t *data,
+			 size_t len);
+size_t mcast_encode_nack(uint8_t *buf, uint32_t session, bool digests, const McastRange *ranges, size_t count);
+
+// Returns false for anything that is not a well-formed datagram.
+bool mcast_parse(const uint8_t *buf, size_t len, McastPacket *packet);
+
+// Digest of the table, bound to the image geometry: the image's tree
+// digest with chunk-sized leaves.
+void mcast_digest_root(uint64_t image_size, uint32_t chunk_size, const std::vector<uint8_t> &digests,
+		       uint8_t root[Sha256::kDigestSize]);
+
+struct McastOptions {
+	// IPv4 group (or, for testing, a unicast address) and port.
+	std::string group = "239.255.77.1";
+	unsigned port = 7789;
+	// Interface to send and join on; the routing table decides if empty.
+	std::string iface;
+	unsigned ttl = 1;
+	// Sender only.
+	unsigned rate_mbit = 100;
+	uint32_t chunk_size = 256 * 1024;
+	// Stop once nothing was asked for in this long; 0 serves forever.
+	unsigned linger_ms = 30000;
+	// Receiver only: give up when the sender is silent this long.
+	unsigned timeout_ms = 60000;
+};
+
+// Parses "ADDR[:PORT]" into |options|. Returns false if malformed.
+bool mcast_parse_group(const char *text, McastOptions *options);
+
+// Opens a non-blocking UDP socket. A receiver binds the group port and
+// joins the group; a sender binds an ephemeral port for NACKs and points
+// multicast at the chosen interface. |group| receives the destination.
+// Returns 0 or -errno.
+int mcast_open_socket(const McastOptions &options, bool receiver, UniqueFd *fd, struct sockaddr_in *group);
+
+} // namespace recovery
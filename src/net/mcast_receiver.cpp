@@ -0,0 +1,376 @@
+#include "net/mcast_receiver.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+const unsigned kTimerMs = 100;
+// NACKs are spread over this window after the sender goes idle.
+const unsigned kNackJitterMs = 500;
+const unsigned kNackHoldoffMs = 500;
+// Memory for chunks in flight; a sender streams them in order, so only a
+// few are ever open at once unless loss is heavy.
+const size_t kPartialBudget = 16 << 20;
+
+int pwrite_full(int fd, const uint8_t *buf, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pwrite(fd, buf + done, len - done, (off_t)(offset + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		done += (size_t)n;
+	}
+	return 0;
+}
+
+} // namespace
+
+McastReceiver::McastReceiver(EventLoop &loop, const McastOptions &options)
+	: m_loop(loop), m_options(options), m_random((unsigned)(monotonic_us() ^ (uint64_t)getpid()))
+{
+}
+
+McastReceiver::~McastReceiver()
+{
+	stop();
+}
+
+int McastReceiver::start(const char *path, const uint8_t *expect_root, ProgressFn progress, DoneFn done)
+{
+	m_out.reset(::open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+	if (!m_out) {
+		int err = -errno;
+		log_error("fleet: cannot open %s: %s", path, strerror(-err));
+		return err;
+	}
+	struct stat st;
+	m_out_is_file = fstat(m_out.get(), &st) == 0 && S_ISREG(st.st_mode);
+	if (expect_root) {
+		m_expect = true;
+		memcpy(m_expect_root, expect_root, sizeof(m_expect_root));
+	}
+
+	int ret = mcast_open_socket(m_options, true, &m_sock, &m_group);
+	if (ret < 0)
+		return ret;
+	ret = m_loop.add_fd(m_sock.get(), EPOLLIN, [this](uint32_t) { on_readable(); });
+	if (ret == 0) {
+		m_timer = m_loop.add_timer(kTimerMs, true, [this] { on_timer(); });
+		ret = std::min(m_timer, 0);
+	}
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+	m_progress = std::move(progress);
+	m_done = std::move(done);
+	m_last_packet_us = monotonic_us();
+	log_info("fleet: waiting for a sender on %s:%u", m_options.group.c_str(), m_options.port);
+	return 0;
+}
+
+void McastReceiver::stop()
+{
+	if (m_timer > 0)
+		m_loop.cancel_timer(m_timer);
+	m_timer = -1;
+	if (m_sock) {
+		m_loop.remove_fd(m_sock.get());
+		m_sock.reset();
+	}
+}
+
+void McastReceiver::on_readable()
+{
+	uint8_t buf[kMcastMaxPacket];
+	// Bounded so a flood cannot starve the rest of the loop.
+	for (unsigned i = 0; i < 1024 && m_sock; i++) {
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+		ssize_t n = recvfrom(m_sock.get(), buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		McastPacket packet;
+		if (!mcast_parse(buf, (size_t)n, &packet))
+			continue;
+		if (packet.type == McastType::Announce) {
+			on_announce(packet, from);
+			continue;
+		}
+		if (!m_joined || packet.session != m_session)
+			continue;
+		m_last_packet_us = monotonic_us();
+		m_stats.bytes_received += (uint64_t)n;
+		if (packet.type == McastType::Digests)
+			on_digests(packet);
+		else if (packet.type == McastType::Data)
+			on_data(packet);
+	}
+}
+
+void McastReceiver::on_announce(const McastPacket &packet, const struct sockaddr_in &from)
+{
+	const McastAnnounce &a = packet.announce;
+	if (m_joined && packet.session != m_session) {
+		// A restarted sender keeps its root; anything else is another
+		// image on the same group.
+		if (memcmp(a.root, m_announce.root, sizeof(a.root)))
+			return;
+		log_info("fleet: sender restarted, continuing");
+		m_session = packet.session;
+	}
+	if (!m_joined) {
+		if (m_expect && memcmp(a.root, m_expect_root, sizeof(a.root)))
+			return;
+		if (m_out_is_file) {
+			if (ftruncate(m_out.get(), (off_t)a.image_size) < 0) {
+				int err = -errno;
+				log_error("fleet: cannot size output: %s", strerror(-err));
+				finish(err);
+				return;
+			}
+		} else {
+			off_t capacity = lseek(m_out.get(), 0, SEEK_END);
+			if (capacity >= 0 && (uint64_t)capacity < a.image_size) {
+				log_error("fleet: image of %llu bytes does not fit in %lld", (unsigned long long)a.image_size,
+					  (long long)capacity);
+				finish(-ENOSPC);
+				return;
+			}
+		}
+		char hex[2 * Sha256::kDigestSize + 1];
+		sha256_to_hex(a.root, hex);
+		log_info("fleet: receiving %llu bytes in %u chunks, root %s", (unsigned long long)a.image_size,
+			 a.chunk_count, hex);
+		m_joined = true;
+		m_session = packet.session;
+		m_announce = a;
+		m_digests.assign((size_t)a.chunk_count * Sha256::kDigestSize, 0);
+		m_have_digest.assign(a.chunk_count, false);
+		m_have_chunk.assign(a.chunk_count, false);
+		m_max_partials = std::max<size_t>(4, kPartialBudget / a.chunk_size);
+		if (!a.chunk_count) {
+			m_digests_ok = true;
+			finish(0);
+			return;
+		}
+	}
+	m_sender = from;
+	m_sender_idle = a.idle;
+	m_last_packet_us = monotonic_us();
+}
+
+void McastReceiver::on_digests(const McastPacket &packet)
+{
+	if (m_digests_ok)
+		return;
+	size_t count = packet.payload_len / Sha256::kDigestSize;
+	if (packet.index >= m_announce.chunk_count || count > m_announce.chunk_count - packet.index)
+		return;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t index = packet.index + (uint32_t)i;
+		if (m_have_digest[index])
+			continue;
+		memcpy(&m_digests[(size_t)index * Sha256::kDigestSize], packet.payload + i * Sha256::kDigestSize,
+		       Sha256::kDigestSize);
+		m_have_digest[index] = true;
+		m_digest_count++;
+	}
+	if (m_digest_count < m_announce.chunk_count)
+		return;
+
+	uint8_t root[Sha256::kDigestSize];
+	mcast_digest_root(m_announce.image_size, m_announce.chunk_size, m_digests, root);
+	if (memcmp(root, m_announce.root, sizeof(root))) {
+		log_warning("fleet: digest table does not match the announced root, refetching");
+		m_have_digest.assign(m_announce.chunk_count, false);
+		m_digest_count = 0;
+		return;
+	}
+	log_debug("fleet: digest table verified");
+	m_digests_ok = true;
+	// Chunks that completed before the table did.
+	std::vector<uint32_t> ready;
+	for (const auto &entry : m_partials)
+		if (!entry.second.missing)
+			ready.push_back(entry.first);
+	for (uint32_t chunk : ready)
+		if (m_sock)
+			verify_chunk(chunk);
+}
+
+McastReceiver::Partial *McastReceiver::partial_for(uint32_t chunk)
+{
+	auto it = m_partials.find(chunk);
+	if (it != m_partials.end())
+		return &it->second;
+
+	if (m_partials.size() >= m_max_partials) {
+		// Drop the one idle longest; it is NACKed again later.
+		auto oldest = m_partials.begin();
+		for (auto i = m_partials.begin(); i != m_partials.end(); ++i)
+			if (i->second.touched_us < oldest->second.touched_us)
+				oldest = i;
+		m_partials.erase(oldest);
+	}
+	uint64_t offset = (uint64_t)chunk * m_announce.chunk_size;
+	size_t len = (size_t)std::min<uint64_t>(m_announce.chunk_size, m_announce.image_size - offset);
+	Partial &p = m_partials[chunk];
+	p.data.reset(new (std::nothrow) uint8_t[len]);
+	if (!p.data) {
+		m_partials.erase(chunk);
+		return nullptr;
+	}
+	p.missing = (len + kMcastFragmentSize - 1) / kMcastFragmentSize;
+	p.fragments.assign(p.missing, false);
+	return &p;
+}
+
+void McastReceiver::on_data(const McastPacket &packet)
+{
+	uint32_t chunk = packet.index;
+	if (chunk >= m_announce.chunk_count)
+		return;
+	if (m_have_chunk[chunk]) {
+		m_stats.duplicates++;
+		return;
+	}
+	uint64_t chunk_offset = (uint64_t)chunk * m_announce.chunk_size;
+	size_t chunk_len = (size_t)std::min<uint64_t>(m_announce.chunk_size, m_announce.image_size - chunk_offset);
+	if (packet.offset % kMcastFragmentSize || packet.offset >= chunk_len ||
+	    packet.payload_len != std::min(kMcastFragmentSize, chunk_len - packet.offset))
+		return;
+
+	Partial *p = partial_for(chunk);
+	if (!p)
+		return;
+	size_t fragment = packet.offset / kMcastFragmentSize;
+	p->touched_us = monotonic_us();
+	if (p->fragments[fragment]) {
+		m_stats.duplicates++;
+		return;
+	}
+	memcpy(p->data.get() + packet.offset, packet.payload, packet.payload_len);
+	p->fragments[fragment] = true;
+	if (--p->missing == 0 && m_digests_ok)
+		verify_chunk(chunk);
+}
+
+void McastReceiver::verify_chunk(uint32_t chunk)
+{
+	auto it = m_partials.find(chunk);
+	uint64_t offset = (uint64_t)chunk * m_announce.chunk_size;
+	size_t len = (size_t)std::min<uint64_t>(m_announce.chunk_size, m_announce.image_size - offset);
+	uint8_t digest[Sha256::kDigestSize];
+	Sha256::digest(it->second.data.get(), len, digest);
+	if (memcmp(digest, &m_digests[(size_t)chunk * Sha256::kDigestSize], sizeof(digest))) {
+		log_warning("fleet: chunk %u failed verification", chunk);
+		m_stats.bad_chunks++;
+		m_partials.erase(it);
+		return;
+	}
+	int ret = pwrite_full(m_out.get(), it->second.data.get(), len, offset);
+	m_partials.erase(it);
+	if (ret < 0) {
+		log_error("fleet: writing at %llu: %s", (unsigned long long)offset, strerror(-ret));
+		finish(ret);
+		return;
+	}
+	m_have_chunk[chunk] = true;
+	m_chunk_count++;
+	if (m_progress)
+		m_progress(m_chunk_count, m_announce.chunk_count);
+	if (m_chunk_count < m_announce.chunk_count)
+		return;
+
+	if (fsync(m_out.get()) < 0 && errno != EINVAL) {
+		int err = -errno;
+		log_error("fleet: sync: %s", strerror(-err));
+		finish(err);
+		return;
+	}
+	log_info("fleet: image complete, %llu bytes received, %llu duplicates, %llu NACKs sent",
+		 (unsigned long long)m_stats.bytes_received, (unsigned long long)m_stats.duplicates,
+		 (unsigned long long)m_stats.nacks_sent);
+	finish(0);
+}
+
+void McastReceiver::on_timer()
+{
+	uint64_t now = monotonic_us();
+	if (m_options.timeout_ms && now - m_last_packet_us > (uint64_t)m_options.timeout_ms * 1000) {
+		log_error("fleet: no sender heard for %u s", m_options.timeout_ms / 1000);
+		finish(-ETIMEDOUT);
+		return;
+	}
+	if (!m_joined || !m_sender_idle || now < m_next_nack_us)
+		return;
+	if (!m_nack_scheduled) {
+		// Sender just went idle: pick a random slot to answer in.
+		m_nack_scheduled = true;
+		m_next_nack_us = now + (m_random() % kNackJitterMs) * 1000;
+		return;
+	}
+	send_nack();
+	// Announces sent before our NACK arrived still say idle; only trust
+	// the ones after the hold-off.
+	m_nack_scheduled = false;
+	m_sender_idle = false;
+	m_next_nack_us = now + kNackHoldoffMs * 1000;
+}
+
+void McastReceiver::send_nack()
+{
+	// Digests first: a chunk cannot be checked without its digest.
+	const std::vector<bool> &have = m_digests_ok ? m_have_chunk : m_have_digest;
+	std::vector<McastRange> ranges;
+	for (uint32_t i = 0; i < have.size() && ranges.size() < kMcastMaxNackRanges;) {
+		if (have[i]) {
+			i++;
+			continue;
+		}
+		uint32_t first = i;
+		while (i < have.size() && !have[i])
+			i++;
+		ranges.push_back({ first, i - first });
+	}
+	if (ranges.empty())
+		return;
+	uint8_t buf[kMcastMaxPacket];
+	size_t len = mcast_encode_nack(buf, m_session, !m_digests_ok, ranges.data(), ranges.size());
+	if (sendto(m_sock.get(), buf, len, 0, (const struct sockaddr *)&m_sender, sizeof(m_sender)) < 0) {
+		log_debug("fleet: NACK: %s", strerror(errno));
+		return;
+	}
+	m_stats.nacks_sent++;
+	log_debug("fleet: asked for %zu %s ranges", ranges.size(), m_digests_ok ? "chunk" : "digest");
+}
+
+void McastReceiver::finish(int result)
+{
+	stop();
+	DoneFn done = std::move(m_done);
+	m_done = nullptr;
+	if (done)
+		done(result);
+}
+
+} // namespace recovery
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+#include "net/mcast_protocol.h"
+
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <random>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace recovery {
+
+// Receives an image from an McastSender into a file or block device,
+// driven by an EventLoop. Chunks arrive in any order and are written in
+// place only after their digest checks out. Whenever the sender reports
+// it is idle, the receiver NACKs just the digests or chunks it still
+// lacks, after a random delay so a whole site does not answer at once.
+class McastReceiver {
+public:
+	using ProgressFn = std::function<void(uint32_t have, uint32_t total)>;
+	// Called once on the loop thread: 0 when every chunk is written and
+	// synced, or -errno.
+	using DoneFn = std::function<void(int)>;
+
+	struct Stats {
+		uint64_t bytes_received = 0;
+		uint64_t duplicates = 0;
+		uint64_t bad_chunks = 0;
+		uint64_t nacks_sent = 0;
+	};
+
+	McastReceiver(EventLoop &loop, const McastOptions &options);
+	~McastReceiver();
+
+	McastReceiver(const McastReceiver &) = delete;
+	McastReceiver &operator=(const McastReceiver &) = delete;
+
+	// Writes the image to |path|. With |expect_root|, only a sender
+	// announcing that digest root is accepted; otherwise the first one
+	// heard is. Returns 0 or -errno.
+	int start(const char *path, const uint8_t *expect_root, ProgressFn progress, DoneFn done);
+	void stop();
+
+	uint64_t image_size() const { return m_announce.image_size; }
+	const Stats &stats() const { return m_stats; }
+
+private:
+	// A chunk still being assembled, or complete but waiting for the
+	// digest table.
+	struct Partial {
+		std::unique_ptr<uint8_t[]> data;
+		std::vector<bool> fragments;
+		size_t missing;
+		uint64_t touched_us;
+	};
+
+	void on_readable();
+	void on_timer();
+	void on_announce(const McastPacket &packet, const struct sockaddr_in &from);
+	void on_digests(const McastPacket &packet);
+	void on_data(const McastPacket &packet);
+	Partial *partial_for(uint32_t chunk);
+	void verify_chunk(uint32_t chunk);
+	void send_nack();
+	void finish(int result);
+
+	EventLoop &m_loop;
+	McastOptions m_options;
+	ProgressFn m_progress;
+	DoneFn m_done;
+	UniqueFd m_out;
+	bool m_out_is_file = false;
+	UniqueFd m_sock;
+	struct sockaddr_in m_group = {};
+	bool m_expect = false;
+	uint8_t m_expect_root[Sha256::kDigestSize] = {};
+
+	bool m_joined = false;
+	uint32_t m_session = 0;
+	struct sockaddr_in m_sender = {};
+	McastAnnounce m_announce;
+
+	std::vector<uint8_t> m_digests;
+	std::vector<bool> m_have_digest;
+	uint32_t m_digest_count = 0;
+	bool m_digests_ok = false;
+
+	std::vector<bool> m_have_chunk;
+	uint32_t m_chunk_count = 0;
+	std::unordered_map<uint32_t, Partial> m_partials;
+	size_t m_max_partials = 0;
+
+	int m_timer = -1;
+	uint64_t m_last_packet_us = 0;
+	bool m_sender_idle = false;
+	bool m_nack_scheduled = false;
+	uint64_t m_next_nack_us = 0;
+	std::minstd_rand m_random;
+	Stats m_stats;
+};
+
+} // namespace recovery
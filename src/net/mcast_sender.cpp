@@ -0,0 +1,341 @@
+#include "net/mcast_sender.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "crypto/tree_hash.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+const unsigned kTickMs = 2;
+const unsigned kAnnounceMs = 500;
+// Credit that may pile up between ticks; bounds the size of a burst.
+const double kMaxBurst = 64 * 1024;
+// IPv4 + UDP headers count against the rate too.
+const size_t kWireOverhead = 28;
+// Image data buffered while the chunk digests are computed.
+const size_t kHashBufferBytes = 64 << 20;
+
+ssize_t pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, buf + done, len - done, (off_t)(offset + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return -EIO; // the image shrank under us
+		done += (size_t)n;
+	}
+	return (ssize_t)done;
+}
+
+} // namespace
+
+McastSender::McastSender(EventLoop &loop, const McastOptions &options) : m_loop(loop), m_options(options)
+{
+}
+
+McastSender::~McastSender()
+{
+	stop();
+}
+
+int McastSender::start(const char *path, DoneFn done)
+{
+	m_image.reset(::open(path, O_RDONLY | O_CLOEXEC));
+	if (!m_image) {
+		int err = -errno;
+		log_error("fleet: cannot open %s: %s", path, strerror(-err));
+		return err;
+	}
+	off_t size = lseek(m_image.get(), 0, SEEK_END);
+	if (size < 0) {
+		int err = -errno;
+		log_error("fleet: cannot size %s: %s", path, strerror(-err));
+		return err;
+	}
+	uint32_t chunk_size = m_options.chunk_size;
+	if (chunk_size < kMcastMinChunkSize || chunk_size > kMcastMaxChunkSize)
+		return -EINVAL;
+	if (((uint64_t)size + chunk_size - 1) / chunk_size > kMcastMaxChunks) {
+		log_error("fleet: %s needs more than %u chunks of %u bytes", path, kMcastMaxChunks, chunk_size);
+		return -EFBIG;
+	}
+	m_announce.image_size = (uint64_t)size;
+	m_announce.chunk_size = chunk_size;
+	m_announce.chunk_count = (uint32_t)(((uint64_t)size + chunk_size - 1) / chunk_size);
+	m_chunk.reset(new (std::nothrow) uint8_t[chunk_size]);
+	if (!m_chunk)
+		return -ENOMEM;
+
+	int ret = hash_image();
+	if (ret < 0)
+		return ret;
+	char hex[2 * Sha256::kDigestSize + 1];
+	sha256_to_hex(m_announce.root, hex);
+	log_info("fleet: %s: %llu bytes in %u chunks, root %s", path, (unsigned long long)size,
+		 m_announce.chunk_count, hex);
+
+	ret = mcast_open_socket(m_options, false, &m_sock, &m_group);
+	if (ret < 0)
+		return ret;
+	if (getrandom(&m_session, sizeof(m_session), 0) != sizeof(m_session))
+		m_session = (uint32_t)(monotonic_us() ^ (uint64_t)getpid() << 16);
+
+	size_t digest_packets = (m_announce.chunk_count + kMcastDigestsPerPacket - 1) / kMcastDigestsPerPacket;
+	m_pending_digests.assign(digest_packets, true);
+	m_pending_digest_count = digest_packets;
+	m_pending_chunks.assign(m_announce.chunk_count, true);
+	m_pending_chunk_count = m_announce.chunk_count;
+
+	ret = m_loop.add_fd(m_sock.get(), EPOLLIN, [this](uint32_t) { on_readable(); });
+	if (ret == 0) {
+		m_tick_timer = m_loop.add_timer(kTickMs, true, [this] { on_tick(); });
+		m_announce_timer = m_loop.add_timer(kAnnounceMs, true, [this] { send_announce(); });
+		if (m_tick_timer < 0 || m_announce_timer < 0)
+			ret = std::min(m_tick_timer, m_announce_timer);
+	}
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+	m_done = std::move(done);
+	m_last_tick_us = m_last_request_us = monotonic_us();
+	send_announce();
+	return 0;
+}
+
+void McastSender::stop()
+{
+	if (m_tick_timer > 0)
+		m_loop.cancel_timer(m_tick_timer);
+	if (m_announce_timer > 0)
+		m_loop.cancel_timer(m_announce_timer);
+	m_tick_timer = m_announce_timer = -1;
+	if (m_sock) {
+		m_loop.remove_fd(m_sock.get());
+		m_sock.reset();
+	}
+}
+
+int McastSender::hash_image()
+{
+	uint64_t start = monotonic_us();
+	uint32_t chunk_size = m_announce.chunk_size;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	TreeHasher tree(chunk_size, cpus > 0 ? (unsigned)cpus : 1);
+
+	// Reading stays sequential; a few chunks in flight per worker keep
+	// every core hashing, within a fixed amount of memory.
+	size_t buffers = std::max<size_t>(2, std::min<size_t>(2 * tree.threads(), kHashBufferBytes / chunk_size));
+	std::vector<std::unique_ptr<uint8_t[]>> data(buffers);
+	std::unique_ptr<std::atomic<unsigned>[]> pending(new std::atomic<unsigned>[buffers]);
+	for (size_t i = 0; i < buffers; i++) {
+		data[i].reset(new (std::nothrow) uint8_t[chunk_size]);
+		if (!data[i])
+			return -ENOMEM;
+		pending[i] = 0;
+	}
+
+	posix_fadvise(m_image.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+	int ret = 0;
+	for (uint32_t i = 0; i < m_announce.chunk_count; i++) {
+		uint64_t offset = (uint64_t)i * chunk_size;
+		size_t len = (size_t)std::min<uint64_t>(chunk_size, m_announce.image_size - offset);
+		size_t slot = i % buffers;
+		tree.wait(&pending[slot]);
+		ssize_t n = pread_full(m_image.get(), data[slot].get(), len, offset);
+		if (n < 0) {
+			log_error("fleet: reading image at %llu: %s", (unsigned long long)offset, strerror((int)-n));
+			ret = (int)n;
+			break;
+		}
+		tree.update(data[slot].get(), len, &pending[slot]);
+	}
+	for (size_t i = 0; i < buffers; i++)
+		tree.wait(&pending[i]);
+	if (ret < 0)
+		return ret;
+	ret = tree.final(m_announce.root);
+	if (ret < 0)
+		return ret;
+	m_digests = tree.leaf_digests();
+	log_debug("fleet: hashed image in %llu ms on %u threads (%s)",
+		  (unsigned long long)((monotonic_us() - start) / 1000), tree.threads(), hash_engine_name());
+	return 0;
+}
+
+void McastSender::on_readable()
+{
+	uint8_t buf[kMcastMaxPacket];
+	for (;;) {
+		ssize_t n = recv(m_sock.get(), buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		McastPacket packet;
+		if (!mcast_parse(buf, (size_t)n, &packet) || packet.type != McastType::Nack ||
+		    packet.session != m_session)
+			continue;
+		m_stats.nacks++;
+		m_last_request_us = monotonic_us();
+		if (packet.nack_digests) {
+			// Ranges count digests; the queue is per packet of them.
+			std::vector<McastRange> packets;
+			for (const McastRange &r : packet.ranges) {
+				if (!r.count)
+					continue;
+				uint32_t first = r.first / kMcastDigestsPerPacket;
+				uint32_t last = (uint32_t)(((uint64_t)r.first + r.count - 1) / kMcastDigestsPerPacket);
+				packets.push_back({ first, last - first + 1 });
+			}
+			queue_ranges(m_pending_digests, &m_pending_digest_count, packets);
+		} else {
+			queue_ranges(m_pending_chunks, &m_pending_chunk_count, packet.ranges);
+		}
+	}
+}
+
+void McastSender::queue_ranges(std::vector<bool> &pending, size_t *count, const std::vector<McastRange> &ranges)
+{
+	for (const McastRange &r : ranges) {
+		uint64_t end = std::min<uint64_t>((uint64_t)r.first + r.count, pending.size());
+		for (uint64_t i = r.first; i < end; i++) {
+			if (!pending[i]) {
+				pending[i] = true;
+				(*count)++;
+			}
+		}
+	}
+}
+
+void McastSender::on_tick()
+{
+	uint64_t now = monotonic_us();
+	m_credit = std::min(kMaxBurst, m_credit + (double)(now - m_last_tick_us) * m_options.rate_mbit / 8);
+	m_last_tick_us = now;
+
+	bool busy = m_pending_digest_count || m_pending_chunk_count || m_fragment_offset < m_chunk_len;
+	while (busy && m_credit > 0) {
+		bool sent = m_pending_digest_count ? send_digests() : send_fragment();
+		if (!sent)
+			break;
+		busy = m_pending_digest_count || m_pending_chunk_count || m_fragment_offset < m_chunk_len;
+		if (!busy)
+			m_last_request_us = now; // lingering starts with the last repair
+	}
+	if (busy || !m_sock)
+		return;
+	// Idle time must not turn into one huge burst later.
+	m_credit = 0;
+	if (m_options.linger_ms && now - m_last_request_us >= (uint64_t)m_options.linger_ms * 1000) {
+		log_info("fleet: no requests for %u s, done: %llu bytes sent, %llu chunks, %llu nacks",
+			 m_options.linger_ms / 1000, (unsigned long long)m_stats.bytes_sent,
+			 (unsigned long long)m_stats.chunks_sent, (unsigned long long)m_stats.nacks);
+		finish(0);
+	}
+}
+
+void McastSender::send_announce()
+{
+	m_announce.idle = !m_pending_digest_count && !m_pending_chunk_count && m_fragment_offset >= m_chunk_len;
+	uint8_t buf[kMcastMaxPacket];
+	send_packet(buf, mcast_encode_announce(buf, m_session, m_announce));
+}
+
+bool McastSender::send_digests()
+{
+	while (!m_pending_digests[m_digest_cursor])
+		m_digest_cursor = (m_digest_cursor + 1) % m_pending_digests.size();
+	uint32_t first = (uint32_t)(m_digest_cursor * kMcastDigestsPerPacket);
+	size_t count = std::min<size_t>(kMcastDigestsPerPacket, m_announce.chunk_count - first);
+	uint8_t buf[kMcastMaxPacket];
+	size_t len = mcast_encode_digests(buf, m_session, first, &m_digests[(size_t)first * Sha256::kDigestSize],
+					  count);
+	if (!send_packet(buf, len))
+		return false;
+	m_pending_digests[m_digest_cursor] = false;
+	m_pending_digest_count--;
+	return true;
+}
+
+bool McastSender::send_fragment()
+{
+	if (m_fragment_offset >= m_chunk_len) {
+		while (!m_pending_chunks[m_chunk_cursor])
+			m_chunk_cursor = (m_chunk_cursor + 1) % m_announce.chunk_count;
+		// Cleared before sending, so a NACK that arrives meanwhile queues
+		// the chunk again rather than being absorbed by this copy.
+		m_pending_chunks[m_chunk_cursor] = false;
+		m_pending_chunk_count--;
+		m_chunk_index = m_chunk_cursor;
+		uint64_t offset = (uint64_t)m_chunk_index * m_announce.chunk_size;
+		size_t len = (size_t)std::min<uint64_t>(m_announce.chunk_size, m_announce.image_size - offset);
+		ssize_t n = pread_full(m_image.get(), m_chunk.get(), len, offset);
+		if (n < 0) {
+			log_error("fleet: reading image at %llu: %s", (unsigned long long)offset, strerror((int)-n));
+			finish((int)n);
+			return false;
+		}
+		m_chunk_len = len;
+		m_fragment_offset = 0;
+	}
+
+	size_t len = std::min(kMcastFragmentSize, m_chunk_len - m_fragment_offset);
+	uint8_t buf[kMcastMaxPacket];
+	size_t packet_len = mcast_encode_data(buf, m_session, m_chunk_index, (uint32_t)m_fragment_offset,
+					      m_chunk.get() + m_fragment_offset, len);
+	if (!send_packet(buf, packet_len))
+		return false;
+	m_fragment_offset += len;
+	if (m_fragment_offset == m_chunk_len)
+		m_stats.chunks_sent++;
+	return true;
+}
+
+bool McastSender::send_packet(const uint8_t *buf, size_t len)
+{
+	for (;;) {
+		ssize_t n = sendto(m_sock.get(), buf, len, 0, (const struct sockaddr *)&m_group, sizeof(m_group));
+		if (n >= 0)
+			break;
+		if (errno == EINTR)
+			continue;
+		// A full queue just delays the rest of this tick.
+		int err = errno;
+		if (err != EAGAIN && err != EWOULDBLOCK && err != ENOBUFS) {
+			log_error("fleet: send: %s", strerror(err));
+			finish(-err);
+		}
+		return false;
+	}
+	m_stats.bytes_sent += len;
+	m_credit -= (double)(len + kWireOverhead);
+	return true;
+}
+
+void McastSender::finish(int result)
+{
+	stop();
+	DoneFn done = std::move(m_done);
+	m_done = nullptr;
+	if (done)
+		done(result);
+}
+
+} // namespace recovery
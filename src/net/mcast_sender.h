@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "common/unique_fd.h"
+#include "net/mcast_protocol.h"
+
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <vector>
+
+namespace recovery {
+
+// Multicasts one image to every receiver on the LAN, driven by an
+// EventLoop. The first pass sends the digest table and then each chunk
+// once; after that only what receivers NACK is sent again, so a hundred
+// boxes cost the uplink one download and the LAN about one image plus
+// repairs. Sending is paced to |rate_mbit| since UDP has no congestion
+// control of its own.
+class McastSender {
+public:
+	// Called once on the loop thread: 0 after |linger_ms| without
+	// requests, or -errno.
+	using DoneFn = std::function<void(int)>;
+
+	struct Stats {
+		uint64_t bytes_sent = 0;
+		uint64_t chunks_sent = 0;
+		uint64_t nacks = 0;
+	};
+
+	McastSender(EventLoop &loop, const McastOptions &options);
+	~McastSender();
+
+	McastSender(const McastSender &) = delete;
+	McastSender &operator=(const McastSender &) = delete;
+
+	// Hashes |path| (a file or block device) and starts sending. Returns 0
+	// or -errno.
+	int start(const char *path, DoneFn done);
+	void stop();
+
+	const uint8_t *root() const { return m_announce.root; }
+	const Stats &stats() const { return m_stats; }
+
+private:
+	int hash_image();
+	void on_readable();
+	void on_tick();
+	void send_announce();
+	// Each sends one datagram; false once the socket is full.
+	bool send_digests();
+	bool send_fragment();
+	bool send_packet(const uint8_t *buf, size_t len);
+	void queue_ranges(std::vector<bool> &pending, size_t *count, const std::vector<McastRange> &ranges);
+	void finish(int result);
+
+	EventLoop &m_loop;
+	McastOptions m_options;
+	DoneFn m_done;
+	UniqueFd m_image;
+	UniqueFd m_sock;
+	struct sockaddr_in m_group = {};
+	uint32_t m_session = 0;
+	McastAnnounce m_announce;
+	std::vector<uint8_t> m_digests;
+
+	// What is still to go out; cursors sweep them round-robin.
+	std::vector<bool> m_pending_digests; // per packet of digests
+	std::vector<bool> m_pending_chunks;
+	size_t m_pending_digest_count = 0;
+	size_t m_pending_chunk_count = 0;
+	size_t m_digest_cursor = 0;
+	uint32_t m_chunk_cursor = 0;
+
+	// Chunk being fragmented; m_fragment_offset == m_chunk_len when none.
+	std::unique_ptr<uint8_t[]> m_chunk;
+	uint32_t m_chunk_index = 0;
+	size_t m_chunk_len = 0;
+	size_t m_fragment_offset = 0;
+
+	int m_tick_timer = -1;
+	int m_announce_timer = -1;
+	uint64_t m_last_tick_us = 0;
+	double m_credit = 0;
+	uint64_t m_last_request_us = 0;
+	Stats m_stats;
+};
+
+} // namespace recovery
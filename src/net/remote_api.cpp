@@ -0,0 +1,255 @@
+#include "net/remote_api.h"
+
+#include "common/log.h"
+#include "common/metrics.h"
+#include "platform/platform.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace recovery {
+
+namespace {
+
+// Major number of /dev/mtdN (linux/major.h).
+const unsigned kMtdCharMajor = 90;
+
+void append_number(std::string &out, const char *key, long long value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "\"%s\":%lld", key, value);
+	out += buf;
+}
+
+void error_body(HttpResponse &response, int status, const char *message)
+{
+	response.status = status;
+	response.body = "{\"error\":";
+	append_json_string(response.body, message);
+	response.body += "}";
+}
+
+// Resolves a target not in the partition table to the device node it
+// names: only block devices and MTD character devices qualify, so no path
+// (a symlink, "..") can lead to a regular file.
+bool resolve_device(const std::string &target, std::string *device)
+{
+	char resolved[PATH_MAX];
+	struct stat st;
+	if (!realpath(target.c_str(), resolved) || strncmp(resolved, "/dev/", 5) || stat(resolved, &st) < 0)
+		return false;
+	if (!S_ISBLK(st.st_mode) && !(S_ISCHR(st.st_mode) && major(st.st_rdev) == kMtdCharMajor))
+		return false;
+	*device = resolved;
+	return true;
+}
+
+} // namespace
+
+void serve_metrics(HttpServer &server)
+{
+	server.route("GET", "/metrics", [](const HttpRequest &, HttpResponse &response) {
+		response.content_type = "text/plain; version=0.0.4";
+		response.body = metrics_export_text();
+	});
+}
+
+RemoteApi::RemoteApi(EventLoop &loop, HttpServer &server, FlashJob &job)
+	: m_loop(loop), m_server(server), m_job(job)
+{
+	m_done.attach(loop, [this] { on_flash_done(); });
+
+	server.route("GET", "/api/status", [this](const HttpRequest &, HttpResponse &response) {
+		status_json(response.body);
+	});
+	server.route("GET", "/api/images", [this](const HttpRequest &, HttpResponse &response) {
+		images_json(response.body);
+	});
+	server.route("POST", "/api/flash", [this](const HttpRequest &request, HttpResponse &response) {
+		std::string image, target, delta;
+		if (!request.param("image", &image) || !request.param("target", &target)) {
+			error_body(response, 400, "image and target are required");
+			return;
+		}
+		FlashMode mode = m_mode;
+		if (request.param("delta", &delta)) {
+			if (delta != "0" && delta != "1") {
+				error_body(response, 400, "delta must be 0 or 1");
+				return;
+			}
+			mode = delta == "1" ? FlashMode::Delta : FlashMode::Full;
+		}
+		int ret = start_flash(image, target, mode);
+		if (ret == -EBUSY)
+			error_body(response, 409, "a flash is already running");
+		else if (ret == -ENOENT)
+			error_body(response, 404, "no such image or target");
+		else if (ret < 0)
+			error_body(response, 500, strerror(-ret));
+		else {
+			response.status = 202;
+			status_json(response.body);
+		}
+	});
+	server.route("POST", "/api/cancel", [this](const HttpRequest &, HttpResponse &response) {
+		if (m_job.state() != FlashState::Running) {
+			error_body(response, 409, "nothing is being flashed");
+			return;
+		}
+		m_job.cancel();
+		status_json(response.body);
+	});
+	server.stream("/api/events", [this](std::string &events) {
+		std::string status;
+		status_json(status);
+		HttpServer::format_event(events, "status", status);
+	});
+	serve_metrics(server);
+}
+
+RemoteApi::~RemoteApi()
+{
+	m_job.cancel();
+	m_job.wait();
+	if (m_timer > 0)
+		m_loop.cancel_timer(m_timer);
+}
+
+void RemoteApi::add_image(const ImageInfo &image)
+{
+	m_images.push_back(image);
+	if (!m_server.stream_clients())
+		return;
+	std::string data;
+	image_json(data, image);
+	m_server.publish("image", data);
+}
+
+int RemoteApi::start_flash(const std::string &image, const std::string &target, FlashMode mode)
+{
+	// Only what the scanner found, onto this box's own partitions: the API
+	// is not a way to write arbitrary files.
+	bool listed = false;
+	for (const ImageInfo &info : m_images)
+		listed |= info.path == image;
+	const platform::Partition *partition = platform::find_partition(target.c_str());
+	std::string device;
+	if (partition)
+		device = partition->device;
+	if (!listed || (!partition && !resolve_device(target, &device)))
+		return -ENOENT;
+
+	int ret = m_job.start(image, device, [this] { m_done.notify(); }, mode);
+	if (ret < 0) {
+		if (ret != -EBUSY)
+			log_error("http: cannot flash %s to %s: %s", image.c_str(), device.c_str(), strerror(-ret));
+		return ret;
+	}
+	m_last_bytes = ~0ull;
+	if (m_timer <= 0)
+		m_timer = m_loop.add_timer(kProgressMs, true, [this] { sample(); });
+	std::string status;
+	status_json(status);
+	m_server.publish("status", status);
+	return 0;
+}
+
+void RemoteApi::sample()
+{
+	if (!m_server.stream_clients())
+		return;
+	PipelineProgress p = m_job.progress();
+	uint64_t bytes = p.bytes[(int)Stage::Read] + p.bytes[(int)Stage::Write];
+	if (bytes == m_last_bytes)
+		return;
+	m_last_bytes = bytes;
+	std::string status;
+	status_json(status);
+	m_server.publish("progress", status);
+}
+
+void RemoteApi::on_flash_done()
+{
+	if (m_job.state() == FlashState::Running)
+		return;
+	if (m_timer > 0)
+		m_loop.cancel_timer(m_timer);
+	m_timer = 0;
+	std::string status;
+	status_json(status);
+	m_server.publish("status", status);
+}
+
+void RemoteApi::status_json(std::string &out) const
+{
+	FlashState state = m_job.state();
+	out += "{\"state\":";
+	append_json_string(out, flash_state_name(state));
+	if (state != FlashState::Idle) {
+		PipelineProgress p = m_job.progress();
+		out += ",\"image\":";
+		append_json_string(out, m_job.image());
+		out += ",\"target\":";
+		append_json_string(out, m_job.device());
+		out += ",\"compression\":";
+		append_json_string(out, compression_name(m_job.compression()));
+		out += ",\"delta\":";
+		out += m_job.mode() == FlashMode::Delta ? "true" : "false";
+		out += ',';
+		append_number(out, "read", (long long)p.bytes[(int)Stage::Read]);
+		out += ',';
+		append_number(out, "written", (long long)p.bytes[(int)Stage::Write]);
+		out += ',';
+		append_number(out, "size", (long long)p.source_size);
+		out += ',';
+		append_number(out, "elapsed_ms", (long long)(p.elapsed_us / 1000));
+		if (p.source_size > 0) {
+			out += ',';
+			append_number(out, "percent", (long long)(p.bytes[(int)Stage::Read] * 100 / (uint64_t)p.source_size));
+		}
+		if (state == FlashState::Failed) {
+			out += ",\"error\":";
+			append_json_string(out, strerror(-m_job.result()));
+		}
+	}
+	out += '}';
+}
+
+void RemoteApi::image_json(std::string &out, const ImageInfo &image) const
+{
+	out += "{\"path\":";
+	append_json_string(out, image.path);
+	out += ",\"root\":";
+	append_json_string(out, image.root);
+	out += ",\"name\":";
+	append_json_string(out, image.name);
+	out += ",\"version\":";
+	append_json_string(out, image.version);
+	out += ',';
+	append_number(out, "size", (long long)image.size);
+	out += ',';
+	append_number(out, "mtime", (long long)(image.mtime_ns / 1000000000));
+	out += ",\"compression\":";
+	append_json_string(out, compression_name(image.compression));
+	out += '}';
+}
+
+void RemoteApi::images_json(std::string &out) const
+{
+	out += '{';
+	append_number(out, "devices_pending", m_devices_pending);
+	out += ",\"images\":[";
+	for (size_t i = 0; i < m_images.size(); i++) {
+		if (i)
+			out += ',';
+		image_json(out, m_images[i]);
+	}
+	out += "]}";
+}
+
+} // namespace recovery
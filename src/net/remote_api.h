@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common/event_loop.h"
+#include "flash/flash_job.h"
+#include "net/http_server.h"
+#include "scan/image_scanner.h"
+
+#include <string>
+#include <vector>
+
+namespace recovery {
+
+// JSON control API for headless boxes, on top of an HttpServer:
+//
+//   GET  /api/status    what the flash job is doing
+//   GET  /api/images    images found so far
+//   POST /api/flash     image=PATH&target=PARTITION starts flashing;
+//                       &delta=1 writes only the blocks that changed,
+//                       &delta=0 all of them (default: set_flash_mode())
+//   POST /api/cancel    stops it
+//   GET  /api/events    server-sent events: "status" on connect and on
+//                       every state change, "progress" (the same object)
+//                       while flashing, "image" as the scanner finds them
+//   GET  /metrics       runtime metrics in the Prometheus text format
+//
+// Progress is sampled from the job's lock-free counters on a timer, only
+// while someone is listening, and each event is formatted once however
+// many clients there are; the flash threads never see the server.
+// Adds GET /metrics to |server|, e.g. one on a local socket for a node
+// exporter to scrape.
+void serve_metrics(HttpServer &server);
+
+class RemoteApi {
+public:
+	// Interval between progress events.
+	static const unsigned kProgressMs = 250;
+
+	RemoteApi(EventLoop &loop, HttpServer &server, FlashJob &job);
+	// Cancels a flash it started and waits for it.
+	~RemoteApi();
+
+	RemoteApi(const RemoteApi &) = delete;
+	RemoteApi &operator=(const RemoteApi &) = delete;
+
+	// Called on the loop thread as scan results come in.
+	void add_image(const ImageInfo &image);
+	void set_devices_pending(unsigned pending) { m_devices_pending = pending; }
+	// How flashes that do not ask for either mode are done.
+	void set_flash_mode(FlashMode mode) { m_mode = mode; }
+
+	// Starts a flash of a listed |image| onto |target|, a partition name
+	// or device of this box. Returns 0 or -errno.
+	int start_flash(const std::string &image, const std::string &target, FlashMode mode);
+
+private:
+	void status_json(std::string &out) const;
+	void images_json(std::string &out) const;
+	void image_json(std::string &out, const ImageInfo &image) const;
+	void sample();
+	void on_flash_done();
+
+	EventLoop &m_loop;
+	HttpServer &m_server;
+	FlashJob &m_job;
+	Notifier m_done;
+	std::vector<ImageInfo> m_images;
+	unsigned m_devices_pending = 0;
+	FlashMode m_mode = FlashMode::Full;
+	int m_timer = 0;
+	uint64_t m_last_bytes = ~0ull;
+};
+
+} // namespace recovery
@@ -0,0 +1,93 @@
+#include "net/url.h"
+
+#include <stdlib.h>
+#include <strings.h>
+
+namespace recovery {
+
+std::string Url::authority() const
+{
+	std::string h = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+	if (port != (tls ? 443u : 80u))
+		h += ":" + std::to_string(port);
+	return h;
+}
+
+std::string Url::str() const
+{
+	return (tls ? "https://" : "http://") + authority() + target;
+}
+
+bool parse_url(const std::string &text, Url *url)
+{
+	Url u;
+	size_t pos;
+	if (!strncasecmp(text.c_str(), "http://", 7)) {
+		pos = 7;
+	} else if (!strncasecmp(text.c_str(), "https://", 8)) {
+		u.tls = true;
+		u.port = 443;
+		pos = 8;
+	} else {
+		return false;
+	}
+
+	size_t end = text.find_first_of("/?#", pos);
+	std::string authority = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+	if (authority.find('@') != std::string::npos)
+		return false; // credentials in URLs are not supported
+
+	size_t colon;
+	if (!authority.empty() && authority[0] == '[') {
+		size_t close = authority.find(']');
+		if (close == std::string::npos)
+			return false;
+		u.host = authority.substr(1, close - 1);
+		colon = authority[close + 1] == ':' ? close + 1 : std::string::npos;
+	} else {
+		colon = authority.rfind(':');
+		u.host = authority.substr(0, colon);
+	}
+	if (colon != std::string::npos) {
+		char *tail;
+		unsigned long port = strtoul(authority.c_str() + colon + 1, &tail, 10);
+		if (*tail || !port || port > 65535)
+			return false;
+		u.port = (unsigned)port;
+	}
+	if (u.host.empty())
+		return false;
+
+	if (end != std::string::npos) {
+		u.target = text.substr(end);
+		size_t hash = u.target.find('#');
+		if (hash != std::string::npos)
+			u.target.erase(hash);
+		if (u.target.empty() || u.target[0] != '/')
+			u.target.insert(0, "/");
+	}
+	*url = u;
+	return true;
+}
+
+bool resolve_url(const Url &base, const std::string &location, Url *url)
+{
+	if (parse_url(location, url))
+		return true;
+	if (location.empty())
+		return false;
+
+	if (!location.compare(0, 2, "//"))
+		return parse_url((base.tls ? "https:" : "http:") + location, url);
+
+	*url = base;
+	if (location[0] == '/') {
+		url->target = location;
+	} else {
+		size_t slash = base.target.rfind('/', base.target.find('?'));
+		url->target = base.target.substr(0, slash + 1) + location;
+	}
+	return true;
+}
+
+} // namespace recovery
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+namespace recovery {
+
+// The parts of an http(s) URL needed to fetch it.
+struct Url {
+	bool tls = false;
+	std::string host;
+	unsigned port = 80;
+	// Path and query, always starting with '/'.
+	std::string target = "/";
+
+	// "host" or "host:port" as sent in the Host header.
+	std::string authority() const;
+	std::string str() const;
+};
+
+// Parses http://host[:port][/path] and https://..., including [v6]
+// literals. Returns false for anything else.
+bool parse_url(const std::string &text, Url *url);
+
+// Resolves a Location header against the URL it was received for.
+bool resolve_url(const Url &base, const std::string &location, Url *url);
+
+} // namespace recovery
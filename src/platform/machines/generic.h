@@ -0,0 +1,24 @@
+#pragma once
+
+// Included by platform/platform.h only.
+//
+// Any Linux box: no partition table, so tools take device paths, and the
+// sink is picked from the node name at run time. This is the default and
+// what desktop builds and the benches use.
+
+namespace recovery {
+namespace platform {
+
+struct Machine {
+	static constexpr const char *kName = "generic";
+	static constexpr Display kDisplay = { "/dev/fb0", 1280, 720 };
+	static constexpr std::array<Partition, 0> kPartitions = {};
+	static constexpr bool kHasMtd = true;
+	// Clusters from sysfs; the governor is left alone on desktops.
+	static constexpr SchedPolicy kSched = { 0, 0, 0, false };
+	// Flash journals go next to the image.
+	static constexpr const char *kJournal = nullptr;
+};
+
+} // namespace platform
+} // namespace recovery
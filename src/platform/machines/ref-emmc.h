@@ -0,0 +1,27 @@
+#pragma once
+
+// Included by platform/platform.h only.
+//
+// eMMC reference box: ARMv8 big.LITTLE (4x A53 on cpu0-3, 2x A72 on
+// cpu4-5), 8 GB eMMC with A/B root filesystems, 1080p.
+
+namespace recovery {
+namespace platform {
+
+struct Machine {
+	static constexpr const char *kName = "ref-emmc";
+	static constexpr Display kDisplay = { "/dev/fb0", 1920, 1080 };
+	static constexpr std::array<Partition, 5> kPartitions = { {
+		{ "boot", "/dev/mmcblk0p1", FlashType::Block },
+		{ "kernel", "/dev/mmcblk0p2", FlashType::Block },
+		{ "rootfs-a", "/dev/mmcblk0p3", FlashType::Block },
+		{ "rootfs-b", "/dev/mmcblk0p4", FlashType::Block },
+		{ "data", "/dev/mmcblk0p5", FlashType::Block },
+	} };
+	static constexpr bool kHasMtd = false;
+	static constexpr SchedPolicy kSched = { 0x30, 0x0f, 0, true };
+	static constexpr const char *kJournal = nullptr;
+};
+
+} // namespace platform
+} // namespace recovery
@@ -0,0 +1,27 @@
+#pragma once
+
+// Included by platform/platform.h only.
+//
+// NAND reference box: MIPS, 512 MB raw NAND split into MTD partitions with
+// UBI on the root filesystem, 720p.
+
+namespace recovery {
+namespace platform {
+
+struct Machine {
+	static constexpr const char *kName = "ref-nand";
+	static constexpr Display kDisplay = { "/dev/fb0", 1280, 720 };
+	static constexpr std::array<Partition, 3> kPartitions = { {
+		{ "bootloader", "/dev/mtd0", FlashType::Mtd },
+		{ "kernel", "/dev/mtd1", FlashType::Mtd },
+		{ "rootfs", "/dev/mtd2", FlashType::Mtd },
+	} };
+	static constexpr bool kHasMtd = true;
+	// One cluster; ondemand idles at the lowest clock, which caps ECC and
+	// decompression throughput.
+	static constexpr SchedPolicy kSched = { 0, 0, 0, true };
+	static constexpr const char *kJournal = nullptr;
+};
+
+} // namespace platform
+} // namespace recovery
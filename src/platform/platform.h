@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+namespace platform {
+
+enum class FlashType {
+	// eMMC, SD, USB and SATA disks: FileSink.
+	Block,
+	// Raw NAND/NOR behind /dev/mtdN: MtdSink.
+	Mtd,
+};
+
+struct Partition {
+	// What tools accept in place of a device, e.g. "rootfs".
+	const char *name;
+	const char *device;
+	FlashType flash;
+};
+
+struct Display {
+	const char *device;
+	// Used for file and "mem:" framebuffers; fbdev nodes report their own.
+	unsigned width;
+	unsigned height;
+};
+
+// Where flashing threads run and how hard the CPU is driven meanwhile; see
+// platform/sched.h. Bit N of a mask is cpuN. With both masks 0 the
+// clusters are told apart at run time by cpu_capacity or maximum clock,
+// and a box whose cores are all alike is left to the kernel.
+struct SchedPolicy {
+	// Decompression and hashing workers.
+	uint64_t big_cpus;
+	// The UI thread is kept on one of these, I/O threads anywhere on them.
+	uint64_t little_cpus;
+	// Best-effort I/O priority of the write stage, 0 (first) to 7.
+	unsigned writer_ioprio;
+	// Hold every cpufreq policy's minimum at its maximum while flashing,
+	// for governors that never ramp up on a recovery box's load.
+	bool boost_cpufreq;
+};
+
+constexpr bool str_equal(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+		a++, b++;
+	return *a == *b;
+}
+
+constexpr bool str_prefix(const char *s, const char *prefix)
+{
+	while (*prefix && *s == *prefix)
+		s++, prefix++;
+	return !*prefix;
+}
+
+} // namespace platform
+} // namespace recovery
+
+// The box this build is for, chosen with MACHINE= on the make command line.
+// Each header in platform/machines/ defines platform::Machine with:
+//
+//   kName        the MACHINE value
+//   kDisplay     framebuffer device and fallback geometry
+//   kPartitions  std::array<Partition, N> of what can be flashed or backed up
+//   kHasMtd      whether the box has raw flash at all
+//   kSched       SchedPolicy for flashing
+//   kJournal     reserved partition for the flash journal (see
+//                flash/flash_journal.h), or nullptr to keep it next to
+//                the image on the source
+//
+// Everything below is constexpr over it, so a box without raw NAND carries
+// no MTD paths and a table lookup of a literal costs nothing at run time.
+#ifndef RECOVERY_MACHINE_HEADER
+#define RECOVERY_MACHINE_HEADER "platform/machines/generic.h"
+#endif
+#include RECOVERY_MACHINE_HEADER
+
+namespace recovery {
+namespace platform {
+
+template <typename M>
+constexpr bool table_consistent()
+{
+	for (const Partition &p : M::kPartitions) {
+		if (p.flash == FlashType::Mtd && !M::kHasMtd)
+			return false;
+		for (const Partition &q : M::kPartitions)
+			if (&p != &q && str_equal(p.name, q.name))
+				return false;
+	}
+	return true;
+}
+static_assert(table_consistent<Machine>(), "partition names must be unique and MTD ones need kHasMtd");
+static_assert(!(Machine::kSched.big_cpus & Machine::kSched.little_cpus) && Machine::kSched.writer_ioprio <= 7,
+	      "big and little CPUs must not overlap; ioprio levels are 0-7");
+
+// The partition called |name| or living on |device|, or nullptr.
+template <typename M = Machine>
+constexpr const Partition *find_partition(const char *name)
+{
+	for (const Partition &p : M::kPartitions)
+		if (str_equal(p.name, name) || str_equal(p.device, name))
+			return &p;
+	return nullptr;
+}
+
+// How |device| is written: from the table, else by its node name on boxes
+// that have raw flash and as a block device or file on those that do not.
+template <typename M = Machine>
+constexpr FlashType flash_type(const char *device)
+{
+	if (const Partition *p = find_partition<M>(device))
+		return p->flash;
+	if constexpr (M::kHasMtd)
+		return str_prefix(device, "/dev/mtd") ? FlashType::Mtd : FlashType::Block;
+	else
+		return FlashType::Block;
+}
+
+} // namespace platform
+} // namespace recovery
@@ -0,0 +1,219 @@
+#include "platform/sched.h"
+
+#include "common/log.h"
+#include "platform/platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+// From linux/ioprio.h, which not every libc's headers carry.
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassShift = 13;
+const int kIoprioClassBestEffort = 2;
+const unsigned kIoprioLowest = 7;
+
+// Reads a small sysfs file, without its newline. Returns false if it
+// cannot be read.
+bool read_file(const std::string &path, std::string *out)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	char buf[64];
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+		n--;
+	out->assign(buf, (size_t)n);
+	return true;
+}
+
+int write_file(const std::string &path, const std::string &value)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	int ret = write(fd, value.data(), value.size()) == (ssize_t)value.size() ? 0 : -errno;
+	close(fd);
+	return ret;
+}
+
+void set_from_mask(cpu_set_t *set, uint64_t mask)
+{
+	CPU_ZERO(set);
+	for (int cpu = 0; cpu < 64; cpu++)
+		if (mask & (1ull << cpu))
+			CPU_SET(cpu, set);
+}
+
+std::string describe(const cpu_set_t &set)
+{
+	std::string out;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		if (!out.empty())
+			out += ',';
+		out += std::to_string(cpu);
+	}
+	return out;
+}
+
+const CpuTopology &topology()
+{
+	static const CpuTopology topology = [] {
+		const platform::SchedPolicy &policy = platform::Machine::kSched;
+		CpuTopology t;
+		if (policy.big_cpus || policy.little_cpus) {
+			set_from_mask(&t.big, policy.big_cpus);
+			set_from_mask(&t.little, policy.little_cpus);
+		} else {
+			t = detect_cpu_topology();
+		}
+		// Only CPUs that are there and that we may use; a kernel booted
+		// with fewer cores, or a cpuset, leaves one cluster or none.
+		cpu_set_t allowed;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+			CPU_AND(&t.big, &t.big, &allowed);
+			CPU_AND(&t.little, &t.little, &allowed);
+		}
+		t.split = CPU_COUNT(&t.big) && CPU_COUNT(&t.little);
+		if (t.split)
+			log_info("sched: big cpus %s, little cpus %s", describe(t.big).c_str(), describe(t.little).c_str());
+		return t;
+	}();
+	return topology;
+}
+
+void warn_once(std::atomic<bool> &warned, const char *what, int err)
+{
+	if (!warned.exchange(true))
+		log_debug("sched: cannot set %s: %s", what, strerror(err));
+}
+
+void set_affinity(const cpu_set_t &set)
+{
+	static std::atomic<bool> warned{ false };
+	if (CPU_COUNT(&set) && sched_setaffinity(0, sizeof(set), &set) < 0)
+		warn_once(warned, "affinity", errno);
+}
+
+void set_ioprio(unsigned level)
+{
+	static std::atomic<bool> warned{ false };
+	// For the calling thread: I/O priorities are per task.
+	int value = kIoprioClassBestEffort << kIoprioClassShift | (int)level;
+	if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, value) < 0)
+		warn_once(warned, "ioprio", errno);
+}
+
+} // namespace
+
+CpuTopology detect_cpu_topology(const char *root)
+{
+	CpuTopology t;
+	CPU_ZERO(&t.big);
+	CPU_ZERO(&t.little);
+	std::vector<unsigned long> speed;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		std::string base = std::string(root) + "/cpu" + std::to_string(cpu);
+		std::string value;
+		if (!read_file(base + "/cpu_capacity", &value) && !read_file(base + "/cpufreq/cpuinfo_max_freq", &value)) {
+			// Past the last CPU, or one that says nothing: no clusters.
+			if (access(base.c_str(), F_OK) == 0)
+				speed.clear();
+			break;
+		}
+		speed.push_back(strtoul(value.c_str(), nullptr, 10));
+	}
+	if (speed.empty())
+		return t;
+	unsigned long fastest = 0;
+	for (unsigned long s : speed)
+		fastest = std::max(fastest, s);
+	for (size_t cpu = 0; cpu < speed.size(); cpu++)
+		CPU_SET(cpu, speed[cpu] == fastest ? &t.big : &t.little);
+	t.split = CPU_COUNT(&t.little) > 0;
+	return t;
+}
+
+void sched_set_role(ThreadRole role)
+{
+	const CpuTopology &t = topology();
+	if (t.split) {
+		if (role == ThreadRole::Ui) {
+			// The last little one; interrupts mostly land on cpu0.
+			cpu_set_t one;
+			CPU_ZERO(&one);
+			for (int cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--) {
+				if (CPU_ISSET(cpu, &t.little)) {
+					CPU_SET(cpu, &one);
+					break;
+				}
+			}
+			set_affinity(one);
+		} else {
+			set_affinity(role == ThreadRole::Compute ? t.big : t.little);
+		}
+	}
+	if (role == ThreadRole::Writer)
+		set_ioprio(platform::Machine::kSched.writer_ioprio);
+	else if (role == ThreadRole::Background)
+		set_ioprio(kIoprioLowest);
+}
+
+unsigned CpufreqBoost::acquire()
+{
+	if (!platform::Machine::kSched.boost_cpufreq || active())
+		return (unsigned)m_saved.size();
+	DIR *dir = opendir(m_root.c_str());
+	if (!dir)
+		return 0;
+	while (struct dirent *entry = readdir(dir)) {
+		if (strncmp(entry->d_name, "policy", 6))
+			continue;
+		std::string base = m_root + "/" + entry->d_name;
+		Saved saved{ base + "/scaling_min_freq", {} };
+		std::string max_freq;
+		// The maximum as it stands, which a thermal or user cap may have
+		// lowered; raising the floor past it would fail.
+		if (!read_file(base + "/scaling_max_freq", &max_freq) || !read_file(saved.path, &saved.min_freq))
+			continue;
+		int ret = write_file(saved.path, max_freq);
+		if (ret < 0) {
+			log_debug("sched: cannot raise %s: %s", saved.path.c_str(), strerror(-ret));
+			continue;
+		}
+		m_saved.push_back(std::move(saved));
+	}
+	closedir(dir);
+	if (!m_saved.empty())
+		log_info("sched: %zu cpufreq polic%s at maximum clock", m_saved.size(), m_saved.size() == 1 ? "y" : "ies");
+	return (unsigned)m_saved.size();
+}
+
+void CpufreqBoost::release()
+{
+	for (const Saved &saved : m_saved) {
+		int ret = write_file(saved.path, saved.min_freq);
+		if (ret < 0)
+			log_warning("sched: cannot restore %s: %s", saved.path.c_str(), strerror(-ret));
+	}
+	m_saved.clear();
+}
+
+} // namespace recovery
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace recovery {
+
+// What a thread does, for placing it per the machine's SchedPolicy.
+enum class ThreadRole {
+	// The event loop: one little core, so workers never preempt it.
+	Ui,
+	// Decompression and hashing: the big cores.
+	Compute,
+	// Waits on a device or the network: the little cores.
+	Io,
+	// The flash write stage: an Io thread with the policy's I/O priority.
+	Writer,
+	// Scanning and previews: the little cores, lowest best-effort I/O
+	// priority so they never hold up a flash.
+	Background,
+};
+
+// The CPUs of each cluster, from the machine's SchedPolicy or sysfs.
+struct CpuTopology {
+	cpu_set_t big;
+	cpu_set_t little;
+	// Whether there are two clusters to tell apart at all.
+	bool split = false;
+};
+
+// Reads cpu_capacity, else cpuinfo_max_freq, of each CPU under |root|;
+// the fastest are big, the rest little.
+CpuTopology detect_cpu_topology(const char *root = "/sys/devices/system/cpu");
+
+// Places the calling thread for |role|. Threads inherit what their
+// creator had, so every thread that matters says what it is. Failing is
+// harmless (e.g. seccomp, no CAP_SYS_NICE) and only logged once.
+void sched_set_role(ThreadRole role);
+
+// Raises each cpufreq policy's scaling_min_freq to its cpuinfo_max_freq
+// while held, when the machine's policy asks for it, and puts back what
+// was there on release().
+class CpufreqBoost {
+public:
+	explicit CpufreqBoost(const char *root = "/sys/devices/system/cpu/cpufreq") : m_root(root) {}
+	~CpufreqBoost() { release(); }
+
+	CpufreqBoost(const CpufreqBoost &) = delete;
+	CpufreqBoost &operator=(const CpufreqBoost &) = delete;
+
+	// Returns the number of policies raised.
+	unsigned acquire();
+	void release();
+
+	bool active() const { return !m_saved.empty(); }
+
+private:
+	struct Saved {
+		std::string path;
+		std::string min_freq;
+	};
+
+	std::string m_root;
+	std::vector<Saved> m_saved;
+};
+
+} // namespace recovery
@@ -0,0 +1,233 @@
+// recovery-restore: unpacks a tarball (.tar, .tar.gz, .tar.zst, ...) onto
+// a partition, optionally formatting it first.
+//
+// Raw images are flashed as they are; this is for backups taken file by
+// file, which restore onto any partition size and filesystem. The archive
+// streams through the flash pipeline into an ExtractSink, so decoding,
+// hashing and file creation overlap (see flash/tar_extract.h).
+
+#include "common/event_loop.h"
+#include "common/log.h"
+#include "flash/pipeline.h"
+#include "flash/tar_extract.h"
+#include "platform/platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char **environ;
+
+using namespace recovery;
+
+namespace {
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] ARCHIVE TARGET\n"
+		"TARGET is a directory, or with --mkfs a device or partition of this box by\n"
+		"name, which is formatted and mounted for the restore.\n"
+		"  -t, --mkfs TYPE   format TARGET as ext4 or ubifs (a UBI volume) first\n"
+		"  -j, --threads N   file writer threads (default one per CPU)\n"
+		"  -v, --verbose     enable debug logging\n",
+		argv0);
+}
+
+double mib_per_s(uint64_t bytes, uint64_t us)
+{
+	return us ? bytes / 1048576.0 / (us / 1e6) : 0;
+}
+
+int run_tool(const char *const argv[])
+{
+	// The tool gets the signals our event loop has blocked.
+	posix_spawnattr_t attr;
+	sigset_t none;
+	sigemptyset(&none);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	pid_t pid;
+	int err = posix_spawnp(&pid, argv[0], nullptr, &attr, (char *const *)argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (err) {
+		log_error("restore: cannot run %s: %s", argv[0], strerror(err));
+		return -err;
+	}
+	int status;
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -errno;
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		log_error("restore: %s failed", argv[0]);
+		return -EIO;
+	}
+	return 0;
+}
+
+// An empty UBI volume is formatted by the first mount; ext4 needs mkfs.
+int format(const char *device, const char *type)
+{
+	log_info("restore: formatting %s as %s", device, type);
+	if (!strcmp(type, "ext4")) {
+		const char *argv[] = { "mkfs.ext4", "-F", "-q", device, nullptr };
+		return run_tool(argv);
+	}
+	const char *argv[] = { "ubiupdatevol", "-t", device, nullptr };
+	return run_tool(argv);
+}
+
+Compression detect_compression_file(const char *path)
+{
+	uint8_t head[kDetectBytes];
+	UniqueFd fd(open(path, O_RDONLY | O_CLOEXEC));
+	ssize_t n = fd ? pread(fd.get(), head, sizeof(head), 0) : -1;
+	Compression compression = detect_compression(head, n > 0 ? (size_t)n : 0);
+	// The tar stream itself is what the sink wants.
+	return compression == Compression::Tar ? Compression::Raw : compression;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "mkfs", required_argument, nullptr, 't' },
+		{ "threads", required_argument, nullptr, 'j' },
+		{ "verbose", no_argument, nullptr, 'v' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	ExtractOptions options;
+	const char *fs_type = nullptr;
+	int c;
+	while ((c = getopt_long(argc, argv, "t:j:vh", long_options, nullptr)) != -1) {
+		switch (c) {
+		case 't':
+			fs_type = optarg;
+			break;
+		case 'j':
+			options.threads = (unsigned)atoi(optarg);
+			break;
+		case 'v':
+			log_set_level(LogLevel::Debug);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || (fs_type && strcmp(fs_type, "ext4") && strcmp(fs_type, "ubifs"))) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *archive = argv[optind];
+	const char *target = argv[optind + 1];
+
+	// Signals are blocked and read from the loop, so this comes before the
+	// decoder and writer threads are started.
+	EventLoop loop;
+	if (!loop.valid())
+		return EXIT_FAILURE;
+	FlashPipeline *running = nullptr;
+	auto cancel = [&running] {
+		if (running)
+			running->cancel();
+	};
+	loop.add_signal(SIGTERM, cancel);
+	loop.add_signal(SIGINT, cancel);
+
+	FileSource source;
+	if (source.open(archive) < 0)
+		return EXIT_FAILURE;
+	std::unique_ptr<Decoder> decoder = make_decoder(detect_compression_file(archive));
+	if (!decoder)
+		return EXIT_FAILURE;
+
+	// The filesystem is mounted on a directory of our own until done.
+	std::string mountpoint;
+	if (fs_type) {
+		if (const platform::Partition *p = platform::find_partition(target))
+			target = p->device;
+		char dir[] = "/tmp/recovery-restore.XXXXXX";
+		if (format(target, fs_type) < 0)
+			return EXIT_FAILURE;
+		if (!mkdtemp(dir)) {
+			log_error("restore: cannot create a mount point: %s", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if (mount(target, dir, fs_type, MS_NOATIME, nullptr) < 0) {
+			log_error("restore: cannot mount %s: %s", target, strerror(errno));
+			rmdir(dir);
+			return EXIT_FAILURE;
+		}
+		mountpoint = dir;
+	}
+
+	int result;
+	{
+		// Closed before the unmount below.
+		ExtractSink sink(options);
+		result = sink.open(mountpoint.empty() ? target : mountpoint.c_str());
+		if (result == 0) {
+			FlashPipeline pipeline(source, *decoder, sink);
+			running = &pipeline;
+			unsigned last_percent = 0;
+			loop.add_timer(1000, true, [&] {
+				PipelineProgress p = pipeline.progress();
+				uint64_t done = p.bytes[(int)Stage::Read];
+				if (p.source_size <= 0) {
+					log_info("restore: %llu MiB", (unsigned long long)(done >> 20));
+					return;
+				}
+				unsigned percent = (unsigned)(done * 100 / (uint64_t)p.source_size);
+				if (percent / 10 != last_percent / 10)
+					log_info("restore: %u%%", percent);
+				last_percent = percent;
+			});
+
+			Notifier finished;
+			finished.attach(loop, [&loop] { loop.quit(); });
+			std::thread runner([&] {
+				result = pipeline.run();
+				finished.notify();
+			});
+			loop.run();
+			runner.join();
+			running = nullptr;
+
+			uint64_t us = pipeline.elapsed_us();
+			const ExtractStats &stats = sink.stats();
+			if (result == 0)
+				log_info("restore: %llu files, %llu directories, %llu links, %llu MiB in %.1f s "
+					 "(%.1f MiB/s), %u writer threads",
+					 (unsigned long long)stats.files, (unsigned long long)stats.dirs,
+					 (unsigned long long)stats.links, (unsigned long long)(stats.bytes >> 20), us / 1e6,
+					 mib_per_s(pipeline.stats(Stage::Write).bytes, us), sink.threads());
+		}
+	}
+
+	if (!mountpoint.empty()) {
+		if (umount2(mountpoint.c_str(), 0) < 0) {
+			log_error("restore: cannot unmount %s: %s", mountpoint.c_str(), strerror(errno));
+			if (!result)
+				result = -EBUSY;
+		} else {
+			rmdir(mountpoint.c_str());
+		}
+	}
+	return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
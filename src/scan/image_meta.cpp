@@ -0,0 +1,553 @@
+#include "scan/image_meta.h"
+
+#include "common/unique_fd.h"
+#include "crypto/sha256.h"
+#include "flash/container.h"
+#include "flash/tar_format.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace recovery {
+
+namespace {
+
+const uint32_t kZipEndMagic = 0x06054b50;
+const uint32_t kZipCentralMagic = 0x02014b50;
+const uint32_t kZipLocalMagic = 0x04034b50;
+const size_t kZipEndSize = 22;
+const size_t kZipCentralSize = 46;
+const size_t kZipLocalSize = 30;
+// The end record may be followed by a comment of up to 64 KiB.
+const size_t kZipEndSearch = kZipEndSize + 0xffff;
+const uint32_t kZipMaxDirectory = 1 << 20;
+const uint16_t kZipStored = 0;
+const uint16_t kZipDeflated = 8;
+// Compressed bytes inflated at most for a changelog.
+const size_t kMaxCompressedChangelog = 64 * 1024;
+
+const uint32_t kZstdMagic = 0xfd2fb528;
+const uint32_t kSquashfsMagic = 0x73717368;
+const uint16_t kExt4Magic = 0xef53;
+const size_t kExt4Superblock = 1024;
+
+// Headers looked at before giving up on finding a tar's first file, and
+// members walked looking for its changelog.
+const unsigned kTarMaxHeaders = 16;
+const unsigned kTarMaxMembers = 256;
+const size_t kTarMaxPax = 64 * 1024;
+
+const char *const kChangelogNames[] = { "changelog", "changelog.txt", "changelog.md", "news", "news.txt" };
+
+uint16_t le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+uint64_t le64(const uint8_t *p)
+{
+	return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+// Reads exactly |len| bytes at |offset|: 0, -EIO for a short read, or -errno.
+int read_at(int fd, void *buf, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, (uint8_t *)buf + done, len - done, (off_t)(offset + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return -EIO;
+		done += (size_t)n;
+	}
+	return 0;
+}
+
+bool is_changelog(const std::string &path)
+{
+	size_t slash = path.rfind('/');
+	const char *base = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+	for (const char *name : kChangelogNames)
+		if (!strcasecmp(base, name))
+			return true;
+	return false;
+}
+
+void to_hex(uint32_t value, std::string *out)
+{
+	char hex[9];
+	snprintf(hex, sizeof(hex), "%08x", value);
+	*out = hex;
+}
+
+// Zip timestamps are local time of the machine that made the archive,
+// which is the best there is.
+int64_t dos_time(uint16_t date, uint16_t time)
+{
+	struct tm tm = {};
+	tm.tm_year = ((date >> 9) & 0x7f) + 80;
+	tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+	tm.tm_mday = date & 0x1f;
+	tm.tm_hour = (time >> 11) & 0x1f;
+	tm.tm_min = (time >> 5) & 0x3f;
+	tm.tm_sec = (time & 0x1f) * 2;
+	return date ? (int64_t)timegm(&tm) : 0;
+}
+
+struct ZipEntry {
+	std::string name;
+	uint16_t method = 0;
+	uint32_t crc = 0;
+	uint32_t compressed = 0;
+	uint32_t size = 0;
+	int64_t mtime = 0;
+	uint32_t local_offset = 0;
+};
+
+// Lists a zip's central directory, found through the end record.
+int zip_entries(int fd, uint64_t file_size, std::vector<ZipEntry> *entries)
+{
+	size_t tail = (size_t)std::min<uint64_t>(file_size, kZipEndSearch);
+	if (tail < kZipEndSize)
+		return -EBADMSG;
+	std::vector<uint8_t> buf(tail);
+	int ret = read_at(fd, buf.data(), tail, file_size - tail);
+	if (ret < 0)
+		return ret;
+	const uint8_t *end = nullptr;
+	for (size_t i = tail - kZipEndSize + 1; i-- > 0;) {
+		if (le32(&buf[i]) == kZipEndMagic) {
+			end = &buf[i];
+			break;
+		}
+	}
+	if (!end)
+		return -EBADMSG;
+	uint32_t dir_size = le32(end + 12);
+	uint32_t dir_offset = le32(end + 16);
+	if (dir_size > kZipMaxDirectory || (uint64_t)dir_offset + dir_size > file_size)
+		return -EBADMSG;
+
+	std::vector<uint8_t> dir(dir_size);
+	ret = read_at(fd, dir.data(), dir_size, dir_offset);
+	if (ret < 0)
+		return ret;
+	for (size_t pos = 0; pos + kZipCentralSize <= dir.size();) {
+		const uint8_t *p = &dir[pos];
+		if (le32(p) != kZipCentralMagic)
+			return -EBADMSG;
+		size_t name_len = le16(p + 28);
+		size_t next = pos + kZipCentralSize + name_len + le16(p + 30) + le16(p + 32);
+		if (next > dir.size())
+			return -EBADMSG;
+		ZipEntry entry;
+		entry.name.assign((const char *)p + kZipCentralSize, name_len);
+		entry.method = le16(p + 10);
+		entry.mtime = dos_time(le16(p + 14), le16(p + 12));
+		entry.crc = le32(p + 16);
+		entry.compressed = le32(p + 20);
+		entry.size = le32(p + 24);
+		entry.local_offset = le32(p + 42);
+		entries->push_back(std::move(entry));
+		pos = next;
+	}
+	return 0;
+}
+
+// The image is the first file, as the zip decoder takes it.
+const ZipEntry *zip_image(const std::vector<ZipEntry> &entries)
+{
+	for (const ZipEntry &entry : entries)
+		if (!entry.name.empty() && entry.name.back() != '/')
+			return &entry;
+	return nullptr;
+}
+
+int zip_read_member(int fd, const ZipEntry &entry, std::string *out)
+{
+	uint8_t local[kZipLocalSize];
+	int ret = read_at(fd, local, sizeof(local), entry.local_offset);
+	if (ret < 0)
+		return ret;
+	if (le32(local) != kZipLocalMagic)
+		return -EBADMSG;
+	uint64_t data = (uint64_t)entry.local_offset + kZipLocalSize + le16(local + 26) + le16(local + 28);
+
+	if (entry.method == kZipStored) {
+		out->resize(std::min<size_t>(entry.size, kMaxChangelog));
+		return read_at(fd, &(*out)[0], out->size(), data);
+	}
+#ifdef HAVE_ZLIB
+	if (entry.method == kZipDeflated) {
+		std::vector<uint8_t> in(std::min<size_t>(entry.compressed, kMaxCompressedChangelog));
+		ret = read_at(fd, in.data(), in.size(), data);
+		if (ret < 0)
+			return ret;
+		z_stream stream = {};
+		if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+			return -ENOMEM;
+		out->resize(kMaxChangelog);
+		stream.next_in = in.data();
+		stream.avail_in = (uInt)in.size();
+		stream.next_out = (Bytef *)&(*out)[0];
+		stream.avail_out = (uInt)out->size();
+		int z = inflate(&stream, Z_SYNC_FLUSH);
+		out->resize(out->size() - stream.avail_out);
+		inflateEnd(&stream);
+		return z == Z_OK || z == Z_STREAM_END || z == Z_BUF_ERROR ? 0 : -EBADMSG;
+	}
+#endif
+	return -ENOTSUP;
+}
+
+// Calls |fn| with each member of a plain tar until it returns false or
+// |limit| are seen; |fn| gets the member and the offset of its data.
+template <typename Fn>
+int tar_walk(int fd, uint64_t file_size, unsigned limit, Fn fn)
+{
+	uint64_t pos = 0;
+	TarOverrides overrides;
+	uint8_t block[kTarBlock];
+	for (unsigned i = 0; i < limit && pos + kTarBlock <= file_size; i++) {
+		int ret = read_at(fd, block, sizeof(block), pos);
+		if (ret < 0)
+			return ret;
+		TarEntry entry;
+		ret = tar_parse_header(block, &entry);
+		if (ret <= 0)
+			return ret;
+		pos += kTarBlock;
+		if (entry.type == TarType::PaxHeader || entry.type == TarType::GnuLongName) {
+			if (entry.size > kTarMaxPax)
+				return -EBADMSG;
+			std::vector<uint8_t> data(entry.size);
+			ret = read_at(fd, data.data(), data.size(), pos);
+			if (ret < 0)
+				return ret;
+			if (entry.type == TarType::GnuLongName)
+				overrides.path.assign((const char *)data.data(), strnlen((const char *)data.data(), data.size()));
+			else if (tar_parse_pax(data.data(), data.size(), &overrides) < 0)
+				return -EBADMSG;
+		} else if (entry.type != TarType::PaxGlobal && entry.type != TarType::GnuLongLink) {
+			overrides.apply(&entry);
+			overrides.clear();
+			if (!fn(entry, pos))
+				return 0;
+		}
+		pos += entry.padded_size();
+	}
+	return 0;
+}
+
+int summary_raw(int fd, uint64_t file_size, ImageSummary *summary)
+{
+	summary->image_size = file_size;
+	uint8_t sb[kExt4Superblock * 2];
+	if (file_size < sizeof(sb) || read_at(fd, sb, sizeof(sb), 0) < 0)
+		return 0;
+	if (le32(sb) == kSquashfsMagic) {
+		summary->build_time = le32(sb + 8);
+	} else if (le16(sb + kExt4Superblock + 0x38) == kExt4Magic) {
+		// When mkfs ran, or failing that the last write.
+		uint32_t mkfs = le32(sb + kExt4Superblock + 0x108);
+		summary->build_time = mkfs ? mkfs : le32(sb + kExt4Superblock + 0x30);
+	}
+	return 0;
+}
+
+int summary_gzip(int fd, uint64_t file_size, ImageSummary *summary)
+{
+	uint8_t head[10], tail[4];
+	int ret = read_at(fd, head, sizeof(head), 0);
+	if (ret == 0 && file_size >= sizeof(head) + sizeof(tail))
+		ret = read_at(fd, tail, sizeof(tail), file_size - sizeof(tail));
+	if (ret < 0)
+		return ret;
+	if (head[0] != 0x1f || head[1] != 0x8b)
+		return 0;
+	summary->build_time = le32(head + 4);
+	// ISIZE is the size modulo 4 GiB: one well below the file's has
+	// wrapped (deflate grows incompressible data by a fraction of a
+	// percent). Images over 4 GiB are rarely gzipped, and one that wrapped
+	// to more than its compressed size shows short.
+	uint32_t isize = le32(tail);
+	if (isize >= file_size - file_size / 64)
+		summary->image_size = isize;
+	return 0;
+}
+
+bool read_varint(const std::vector<uint8_t> &buf, size_t *pos, uint64_t *value)
+{
+	*value = 0;
+	for (unsigned shift = 0; shift < 63 && *pos < buf.size(); shift += 7) {
+		uint8_t b = buf[(*pos)++];
+		*value |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// Sums the uncompressed sizes in the index before the stream footer,
+// provided the file is that one stream.
+int summary_xz(int fd, uint64_t file_size, ImageSummary *summary)
+{
+	const size_t kHeader = 12, kFooter = 12;
+	uint8_t footer[kFooter];
+	if (file_size < kHeader + kFooter)
+		return 0;
+	int ret = read_at(fd, footer, sizeof(footer), file_size - kFooter);
+	if (ret < 0)
+		return ret;
+	if (footer[10] != 'Y' || footer[11] != 'Z')
+		return 0;
+	uint64_t index_size = ((uint64_t)le32(footer + 4) + 1) * 4;
+	if (index_size > kZipMaxDirectory || index_size + kHeader + kFooter > file_size)
+		return 0;
+	std::vector<uint8_t> index((size_t)index_size);
+	ret = read_at(fd, index.data(), index.size(), file_size - kFooter - index_size);
+	if (ret < 0)
+		return ret;
+	size_t pos = 1;
+	uint64_t records, blocks = 0, size = 0;
+	if (index[0] != 0 || !read_varint(index, &pos, &records))
+		return 0;
+	for (uint64_t i = 0; i < records; i++) {
+		uint64_t unpadded, uncompressed;
+		if (!read_varint(index, &pos, &unpadded) || !read_varint(index, &pos, &uncompressed))
+			return 0;
+		blocks += (unpadded + 3) & ~3ull;
+		size += uncompressed;
+	}
+	if (kHeader + blocks + index_size + kFooter == file_size)
+		summary->image_size = size;
+	return 0;
+}
+
+// The frame's content size, which zstd writes for a single frame even
+// with -T; concatenated frames are not walked.
+int summary_zstd(int fd, ImageSummary *summary)
+{
+	uint8_t head[18];
+	int ret = read_at(fd, head, sizeof(head), 0);
+	if (ret < 0)
+		return ret == -EIO ? 0 : ret;
+	if (le32(head) != kZstdMagic)
+		return 0;
+	uint8_t fhd = head[4];
+	bool single_segment = fhd & 0x20;
+	static const size_t kDictSize[] = { 0, 1, 2, 4 };
+	size_t pos = 5 + (single_segment ? 0 : 1) + kDictSize[fhd & 3];
+	switch (fhd >> 6) {
+	case 0:
+		if (single_segment)
+			summary->image_size = head[pos];
+		break;
+	case 1:
+		summary->image_size = le16(head + pos) + 256;
+		break;
+	case 2:
+		summary->image_size = le32(head + pos);
+		break;
+	case 3:
+		summary->image_size = le64(head + pos);
+		break;
+	}
+	return 0;
+}
+
+int summary_container(int fd, ImageSummary *summary, ImageDetails *details)
+{
+	ContainerHeader header;
+	int ret = read_at(fd, &header, sizeof(header), 0);
+	if (ret < 0)
+		return ret;
+	if (container_index_size((const uint8_t *)&header, sizeof(header)) <= 0)
+		return 0;
+	if (summary)
+		summary->image_size = header.image_size;
+	if (details) {
+		char hex[2 * Sha256::kDigestSize + 1];
+		sha256_to_hex(header.root, hex);
+		details->checksum_kind = "tree-sha256";
+		details->checksum = hex;
+	}
+	return 0;
+}
+
+// A sidecar file next to the image: PATH.sha256 as sha256sum writes it,
+// PATH.changelog as is.
+void read_sidecars(const char *path, ImageDetails *details)
+{
+	std::string base = path;
+	if (details->checksum.empty()) {
+		UniqueFd fd(open((base + ".sha256").c_str(), O_RDONLY | O_CLOEXEC));
+		char line[2 * Sha256::kDigestSize + 1];
+		uint8_t digest[Sha256::kDigestSize];
+		if (fd && read(fd.get(), line, sizeof(line) - 1) == (ssize_t)sizeof(line) - 1) {
+			line[sizeof(line) - 1] = '\0';
+			if (sha256_from_hex(line, digest)) {
+				details->checksum_kind = "sha256";
+				details->checksum = line;
+			}
+		}
+	}
+	if (details->changelog.empty()) {
+		UniqueFd fd(open((base + ".changelog").c_str(), O_RDONLY | O_CLOEXEC));
+		if (fd) {
+			details->changelog.resize(kMaxChangelog);
+			ssize_t n = read(fd.get(), &details->changelog[0], kMaxChangelog);
+			details->changelog.resize(n > 0 ? (size_t)n : 0);
+		}
+	}
+}
+
+bool ends_with(const std::string &s, const char *suffix)
+{
+	size_t n = strlen(suffix);
+	return s.size() > n && !strcasecmp(s.c_str() + s.size() - n, suffix);
+}
+
+} // namespace
+
+void parse_image_name(const char *file_name, std::string *name, std::string *version)
+{
+	static const char *const kCompressed[] = { ".gz", ".xz", ".zst", ".bz2", ".tar", ".zip" };
+	static const char *const kImages[] = { ".img", ".bin", ".ubi", ".ext4", ".wic", ".sdcard", ".squashfs", ".ruic" };
+
+	const char *slash = strrchr(file_name, '/');
+	std::string stem = slash ? slash + 1 : file_name;
+	for (const char *suffix : kCompressed) {
+		if (ends_with(stem, suffix)) {
+			stem.resize(stem.size() - strlen(suffix));
+			break;
+		}
+	}
+	for (const char *suffix : kImages) {
+		if (ends_with(stem, suffix)) {
+			stem.resize(stem.size() - strlen(suffix));
+			break;
+		}
+	}
+
+	size_t split = std::string::npos;
+	for (size_t i = 1; i + 1 < stem.size() && split == std::string::npos; i++) {
+		const char *p = stem.c_str() + i;
+		if ((p[0] == '-' || p[0] == '_') && (isdigit((unsigned char)p[1]) || (p[1] == 'v' && isdigit((unsigned char)p[2]))))
+			split = i;
+	}
+	*name = stem.substr(0, split);
+	*version = split == std::string::npos ? std::string() : stem.substr(split + 1);
+}
+
+int read_image_summary(const char *path, Compression compression, ImageSummary *summary)
+{
+	UniqueFd fd(open(path, O_RDONLY | O_CLOEXEC));
+	struct stat st;
+	if (!fd || fstat(fd.get(), &st) < 0)
+		return -errno;
+	uint64_t file_size = (uint64_t)st.st_size;
+	*summary = ImageSummary();
+
+	switch (compression) {
+	case Compression::Raw:
+		return summary_raw(fd.get(), file_size, summary);
+	case Compression::Gzip:
+		return summary_gzip(fd.get(), file_size, summary);
+	case Compression::Xz:
+		return summary_xz(fd.get(), file_size, summary);
+	case Compression::Zstd:
+		return summary_zstd(fd.get(), summary);
+	case Compression::Bzip2:
+		return 0;
+	case Compression::Container:
+		return summary_container(fd.get(), summary, nullptr);
+	case Compression::Tar:
+		return tar_walk(fd.get(), file_size, kTarMaxHeaders, [&](const TarEntry &entry, uint64_t) {
+			if (entry.type != TarType::File)
+				return true;
+			summary->image_size = entry.size;
+			summary->build_time = entry.mtime;
+			return false;
+		});
+	case Compression::Zip: {
+		std::vector<ZipEntry> entries;
+		int ret = zip_entries(fd.get(), file_size, &entries);
+		const ZipEntry *image = ret == 0 ? zip_image(entries) : nullptr;
+		if (image) {
+			summary->build_time = image->mtime;
+			// Zip64 sizes are not looked for.
+			if (image->size != 0xffffffff)
+				summary->image_size = image->size;
+		}
+		return ret == -EBADMSG ? 0 : ret;
+	}
+	}
+	return 0;
+}
+
+int read_image_details(const char *path, Compression compression, ImageDetails *details)
+{
+	UniqueFd fd(open(path, O_RDONLY | O_CLOEXEC));
+	struct stat st;
+	if (!fd || fstat(fd.get(), &st) < 0)
+		return -errno;
+	uint64_t file_size = (uint64_t)st.st_size;
+	*details = ImageDetails();
+
+	int ret = 0;
+	if (compression == Compression::Container) {
+		ret = summary_container(fd.get(), nullptr, details);
+	} else if (compression == Compression::Zip) {
+		std::vector<ZipEntry> entries;
+		ret = zip_entries(fd.get(), file_size, &entries);
+		if (const ZipEntry *image = ret == 0 ? zip_image(entries) : nullptr) {
+			details->checksum_kind = "crc32";
+			to_hex(image->crc, &details->checksum);
+		}
+		for (const ZipEntry &entry : entries) {
+			if (is_changelog(entry.name)) {
+				// What cannot be read just leaves the changelog out.
+				if (zip_read_member(fd.get(), entry, &details->changelog) < 0)
+					details->changelog.clear();
+				break;
+			}
+		}
+	} else if (compression == Compression::Tar) {
+		std::string &changelog = details->changelog;
+		ret = tar_walk(fd.get(), file_size, kTarMaxMembers, [&](const TarEntry &entry, uint64_t data) {
+			if (entry.type != TarType::File || !is_changelog(entry.path))
+				return true;
+			changelog.resize((size_t)std::min<uint64_t>(entry.size, kMaxChangelog));
+			if (read_at(fd.get(), &changelog[0], changelog.size(), data) < 0)
+				changelog.clear();
+			return false;
+		});
+	}
+	if (ret == -EBADMSG)
+		ret = 0;
+	if (ret < 0)
+		return ret;
+	read_sidecars(path, details);
+	return 0;
+}
+
+} // namespace recovery
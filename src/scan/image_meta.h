@@ -0,0 +1,49 @@
+#pragma once
+
+#include "flash/decoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace recovery {
+
+// What the image list shows of an image, read from the few bytes that
+// carry it: the archive's central directory (zip), its first member's
+// header (tar), the container index (ruic), the compressor's header and
+// trailer (gz, xz, zst), or the filesystem superblock of a raw image. No
+// image is ever decompressed for it.
+struct ImageSummary {
+	// Seconds since the epoch, 0 if the image does not say.
+	int64_t build_time = 0;
+	// Size once decompressed, 0 if unknown without decompressing.
+	uint64_t image_size = 0;
+};
+
+// Extended details, read on demand for the image under the cursor.
+struct ImageDetails {
+	// "sha256", "tree-sha256" or "crc32", and its value in hex; empty if
+	// the image carries none.
+	std::string checksum_kind;
+	std::string checksum;
+	// Start of the changelog: a CHANGELOG (or NEWS) member of a zip or tar
+	// archive, else a PATH.changelog file next to the image.
+	std::string changelog;
+
+	// Memory held, for the cache's budget.
+	size_t bytes() const { return sizeof(*this) + checksum.size() + changelog.size(); }
+};
+
+// Longest changelog kept; the screen only shows its first lines.
+const size_t kMaxChangelog = 4096;
+
+// Splits a file name like "rootfs-2.4.1.img.xz" into "rootfs" and "2.4.1":
+// the version is what follows the first '-' or '_' before a digit (or 'v'
+// and a digit), once the image and compression extensions are dropped.
+void parse_image_name(const char *file_name, std::string *name, std::string *version);
+
+// Both return 0 or -errno; a format that carries nothing is not an error.
+int read_image_summary(const char *path, Compression compression, ImageSummary *summary);
+int read_image_details(const char *path, Compression compression, ImageDetails *details);
+
+} // namespace recovery
@@ -0,0 +1,137 @@
+#include "scan/image_preview.h"
+
+#include "common/log.h"
+#include "common/trace.h"
+#include "platform/sched.h"
+
+#include <string.h>
+
+namespace recovery {
+
+ImagePreview::ImagePreview(size_t cache_bytes) : m_cache_bytes(cache_bytes)
+{
+}
+
+ImagePreview::~ImagePreview()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void ImagePreview::start(ReadyFn on_ready)
+{
+	m_on_ready = std::move(on_ready);
+	m_thread = std::thread(&ImagePreview::worker, this);
+}
+
+void ImagePreview::want(std::vector<Request> summaries, const Request *details)
+{
+	bool want_details = details && !this->details(details->path, details->mtime_ns);
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_summaries = std::move(summaries);
+		m_want_details = want_details;
+		if (want_details)
+			m_details = *details;
+	}
+	m_wake.notify_one();
+}
+
+std::vector<ImagePreview::Result> ImagePreview::take()
+{
+	std::vector<Result> results;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		results.swap(m_results);
+	}
+	for (const Result &result : results)
+		if (result.details)
+			cache(result);
+	return results;
+}
+
+std::shared_ptr<const ImageDetails> ImagePreview::details(const std::string &path, int64_t mtime_ns)
+{
+	auto it = m_by_path.find(path);
+	if (it == m_by_path.end() || it->second->mtime_ns != mtime_ns)
+		return nullptr;
+	m_lru.splice(m_lru.begin(), m_lru, it->second);
+	return it->second->details;
+}
+
+void ImagePreview::cache(const Result &result)
+{
+	auto it = m_by_path.find(result.path);
+	if (it != m_by_path.end()) {
+		m_cached_bytes -= it->second->details->bytes();
+		m_lru.erase(it->second);
+		m_by_path.erase(it);
+	}
+	m_lru.push_front(Entry{ result.path, result.mtime_ns, result.details });
+	m_by_path[result.path] = m_lru.begin();
+	m_cached_bytes += result.details->bytes();
+	// The newest entry stays even if it alone is over budget.
+	while (m_cached_bytes > m_cache_bytes && m_lru.size() > 1) {
+		const Entry &old = m_lru.back();
+		m_cached_bytes -= old.details->bytes();
+		m_by_path.erase(old.path);
+		m_lru.pop_back();
+	}
+}
+
+void ImagePreview::worker()
+{
+	TRACE_THREAD_NAME("preview");
+	sched_set_role(ThreadRole::Background);
+	std::unique_lock<std::mutex> lock(m_lock);
+	for (;;) {
+		m_wake.wait(lock, [this] { return m_stop || m_want_details || !m_summaries.empty(); });
+		if (m_stop)
+			break;
+
+		Result result;
+		Request request;
+		if (m_want_details) {
+			request = std::move(m_details);
+			m_want_details = false;
+		} else {
+			request = std::move(m_summaries.front());
+			m_summaries.erase(m_summaries.begin());
+			result.has_summary = true;
+		}
+		lock.unlock();
+
+		result.path = request.path;
+		result.mtime_ns = request.mtime_ns;
+		int ret;
+		if (result.has_summary) {
+			TRACE_SCOPE("preview", "summary");
+			ret = read_image_summary(request.path.c_str(), request.compression, &result.summary);
+		} else {
+			TRACE_SCOPE("preview", "details");
+			auto details = std::make_shared<ImageDetails>();
+			ret = read_image_details(request.path.c_str(), request.compression, details.get());
+			result.details = std::move(details);
+		}
+		// An unreadable image still gets a result, so it is not asked for
+		// again and again; it just shows nothing more.
+		if (ret < 0)
+			log_debug("preview: cannot read %s: %s", request.path.c_str(), strerror(-ret));
+
+		lock.lock();
+		bool first = m_results.empty();
+		m_results.push_back(std::move(result));
+		if (first && m_on_ready) {
+			lock.unlock();
+			m_on_ready();
+			lock.lock();
+		}
+	}
+}
+
+} // namespace recovery
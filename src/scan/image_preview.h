@@ -0,0 +1,95 @@
+#pragma once
+
+#include "scan/image_meta.h"
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace recovery {
+
+// Fills in what the image list shows beyond the file names, on a thread
+// of its own so a slow stick never stalls the UI: summaries of the rows
+// on screen and the details of the one under the cursor. Each want()
+// replaces what is still waiting, so scrolling past images never reads
+// them. Details are kept for the most recently shown images, up to a
+// memory budget; summaries are small and the list keeps them itself.
+class ImagePreview {
+public:
+	static const size_t kDefaultCacheBytes = 256 * 1024;
+
+	struct Request {
+		std::string path;
+		int64_t mtime_ns = 0;
+		Compression compression = Compression::Raw;
+	};
+
+	struct Result {
+		std::string path;
+		int64_t mtime_ns = 0;
+		// For a summary request; otherwise |details| is set.
+		bool has_summary = false;
+		ImageSummary summary;
+		std::shared_ptr<const ImageDetails> details;
+	};
+
+	// Called on the worker thread when results are waiting.
+	using ReadyFn = std::function<void()>;
+
+	explicit ImagePreview(size_t cache_bytes = kDefaultCacheBytes);
+	// Stops the worker once it is done with the image in hand.
+	~ImagePreview();
+
+	ImagePreview(const ImagePreview &) = delete;
+	ImagePreview &operator=(const ImagePreview &) = delete;
+
+	void start(ReadyFn on_ready);
+
+	// The rest are for the UI thread.
+
+	// Replaces the waiting requests with summaries of |summaries| and,
+	// ahead of them, the details of |details| unless they are cached.
+	void want(std::vector<Request> summaries, const Request *details);
+	// Finished results, oldest first; their details join the cache.
+	std::vector<Result> take();
+	// Cached details of |path| as it was at |mtime_ns|, or null.
+	std::shared_ptr<const ImageDetails> details(const std::string &path, int64_t mtime_ns);
+
+	size_t cached() const { return m_lru.size(); }
+	size_t cached_bytes() const { return m_cached_bytes; }
+
+private:
+	struct Entry {
+		std::string path;
+		int64_t mtime_ns;
+		std::shared_ptr<const ImageDetails> details;
+	};
+
+	void worker();
+	void cache(const Result &result);
+
+	size_t m_cache_bytes;
+	ReadyFn m_on_ready;
+	std::thread m_thread;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::vector<Request> m_summaries;
+	bool m_want_details = false;
+	Request m_details;
+	std::vector<Result> m_results;
+	bool m_stop = false;
+
+	// Most recently used first.
+	std::list<Entry> m_lru;
+	std::unordered_map<std::string, std::list<Entry>::iterator> m_by_path;
+	size_t m_cached_bytes = 0;
+};
+
+} // namespace recovery
@@ -0,0 +1,311 @@
+#include "scan/image_scanner.h"
+
+#include "common/clock.h"
+#include "common/log.h"
+#include "common/trace.h"
+#include "platform/sched.h"
+#include "scan/image_meta.h"
+#include "scan/manifest.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unordered_set>
+
+namespace recovery {
+
+namespace {
+
+int64_t mtime_ns(const struct stat &st)
+{
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool ends_with(const char *s, size_t len, const char *suffix)
+{
+	size_t n = strlen(suffix);
+	return len >= n && !strncasecmp(s + len - n, suffix, n);
+}
+
+// State of the walk over one root.
+struct Walk {
+	const ScanOptions &options;
+	const std::atomic<bool> &cancel;
+	const ImageScanner::ImageFn &on_image;
+	const std::string &root;
+	dev_t dev;
+	uint64_t deadline_us;
+	Manifest manifest;
+	std::unordered_set<std::string> visited;
+	ScanResult result;
+
+	void scan_dir(const std::string &rel, unsigned depth);
+	bool list_dir(const std::string &path, Manifest::Dir &dir);
+};
+
+// Reads the subdirectories and candidate images of |path|. Symlinks are
+// not followed, so a link loop cannot trap the walk.
+bool Walk::list_dir(const std::string &path, Manifest::Dir &dir)
+{
+	DIR *d = opendir(path.c_str());
+	if (!d) {
+		log_debug("scan: cannot open %s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	while (struct dirent *entry = readdir(d)) {
+		const char *name = entry->d_name;
+		// Hidden entries are skipped, and names the manifest cannot store
+		// are not worth offering anyway.
+		if (name[0] == '.' || strchr(name, '\n'))
+			continue;
+
+		unsigned char type = entry->d_type;
+		struct stat st;
+		bool have_stat = false;
+		if (type == DT_UNKNOWN) {
+			if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			have_stat = true;
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR) {
+			dir.subdirs.emplace_back(name);
+		} else if (type == DT_REG && is_image_name(name, nullptr)) {
+			if (!have_stat && fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			Manifest::File file;
+			file.name = name;
+			file.size = (uint64_t)st.st_size;
+			file.mtime_ns = mtime_ns(st);
+			dir.files.push_back(std::move(file));
+		}
+	}
+	closedir(d);
+
+	std::sort(dir.subdirs.begin(), dir.subdirs.end());
+	std::sort(dir.files.begin(), dir.files.end(),
+		  [](const Manifest::File &a, const Manifest::File &b) { return a.name < b.name; });
+	return true;
+}
+
+void Walk::scan_dir(const std::string &rel, unsigned depth)
+{
+	if (cancel.load(std::memory_order_relaxed) || monotonic_us() > deadline_us) {
+		result.truncated = true;
+		return;
+	}
+
+	std::string path = rel.empty() ? root : root + "/" + rel;
+	struct stat st;
+	if (lstat(path.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) || st.st_dev != dev)
+		return;
+
+	Manifest::Dir dir;
+	const Manifest::Dir *cached = manifest.find(rel);
+	if (cached && cached->mtime_ns == mtime_ns(st)) {
+		// The set of names is unchanged; only the files themselves may have
+		// been rewritten in place.
+		dir = *cached;
+		for (auto it = dir.files.begin(); it != dir.files.end();) {
+			struct stat fst;
+			if (lstat((path + "/" + it->name).c_str(), &fst) < 0 || !S_ISREG(fst.st_mode)) {
+				it = dir.files.erase(it);
+				continue;
+			}
+			it->size = (uint64_t)fst.st_size;
+			it->mtime_ns = mtime_ns(fst);
+			++it;
+		}
+		result.dirs_cached++;
+	} else {
+		if (!list_dir(path, dir))
+			return;
+		result.dirs_read++;
+	}
+	dir.mtime_ns = mtime_ns(st);
+
+	for (const Manifest::File &file : dir.files) {
+		ImageInfo image;
+		image.root = root;
+		image.path = path + "/" + file.name;
+		image.size = file.size;
+		image.mtime_ns = file.mtime_ns;
+		is_image_name(file.name.c_str(), &image.compression);
+		parse_image_name(file.name.c_str(), &image.name, &image.version);
+		result.images++;
+		on_image(image);
+	}
+
+	std::vector<std::string> subdirs = dir.subdirs;
+	manifest.put(rel, std::move(dir));
+	visited.insert(rel);
+
+	if (depth >= options.max_depth)
+		return;
+	for (const std::string &sub : subdirs)
+		scan_dir(rel.empty() ? sub : rel + "/" + sub, depth + 1);
+}
+
+} // namespace
+
+bool is_image_name(const char *name, Compression *compression)
+{
+	static const struct {
+		const char *suffix;
+		Compression compression;
+	} kCompressed[] = {
+		{ ".gz", Compression::Gzip },
+		{ ".xz", Compression::Xz },
+		{ ".zst", Compression::Zstd },
+		{ ".bz2", Compression::Bzip2 },
+		{ ".tar", Compression::Tar },
+		{ ".zip", Compression::Zip },
+	};
+	static const char *const kImages[] = { ".img", ".bin", ".ubi", ".ext4", ".wic", ".sdcard", ".squashfs" };
+
+	size_t len = strlen(name);
+	if (len > 5 && ends_with(name, len, ".ruic")) {
+		if (compression)
+			*compression = Compression::Container;
+		return true;
+	}
+	Compression c = Compression::Raw;
+	for (const auto &entry : kCompressed) {
+		if (ends_with(name, len, entry.suffix)) {
+			c = entry.compression;
+			len -= strlen(entry.suffix);
+			break;
+		}
+	}
+	for (const char *suffix : kImages) {
+		// The name must be more than just the extension.
+		if (len > strlen(suffix) && ends_with(name, len, suffix)) {
+			if (compression)
+				*compression = c;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::string> find_scan_roots(const char *mounts)
+{
+	static const char *const kDevices[] = { "/dev/sd", "/dev/mmcblk", "/dev/nvme", "/dev/hd", "/dev/vd", "/dev/sr" };
+
+	std::vector<std::string> roots;
+	FILE *f = setmntent(mounts, "re");
+	if (!f) {
+		log_warning("scan: cannot read %s: %s", mounts, strerror(errno));
+		return roots;
+	}
+	struct mntent entry;
+	char buf[1024];
+	while (getmntent_r(f, &entry, buf, sizeof(buf))) {
+		if (!strcmp(entry.mnt_dir, "/"))
+			continue;
+		bool storage = false;
+		for (const char *prefix : kDevices)
+			storage = storage || !strncmp(entry.mnt_fsname, prefix, strlen(prefix));
+		if (storage && std::find(roots.begin(), roots.end(), entry.mnt_dir) == roots.end())
+			roots.emplace_back(entry.mnt_dir);
+	}
+	endmntent(f);
+	return roots;
+}
+
+ImageScanner::ImageScanner(const ScanOptions &options) : m_options(options)
+{
+}
+
+ImageScanner::~ImageScanner()
+{
+	cancel();
+	wait();
+}
+
+void ImageScanner::start(std::vector<std::string> roots, ImageFn on_image, DoneFn on_done)
+{
+	cancel();
+	wait();
+
+	m_roots = std::move(roots);
+	m_on_image = std::move(on_image);
+	m_on_done = std::move(on_done);
+	m_next = 0;
+	m_cancel = false;
+
+	unsigned threads = std::min<size_t>(std::max(m_options.max_threads, 1u), m_roots.size());
+	m_active = threads;
+	for (unsigned i = 0; i < threads; i++)
+		m_threads.emplace_back(&ImageScanner::worker, this);
+}
+
+void ImageScanner::wait()
+{
+	for (std::thread &t : m_threads)
+		t.join();
+	m_threads.clear();
+}
+
+void ImageScanner::worker()
+{
+	TRACE_THREAD_NAME("scan");
+	sched_set_role(ThreadRole::Background);
+	for (;;) {
+		size_t i = m_next.fetch_add(1);
+		if (i >= m_roots.size() || m_cancel)
+			break;
+		ScanResult result = scan_root(m_roots[i]);
+		if (m_on_done)
+			m_on_done(result);
+	}
+	m_active.fetch_sub(1);
+}
+
+ScanResult ImageScanner::scan_root(const std::string &root)
+{
+	TRACE_SCOPE("scan", "device");
+	uint64_t start = monotonic_us();
+	Walk walk{ m_options, m_cancel, m_on_image, root, 0, start + (uint64_t)m_options.budget_ms * 1000, {}, {}, {} };
+	walk.result.root = root;
+
+	struct stat st;
+	if (stat(root.c_str(), &st) < 0) {
+		log_warning("scan: cannot stat %s: %s", root.c_str(), strerror(errno));
+		return walk.result;
+	}
+	walk.dev = st.st_dev;
+
+	std::string cache_dir = root + "/" + m_options.cache_dir;
+	std::string manifest_path = cache_dir + "/manifest";
+	if (!m_options.cache_dir.empty())
+		walk.manifest.load(manifest_path);
+
+	walk.scan_dir("", 0);
+	walk.result.elapsed_us = monotonic_us() - start;
+
+	// A truncated walk still refreshes what it saw but keeps the rest.
+	if (!walk.result.truncated)
+		walk.manifest.retain(walk.visited);
+	if (!m_options.cache_dir.empty() && walk.manifest.dirty() && !m_cancel) {
+		int ret = mkdir(cache_dir.c_str(), 0755) < 0 && errno != EEXIST ? -errno : 0;
+		if (!ret)
+			ret = walk.manifest.save(manifest_path);
+		// Read-only and full media are normal; the next scan just walks again.
+		if (ret < 0)
+			log_debug("scan: cannot save %s: %s", manifest_path.c_str(), strerror(-ret));
+	}
+
+	log_info("scan: %s: %u images, %u dirs read, %u cached, %llu ms%s", root.c_str(), walk.result.images,
+		 walk.result.dirs_read, walk.result.dirs_cached, (unsigned long long)walk.result.elapsed_us / 1000,
+		 walk.result.truncated ? " (budget exceeded)" : "");
+	return walk.result;
+}
+
+} // namespace recovery
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "flash/decoder.h"
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+// A flashable image found on some device.
+struct ImageInfo {
+	// Mount point of the filesystem it was found on.
+	std::string root;
+	std::string path;
+	uint64_t size = 0;
+	int64_t mtime_ns = 0;
+	// From the file name; the flash pipeline still checks the magic.
+	Compression compression = Compression::Raw;
+	// Also from the file name, see parse_image_name().
+	std::string name;
+	std::string version;
+};
+
+struct ScanOptions {
+	// Directory levels below each root that are looked at.
+	unsigned max_depth = 4;
+	// Per root; whatever is not reached by then is skipped.
+	unsigned budget_ms = 10000;
+	// Roots are scanned concurrently, up to this many at once.
+	unsigned max_threads = 4;
+	// Hidden directory in each root that holds the manifest cache; empty
+	// to disable it. Keeping the manifest one level down means rewriting
+	// it does not change the root's own mtime.
+	std::string cache_dir = ".recovery-ui";
+};
+
+struct ScanResult {
+	std::string root;
+	unsigned images = 0;
+	// Directories listed with readdir() and ones taken from the manifest.
+	unsigned dirs_read = 0;
+	unsigned dirs_cached = 0;
+	uint64_t elapsed_us = 0;
+	// The time budget ran out before the walk was complete.
+	bool truncated = false;
+};
+
+// Looks for images on several filesystems at once, one thread per device,
+// so a slow HDD does not hold up the USB stick next to it. Results are
+// reported as they are found rather than at the end.
+//
+// The walk stays on each root's filesystem, skips hidden entries, and
+// reuses the manifest of the previous scan (see Manifest) for every
+// directory that has not changed since.
+class ImageScanner {
+public:
+	// Both called on scanner threads, possibly concurrently.
+	using ImageFn = std::function<void(const ImageInfo &image)>;
+	using DoneFn = std::function<void(const ScanResult &result)>;
+
+	explicit ImageScanner(const ScanOptions &options = ScanOptions());
+	// Cancels and joins.
+	~ImageScanner();
+
+	ImageScanner(const ImageScanner &) = delete;
+	ImageScanner &operator=(const ImageScanner &) = delete;
+
+	void start(std::vector<std::string> roots, ImageFn on_image, DoneFn on_done);
+	void cancel() { m_cancel = true; }
+	void wait();
+
+	bool running() const { return m_active.load() > 0; }
+
+private:
+	void worker();
+	ScanResult scan_root(const std::string &root);
+
+	ScanOptions m_options;
+	std::vector<std::string> m_roots;
+	ImageFn m_on_image;
+	DoneFn m_on_done;
+	std::vector<std::thread> m_threads;
+	std::atomic<size_t> m_next{ 0 };
+	std::atomic<unsigned> m_active{ 0 };
+	std::atomic<bool> m_cancel{ false };
+};
+
+// True if |name| looks like an image: *.ruic, or *.img, *.bin, *.ubi,
+// *.ext4, *.wic, *.sdcard or *.squashfs optionally followed by .gz, .xz,
+// .zst, .bz2, or the legacy .tar and .zip.
+bool is_image_name(const char *name, Compression *compression);
+
+// Mount points of removable and secondary storage (USB, SD/MMC, SATA,
+// NVMe) from /proc/self/mounts, excluding the root filesystem.
+std::vector<std::string> find_scan_roots(const char *mounts = "/proc/self/mounts");
+
+} // namespace recovery
@@ -0,0 +1,154 @@
+#include "scan/manifest.h"
+
+#include "common/log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace recovery {
+
+namespace {
+
+// Bump the version whenever is_image_name() changes what it accepts, or
+// old manifests would keep hiding newly recognised images.
+constexpr const char *kMagic = "RUIM 2";
+
+bool same(const Manifest::Dir &a, const Manifest::Dir &b)
+{
+	return a.mtime_ns == b.mtime_ns && a.subdirs == b.subdirs && a.files == b.files;
+}
+
+// Strips the newline; false if the line was cut short by the buffer.
+bool chomp(char *line)
+{
+	size_t len = strlen(line);
+	if (!len || line[len - 1] != '\n')
+		return false;
+	line[len - 1] = '\0';
+	return true;
+}
+
+} // namespace
+
+int Manifest::load(const std::string &path)
+{
+	m_dirs.clear();
+	m_dirty = false;
+
+	FILE *f = fopen(path.c_str(), "re");
+	if (!f)
+		return -errno;
+
+	char line[4096 + 64];
+	Dir *dir = nullptr;
+	bool ok = fgets(line, sizeof(line), f) && chomp(line) && !strcmp(line, kMagic);
+	while (ok && fgets(line, sizeof(line), f)) {
+		if (!chomp(line) || line[0] == '\0' || line[1] != ' ') {
+			ok = false;
+			break;
+		}
+		char *arg = line + 2, *end;
+		switch (line[0]) {
+		case 'd': {
+			long long mtime = strtoll(arg, &end, 10);
+			ok = *end == ' ';
+			if (ok) {
+				dir = &m_dirs[end + 1];
+				dir->mtime_ns = mtime;
+			}
+			break;
+		}
+		case 's':
+			ok = dir != nullptr;
+			if (ok)
+				dir->subdirs.emplace_back(arg);
+			break;
+		case 'f': {
+			File file;
+			file.size = strtoull(arg, &end, 10);
+			ok = dir && *end == ' ';
+			if (ok) {
+				file.mtime_ns = strtoll(end + 1, &end, 10);
+				ok = *end == ' ';
+			}
+			if (ok) {
+				file.name = end + 1;
+				dir->files.push_back(std::move(file));
+			}
+			break;
+		}
+		default:
+			ok = false;
+		}
+	}
+	fclose(f);
+
+	if (!ok) {
+		log_warning("scan: ignoring corrupt manifest %s", path.c_str());
+		m_dirs.clear();
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int Manifest::save(const std::string &path) const
+{
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "we");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "%s\n", kMagic);
+	for (const auto &entry : m_dirs) {
+		fprintf(f, "d %lld %s\n", (long long)entry.second.mtime_ns, entry.first.c_str());
+		for (const std::string &sub : entry.second.subdirs)
+			fprintf(f, "s %s\n", sub.c_str());
+		for (const File &file : entry.second.files)
+			fprintf(f, "f %llu %lld %s\n", (unsigned long long)file.size, (long long)file.mtime_ns,
+				file.name.c_str());
+	}
+
+	// USB sticks get pulled without warning; never leave a torn file.
+	int err = 0;
+	if (fflush(f) || fsync(fileno(f)))
+		err = -errno;
+	if (fclose(f) && !err)
+		err = -errno;
+	if (!err && rename(tmp.c_str(), path.c_str()))
+		err = -errno;
+	if (err)
+		unlink(tmp.c_str());
+	return err;
+}
+
+const Manifest::Dir *Manifest::find(const std::string &dir) const
+{
+	auto it = m_dirs.find(dir);
+	return it == m_dirs.end() ? nullptr : &it->second;
+}
+
+void Manifest::put(const std::string &dir, Dir entry)
+{
+	auto it = m_dirs.find(dir);
+	if (it != m_dirs.end() && same(it->second, entry))
+		return;
+	m_dirs[dir] = std::move(entry);
+	m_dirty = true;
+}
+
+void Manifest::retain(const std::unordered_set<std::string> &keep)
+{
+	for (auto it = m_dirs.begin(); it != m_dirs.end();) {
+		if (keep.count(it->first)) {
+			++it;
+		} else {
+			it = m_dirs.erase(it);
+			m_dirty = true;
+		}
+	}
+}
+
+} // namespace recovery
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace recovery {
+
+// What an image scan found in each directory of one filesystem, saved on
+// that filesystem so the next scan can skip readdir() for every directory
+// whose mtime has not changed. Candidate images are keyed by size and
+// mtime so a file replaced in place is noticed.
+//
+// Paths are relative to the filesystem root ("" for the root itself).
+// The file is line-based text:
+//
+//	RUIM 2
+//	d <mtime_ns> <dir path>
+//	s <subdirectory name>
+//	f <size> <mtime_ns> <file name>
+//
+// where s and f lines belong to the preceding d line.
+class Manifest {
+public:
+	struct File {
+		std::string name;
+		uint64_t size = 0;
+		int64_t mtime_ns = 0;
+
+		bool operator==(const File &o) const { return name == o.name && size == o.size && mtime_ns == o.mtime_ns; }
+	};
+
+	struct Dir {
+		int64_t mtime_ns = 0;
+		std::vector<std::string> subdirs;
+		std::vector<File> files;
+	};
+
+	// Returns 0, -ENOENT, or -EINVAL for a corrupt or foreign file (the
+	// manifest is then empty).
+	int load(const std::string &path);
+	// Writes to a temporary file and renames it over |path|.
+	int save(const std::string &path) const;
+
+	const Dir *find(const std::string &dir) const;
+	void put(const std::string &dir, Dir entry);
+	// Drops every directory not in |keep|, e.g. deleted ones.
+	void retain(const std::unordered_set<std::string> &keep);
+
+	bool empty() const { return m_dirs.empty(); }
+	size_t size() const { return m_dirs.size(); }
+	bool dirty() const { return m_dirty; }
+
+private:
+	std::unordered_map<std::string, Dir> m_dirs;
+	bool m_dirty = false;
+};
+
+} // namespace recovery
@@ -0,0 +1,52 @@
+#pragma once
+
+// On-disk layout of a precompiled font atlas, shared by tools/mkatlas and
+// the runtime reader. All fields are little-endian.
+//
+//   AtlasHeader
+//   AtlasGlyph[glyph_count]   sorted by codepoint, at header.glyphs
+//   8-bit coverage bitmaps    one per glyph, rows of |width| bytes
+//
+// The file is mapped read-only and used in place: lookups are a binary
+// search over the glyph table and bitmaps are blended straight from the
+// mapping, so drawing text never allocates.
+
+#include <stdint.h>
+
+namespace recovery {
+
+static const char kAtlasMagic[4] = { 'R', 'U', 'I', 'A' };
+static const uint32_t kAtlasVersion = 1;
+
+struct AtlasHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t glyph_count;
+	// File offset of the glyph table.
+	uint32_t glyphs;
+	uint32_t file_size;
+	uint16_t pixel_size;
+	uint16_t line_height;
+	// Baseline distances in pixels; descent is negative.
+	int16_t ascent;
+	int16_t descent;
+};
+
+struct AtlasGlyph {
+	uint32_t codepoint;
+	// File offset of the coverage bitmap.
+	uint32_t bitmap;
+	uint16_t width;
+	uint16_t height;
+	// Offset of the bitmap's top-left corner from the pen position on the
+	// baseline; |top| grows upwards.
+	int16_t left;
+	int16_t top;
+	uint16_t advance;
+	uint16_t reserved;
+};
+
+static_assert(sizeof(AtlasHeader) == 28, "AtlasHeader layout");
+static_assert(sizeof(AtlasGlyph) == 20, "AtlasGlyph layout");
+
+} // namespace recovery
@@ -0,0 +1,98 @@
+#include "text/font_atlas.h"
+
+#include "common/log.h"
+#include "common/unique_fd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace recovery {
+
+FontAtlas::~FontAtlas()
+{
+	close();
+}
+
+int FontAtlas::open(const char *path)
+{
+	close();
+
+	UniqueFd fd(::open(path, O_RDONLY | O_CLOEXEC));
+	struct stat st;
+	if (!fd || fstat(fd.get(), &st) < 0) {
+		int err = -errno;
+		log_debug("font: cannot open %s: %s", path, strerror(errno));
+		return err;
+	}
+	if ((size_t)st.st_size < sizeof(AtlasHeader)) {
+		log_error("font: %s is truncated", path);
+		return -EINVAL;
+	}
+
+	void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+	if (base == MAP_FAILED) {
+		int err = -errno;
+		log_error("font: cannot map %s: %s", path, strerror(errno));
+		return err;
+	}
+	m_base = (const uint8_t *)base;
+	m_size = st.st_size;
+
+	// Validate the table bounds once; glyph bitmaps were checked by mkatlas
+	// and are bounds-checked lazily in find().
+	const AtlasHeader *h = header();
+	uint32_t count = le32toh(h->glyph_count);
+	uint32_t table = le32toh(h->glyphs);
+	if (memcmp(h->magic, kAtlasMagic, sizeof(kAtlasMagic)) || le32toh(h->version) != kAtlasVersion ||
+	    le32toh(h->file_size) != m_size || table % 4 || table > m_size ||
+	    count > (m_size - table) / sizeof(AtlasGlyph)) {
+		log_error("font: %s is not a valid atlas", path);
+		close();
+		return -EINVAL;
+	}
+	m_glyphs = (const AtlasGlyph *)(m_base + table);
+	m_count = count;
+	return 0;
+}
+
+void FontAtlas::close()
+{
+	if (m_base)
+		munmap((void *)m_base, m_size);
+	m_base = nullptr;
+	m_size = 0;
+	m_glyphs = nullptr;
+	m_count = 0;
+}
+
+bool FontAtlas::find(uint32_t codepoint, Glyph *glyph) const
+{
+	uint32_t lo = 0, hi = m_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t cp = le32toh(m_glyphs[mid].codepoint);
+		if (cp < codepoint) {
+			lo = mid + 1;
+		} else if (cp > codepoint) {
+			hi = mid;
+		} else {
+			const AtlasGlyph &g = m_glyphs[mid];
+			uint32_t offset = le32toh(g.bitmap);
+			glyph->width = le16toh(g.width);
+			glyph->height = le16toh(g.height);
+			if (offset > m_size || (size_t)glyph->width * glyph->height > m_size - offset)
+				return false;
+			glyph->bitmap = m_base + offset;
+			glyph->left = (int16_t)le16toh((uint16_t)g.left);
+			glyph->top = (int16_t)le16toh((uint16_t)g.top);
+			glyph->advance = le16toh(g.advance);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace recovery
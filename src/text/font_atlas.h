@@ -0,0 +1,53 @@
+#pragma once
+
+#include "text/atlas_format.h"
+
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace recovery {
+
+// Decoded view of one glyph; points into the mapped atlas.
+struct Glyph {
+	const uint8_t *bitmap = nullptr;
+	unsigned width = 0;
+	unsigned height = 0;
+	int left = 0;
+	int top = 0;
+	int advance = 0;
+};
+
+// A font atlas produced by mkatlas, mapped read-only.
+class FontAtlas {
+public:
+	FontAtlas() = default;
+	~FontAtlas();
+
+	FontAtlas(const FontAtlas &) = delete;
+	FontAtlas &operator=(const FontAtlas &) = delete;
+
+	// Maps and sanity-checks |path|. Returns 0 or a negative errno.
+	int open(const char *path);
+	void close();
+
+	bool is_open() const { return m_base != nullptr; }
+	unsigned pixel_size() const { return le16toh(header()->pixel_size); }
+	unsigned line_height() const { return le16toh(header()->line_height); }
+	int ascent() const { return (int16_t)le16toh((uint16_t)header()->ascent); }
+	int descent() const { return (int16_t)le16toh((uint16_t)header()->descent); }
+	unsigned glyph_count() const { return m_count; }
+
+	// Looks up |codepoint|; false if the atlas does not contain it.
+	bool find(uint32_t codepoint, Glyph *glyph) const;
+
+private:
+	const AtlasHeader *header() const { return (const AtlasHeader *)m_base; }
+
+	const uint8_t *m_base = nullptr;
+	size_t m_size = 0;
+	const AtlasGlyph *m_glyphs = nullptr;
+	uint32_t m_count = 0;
+};
+
+} // namespace recovery
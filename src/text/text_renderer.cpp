@@ -0,0 +1,46 @@
+#include "text/text_renderer.h"
+
+#include "text/utf8.h"
+
+namespace recovery {
+
+bool TextRenderer::glyph(uint32_t codepoint, Glyph *g) const
+{
+	return m_atlas.find(codepoint, g) || m_atlas.find(0xfffd, g) || m_atlas.find('?', g);
+}
+
+int TextRenderer::measure(const char *utf8) const
+{
+	int width = 0;
+	Glyph g;
+	for (uint32_t c; (c = utf8_next(utf8));) {
+		if (glyph(c, &g))
+			width += g.advance;
+		else
+			width += m_atlas.pixel_size() / 2;
+	}
+	return width;
+}
+
+int TextRenderer::draw(Canvas &canvas, int x, int y, const char *utf8, const Color &color) const
+{
+	int baseline = y + m_atlas.ascent();
+	const Rect &clip = canvas.clip();
+	Glyph g;
+
+	for (uint32_t c; (c = utf8_next(utf8));) {
+		if (!glyph(c, &g)) {
+			x += m_atlas.pixel_size() / 2;
+			continue;
+		}
+		// Glyphs left of the clip cost only the lookup; stop once past it.
+		if (x >= clip.right())
+			break;
+		if (g.width && x + g.left + (int)g.width > clip.x)
+			canvas.blend_mask(x + g.left, baseline - g.top, g.bitmap, g.width, g.width, g.height, color);
+		x += g.advance;
+	}
+	return x;
+}
+
+} // namespace recovery
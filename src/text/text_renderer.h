@@ -0,0 +1,31 @@
+#pragma once
+
+#include "fb/canvas.h"
+#include "text/font_atlas.h"
+
+namespace recovery {
+
+// Draws UTF-8 text from a FontAtlas onto a Canvas. Stateless apart from
+// the atlas reference; no allocation per call.
+class TextRenderer {
+public:
+	explicit TextRenderer(const FontAtlas &atlas) : m_atlas(atlas) {}
+
+	const FontAtlas &atlas() const { return m_atlas; }
+	unsigned line_height() const { return m_atlas.line_height(); }
+
+	// Advance width of |utf8| in pixels.
+	int measure(const char *utf8) const;
+	// Draws |utf8| with the top of its line box at |y|. Returns the pen x
+	// position after the last glyph.
+	int draw(Canvas &canvas, int x, int y, const char *utf8, const Color &color) const;
+
+private:
+	// The glyph for |codepoint| or the replacement glyph; false if neither
+	// exists, which renders as blank space.
+	bool glyph(uint32_t codepoint, Glyph *g) const;
+
+	const FontAtlas &m_atlas;
+};
+
+} // namespace recovery
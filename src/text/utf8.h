@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace recovery {
+
+// Decodes one UTF-8 sequence at |p| and advances past it. Malformed input
+// yields U+FFFD and skips one byte; returns 0 at the terminating NUL.
+static inline uint32_t utf8_next(const char *&p)
+{
+	const uint8_t *s = (const uint8_t *)p;
+	uint32_t c = s[0];
+	if (c < 0x80) {
+		if (c)
+			p++;
+		return c;
+	}
+
+	int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : -1;
+	if (extra < 0 || c > 0xf4) {
+		p++;
+		return 0xfffd;
+	}
+	c &= 0x3f >> extra;
+	for (int i = 1; i <= extra; i++) {
+		if ((s[i] & 0xc0) != 0x80) {
+			p++;
+			return 0xfffd;
+		}
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+	p += extra + 1;
+	return c;
+}
+
+} // namespace recovery
@@ -0,0 +1,333 @@
+#include "ui/image_list_screen.h"
+
+#include "common/log.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+namespace recovery {
+
+namespace {
+
+const Color kBackground(0x10, 0x18, 0x28);
+const Color kHeader(0x20, 0x50, 0x90);
+const Color kSelected(0x30, 0x40, 0x60);
+const Color kText(0xff, 0xff, 0xff);
+const Color kDim(0x90, 0xa0, 0xb0);
+
+// Lines of the details pane: what the image is, its checksum, and the
+// start of its changelog.
+const int kDetailLines = 4;
+// Rows reserved on entering beyond the images found so far.
+const size_t kRowsAhead = 64;
+
+void format_size(uint64_t bytes, char *buf, size_t len)
+{
+	if (bytes >= (1ull << 30))
+		snprintf(buf, len, "%.1f GiB", (double)bytes / (1ull << 30));
+	else if (bytes >= (1ull << 20))
+		snprintf(buf, len, "%llu MiB", (unsigned long long)(bytes >> 20));
+	else
+		snprintf(buf, len, "%llu KiB", (unsigned long long)((bytes + 1023) >> 10));
+}
+
+const char *basename_of(const std::string &path)
+{
+	size_t slash = path.rfind('/');
+	return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+void format_date(int64_t seconds, char *buf, size_t len)
+{
+	time_t t = (time_t)seconds;
+	struct tm tm;
+	if (!gmtime_r(&t, &tm) || !strftime(buf, len, "%Y-%m-%d", &tm))
+		buf[0] = '\0';
+}
+
+} // namespace
+
+ImageListScreen::ImageListScreen(Renderer &renderer, const TextRenderer *text) : m_renderer(renderer), m_text(text)
+{
+}
+
+bool ImageListScreen::enter(Arena &arena, const Rect &bounds)
+{
+	m_layout = arena.make<Layout>();
+	if (!m_layout)
+		return false;
+	// Room for what may still be found during the visit; growing past it
+	// only leaves the old array in the arena until the next visit.
+	m_layout->rows_text = arena.make<RowVector>(ArenaAllocator<Row>(arena));
+	if (!m_layout->rows_text)
+		return false;
+	m_layout->rows_text->reserve(m_images.size() + kRowsAhead);
+	for (size_t i = 0; i < m_images.size(); i++)
+		format_row(i);
+
+	int line = m_text ? (int)m_text->line_height() : bounds.h / 24;
+	Layout &l = *m_layout;
+	l.margin = bounds.w / 32;
+	l.header = Rect(0, 0, bounds.w, bounds.h / 12);
+	l.status = Rect(0, bounds.h - line * 2, bounds.w, line * 2);
+	l.details = Rect(0, l.status.y - line * kDetailLines, bounds.w, line * kDetailLines);
+	l.list = Rect(0, l.header.bottom(), bounds.w, l.details.y - l.header.bottom());
+	l.row_height = line + line / 2;
+	l.rows = l.row_height > 0 ? l.list.h / l.row_height : 0;
+	if (l.rows <= 0)
+		return false;
+	request_preview();
+	return true;
+}
+
+void ImageListScreen::format_row(size_t index)
+{
+	RowVector &rows = *m_layout->rows_text;
+	if (index >= rows.size())
+		rows.resize(index + 1);
+	const Entry &entry = m_images[index];
+	Row &row = rows[index];
+	// What will be written, once the header has told.
+	format_size(entry.summary.image_size ? entry.summary.image_size : entry.image.size, row.size,
+		    sizeof(row.size));
+	row.date[0] = '\0';
+	if (entry.summary.build_time)
+		format_date(entry.summary.build_time, row.date, sizeof(row.date));
+}
+
+Rect ImageListScreen::row_rect(size_t index) const
+{
+	const Layout &l = *m_layout;
+	return Rect(l.list.x, l.list.y + (int)(index - m_top) * l.row_height, l.list.w, l.row_height);
+}
+
+void ImageListScreen::invalidate_row(size_t index)
+{
+	if (m_layout && index >= m_top && index < m_top + (size_t)m_layout->rows)
+		m_renderer.invalidate(row_rect(index));
+}
+
+void ImageListScreen::add(const ImageInfo &image)
+{
+	m_by_path[image.path] = m_images.size();
+	m_images.push_back(Entry{ image, false, {} });
+	if (m_layout)
+		format_row(m_images.size() - 1);
+	invalidate_row(m_images.size() - 1);
+	if (m_layout) {
+		m_renderer.invalidate(m_layout->status);
+		if (m_images.size() == 1)
+			m_renderer.invalidate(m_layout->details);
+		if (m_images.size() <= m_top + (size_t)m_layout->rows)
+			request_preview();
+	}
+}
+
+void ImageListScreen::request_preview()
+{
+	if (!m_preview || !m_layout || m_images.empty())
+		return;
+	std::vector<ImagePreview::Request> summaries;
+	size_t end = std::min(m_images.size(), m_top + (size_t)m_layout->rows);
+	for (size_t i = m_top; i < end; i++) {
+		const ImageInfo &image = m_images[i].image;
+		if (!m_images[i].has_summary)
+			summaries.push_back(ImagePreview::Request{ image.path, image.mtime_ns, image.compression });
+	}
+	const ImageInfo &selected = m_images[m_selected].image;
+	ImagePreview::Request details{ selected.path, selected.mtime_ns, selected.compression };
+	m_preview->want(std::move(summaries), &details);
+}
+
+void ImageListScreen::preview_ready()
+{
+	if (!m_preview)
+		return;
+	for (const ImagePreview::Result &result : m_preview->take()) {
+		auto it = m_by_path.find(result.path);
+		if (it == m_by_path.end())
+			continue;
+		Entry &entry = m_images[it->second];
+		if (result.has_summary) {
+			entry.has_summary = true;
+			entry.summary = result.summary;
+			if (m_layout)
+				format_row(it->second);
+			invalidate_row(it->second);
+		} else if (it->second == m_selected && m_layout) {
+			m_renderer.invalidate(m_layout->details);
+		}
+	}
+}
+
+void ImageListScreen::set_devices_pending(unsigned pending)
+{
+	m_devices_pending = pending;
+	if (m_layout)
+		m_renderer.invalidate(m_layout->status);
+}
+
+void ImageListScreen::select(long index)
+{
+	if (m_images.empty())
+		return;
+	index = std::max(0L, std::min(index, (long)m_images.size() - 1));
+	if ((size_t)index == m_selected)
+		return;
+
+	size_t rows = (size_t)m_layout->rows;
+	size_t top = m_top;
+	if ((size_t)index < top)
+		top = (size_t)index;
+	else if ((size_t)index >= top + rows)
+		top = (size_t)index - rows + 1;
+
+	if (top != m_top) {
+		m_top = top;
+		m_renderer.invalidate(m_layout->list);
+	} else {
+		invalidate_row(m_selected);
+		invalidate_row((size_t)index);
+	}
+	m_selected = (size_t)index;
+	m_renderer.invalidate(m_layout->details);
+	request_preview();
+}
+
+bool ImageListScreen::on_key(const KeyEvent &event)
+{
+	if (event.action == KeyAction::Release || !m_layout)
+		return false;
+
+	long page = m_layout->rows;
+	switch (event.key) {
+	case Key::Up:
+		select((long)m_selected - 1);
+		return true;
+	case Key::Down:
+		select((long)m_selected + 1);
+		return true;
+	case Key::PageUp:
+		select((long)m_selected - page);
+		return true;
+	case Key::PageDown:
+		select((long)m_selected + page);
+		return true;
+	case Key::Home:
+		select(0);
+		return true;
+	case Key::Ok:
+		if (event.action == KeyAction::Press && m_selected < m_images.size() && m_on_activate)
+			m_on_activate(m_images[m_selected].image);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void ImageListScreen::paint_details(Canvas &canvas, int line)
+{
+	const Layout &l = *m_layout;
+	if (m_selected >= m_images.size())
+		return;
+	const Entry &entry = m_images[m_selected];
+	int y = l.details.y;
+	char text[160];
+	char size[32];
+	format_size(entry.image.size, size, sizeof(size));
+	snprintf(text, sizeof(text), "%s, %s %s", basename_of(entry.image.path), size,
+		 compression_name(entry.image.compression));
+	m_text->draw(canvas, l.margin, y, text, kText);
+	y += line;
+
+	std::shared_ptr<const ImageDetails> details =
+		m_preview ? m_preview->details(entry.image.path, entry.image.mtime_ns) : nullptr;
+	if (!details) {
+		if (m_preview)
+			m_text->draw(canvas, l.margin, y, "Reading details...", kDim);
+		return;
+	}
+	if (!details->checksum.empty()) {
+		snprintf(text, sizeof(text), "%s %s", details->checksum_kind.c_str(), details->checksum.c_str());
+		m_text->draw(canvas, l.margin, y, text, kDim);
+		y += line;
+	}
+	// The changelog's first non-empty lines, as many as fit.
+	const std::string &log = details->changelog;
+	for (size_t pos = 0; pos < log.size() && y + line <= l.details.bottom();) {
+		size_t end = log.find('\n', pos);
+		if (end == std::string::npos)
+			end = log.size();
+		size_t len = end - pos;
+		if (len && log[end - 1] == '\r')
+			len--;
+		if (len) {
+			// Copied out to terminate it; no screen is wider than this.
+			len = std::min(len, sizeof(text) - 1);
+			memcpy(text, log.data() + pos, len);
+			text[len] = '\0';
+			m_text->draw(canvas, l.margin, y, text, kDim);
+			y += line;
+		}
+		pos = end + 1;
+	}
+}
+
+void ImageListScreen::paint(Canvas &canvas, const Rect &dirty)
+{
+	const Layout &l = *m_layout;
+	int line = m_text ? (int)m_text->line_height() : 0;
+
+	// The canvas is clipped to |dirty|, so this only clears what is redrawn.
+	canvas.fill_rect(dirty, kBackground);
+	if (dirty.intersects(l.header)) {
+		canvas.fill_rect(l.header, kHeader);
+		if (m_text)
+			m_text->draw(canvas, l.margin, (l.header.h - line) / 2, "Recovery", kText);
+	}
+
+	for (int r = 0; r < l.rows; r++) {
+		size_t index = m_top + (size_t)r;
+		Rect row = row_rect(index);
+		if (!dirty.intersects(row))
+			continue;
+		if (index >= m_images.size())
+			continue;
+		if (index == m_selected)
+			canvas.fill_rect(row, kSelected);
+		if (!m_text)
+			continue;
+
+		const ImageInfo &image = m_images[index].image;
+		const Row &text = (*l.rows_text)[index];
+		int y = row.y + (row.h - line) / 2;
+		int size_x = row.right() - l.margin - m_text->measure(text.size);
+		m_text->draw(canvas, size_x, y, text.size, kDim);
+		int x = m_text->draw(canvas, l.margin, y, image.name.c_str(), kText);
+		if (!image.version.empty())
+			x = m_text->draw(canvas, x + line / 2, y, image.version.c_str(), kText);
+		if (text.date[0])
+			x = m_text->draw(canvas, x + line, y, text.date, kDim);
+		m_text->draw(canvas, x + line, y, image.root.c_str(), kDim);
+	}
+
+	if (dirty.intersects(l.details) && m_text)
+		paint_details(canvas, line);
+
+	if (dirty.intersects(l.status) && m_text) {
+		char status[96];
+		size_t n = m_images.size();
+		if (m_devices_pending)
+			snprintf(status, sizeof(status), "Scanning %u device%s... %zu image%s found", m_devices_pending,
+				 m_devices_pending == 1 ? "" : "s", n, n == 1 ? "" : "s");
+		else if (!n)
+			snprintf(status, sizeof(status), "No images found");
+		else
+			snprintf(status, sizeof(status), "%zu image%s found", n, n == 1 ? "" : "s");
+		m_text->draw(canvas, l.margin, l.status.y + (l.status.h - line) / 2, status, kDim);
+	}
+}
+
+} // namespace recovery
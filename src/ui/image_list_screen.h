@@ -0,0 +1,92 @@
+#pragma once
+
+#include "scan/image_preview.h"
+#include "scan/image_scanner.h"
+#include "text/text_renderer.h"
+#include "ui/screen.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace recovery {
+
+// Lists the images found by the scanner, filling in as devices report, and
+// lets the user pick one. Build dates and image sizes of the rows on
+// screen, and the details of the selected one, come from an ImagePreview
+// as they are read. The list itself outlives visits to the screen; the
+// layout and the text of each row are rebuilt in the arena on each
+// enter(), so painting allocates nothing.
+class ImageListScreen : public Screen {
+public:
+	using ActivateFn = std::function<void(const ImageInfo &image)>;
+
+	// |text| may be null when no font is available.
+	ImageListScreen(Renderer &renderer, const TextRenderer *text);
+
+	const char *name() const override { return "image-list"; }
+	bool enter(Arena &arena, const Rect &bounds) override;
+	void leave() override { m_layout = nullptr; }
+	void paint(Canvas &canvas, const Rect &dirty) override;
+	bool on_key(const KeyEvent &event) override;
+
+	void set_activate_handler(ActivateFn fn) { m_on_activate = std::move(fn); }
+	// Without one only what the scanner found is shown.
+	void set_preview(ImagePreview *preview) { m_preview = preview; }
+
+	// Called on the UI thread as scan results come in.
+	void add(const ImageInfo &image);
+	void set_devices_pending(unsigned pending);
+	// Called on the UI thread when the preview has results.
+	void preview_ready();
+
+	size_t count() const { return m_images.size(); }
+
+private:
+	// What a row shows beyond the image's own strings, formatted once.
+	struct Row {
+		char size[16];
+		char date[16];
+	};
+	using RowVector = std::vector<Row, ArenaAllocator<Row>>;
+
+	struct Layout {
+		Rect header;
+		Rect list;
+		Rect details;
+		Rect status;
+		int row_height;
+		int rows;
+		int margin;
+		// One per image, in the arena with the layout.
+		RowVector *rows_text;
+	};
+
+	struct Entry {
+		ImageInfo image;
+		bool has_summary = false;
+		ImageSummary summary;
+	};
+
+	Rect row_rect(size_t index) const;
+	void format_row(size_t index);
+	void invalidate_row(size_t index);
+	void select(long index);
+	// Asks the preview for what the screen shows and does not have yet.
+	void request_preview();
+	void paint_details(Canvas &canvas, int line);
+
+	Renderer &m_renderer;
+	const TextRenderer *m_text;
+	ActivateFn m_on_activate;
+	ImagePreview *m_preview = nullptr;
+	std::vector<Entry> m_images;
+	std::unordered_map<std::string, size_t> m_by_path;
+	size_t m_selected = 0;
+	size_t m_top = 0;
+	unsigned m_devices_pending = 0;
+	Layout *m_layout = nullptr;
+};
+
+} // namespace recovery
@@ -0,0 +1,183 @@
+#include "ui/log_screen.h"
+
+#include "common/log.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace recovery {
+
+namespace {
+
+const Color kBackground(0x10, 0x18, 0x28);
+const Color kHeader(0x20, 0x50, 0x90);
+const Color kText(0xff, 0xff, 0xff);
+const Color kDim(0x90, 0xa0, 0xb0);
+const Color kWarning(0xff, 0xc0, 0x40);
+const Color kError(0xff, 0x60, 0x50);
+
+// Rows are cut off here; wider than any screen in characters.
+const size_t kMaxRow = 255;
+// Column of the level letter LogStore lines get from log_message().
+const size_t kLevelColumn = 13;
+
+Color line_color(const char *text, size_t len)
+{
+	if (len <= kLevelColumn)
+		return kText;
+	switch (text[kLevelColumn]) {
+	case 'D':
+		return kDim;
+	case 'W':
+		return kWarning;
+	case 'E':
+		return kError;
+	default:
+		return kText;
+	}
+}
+
+} // namespace
+
+LogScreen::LogScreen(Renderer &renderer, const TextRenderer *text, std::string path)
+	: m_renderer(renderer), m_text(text), m_path(std::move(path))
+{
+}
+
+bool LogScreen::enter(Arena &arena, const Rect &bounds)
+{
+	m_layout = arena.make<Layout>();
+	if (!m_layout)
+		return false;
+
+	int line = m_text ? (int)m_text->line_height() : bounds.h / 24;
+	Layout &l = *m_layout;
+	l.margin = bounds.w / 32;
+	l.header = Rect(0, 0, bounds.w, bounds.h / 12);
+	l.status = Rect(0, bounds.h - line * 2, bounds.w, line * 2);
+	l.list = Rect(0, l.header.bottom(), bounds.w, l.status.y - l.header.bottom());
+	l.row_height = line;
+	l.rows = l.row_height > 0 ? l.list.h / l.row_height : 0;
+	if (l.rows <= 0)
+		return false;
+
+	// An empty screen is still shown if the log cannot be read.
+	int ret = m_view.open(m_path.c_str());
+	if (ret < 0)
+		log_warning("log: cannot open %s: %s", m_path.c_str(), strerror(-ret));
+	m_top = m_follow ? max_top() : std::min(m_top, max_top());
+	return true;
+}
+
+void LogScreen::leave()
+{
+	// The mapping is only kept while on screen.
+	m_view.close();
+	m_layout = nullptr;
+}
+
+size_t LogScreen::max_top() const
+{
+	size_t rows = (size_t)m_layout->rows;
+	size_t lines = m_view.line_count();
+	return lines > rows ? lines - rows : 0;
+}
+
+void LogScreen::scroll_to(long top)
+{
+	top = std::max(0L, std::min(top, (long)max_top()));
+	m_follow = (size_t)top == max_top();
+	if ((size_t)top == m_top)
+		return;
+	m_top = (size_t)top;
+	m_renderer.invalidate(m_layout->list);
+	m_renderer.invalidate(m_layout->status);
+}
+
+void LogScreen::refresh()
+{
+	if (!m_layout)
+		return;
+	size_t before = m_view.line_count();
+	if (!m_view.refresh())
+		return;
+	m_renderer.invalidate(m_layout->status);
+	// New lines only matter if they land in the visible rows.
+	if (before < m_top + (size_t)m_layout->rows)
+		m_renderer.invalidate(m_layout->list);
+	if (m_follow)
+		scroll_to((long)max_top());
+}
+
+bool LogScreen::on_key(const KeyEvent &event)
+{
+	if (event.action == KeyAction::Release || !m_layout)
+		return false;
+
+	long top = (long)m_top;
+	long page = std::max(1, m_layout->rows - 1);
+	switch (event.key) {
+	case Key::Up:
+		scroll_to(top - 1);
+		return true;
+	case Key::Down:
+		scroll_to(top + 1);
+		return true;
+	case Key::PageUp:
+		scroll_to(top - page);
+		return true;
+	case Key::PageDown:
+		scroll_to(top + page);
+		return true;
+	case Key::Home:
+		scroll_to(0);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void LogScreen::paint(Canvas &canvas, const Rect &dirty)
+{
+	const Layout &l = *m_layout;
+	int line = m_text ? (int)m_text->line_height() : 0;
+
+	canvas.fill_rect(dirty, kBackground);
+	if (dirty.intersects(l.header)) {
+		canvas.fill_rect(l.header, kHeader);
+		if (m_text)
+			m_text->draw(canvas, l.margin, (l.header.h - line) / 2, "Log", kText);
+	}
+	if (!m_text)
+		return;
+
+	for (int r = 0; r < l.rows; r++) {
+		Rect row(l.list.x, l.list.y + r * l.row_height, l.list.w, l.row_height);
+		if (!dirty.intersects(row))
+			continue;
+		const char *text;
+		size_t len;
+		if (!m_view.line(m_top + (size_t)r, &text, &len))
+			break;
+		// The mapping has no terminators; copy just this row out.
+		char buf[kMaxRow + 1];
+		size_t n = std::min(len, kMaxRow);
+		memcpy(buf, text, n);
+		buf[n] = '\0';
+		m_text->draw(canvas, l.margin, row.y, buf, line_color(text, len));
+	}
+
+	if (dirty.intersects(l.status)) {
+		char status[96];
+		size_t lines = m_view.line_count();
+		if (!lines)
+			snprintf(status, sizeof(status), "Log is empty");
+		else
+			snprintf(status, sizeof(status), "Lines %zu-%zu of %zu%s", m_top + 1,
+				 std::min(m_top + (size_t)l.rows, lines), lines, m_follow ? ", following" : "");
+		m_text->draw(canvas, l.margin, l.status.y + (l.status.h - line) / 2, status, kDim);
+	}
+}
+
+} // namespace recovery
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common/log_store.h"
+#include "text/text_renderer.h"
+#include "ui/screen.h"
+
+#include <string>
+
+namespace recovery {
+
+// Shows the log written by a LogStore, one text row per line. Only the rows
+// on screen are ever read from the mapping, so scrolling is as cheap with
+// 100000 lines as with ten, and writers are never held up by the UI. At the
+// bottom the view follows new lines as they come in.
+class LogScreen : public Screen {
+public:
+	// |text| may be null when no font is available.
+	LogScreen(Renderer &renderer, const TextRenderer *text, std::string path);
+
+	const char *name() const override { return "log"; }
+	bool enter(Arena &arena, const Rect &bounds) override;
+	void leave() override;
+	void paint(Canvas &canvas, const Rect &dirty) override;
+	bool on_key(const KeyEvent &event) override;
+
+	// Picks up new lines; called from a timer while the screen is shown.
+	void refresh();
+
+private:
+	struct Layout {
+		Rect header;
+		Rect list;
+		Rect status;
+		int row_height;
+		int rows;
+		int margin;
+	};
+
+	size_t max_top() const;
+	void scroll_to(long top);
+
+	Renderer &m_renderer;
+	const TextRenderer *m_text;
+	std::string m_path;
+	LogView m_view;
+	size_t m_top = 0;
+	bool m_follow = true;
+	Layout *m_layout = nullptr;
+};
+
+} // namespace recovery
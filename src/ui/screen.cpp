@@ -0,0 +1,69 @@
+#include "ui/screen.h"
+
+#include "common/log.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+
+namespace recovery {
+
+static Gauge s_arena_used("recovery_ui_arena_bytes", "", "Arena bytes the current screen uses.");
+static Gauge s_arena_high_water("recovery_ui_arena_high_water_bytes", "",
+				"Most arena bytes any screen has needed.");
+static Gauge s_arena_reserved("recovery_ui_arena_reserved_bytes", "", "Bytes mapped for the screen arena.");
+static Gauge s_arena_overflows("recovery_ui_arena_overflows", "",
+			       "Arena blocks mapped beyond the first; a screen outgrew the block size.");
+
+ScreenManager::ScreenManager(Renderer &renderer, size_t arena_block) : m_renderer(renderer), m_arena(arena_block)
+{
+}
+
+ScreenManager::~ScreenManager()
+{
+	leave();
+}
+
+void ScreenManager::leave()
+{
+	if (!m_current)
+		return;
+	m_current->leave();
+	log_debug("ui: leaving %s, arena %zu bytes used, %zu high water, %zu mapped, %u overflows",
+		  m_current->name(), m_arena.used(), m_arena.high_water(), m_arena.reserved(), m_arena.overflows());
+	m_arena.reset();
+	m_current = nullptr;
+}
+
+bool ScreenManager::show(Screen &next)
+{
+	leave();
+	if (!next.enter(m_arena, m_renderer.bounds())) {
+		log_error("ui: cannot build screen %s", next.name());
+		next.leave();
+		m_arena.reset();
+		return false;
+	}
+	m_current = &next;
+	m_renderer.invalidate_all();
+	publish_arena();
+	return true;
+}
+
+void ScreenManager::publish_arena() const
+{
+	s_arena_used.set((int64_t)m_arena.used());
+	s_arena_high_water.set((int64_t)m_arena.high_water());
+	s_arena_reserved.set((int64_t)m_arena.reserved());
+	s_arena_overflows.set(m_arena.overflows());
+}
+
+long ScreenManager::repaint()
+{
+	if (!m_current)
+		return 0;
+	TRACE_SCOPE("ui", "repaint");
+	// Screens grow their arena as what they show comes in.
+	publish_arena();
+	return m_renderer.repaint([this](Canvas &canvas, const Rect &dirty) { m_current->paint(canvas, dirty); });
+}
+
+} // namespace recovery
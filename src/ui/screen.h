@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common/arena.h"
+#include "fb/renderer.h"
+#include "input/keys.h"
+
+namespace recovery {
+
+// One full-screen page of the UI (image list, partition picker, progress,
+// log viewer). Everything a screen builds for its visit, widgets included,
+// goes into the arena passed to enter(); it is all released when the user
+// navigates away, so a screen needs no teardown code beyond leave().
+class Screen {
+public:
+	virtual ~Screen() = default;
+
+	virtual const char *name() const = 0;
+
+	// Builds transient state in |arena| for a screen of |bounds|. Returns
+	// false if the screen cannot be shown (typically out of memory).
+	virtual bool enter(Arena &arena, const Rect &bounds) = 0;
+	// Drops any pointers into the arena; it is reset right after.
+	virtual void leave() {}
+
+	virtual void paint(Canvas &canvas, const Rect &dirty) = 0;
+
+	// Returns true if the key was consumed. Screens invalidate what the key
+	// changed; the event loop repaints after the batch.
+	virtual bool on_key(const KeyEvent &) { return false; }
+};
+
+// Owns the arena shared by successive screens and switches between them.
+// Only one screen is built at a time, and going back rebuilds the previous
+// one, so peak memory is that of the largest screen rather than of the
+// navigation history.
+class ScreenManager {
+public:
+	explicit ScreenManager(Renderer &renderer, size_t arena_block = 64 * 1024);
+	~ScreenManager();
+
+	ScreenManager(const ScreenManager &) = delete;
+	ScreenManager &operator=(const ScreenManager &) = delete;
+
+	// Leaves the current screen, releases its arena and enters |next|.
+	// On failure no screen is current and the error is logged.
+	bool show(Screen &next);
+
+	Screen *current() const { return m_current; }
+	bool on_key(const KeyEvent &event) { return m_current && m_current->on_key(event); }
+	// Repaints the dirty parts of the current screen.
+	long repaint();
+
+	// For diagnostics: high_water() is the biggest any screen has needed.
+	// Its counters are also exported as recovery_ui_arena_* metrics.
+	const Arena &arena() const { return m_arena; }
+
+private:
+	void leave();
+	void publish_arena() const;
+
+	Renderer &m_renderer;
+	Arena m_arena;
+	Screen *m_current = nullptr;
+};
+
+} // namespace recovery
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Usage: bench-suite.sh FLASH_BENCH WORKDIR VERSION MACHINE SIZE_MB CODECS PROFILE...
+#
+# Flashes a synthetic SIZE_MB MiB image onto a fake device for each
+# PROFILE, once raw and once compressed with each of CODECS (a space
+# separated list of gz, xz, zst, bz2), and prints the runs as one JSON
+# object tagged with VERSION and MACHINE, so results can be compared
+# across releases and boxes. Images are made in WORKDIR with the host's
+# compressors; a codec whose tool is missing is skipped with a note.
+# Runs go through $BENCH_RUNNER, if set. Fails if any run does.
+
+set -e
+
+bench=$1
+work=$2
+version=$3
+machine=$4
+size_mb=$5
+codecs=$6
+if [ -z "$bench" ] || [ -z "$work" ] || [ -z "$size_mb" ] || [ $# -lt 7 ]; then
+	echo "usage: $0 FLASH_BENCH WORKDIR VERSION MACHINE SIZE_MB CODECS PROFILE..." >&2
+	exit 2
+fi
+shift 6
+
+mkdir -p "$work"
+image=$work/bench-$size_mb.img
+# The image only depends on its size, so it is kept between runs.
+if [ ! -s "$image" ]; then
+	$BENCH_RUNNER "$bench" --size "$size_mb" --fill mixed --write-image "$image.tmp"
+	mv "$image.tmp" "$image"
+fi
+
+inputs=$image
+for codec in $codecs; do
+	case $codec in
+	gz) tool="gzip -c" ;;
+	xz) tool="xz -T0 -c" ;;
+	zst) tool="zstd -q -c" ;;
+	bz2) tool="bzip2 -c" ;;
+	*) echo "$0: unknown codec $codec" >&2; exit 2 ;;
+	esac
+	if ! command -v ${tool%% *} >/dev/null 2>&1; then
+		echo "$0: no ${tool%% *} on this host, skipping $codec" >&2
+		continue
+	fi
+	if [ ! -s "$image.$codec" ] || [ "$image" -nt "$image.$codec" ]; then
+		$tool "$image" > "$image.$codec.tmp"
+		mv "$image.$codec.tmp" "$image.$codec"
+	fi
+	inputs="$inputs $image.$codec"
+done
+
+status=0
+sep=
+printf '{"version":"%s","machine":"%s","size_mb":%s,"results":[' "$version" "$machine" "$size_mb"
+for profile in "$@"; do
+	for input in $inputs; do
+		echo "$0: $(basename "$profile" .profile) <- $(basename "$input")" >&2
+		if run=$($BENCH_RUNNER "$bench" --source "$input" --fake "$profile"); then
+			printf '%s\n%s' "$sep" "$run"
+			sep=,
+		else
+			status=1
+		fi
+	done
+done
+printf ']}\n'
+exit $status
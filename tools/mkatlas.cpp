@@ -0,0 +1,211 @@
+// mkatlas: rasterizes the glyphs recovery-ui needs into a font atlas.
+//
+// Runs on the build host. The glyph set is the union of charset files
+// (ranges such as "0400-045F", one per line, '#' comments) and every
+// character found in the given text files, which is how the CJK glyphs
+// actually used by the translations get in without shipping all of CJK.
+//
+//   mkatlas --font FILE --size PX [--charset FILE]... [--text FILE]... -o OUT
+
+#include "text/atlas_format.h"
+#include "text/utf8.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <endian.h>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace recovery;
+
+namespace {
+
+bool read_file(const char *path, std::string &out)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		out.append(buf, n);
+	fclose(f);
+	return true;
+}
+
+bool add_charset(const char *path, std::set<uint32_t> &codepoints)
+{
+	std::string text;
+	if (!read_file(path, text))
+		return false;
+
+	size_t pos = 0;
+	for (int line = 1; pos < text.size(); line++) {
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string l = text.substr(pos, end - pos);
+		pos = end + 1;
+
+		size_t hash = l.find('#');
+		if (hash != std::string::npos)
+			l.erase(hash);
+		unsigned first, last;
+		char dash;
+		int fields = sscanf(l.c_str(), " %x %c %x", &first, &dash, &last);
+		if (fields <= 0)
+			continue;
+		if (fields == 1)
+			last = first;
+		else if (fields != 3 || dash != '-' || last < first) {
+			fprintf(stderr, "%s:%d: expected a range like 0400-045F\n", path, line);
+			return false;
+		}
+		for (uint32_t c = first; c <= last; c++)
+			codepoints.insert(c);
+	}
+	return true;
+}
+
+bool add_text(const char *path, std::set<uint32_t> &codepoints)
+{
+	std::string text;
+	if (!read_file(path, text))
+		return false;
+	const char *p = text.c_str();
+	for (uint32_t c; (c = utf8_next(p));)
+		if (c >= 0x20)
+			codepoints.insert(c);
+	return true;
+}
+
+void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s --font FILE --size PX [--charset FILE]... [--text FILE]... -o OUT\n", argv0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	const char *font = nullptr;
+	const char *output = nullptr;
+	unsigned size = 0;
+	std::set<uint32_t> codepoints;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_arg = i + 1 < argc;
+		if (!strcmp(argv[i], "--font") && has_arg)
+			font = argv[++i];
+		else if (!strcmp(argv[i], "--size") && has_arg)
+			size = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--charset") && has_arg) {
+			if (!add_charset(argv[++i], codepoints))
+				return 1;
+		} else if (!strcmp(argv[i], "--text") && has_arg) {
+			if (!add_text(argv[++i], codepoints))
+				return 1;
+		} else if (!strcmp(argv[i], "-o") && has_arg)
+			output = argv[++i];
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!font || !output || !size || size > 1000) {
+		usage(argv[0]);
+		return 2;
+	}
+	// The text renderer falls back to these for missing characters.
+	codepoints.insert('?');
+	codepoints.insert(0xfffd);
+
+	FT_Library library;
+	FT_Face face;
+	if (FT_Init_FreeType(&library) || FT_New_Face(library, font, 0, &face)) {
+		fprintf(stderr, "mkatlas: cannot load %s\n", font);
+		return 1;
+	}
+	if (FT_Set_Pixel_Sizes(face, 0, size)) {
+		fprintf(stderr, "mkatlas: %s has no %u px size\n", font, size);
+		return 1;
+	}
+
+	std::vector<AtlasGlyph> glyphs;
+	std::vector<uint8_t> bitmaps;
+	unsigned missing = 0;
+	for (uint32_t c : codepoints) {
+		if (!FT_Get_Char_Index(face, c)) {
+			missing++;
+			continue;
+		}
+		if (FT_Load_Char(face, c, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL))
+			continue;
+		FT_GlyphSlot slot = face->glyph;
+		const FT_Bitmap &bm = slot->bitmap;
+		if (bm.pixel_mode != FT_PIXEL_MODE_GRAY && bm.rows)
+			continue;
+
+		AtlasGlyph g = {};
+		g.codepoint = htole32(c);
+		g.bitmap = (uint32_t)bitmaps.size();
+		g.width = htole16((uint16_t)bm.width);
+		g.height = htole16((uint16_t)bm.rows);
+		g.left = (int16_t)htole16((uint16_t)slot->bitmap_left);
+		g.top = (int16_t)htole16((uint16_t)slot->bitmap_top);
+		g.advance = htole16((uint16_t)((slot->advance.x + 32) >> 6));
+		for (unsigned y = 0; y < bm.rows; y++) {
+			const uint8_t *row = bm.buffer + (long)y * bm.pitch;
+			bitmaps.insert(bitmaps.end(), row, row + bm.width);
+		}
+		glyphs.push_back(g);
+	}
+
+	AtlasHeader header = {};
+	memcpy(header.magic, kAtlasMagic, sizeof(kAtlasMagic));
+	uint32_t table = (sizeof(AtlasHeader) + 3) & ~3u;
+	uint32_t bitmap_base = table + (uint32_t)(glyphs.size() * sizeof(AtlasGlyph));
+	header.version = htole32(kAtlasVersion);
+	header.glyph_count = htole32((uint32_t)glyphs.size());
+	header.glyphs = htole32(table);
+	header.file_size = htole32(bitmap_base + (uint32_t)bitmaps.size());
+	header.pixel_size = htole16((uint16_t)size);
+	header.line_height = htole16((uint16_t)((face->size->metrics.height + 63) >> 6));
+	header.ascent = (int16_t)htole16((uint16_t)((face->size->metrics.ascender + 63) >> 6));
+	header.descent = (int16_t)htole16((uint16_t)(face->size->metrics.descender >> 6));
+	for (AtlasGlyph &g : glyphs)
+		g.bitmap = htole32(bitmap_base + g.bitmap);
+
+	FILE *f = fopen(output, "wb");
+	if (!f) {
+		perror(output);
+		return 1;
+	}
+	static const uint8_t pad[4] = {};
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		  fwrite(pad, 1, table - sizeof(header), f) == table - sizeof(header) &&
+		  fwrite(glyphs.data(), sizeof(AtlasGlyph), glyphs.size(), f) == glyphs.size() &&
+		  fwrite(bitmaps.data(), 1, bitmaps.size(), f) == bitmaps.size();
+	if (fclose(f) || !ok) {
+		fprintf(stderr, "mkatlas: cannot write %s\n", output);
+		remove(output);
+		return 1;
+	}
+
+	printf("mkatlas: %s: %zu glyphs at %u px, %zu KiB", output, glyphs.size(), size,
+	       (bitmap_base + bitmaps.size() + 1023) / 1024);
+	if (missing)
+		printf(", %u not in font", missing);
+	printf("\n");
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	return 0;
+}
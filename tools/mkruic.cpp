@@ -0,0 +1,227 @@
+// mkruic: packs a partition image into a RUIC container for recovery-ui.
+//
+// Runs on the build host. The image is read twice: once to hash every
+// chunk and decide which chunks share a blob (see ContainerPlanner), and
+// once to compress the blobs on all cores and write them after the index.
+// Blobs that zstd cannot shrink are stored as they are.
+//
+//   mkruic [--chunk KB] [--level N] [--threads N] IMAGE -o OUT
+
+#include "crypto/sha256.h"
+#include "crypto/tree_hash.h"
+#include "flash/container.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <zstd.h>
+
+using namespace recovery;
+
+namespace {
+
+void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [--chunk KB] [--level N] [--threads N] IMAGE -o OUT\n"
+		"  --chunk KB    chunk size, %u..%u (default 1024)\n"
+		"  --level N     zstd level (default 19)\n"
+		"  --threads N   compressor threads (default one per CPU)\n",
+		argv0, kContainerMinChunk / 1024, kContainerMaxChunk / 1024);
+}
+
+bool pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+	while (len) {
+		ssize_t n = pread(fd, buf, len, (off_t)offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= (size_t)n;
+		offset += (uint64_t)n;
+	}
+	return true;
+}
+
+bool write_full(int fd, const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		buf += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+struct Job {
+	uint32_t chunk;
+	size_t raw_size;
+	std::vector<uint8_t> data;
+	uint8_t codec;
+	bool ok;
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t chunk_size = 1 << 20;
+	int level = 19;
+	unsigned threads = std::thread::hardware_concurrency();
+	const char *input = nullptr;
+	const char *output = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_arg = i + 1 < argc;
+		if (!strcmp(argv[i], "--chunk") && has_arg)
+			chunk_size = (uint32_t)atoi(argv[++i]) * 1024;
+		else if (!strcmp(argv[i], "--level") && has_arg)
+			level = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && has_arg)
+			threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && has_arg)
+			output = argv[++i];
+		else if (argv[i][0] != '-' && !input)
+			input = argv[i];
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!input || !output || chunk_size < kContainerMinChunk || chunk_size > kContainerMaxChunk) {
+		usage(argv[0]);
+		return 2;
+	}
+	if (!threads)
+		threads = 1;
+
+	int in = open(input, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (in < 0 || fstat(in, &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "mkruic: cannot read %s\n", input);
+		return 1;
+	}
+
+	// Pass 1: digests and the blob each chunk goes into.
+	ContainerIndex index;
+	index.header.chunk_size = chunk_size;
+	index.header.image_size = (uint64_t)st.st_size;
+	uint32_t chunk_count = (uint32_t)((index.header.image_size + chunk_size - 1) / chunk_size);
+	std::vector<uint8_t> leaves((size_t)chunk_count * Sha256::kDigestSize);
+	std::vector<uint32_t> first_chunk;
+	std::vector<uint8_t> buf(chunk_size);
+	ContainerPlanner planner;
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		index.chunk_blob.push_back(0);
+		size_t len = index.chunk_length(i);
+		if (!pread_full(in, buf.data(), len, (uint64_t)i * chunk_size)) {
+			fprintf(stderr, "mkruic: cannot read %s\n", input);
+			return 1;
+		}
+		uint8_t *digest = &leaves[(size_t)i * Sha256::kDigestSize];
+		Sha256::digest(buf.data(), len, digest);
+		bool is_new;
+		index.chunk_blob[i] = planner.add(digest, &is_new);
+		if (is_new) {
+			ContainerBlob blob = {};
+			memcpy(blob.digest, digest, sizeof(blob.digest));
+			index.blobs.push_back(blob);
+			first_chunk.push_back(i);
+		}
+	}
+	tree_hash_root(index.header.image_size, chunk_size, leaves, index.header.root);
+
+	std::string partial = std::string(output) + ".tmp";
+	int out = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	std::vector<uint8_t> encoded;
+	container_encode_index(index, encoded);
+	if (out < 0 || lseek(out, (off_t)encoded.size(), SEEK_SET) < 0) {
+		fprintf(stderr, "mkruic: cannot write %s\n", partial.c_str());
+		return 1;
+	}
+
+	// Pass 2: compress a batch of blobs on every thread, then write it.
+	uint64_t stored_total = 0;
+	size_t batch = 4 * (size_t)threads;
+	std::vector<Job> jobs(batch);
+	std::vector<ZSTD_CCtx *> contexts(threads);
+	for (ZSTD_CCtx *&ctx : contexts) {
+		ctx = ZSTD_createCCtx();
+		ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+	}
+	for (size_t first = 0; first < index.blobs.size(); first += batch) {
+		size_t count = std::min(batch, index.blobs.size() - first);
+		std::atomic<size_t> next{ 0 };
+		auto worker = [&](unsigned t) {
+			std::vector<uint8_t> raw(chunk_size);
+			for (size_t j; (j = next++) < count;) {
+				Job &job = jobs[j];
+				job.chunk = first_chunk[first + j];
+				job.raw_size = index.chunk_length(job.chunk);
+				job.ok = pread_full(in, raw.data(), job.raw_size, (uint64_t)job.chunk * chunk_size);
+				if (!job.ok)
+					continue;
+				job.data.resize(ZSTD_compressBound(job.raw_size));
+				size_t n = ZSTD_compress2(contexts[t], job.data.data(), job.data.size(), raw.data(),
+							  job.raw_size);
+				if (ZSTD_isError(n) || n >= job.raw_size) {
+					job.data.assign(raw.begin(), raw.begin() + job.raw_size);
+					job.codec = kContainerStored;
+				} else {
+					job.data.resize(n);
+					job.codec = kContainerZstd;
+				}
+			}
+		};
+		std::vector<std::thread> pool;
+		for (unsigned t = 0; t < threads; t++)
+			pool.emplace_back(worker, t);
+		for (std::thread &t : pool)
+			t.join();
+
+		for (size_t j = 0; j < count; j++) {
+			Job &job = jobs[j];
+			if (!job.ok || !write_full(out, job.data.data(), job.data.size())) {
+				fprintf(stderr, "mkruic: I/O error on blob %zu\n", first + j);
+				unlink(partial.c_str());
+				return 1;
+			}
+			index.blobs[first + j].stored_size = (uint32_t)job.data.size();
+			index.blobs[first + j].codec = job.codec;
+			stored_total += job.data.size();
+		}
+	}
+	for (ZSTD_CCtx *ctx : contexts)
+		ZSTD_freeCCtx(ctx);
+
+	encoded.clear();
+	container_encode_index(index, encoded);
+	if (pwrite(out, encoded.data(), encoded.size(), 0) != (ssize_t)encoded.size() || fsync(out) < 0 ||
+	    close(out) < 0 || rename(partial.c_str(), output) < 0) {
+		fprintf(stderr, "mkruic: cannot write %s\n", output);
+		unlink(partial.c_str());
+		return 1;
+	}
+	close(in);
+
+	char hex[2 * Sha256::kDigestSize + 1];
+	sha256_to_hex(index.header.root, hex);
+	printf("%s: %u chunks in %zu blobs, %llu -> %llu bytes, tree sha256 %s\n", output, chunk_count,
+	       index.blobs.size(), (unsigned long long)index.header.image_size,
+	       (unsigned long long)(encoded.size() + stored_total), hex);
+	return 0;
+}
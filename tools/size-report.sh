@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Usage: size-report.sh BINARY STRIPPED BUDGET_KB
+#
+# Prints where the bytes of BINARY (built with -g) come from, one line per
+# subsystem of src/ plus the C and C++ runtimes, and fails if STRIPPED is
+# larger than BUDGET_KB. Symbols are attributed by the source file their
+# debug info names; whatever has none comes from the static runtime
+# libraries, which are built without it, and is told apart by name.
+
+set -e
+
+bin=$1
+stripped=$2
+budget_kb=$3
+NM=${NM:-nm}
+
+if [ -z "$bin" ] || [ -z "$stripped" ] || [ -z "$budget_kb" ]; then
+	echo "usage: $0 BINARY STRIPPED BUDGET_KB" >&2
+	exit 2
+fi
+
+$NM --print-size --line-numbers "$bin" | awk '
+	function hex(s,    i, n) {
+		n = 0
+		for (i = 1; i <= length(s); i++)
+			n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+		return n
+	}
+	# address size type name [file:line]
+	# Code and initialized data only; .bss takes no room in the file.
+	# Aliases share an address and are counted once.
+	NF >= 4 && $3 ~ /^[TtWwRrDdVv]$/ && !seen[$1]++ {
+		size = hex(tolower($2))
+		if ($4 ~ /^_Z/)
+			where = "libstdc++"
+		else if ($4 ~ /^(_Unwind|__gcc_|__deregister|__register_frame)/)
+			where = "libgcc"
+		else
+			where = "libc"
+		if (NF >= 5) {
+			file = $NF
+			sub(/:[0-9]+$/, "", file)
+			if (file ~ /\/c\+\+\//)
+				where = "libstdc++ templates"
+			else if (match(file, /(^|\/)src\/[^\/]+\//))
+				where = substr(file, RSTART + (substr(file, RSTART, 1) == "/"), RLENGTH - 1)
+			else if (file ~ /(^|\/)src\/[^\/]+$/)
+				where = "src/ (mains)"
+			else
+				where = "other"
+			sub(/\/$/, "", where)
+		}
+		bytes[where] += size
+		total += size
+	}
+	END {
+		for (w in bytes)
+			printf "%10.1f KiB %5.1f%%  %s\n", bytes[w] / 1024, total ? 100 * bytes[w] / total : 0, w
+	}
+' | sort -rn
+
+actual=$(wc -c < "$stripped")
+kb=$(( (actual + 1023) / 1024 ))
+echo "$stripped: $kb KiB stripped, budget $budget_kb KiB"
+[ "$kb" -le "$budget_kb" ]